@@ -33,6 +33,10 @@
 /* Functions prototypes */
 static void __set_exception(int en, char *msg) __sets_exception;
 static int __parse_resource(PyObject *obj, struct sanlk_resource **res_ret) __neg_sets_exception;
+static int __parse_acquire(PyObject *args, PyObject *keywds, int *sanlockfd,
+                           int *pid, struct sanlk_resource **res_ret) __neg_sets_exception;
+static int __parse_release(PyObject *args, PyObject *keywds, int *sanlockfd,
+                           int *pid, struct sanlk_resource **res_ret) __neg_sets_exception;
 
 /* Sanlock module */
 PyDoc_STRVAR(pydoc_sanlock, "\
@@ -223,6 +227,56 @@ py_register(PyObject *self __unused, PyObject *args)
     return PyInt_FromLong(sanlockfd);
 }
 
+/* session_open */
+PyDoc_STRVAR(pydoc_session_open, "\
+session_open() -> int\n\
+Open an admin session to the sanlock daemon and return its fd. The fd\n\
+can be passed as the session argument of inq_lockspace, get_lockspaces,\n\
+get_hosts, read_resource_owners and request, which then use it instead\n\
+of connecting to the daemon for each call. Calls using one session must\n\
+not run concurrently.");
+
+static PyObject *
+py_session_open(PyObject *self __unused, PyObject *args __unused)
+{
+    int fd;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = sanlock_session_open(0);
+    Py_END_ALLOW_THREADS
+
+    if (fd < 0) {
+        __set_exception(fd, "Unable to open sanlock session");
+        return NULL;
+    }
+
+    return PyInt_FromLong(fd);
+}
+
+/* session_close */
+PyDoc_STRVAR(pydoc_session_close, "\
+session_close(fd)\n\
+Close an admin session opened with session_open.");
+
+static PyObject *
+py_session_close(PyObject *self __unused, PyObject *args)
+{
+    int fd = -1;
+    int rv;
+
+    if (!PyArg_ParseTuple(args, "i", &fd))
+        return NULL;
+
+    rv = sanlock_session_close(fd);
+
+    if (rv < 0) {
+        __set_exception(rv, "Unable to close sanlock session");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
 /* get_alignment */
 PyDoc_STRVAR(pydoc_get_alignment, "\
 get_alignment(path) -> int\n\
@@ -653,7 +707,7 @@ py_add_lockspace(PyObject *self __unused, PyObject *args, PyObject *keywds)
 
 /* inq_lockspace */
 PyDoc_STRVAR(pydoc_inq_lockspace, "\
-inq_lockspace(lockspace, host_id, path, offset=0, wait=False)\n\
+inq_lockspace(lockspace, host_id, path, offset=0, wait=False, session=-1)\n\
 Return True if the sanlock daemon currently owns the host_id in lockspace,\n\
 False otherwise. The special value None is returned when the daemon is\n\
 still in the process of acquiring or releasing the host_id. If the wait\n\
@@ -663,20 +717,20 @@ acquired or released.");
 static PyObject *
 py_inq_lockspace(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
-    int rv, waitrs = 0, flags = 0;
+    int rv, waitrs = 0, flags = 0, session = -1;
     const char *lockspace, *path;
     struct sanlk_lockspace ls;
 
     static char *kwlist[] = {"lockspace", "host_id", "path", "offset",
-                                "wait", NULL};
+                                "wait", "session", NULL};
 
     /* initialize lockspace structure */
     memset(&ls, 0, sizeof(struct sanlk_lockspace));
 
     /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "sks|ki", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "sks|kii", kwlist,
         &lockspace, &ls.host_id, &path, &ls.host_id_disk.offset,
-        &waitrs)) {
+        &waitrs, &session)) {
         return NULL;
     }
 
@@ -691,7 +745,10 @@ py_inq_lockspace(PyObject *self __unused, PyObject *args, PyObject *keywds)
 
     /* add sanlock lockspace (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
-    rv = sanlock_inq_lockspace(&ls, flags);
+    if (session < 0)
+        rv = sanlock_inq_lockspace(&ls, flags);
+    else
+        rv = sanlock_session_inq_lockspace(session, &ls, flags);
     Py_END_ALLOW_THREADS
 
     if (rv == 0) {
@@ -763,7 +820,7 @@ py_rem_lockspace(PyObject *self __unused, PyObject *args, PyObject *keywds)
 
 /* get_lockspaces */
 PyDoc_STRVAR(pydoc_get_lockspaces, "\
-get_lockspaces() -> list\n\
+get_lockspaces(session=-1) -> list\n\
 Return the list of lockspaces currently managed by sanlock. The reported\n\
 flag indicates whether the lockspace is acquired (0) or in transition.\n\
 The possible transition values are LSFLAG_ADD if the lockspace is in the\n\
@@ -773,13 +830,23 @@ released.\n");
 static PyObject *
 py_get_lockspaces(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
-    int rv, i, lss_count;
+    int rv, i, lss_count, session = -1;
     struct sanlk_lockspace *lss = NULL;
     PyObject *ls_list = NULL, *ls_entry = NULL, *ls_value = NULL;
 
+    static char *kwlist[] = {"session", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "|i", kwlist, &session)) {
+        return NULL;
+    }
+
     /* get all the lockspaces (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
-    rv = sanlock_get_lockspaces(&lss, &lss_count, 0);
+    if (session < 0)
+        rv = sanlock_get_lockspaces(&lss, &lss_count, 0);
+    else
+        rv = sanlock_session_get_lockspaces(session, &lss, &lss_count, 0);
     Py_END_ALLOW_THREADS
 
     if (rv < 0) {
@@ -855,7 +922,7 @@ exit_fail:
 
 /* get_hosts */
 PyDoc_STRVAR(pydoc_get_hosts, "\
-get_hosts(lockspace, host_id=0) -> list\n\
+get_hosts(lockspace, host_id=0, session=-1) -> list\n\
 Return the list of hosts currently alive in a lockspace. When the host_id\n\
 is specified then only the requested host status is returned. The reported\n\
 flag indicates whether the host is free (HOST_FREE), alive (HOST_LIVE),\n\
@@ -868,23 +935,27 @@ timestamp and the io_timeout.\n");
 static PyObject *
 py_get_hosts(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
-    int rv, hss_count = 0;
+    int rv, hss_count = 0, session = -1;
     uint64_t host_id = 0;
     const char *lockspace = NULL;
     struct sanlk_host *hss = NULL;
     PyObject *ls_list = NULL;
 
-    static char *kwlist[] = {"lockspace", "host_id", NULL};
+    static char *kwlist[] = {"lockspace", "host_id", "session", NULL};
 
     /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "s|k", kwlist,
-        &lockspace, &host_id)) {
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "s|ki", kwlist,
+        &lockspace, &host_id, &session)) {
         return NULL;
     }
 
     /* get all the lockspaces (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
-    rv = sanlock_get_hosts(lockspace, host_id, &hss, &hss_count, 0);
+    if (session < 0)
+        rv = sanlock_get_hosts(lockspace, host_id, &hss, &hss_count, 0);
+    else
+        rv = sanlock_session_get_hosts(session, lockspace, host_id,
+                                       &hss, &hss_count, 0);
     Py_END_ALLOW_THREADS
 
     if (rv < 0) {
@@ -899,20 +970,12 @@ exit_fail:
     return ls_list;
 }
 
-/* acquire */
-PyDoc_STRVAR(pydoc_acquire, "\
-acquire(lockspace, resource, disks \
-[, slkfd=fd, pid=owner, shared=False, version=None])\n\
-Acquire a resource lease for the current process (using the slkfd argument\n\
-to specify the sanlock file descriptor) or for an other process (using the\n\
-pid argument). If shared is True the resource will be acquired in the shared\n\
-mode. The version is the version of the lease that must be acquired or fail.\n\
-The disks must be in the format: [(path, offset), ... ]\n");
-
-static PyObject *
-py_acquire(PyObject *self __unused, PyObject *args, PyObject *keywds)
+/* parse the acquire arguments, res is allocated on success */
+static int
+__parse_acquire(PyObject *args, PyObject *keywds, int *sanlockfd, int *pid,
+                struct sanlk_resource **res_ret)
 {
-    int rv, sanlockfd = -1, pid = -1, shared = 0;
+    int shared = 0;
     const char *lockspace, *resource;
     struct sanlk_resource *res;
     PyObject *disks, *version = Py_None;
@@ -922,20 +985,20 @@ py_acquire(PyObject *self __unused, PyObject *args, PyObject *keywds)
 
     /* parse python tuple */
     if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iiiO", kwlist,
-        &lockspace, &resource, &PyList_Type, &disks, &sanlockfd, &pid,
+        &lockspace, &resource, &PyList_Type, &disks, sanlockfd, pid,
         &shared, &version)) {
-        return NULL;
+        return -1;
     }
 
     /* check if any of the slkfd or pid parameters was given */
-    if (sanlockfd == -1 && pid == -1) {
+    if (*sanlockfd == -1 && *pid == -1) {
         __set_exception(EINVAL, "Invalid slkfd and pid values");
-        return NULL;
+        return -1;
     }
 
     /* parse and check sanlock resource */
     if (__parse_resource(disks, &res) < 0) {
-        return NULL;
+        return -1;
     }
 
     /* prepare sanlock names */
@@ -953,10 +1016,66 @@ py_acquire(PyObject *self __unused, PyObject *args, PyObject *keywds)
         res->lver = PyInt_AsUnsignedLongMask(version);
         if (res->lver == -1) {
             __set_exception(EINVAL, "Unable to convert the version value");
-            goto exit_fail;
+            free(res);
+            return -1;
         }
     }
 
+    *res_ret = res;
+    return 0;
+}
+
+/* parse the release arguments, res is allocated on success */
+static int
+__parse_release(PyObject *args, PyObject *keywds, int *sanlockfd, int *pid,
+                struct sanlk_resource **res_ret)
+{
+    const char *lockspace, *resource;
+    struct sanlk_resource *res;
+    PyObject *disks;
+
+    static char *kwlist[] = {"lockspace", "resource", "disks", "slkfd",
+                                "pid", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|ii", kwlist,
+        &lockspace, &resource, &PyList_Type, &disks, sanlockfd, pid)) {
+        return -1;
+    }
+
+    /* parse and check sanlock resource */
+    if (__parse_resource(disks, &res) < 0) {
+        return -1;
+    }
+
+    /* prepare sanlock names */
+    strncpy(res->lockspace_name, lockspace, SANLK_NAME_LEN);
+    strncpy(res->name, resource, SANLK_NAME_LEN);
+
+    *res_ret = res;
+    return 0;
+}
+
+/* acquire */
+PyDoc_STRVAR(pydoc_acquire, "\
+acquire(lockspace, resource, disks \
+[, slkfd=fd, pid=owner, shared=False, version=None])\n\
+Acquire a resource lease for the current process (using the slkfd argument\n\
+to specify the sanlock file descriptor) or for an other process (using the\n\
+pid argument). If shared is True the resource will be acquired in the shared\n\
+mode. The version is the version of the lease that must be acquired or fail.\n\
+The disks must be in the format: [(path, offset), ... ]\n");
+
+static PyObject *
+py_acquire(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int rv, sanlockfd = -1, pid = -1;
+    struct sanlk_resource *res;
+
+    if (__parse_acquire(args, keywds, &sanlockfd, &pid, &res) < 0) {
+        return NULL;
+    }
+
     /* acquire sanlock resource (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
     rv = sanlock_acquire(sanlockfd, pid, 0, 1, &res, 0);
@@ -975,6 +1094,75 @@ exit_fail:
     return NULL;
 }
 
+/* acquire_start */
+PyDoc_STRVAR(pydoc_acquire_start, "\
+acquire_start(lockspace, resource, disks \
+[, slkfd=fd, pid=owner, shared=False, version=None]) -> int\n\
+Start acquiring a resource lease like acquire, without waiting for the\n\
+result. Returns a file descriptor that becomes readable when the result\n\
+is ready, to be passed with the same slkfd to acquire_result, e.g.\n\
+    fd = sanlock.acquire_start(ls, res, disks, slkfd=slkfd)\n\
+    loop.add_reader(fd, done_cb, fd)\n\
+where done_cb calls loop.remove_reader(fd) and\n\
+sanlock.acquire_result(fd, slkfd=slkfd).");
+
+static PyObject *
+py_acquire_start(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int fd, sanlockfd = -1, pid = -1;
+    struct sanlk_resource *res;
+
+    if (__parse_acquire(args, keywds, &sanlockfd, &pid, &res) < 0) {
+        return NULL;
+    }
+
+    /* send the acquire request (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    fd = sanlock_acquire_start(sanlockfd, pid, 0, 1, &res, 0);
+    Py_END_ALLOW_THREADS
+
+    free(res);
+
+    if (fd < 0) {
+        __set_exception(fd, "Sanlock resource not acquired");
+        return NULL;
+    }
+
+    return PyInt_FromLong(fd);
+}
+
+/* acquire_result */
+PyDoc_STRVAR(pydoc_acquire_result, "\
+acquire_result(fd [, slkfd=fd])\n\
+Get the result of acquire_start, raising an exception if the resource\n\
+was not acquired. The fd is closed unless it is the slkfd.");
+
+static PyObject *
+py_acquire_result(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int rv, fd, sanlockfd = -1;
+
+    static char *kwlist[] = {"fd", "slkfd", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|i", kwlist,
+        &fd, &sanlockfd)) {
+        return NULL;
+    }
+
+    /* get the acquire result (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_acquire_result(sanlockfd, fd, 0, NULL);
+    Py_END_ALLOW_THREADS
+
+    if (rv != 0) {
+        __set_exception(rv, "Sanlock resource not acquired");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
 /* release */
 PyDoc_STRVAR(pydoc_release, "\
 release(lockspace, resource, disks [, slkfd=fd, pid=owner])\n\
@@ -985,28 +1173,12 @@ static PyObject *
 py_release(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
     int rv, sanlockfd = -1, pid = -1;
-    const char *lockspace, *resource;
     struct sanlk_resource *res;
-    PyObject *disks;
-
-    static char *kwlist[] = {"lockspace", "resource", "disks", "slkfd",
-                                "pid", NULL};
 
-    /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|ii", kwlist,
-        &lockspace, &resource, &PyList_Type, &disks, &sanlockfd, &pid)) {
-        return NULL;
-    }
-
-    /* parse and check sanlock resource */
-    if (__parse_resource(disks, &res) < 0) {
+    if (__parse_release(args, keywds, &sanlockfd, &pid, &res) < 0) {
         return NULL;
     }
 
-    /* prepare sanlock names */
-    strncpy(res->lockspace_name, lockspace, SANLK_NAME_LEN);
-    strncpy(res->name, resource, SANLK_NAME_LEN);
-
     /* release sanlock resource (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
     rv = sanlock_release(sanlockfd, pid, 0, 1, &res);
@@ -1025,9 +1197,72 @@ exit_fail:
     return NULL;
 }
 
+/* release_start */
+PyDoc_STRVAR(pydoc_release_start, "\
+release_start(lockspace, resource, disks [, slkfd=fd, pid=owner]) -> int\n\
+Start releasing a resource lease like release, without waiting for the\n\
+result. Returns a file descriptor for release_result, see acquire_start.");
+
+static PyObject *
+py_release_start(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int fd, sanlockfd = -1, pid = -1;
+    struct sanlk_resource *res;
+
+    if (__parse_release(args, keywds, &sanlockfd, &pid, &res) < 0) {
+        return NULL;
+    }
+
+    /* send the release request (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    fd = sanlock_release_start(sanlockfd, pid, 0, 1, &res);
+    Py_END_ALLOW_THREADS
+
+    free(res);
+
+    if (fd < 0) {
+        __set_exception(fd, "Sanlock resource not released");
+        return NULL;
+    }
+
+    return PyInt_FromLong(fd);
+}
+
+/* release_result */
+PyDoc_STRVAR(pydoc_release_result, "\
+release_result(fd [, slkfd=fd])\n\
+Get the result of release_start, raising an exception if the resource\n\
+was not released. The fd is closed unless it is the slkfd.");
+
+static PyObject *
+py_release_result(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int rv, fd, sanlockfd = -1;
+
+    static char *kwlist[] = {"fd", "slkfd", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|i", kwlist,
+        &fd, &sanlockfd)) {
+        return NULL;
+    }
+
+    /* get the release result (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_release_result(sanlockfd, fd);
+    Py_END_ALLOW_THREADS
+
+    if (rv != 0) {
+        __set_exception(rv, "Sanlock resource not released");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
 /* request */
 PyDoc_STRVAR(pydoc_request, "\
-request(lockspace, resource, disks [, action=REQ_GRACEFUL, version=None])\n\
+request(lockspace, resource, disks [, action=REQ_GRACEFUL, version=None, session=-1])\n\
 Request the owner of a resource to do something specified by action.\n\
 The possible values for action are: REQ_GRACEFUL to request a graceful\n\
 release of the resource and REQ_FORCE to sigkill the owner of the\n\
@@ -1038,17 +1273,18 @@ The disks must be in the format: [(path, offset), ... ]");
 static PyObject *
 py_request(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
-    int rv, action = SANLK_REQ_GRACEFUL, flags = 0;
+    int rv, action = SANLK_REQ_GRACEFUL, flags = 0, session = -1;
     const char *lockspace, *resource;
     struct sanlk_resource *res;
     PyObject *disks, *version = Py_None;
 
     static char *kwlist[] = {"lockspace", "resource", "disks", "action",
-                                "version", NULL};
+                                "version", "session", NULL};
 
     /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iO", kwlist,
-        &lockspace, &resource, &PyList_Type, &disks, &action, &version)) {
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iOi", kwlist,
+        &lockspace, &resource, &PyList_Type, &disks, &action, &version,
+        &session)) {
         return NULL;
     }
 
@@ -1075,7 +1311,10 @@ py_request(PyObject *self __unused, PyObject *args, PyObject *keywds)
 
     /* request sanlock resource (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
-    rv = sanlock_request(flags, action, res);
+    if (session < 0)
+        rv = sanlock_request(flags, action, res);
+    else
+        rv = sanlock_session_request(session, flags, action, res);
     Py_END_ALLOW_THREADS
 
     if (rv != 0) {
@@ -1093,7 +1332,7 @@ exit_fail:
 
 /* read_resource_owners */
 PyDoc_STRVAR(pydoc_read_resource_owners, "\
-read_resource_owners(lockspace, resource, disks) -> list\n\
+read_resource_owners(lockspace, resource, disks, session=-1) -> list\n\
 Returns the list of hosts owning a resource, the list is not filtered and\n\
 it might contain hosts that are currently failing or dead. The hosts are\n\
 returned in the same format used by get_hosts.\n\
@@ -1102,17 +1341,17 @@ The disks must be in the format: [(path, offset), ... ]");
 static PyObject *
 py_read_resource_owners(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
-    int rv, hss_count = 0;
+    int rv, hss_count = 0, session = -1;
     const char *lockspace, *resource;
     struct sanlk_resource *res = NULL;
     struct sanlk_host *hss = NULL;
     PyObject *disks, *ls_list = NULL;
 
-    static char *kwlist[] = {"lockspace", "resource", "disks", NULL};
+    static char *kwlist[] = {"lockspace", "resource", "disks", "session", NULL};
 
     /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!", kwlist,
-        &lockspace, &resource, &PyList_Type, &disks)) {
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|i", kwlist,
+        &lockspace, &resource, &PyList_Type, &disks, &session)) {
         return NULL;
     }
 
@@ -1127,7 +1366,11 @@ py_read_resource_owners(PyObject *self __unused, PyObject *args, PyObject *keywd
 
     /* read resource owners (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
-    rv = sanlock_read_resource_owners(res, 0, &hss, &hss_count);
+    if (session < 0)
+        rv = sanlock_read_resource_owners(res, 0, &hss, &hss_count);
+    else
+        rv = sanlock_session_read_resource_owners(session, res, 0,
+                                                  &hss, &hss_count);
     Py_END_ALLOW_THREADS
 
     if (rv != 0) {
@@ -1494,6 +1737,8 @@ py_set_event(PyObject *self __unused, PyObject *args, PyObject *keywds)
 static PyMethodDef
 sanlock_methods[] = {
     {"register", py_register, METH_NOARGS, pydoc_register},
+    {"session_open", py_session_open, METH_NOARGS, pydoc_session_open},
+    {"session_close", py_session_close, METH_VARARGS, pydoc_session_close},
     {"get_alignment", py_get_alignment, METH_VARARGS, pydoc_get_alignment},
     {"init_lockspace", (PyCFunction) py_init_lockspace,
                         METH_VARARGS|METH_KEYWORDS, pydoc_init_lockspace},
@@ -1523,6 +1768,14 @@ sanlock_methods[] = {
                 METH_VARARGS|METH_KEYWORDS, pydoc_acquire},
     {"release", (PyCFunction) py_release,
                 METH_VARARGS|METH_KEYWORDS, pydoc_release},
+    {"acquire_start", (PyCFunction) py_acquire_start,
+                METH_VARARGS|METH_KEYWORDS, pydoc_acquire_start},
+    {"acquire_result", (PyCFunction) py_acquire_result,
+                METH_VARARGS|METH_KEYWORDS, pydoc_acquire_result},
+    {"release_start", (PyCFunction) py_release_start,
+                METH_VARARGS|METH_KEYWORDS, pydoc_release_start},
+    {"release_result", (PyCFunction) py_release_result,
+                METH_VARARGS|METH_KEYWORDS, pydoc_release_result},
     {"request", (PyCFunction) py_request,
                 METH_VARARGS|METH_KEYWORDS, pydoc_request},
     {"killpath", (PyCFunction) py_killpath,
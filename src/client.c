@@ -146,14 +146,81 @@ retry:
 	return (int)h.data;
 }
 
-static int cmd_lockspace(int cmd, struct sanlk_lockspace *ls, uint32_t flags, uint32_t data)
+/*
+ * Admin calls connect for a single cmd, or with sock from
+ * sanlock_session_open() they use that connection, which must be
+ * left at the start of the next reply.
+ */
+
+static int session_connect(int sock, int *fd)
 {
-	int rv, fd;
+	if (sock == -1)
+		return connect_socket(fd);
+	if (sock < 0)
+		return -EINVAL;
+
+	*fd = sock;
+	return 0;
+}
+
+static void session_done(int sock, int fd, int rem)
+{
+	char trash[256];
+	int rv;
+
+	if (sock == -1) {
+		close(fd);
+		return;
+	}
+
+	/* reply data the caller did not read */
+	while (rem > 0) {
+		rv = recv_data(fd, trash, rem < (int)sizeof(trash) ? rem : (int)sizeof(trash),
+			       MSG_WAITALL);
+		if (rv <= 0)
+			break;
+		rem -= rv;
+	}
+}
+
+int sanlock_session_open(uint32_t flags)
+{
+	int fd, rv;
 
 	rv = connect_socket(&fd);
 	if (rv < 0)
 		return rv;
 
+	rv = send_header(fd, SM_CMD_SESSION, flags, 0, 0, 0);
+	if (rv < 0)
+		goto fail;
+
+	rv = recv_result(fd);
+	if (rv < 0)
+		goto fail;
+
+	return fd;
+ fail:
+	close(fd);
+	return rv;
+}
+
+int sanlock_session_close(int sock)
+{
+	if (sock < 0)
+		return -EINVAL;
+	return close(sock) < 0 ? -errno : 0;
+}
+
+static int cmd_lockspace(int sock, int cmd, struct sanlk_lockspace *ls,
+			 uint32_t flags, uint32_t data)
+{
+	int rv, fd;
+
+	rv = session_connect(sock, &fd);
+	if (rv < 0)
+		return rv;
+
 	rv = send_header(fd, cmd, flags, sizeof(struct sanlk_lockspace), data, 0);
 	if (rv < 0)
 		goto out;
@@ -166,38 +233,45 @@ static int cmd_lockspace(int cmd, struct sanlk_lockspace *ls, uint32_t flags, ui
 
 	rv = recv_result(fd);
  out:
-	close(fd);
+	session_done(sock, fd, 0);
 	return rv;
 }
 
 int sanlock_add_lockspace(struct sanlk_lockspace *ls, uint32_t flags)
 {
-	return cmd_lockspace(SM_CMD_ADD_LOCKSPACE, ls, flags, 0);
+	return cmd_lockspace(-1, SM_CMD_ADD_LOCKSPACE, ls, flags, 0);
 }
 
 int sanlock_add_lockspace_timeout(struct sanlk_lockspace *ls, uint32_t flags, uint32_t io_timeout)
 {
-	return cmd_lockspace(SM_CMD_ADD_LOCKSPACE, ls, flags, io_timeout);
+	return cmd_lockspace(-1, SM_CMD_ADD_LOCKSPACE, ls, flags, io_timeout);
 }
 
 int sanlock_inq_lockspace(struct sanlk_lockspace *ls, uint32_t flags)
 {
-	return cmd_lockspace(SM_CMD_INQ_LOCKSPACE, ls, flags, 0);
+	return cmd_lockspace(-1, SM_CMD_INQ_LOCKSPACE, ls, flags, 0);
+}
+
+int sanlock_session_inq_lockspace(int sock, struct sanlk_lockspace *ls, uint32_t flags)
+{
+	if (sock < 0)
+		return -EINVAL;
+	return cmd_lockspace(sock, SM_CMD_INQ_LOCKSPACE, ls, flags, 0);
 }
 
 int sanlock_rem_lockspace(struct sanlk_lockspace *ls, uint32_t flags)
 {
-	return cmd_lockspace(SM_CMD_REM_LOCKSPACE, ls, flags, 0);
+	return cmd_lockspace(-1, SM_CMD_REM_LOCKSPACE, ls, flags, 0);
 }
 
-int sanlock_get_lockspaces(struct sanlk_lockspace **lss, int *lss_count,
-			   uint32_t flags)
+static int get_lockspaces(int sock, struct sanlk_lockspace **lss, int *lss_count,
+			  uint32_t flags)
 {
 	struct sanlk_lockspace *lsbuf, *ls;
 	struct sm_header h;
-	int rv, fd, i, ret, recv_count;
+	int rv, fd, i, ret, recv_count, rem = 0;
 
-	rv = connect_socket(&fd);
+	rv = session_connect(sock, &fd);
 	if (rv < 0)
 		return rv;
 
@@ -220,6 +294,8 @@ int sanlock_get_lockspaces(struct sanlk_lockspace **lss, int *lss_count,
 		goto out;
 	}
 
+	rem = h.length - sizeof(h);
+
 	/* -ENOSPC means that the daemon's send buffer ran out of space */
 
 	rv = (int)h.data;
@@ -252,23 +328,38 @@ int sanlock_get_lockspaces(struct sanlk_lockspace **lss, int *lss_count,
 			goto out;
 		}
 
+		rem -= ret;
 		ls++;
 	}
 
 	*lss = lsbuf;
  out:
-	close(fd);
+	session_done(sock, fd, rem);
 	return rv;
 }
 
-int sanlock_get_hosts(const char *ls_name, uint64_t host_id,
-		      struct sanlk_host **hss, int *hss_count,
-		      uint32_t flags)
+int sanlock_get_lockspaces(struct sanlk_lockspace **lss, int *lss_count,
+			   uint32_t flags)
+{
+	return get_lockspaces(-1, lss, lss_count, flags);
+}
+
+int sanlock_session_get_lockspaces(int sock, struct sanlk_lockspace **lss,
+				   int *lss_count, uint32_t flags)
+{
+	if (sock < 0)
+		return -EINVAL;
+	return get_lockspaces(sock, lss, lss_count, flags);
+}
+
+static int get_hosts(int sock, const char *ls_name, uint64_t host_id,
+		     struct sanlk_host **hss, int *hss_count,
+		     uint32_t flags)
 {
 	struct sm_header h;
 	struct sanlk_lockspace ls;
 	struct sanlk_host *hsbuf, *hs;
-	int rv, fd, i, ret, recv_count;
+	int rv, fd, i, ret, recv_count, rem = 0;
 
 	if (!ls_name)
 		return -EINVAL;
@@ -277,7 +368,7 @@ int sanlock_get_hosts(const char *ls_name, uint64_t host_id,
 	strncpy(ls.name, ls_name, SANLK_NAME_LEN);
 	ls.host_id = host_id;
 
-	rv = connect_socket(&fd);
+	rv = session_connect(sock, &fd);
 	if (rv < 0)
 		return rv;
 
@@ -308,6 +399,8 @@ int sanlock_get_hosts(const char *ls_name, uint64_t host_id,
 		goto out;
 	}
 
+	rem = h.length - sizeof(h);
+
 	/* -ENOSPC means that the daemon's send buffer ran out of space */
 
 	rv = (int)h.data;
@@ -340,15 +433,32 @@ int sanlock_get_hosts(const char *ls_name, uint64_t host_id,
 			goto out;
 		}
 
+		rem -= ret;
 		hs++;
 	}
 
 	*hss = hsbuf;
  out:
-	close(fd);
+	session_done(sock, fd, rem);
 	return rv;
 }
 
+int sanlock_get_hosts(const char *ls_name, uint64_t host_id,
+		      struct sanlk_host **hss, int *hss_count,
+		      uint32_t flags)
+{
+	return get_hosts(-1, ls_name, host_id, hss, hss_count, flags);
+}
+
+int sanlock_session_get_hosts(int sock, const char *ls_name, uint64_t host_id,
+			      struct sanlk_host **hss, int *hss_count,
+			      uint32_t flags)
+{
+	if (sock < 0)
+		return -EINVAL;
+	return get_hosts(sock, ls_name, host_id, hss, hss_count, flags);
+}
+
 int sanlock_set_config(const char *ls_name, uint32_t flags, uint32_t cmd, GNUC_UNUSED void *data)
 {
 	struct sanlk_lockspace ls;
@@ -617,18 +727,18 @@ int sanlock_write_resource(struct sanlk_resource *res,
 	return rv;
 }
 
-int sanlock_read_resource_owners(struct sanlk_resource *res, uint32_t flags,
-				 struct sanlk_host **hss, int *hss_count)
+static int read_resource_owners(int sock, struct sanlk_resource *res, uint32_t flags,
+				struct sanlk_host **hss, int *hss_count)
 {
 	struct sm_header h;
 	struct sanlk_host *hsbuf, *hs;
-	int rv, fd, i, ret, recv_count;
+	int rv, fd, i, ret, recv_count, rem = 0;
 
 	if (!res || !res->num_disks || res->num_disks > SANLK_MAX_DISKS ||
 	    !res->disks[0].path[0])
 		return -EINVAL;
 
-	rv = connect_socket(&fd);
+	rv = session_connect(sock, &fd);
 	if (rv < 0)
 		return rv;
 
@@ -666,6 +776,8 @@ int sanlock_read_resource_owners(struct sanlk_resource *res, uint32_t flags,
 		goto out;
 	}
 
+	rem = h.length - sizeof(h);
+
 	rv = (int)h.data;
 	if (rv < 0)
 		goto out;
@@ -681,6 +793,7 @@ int sanlock_read_resource_owners(struct sanlk_resource *res, uint32_t flags,
 		goto out;
 	}
 
+	rem -= rv;
 	rv = 0;
 
 	*hss_count = h.data2;
@@ -709,15 +822,31 @@ int sanlock_read_resource_owners(struct sanlk_resource *res, uint32_t flags,
 			goto out;
 		}
 
+		rem -= ret;
 		hs++;
 	}
 
 	*hss = hsbuf;
  out:
-	close(fd);
+	session_done(sock, fd, rem);
 	return rv;
 }
 
+int sanlock_read_resource_owners(struct sanlk_resource *res, uint32_t flags,
+				 struct sanlk_host **hss, int *hss_count)
+{
+	return read_resource_owners(-1, res, flags, hss, hss_count);
+}
+
+int sanlock_session_read_resource_owners(int sock, struct sanlk_resource *res,
+					 uint32_t flags, struct sanlk_host **hss,
+					 int *hss_count)
+{
+	if (sock < 0)
+		return -EINVAL;
+	return read_resource_owners(sock, res, flags, hss, hss_count);
+}
+
 int sanlock_test_resource_owners(struct sanlk_resource *res GNUC_UNUSED,
 				 uint32_t flags GNUC_UNUSED,
 				 struct sanlk_host *owners, int owners_count,
@@ -1023,9 +1152,9 @@ int sanlock_restrict(int sock, uint32_t flags)
 	return rv;
 }
 
-int sanlock_version(uint32_t flags, uint32_t *version, uint32_t *proto)
+static int cmd_version(uint32_t flags, struct sm_header *h,
+		       struct sm_version_info *info)
 {
-	struct sm_header h;
 	int fd, rv;
 
 	rv = connect_socket(&fd);
@@ -1036,33 +1165,112 @@ int sanlock_version(uint32_t flags, uint32_t *version, uint32_t *proto)
 	if (rv < 0)
 		goto out;
 
-	memset(&h, 0, sizeof(h));
+	memset(h, 0, sizeof(struct sm_header));
 
-	rv = recv_data(fd, &h, sizeof(h), MSG_WAITALL);
+	rv = recv_data(fd, h, sizeof(struct sm_header), MSG_WAITALL);
 	if (rv < 0) {
 		rv = -errno;
 		goto out;
 	}
 
-	if (rv != sizeof(h)) {
+	if (rv != sizeof(struct sm_header)) {
 		rv = -1;
 		goto out;
 	}
 
-	if (proto)
-		*proto = h.version;
+	/* older daemons send no info, leaving it zeroed */
+	if (info) {
+		memset(info, 0, sizeof(struct sm_version_info));
 
-	rv = (int)h.data;
-	if (rv < 0)
-		goto out;
+		if (h->length >= sizeof(struct sm_header) + sizeof(struct sm_version_info)) {
+			rv = recv_data(fd, info, sizeof(struct sm_version_info), MSG_WAITALL);
+			if (rv < 0) {
+				rv = -errno;
+				goto out;
+			}
+			if (rv != sizeof(struct sm_version_info)) {
+				rv = -1;
+				goto out;
+			}
+		}
+	}
 
-	*version = h.data2;
-	rv = 0;
+	rv = (int)h->data;
  out:
 	close(fd);
 	return rv;
 }
 
+int sanlock_version(uint32_t flags, uint32_t *version, uint32_t *proto)
+{
+	struct sm_header h;
+	int rv;
+
+	rv = cmd_version(flags, &h, NULL);
+	if (rv < 0)
+		return rv;
+
+	if (proto)
+		*proto = h.version;
+
+	*version = h.data2;
+	return 0;
+}
+
+int sanlock_max_resources(uint32_t flags, int *max_resources)
+{
+	struct sm_version_info info;
+	struct sm_header h;
+	int rv;
+
+	rv = cmd_version(flags, &h, &info);
+	if (rv < 0)
+		return rv;
+
+	*max_resources = info.max_resources ? (int)info.max_resources : SANLK_MAX_RESOURCES;
+	return 0;
+}
+
+/*
+ * Older daemons only accept SANLK_MAX_RESOURCES per acquire/release,
+ * so ask the daemon before sending more.  The answer is cached until an
+ * acquire or release fails in a way that a smaller limit would explain
+ * (e.g. the daemon was restarted with an older version), and then it's
+ * asked again.
+ */
+
+static int daemon_max_resources;
+
+static void check_res_result(int rv)
+{
+	if (rv == -E2BIG || rv == -EINVAL)
+		daemon_max_resources = 0;
+}
+
+static int check_res_count(int res_count)
+{
+	int max = daemon_max_resources;
+	int rv;
+
+	if (res_count < 0 || res_count > SANLK_MAX_RESOURCES_BATCH)
+		return -EINVAL;
+
+	if (res_count <= SANLK_MAX_RESOURCES)
+		return 0;
+
+	if (!max) {
+		rv = sanlock_max_resources(0, &max);
+		if (rv < 0)
+			return rv;
+		daemon_max_resources = max;
+	}
+
+	if (res_count > max)
+		return -EINVAL;
+
+	return 0;
+}
+
 int sanlock_killpath(int sock, uint32_t flags, const char *path, char *args)
 {
 	char path_max[SANLK_HELPER_PATH_LEN];
@@ -1098,17 +1306,24 @@ int sanlock_killpath(int sock, uint32_t flags, const char *path, char *args)
 	return rv;
 }
 
-int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
-		    struct sanlk_resource *res_args[],
-		    struct sanlk_options *opt_in)
+/*
+ * The _start functions send the cmd and return the fd that the reply
+ * will arrive on: sock itself, or a new connection when sock is -1.
+ */
+
+static int acquire_start(int sock, int pid, uint32_t flags, int res_count,
+			 struct sanlk_resource *res_args[],
+			 struct sanlk_options *opt_in)
 {
 	struct sanlk_resource *res;
 	struct sanlk_options opt;
-	int rv, i, fd, data2;
-	int datalen = 0;
+	char *buf;
+	int rv, i, fd, data2, len;
+	int datalen = 0, pos = 0;
 
-	if (res_count > SANLK_MAX_RESOURCES)
-		return -EINVAL;
+	rv = check_res_count(res_count);
+	if (rv < 0)
+		return rv;
 
 	for (i = 0; i < res_count; i++) {
 		res = res_args[i];
@@ -1120,6 +1335,21 @@ int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
 		datalen += (res->num_disks * sizeof(struct sanlk_disk));
 	}
 
+	/* resources are sent in one buffer rather than two sends each */
+
+	buf = malloc(datalen ? datalen : 1);
+	if (!buf)
+		return -ENOMEM;
+
+	for (i = 0; i < res_count; i++) {
+		res = res_args[i];
+		memcpy(buf + pos, res, sizeof(struct sanlk_resource));
+		pos += sizeof(struct sanlk_resource);
+		len = sizeof(struct sanlk_disk) * res->num_disks;
+		memcpy(buf + pos, res->disks, len);
+		pos += len;
+	}
+
 	datalen += sizeof(struct sanlk_options);
 	if (opt_in) {
 		memcpy(&opt, opt_in, sizeof(struct sanlk_options));
@@ -1135,8 +1365,10 @@ int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
 		data2 = pid;
 
 		rv = connect_socket(&fd);
-		if (rv < 0)
+		if (rv < 0) {
+			free(buf);
 			return rv;
+		}
 	} else {
 		/* use our own existing registered connection and ask daemon
 		   to acquire a lease for self */
@@ -1147,17 +1379,10 @@ int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
 
 	rv = send_header(fd, SM_CMD_ACQUIRE, flags, datalen, res_count, data2);
 	if (rv < 0)
-		return rv;
-
-	for (i = 0; i < res_count; i++) {
-		res = res_args[i];
-		rv = send_data(fd, res, sizeof(struct sanlk_resource), 0);
-		if (rv < 0) {
-			rv = -1;
-			goto out;
-		}
+		goto out;
 
-		rv = send_data(fd, res->disks, sizeof(struct sanlk_disk) * res->num_disks, 0);
+	if (pos) {
+		rv = send_data(fd, buf, pos, 0);
 		if (rv < 0) {
 			rv = -1;
 			goto out;
@@ -1178,7 +1403,83 @@ int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
 		}
 	}
 
+	free(buf);
+	return fd;
+ out:
+	if (sock == -1)
+		close(fd);
+	free(buf);
+	return rv;
+}
+
+int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
+		    struct sanlk_resource *res_args[],
+		    struct sanlk_options *opt_in)
+{
+	int fd, rv;
+
+	fd = acquire_start(sock, pid, flags, res_count, res_args, opt_in);
+	if (fd < 0)
+		return fd;
+
 	rv = recv_result(fd);
+	check_res_result(rv);
+
+	if (sock == -1)
+		close(fd);
+	return rv;
+}
+
+int sanlock_acquire_start(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[],
+			  struct sanlk_options *opt_in)
+{
+	return acquire_start(sock, pid, flags | SM_FLAG_RES_RESULTS,
+			     res_count, res_args, opt_in);
+}
+
+/*
+ * Daemons that don't return a result per resource reply with only the
+ * header, and each resource gets the overall result.
+ */
+
+int sanlock_acquire_result(int sock, int fd, int res_count, int *res_results)
+{
+	struct sm_header h;
+	int rv, i, len, count = 0;
+
+	memset(&h, 0, sizeof(h));
+
+	rv = recv_data(fd, &h, sizeof(h), MSG_WAITALL);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+	if (rv != sizeof(h)) {
+		rv = -1;
+		goto out;
+	}
+
+	len = h.length - sizeof(h);
+	if (len > 0)
+		count = len / sizeof(int);
+
+	for (i = 0; i < count; i++) {
+		rv = recv_data(fd, &len, sizeof(int), MSG_WAITALL);
+		if (rv != sizeof(int)) {
+			rv = -1;
+			goto out;
+		}
+		if (res_results && i < res_count)
+			res_results[i] = len;
+	}
+
+	rv = (int)h.data;
+
+	for (i = count; res_results && i < res_count; i++)
+		res_results[i] = rv;
+
+	check_res_result(rv);
  out:
 	if (sock == -1)
 		close(fd);
@@ -1260,7 +1561,7 @@ int sanlock_inquire(int sock, int pid, uint32_t flags, int *res_count,
 	return rv;
 }
 
-int sanlock_convert(int sock, int pid, uint32_t flags, struct sanlk_resource *res)
+int sanlock_convert_start(int sock, int pid, uint32_t flags, struct sanlk_resource *res)
 {
 	int fd, rv, data2, datalen;
 
@@ -1296,22 +1597,61 @@ int sanlock_convert(int sock, int pid, uint32_t flags, struct sanlk_resource *re
 		goto out;
 	}
 
-	rv = recv_result(fd);
+	return fd;
  out:
 	if (sock == -1)
 		close(fd);
 	return rv;
 }
 
+int sanlock_convert_result(int sock, int fd)
+{
+	int rv;
+
+	rv = recv_result(fd);
+
+	if (sock == -1)
+		close(fd);
+	return rv;
+}
+
+int sanlock_convert(int sock, int pid, uint32_t flags, struct sanlk_resource *res)
+{
+	int fd;
+
+	fd = sanlock_convert_start(sock, pid, flags, res);
+	if (fd < 0)
+		return fd;
+
+	return sanlock_convert_result(sock, fd);
+}
+
 /* tell daemon to release lease(s) for given pid.
    I don't think the pid itself will usually tell sm to release leases,
    but it will be requested by a manager overseeing the pid */
 
-int sanlock_release(int sock, int pid, uint32_t flags, int res_count,
-		    struct sanlk_resource *res_args[])
+int sanlock_release_start(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[])
 {
+	char *buf = NULL;
 	int fd, rv, i, data2, datalen;
 
+	rv = check_res_count(res_count);
+	if (rv < 0)
+		return rv;
+
+	datalen = res_count * sizeof(struct sanlk_resource);
+
+	if (datalen) {
+		buf = malloc(datalen);
+		if (!buf)
+			return -ENOMEM;
+
+		for (i = 0; i < res_count; i++)
+			memcpy(buf + (i * sizeof(struct sanlk_resource)), res_args[i],
+			       sizeof(struct sanlk_resource));
+	}
+
 	if (sock == -1) {
 		/* connect to daemon and ask it to acquire a lease for
 		   another registered pid */
@@ -1319,8 +1659,10 @@ int sanlock_release(int sock, int pid, uint32_t flags, int res_count,
 		data2 = pid;
 
 		rv = connect_socket(&fd);
-		if (rv < 0)
+		if (rv < 0) {
+			free(buf);
 			return rv;
+		}
 	} else {
 		/* use our own existing registered connection and ask daemon
 		   to acquire a lease for self */
@@ -1329,29 +1671,53 @@ int sanlock_release(int sock, int pid, uint32_t flags, int res_count,
 		fd = sock;
 	}
 
-	datalen = res_count * sizeof(struct sanlk_resource);
-
 	rv = send_header(fd, SM_CMD_RELEASE, flags, datalen, res_count, data2);
 	if (rv < 0)
 		goto out;
 
-	for (i = 0; i < res_count; i++) {
-		rv = send_data(fd, res_args[i], sizeof(struct sanlk_resource), 0);
+	if (buf) {
+		rv = send_data(fd, buf, datalen, 0);
 		if (rv < 0) {
 			rv = -1;
 			goto out;
 		}
 	}
 
-	rv = recv_result(fd);
+	free(buf);
+	return fd;
  out:
 	if (sock == -1)
 		close(fd);
+	free(buf);
 	return rv;
 }
 
-int sanlock_request(uint32_t flags, uint32_t force_mode,
-		    struct sanlk_resource *res)
+int sanlock_release_result(int sock, int fd)
+{
+	int rv;
+
+	rv = recv_result(fd);
+	check_res_result(rv);
+
+	if (sock == -1)
+		close(fd);
+	return rv;
+}
+
+int sanlock_release(int sock, int pid, uint32_t flags, int res_count,
+		    struct sanlk_resource *res_args[])
+{
+	int fd;
+
+	fd = sanlock_release_start(sock, pid, flags, res_count, res_args);
+	if (fd < 0)
+		return fd;
+
+	return sanlock_release_result(sock, fd);
+}
+
+static int request(int sock, uint32_t flags, uint32_t force_mode,
+		   struct sanlk_resource *res)
 {
 	int fd, rv, datalen;
 
@@ -1361,7 +1727,7 @@ int sanlock_request(uint32_t flags, uint32_t force_mode,
 	datalen = sizeof(struct sanlk_resource) +
 		  sizeof(struct sanlk_disk) * res->num_disks;
 
-	rv = connect_socket(&fd);
+	rv = session_connect(sock, &fd);
 	if (rv < 0)
 		return rv;
 
@@ -1383,12 +1749,26 @@ int sanlock_request(uint32_t flags, uint32_t force_mode,
 
 	rv = recv_result(fd);
  out:
-	close(fd);
+	session_done(sock, fd, 0);
 	return rv;
 }
 
-int sanlock_examine(uint32_t flags, struct sanlk_lockspace *ls,
+int sanlock_request(uint32_t flags, uint32_t force_mode,
 		    struct sanlk_resource *res)
+{
+	return request(-1, flags, force_mode, res);
+}
+
+int sanlock_session_request(int sock, uint32_t flags, uint32_t force_mode,
+			    struct sanlk_resource *res)
+{
+	if (sock < 0)
+		return -EINVAL;
+	return request(sock, flags, force_mode, res);
+}
+
+static int examine(int sock, uint32_t flags, struct sanlk_lockspace *ls,
+		   struct sanlk_resource *res)
 {
 	char *data;
 	int rv, fd, cmd, datalen;
@@ -1396,7 +1776,7 @@ int sanlock_examine(uint32_t flags, struct sanlk_lockspace *ls,
 	if (!ls && !res)
 		return -EINVAL;
 
-	rv = connect_socket(&fd);
+	rv = session_connect(sock, &fd);
 	if (rv < 0)
 		return rv;
 
@@ -1422,11 +1802,26 @@ int sanlock_examine(uint32_t flags, struct sanlk_lockspace *ls,
 
 	rv = recv_result(fd);
  out:
-	close(fd);
+	session_done(sock, fd, 0);
 	return rv;
 }
 
-int sanlock_set_lvb(uint32_t flags, struct sanlk_resource *res, char *lvb, int lvblen)
+int sanlock_examine(uint32_t flags, struct sanlk_lockspace *ls,
+		    struct sanlk_resource *res)
+{
+	return examine(-1, flags, ls, res);
+}
+
+int sanlock_session_examine(int sock, uint32_t flags, struct sanlk_lockspace *ls,
+			    struct sanlk_resource *res)
+{
+	if (sock < 0)
+		return -EINVAL;
+	return examine(sock, flags, ls, res);
+}
+
+static int set_lvb(int sock, uint32_t flags, struct sanlk_resource *res,
+		   char *lvb, int lvblen)
 {
 	int datalen = 0;
 	int rv, fd;
@@ -1436,13 +1831,13 @@ int sanlock_set_lvb(uint32_t flags, struct sanlk_resource *res, char *lvb, int l
 
 	datalen = sizeof(struct sanlk_resource) + lvblen;
 
-	rv = connect_socket(&fd);
+	rv = session_connect(sock, &fd);
 	if (rv < 0)
 		return rv;
 
 	rv = send_header(fd, SM_CMD_SET_LVB, flags, datalen, 0, 0);
 	if (rv < 0)
-		return rv;
+		goto out;
 
 	rv = send_data(fd, res, sizeof(struct sanlk_resource), 0);
 	if (rv < 0) {
@@ -1458,29 +1853,43 @@ int sanlock_set_lvb(uint32_t flags, struct sanlk_resource *res, char *lvb, int l
 
 	rv = recv_result(fd);
  out:
-	close(fd);
+	session_done(sock, fd, 0);
 	return rv;
 }
 
-int sanlock_get_lvb(uint32_t flags, struct sanlk_resource *res, char *lvb, int lvblen)
+int sanlock_set_lvb(uint32_t flags, struct sanlk_resource *res, char *lvb, int lvblen)
+{
+	return set_lvb(-1, flags, res, lvb, lvblen);
+}
+
+int sanlock_session_set_lvb(int sock, uint32_t flags, struct sanlk_resource *res,
+			    char *lvb, int lvblen)
+{
+	if (sock < 0)
+		return -EINVAL;
+	return set_lvb(sock, flags, res, lvb, lvblen);
+}
+
+static int get_lvb(int sock, uint32_t flags, struct sanlk_resource *res,
+		   char *lvb, int lvblen)
 {
 	struct sm_header h;
 	char *reply_data = NULL;
 	int datalen = 0;
-	int rv, fd, len;
+	int rv, fd, len, rem = 0;
 
 	if (!res || !lvb || !lvblen)
 		return -EINVAL;
 
 	datalen = sizeof(struct sanlk_resource);
 
-	rv = connect_socket(&fd);
+	rv = session_connect(sock, &fd);
 	if (rv < 0)
 		return rv;
 
 	rv = send_header(fd, SM_CMD_GET_LVB, flags, datalen, 0, 0);
 	if (rv < 0)
-		return rv;
+		goto out;
 
 	rv = send_data(fd, res, sizeof(struct sanlk_resource), 0);
 	if (rv < 0) {
@@ -1506,6 +1915,7 @@ int sanlock_get_lvb(uint32_t flags, struct sanlk_resource *res, char *lvb, int l
 
 	reply_data = malloc(len);
 	if (!reply_data) {
+		rem = len;
 		rv = -ENOMEM;
 		goto out;
 	}
@@ -1526,10 +1936,187 @@ int sanlock_get_lvb(uint32_t flags, struct sanlk_resource *res, char *lvb, int l
 
 	rv = (int)h.data;
  out:
+	session_done(sock, fd, rem);
+	return rv;
+}
+
+int sanlock_get_lvb(uint32_t flags, struct sanlk_resource *res, char *lvb, int lvblen)
+{
+	return get_lvb(-1, flags, res, lvb, lvblen);
+}
+
+int sanlock_session_get_lvb(int sock, uint32_t flags, struct sanlk_resource *res,
+			    char *lvb, int lvblen)
+{
+	if (sock < 0)
+		return -EINVAL;
+	return get_lvb(sock, flags, res, lvb, lvblen);
+}
+
+int sanlock_pipeline_open(uint32_t flags, int *max_inflight)
+{
+	struct sm_header h;
+	int fd, rv;
+
+	rv = connect_socket(&fd);
+	if (rv < 0)
+		return rv;
+
+	rv = send_header(fd, SM_CMD_PIPELINE, flags, 0, 0, 0);
+	if (rv < 0)
+		goto fail;
+
+	memset(&h, 0, sizeof(h));
+
+	rv = recv_data(fd, &h, sizeof(h), MSG_WAITALL);
+	if (rv != sizeof(h)) {
+		rv = -1;
+		goto fail;
+	}
+
+	rv = (int)h.data;
+	if (rv < 0)
+		goto fail;
+
+	if (max_inflight)
+		*max_inflight = (int)h.data2;
+	return fd;
+ fail:
 	close(fd);
 	return rv;
 }
 
+static uint32_t pipeline_seq;
+
+/* the header and data go in one send so the daemon can read them at once */
+
+static int pipeline_submit(int sock, int cmd, uint32_t flags,
+			   uint32_t data, uint32_t data2,
+			   void *buf1, int len1, void *buf2, int len2)
+{
+	struct sm_header *h;
+	char *msg, *p;
+	int len = sizeof(struct sm_header) + len1 + len2;
+	int pos = 0, rv;
+
+	msg = malloc(len);
+	if (!msg)
+		return -ENOMEM;
+
+	h = (struct sm_header *)msg;
+	memset(h, 0, sizeof(struct sm_header));
+	h->magic = SM_MAGIC;
+	h->version = SM_PROTO;
+	h->cmd = cmd;
+	h->cmd_flags = flags;
+	h->length = len;
+	h->data = data;
+	h->data2 = data2;
+
+	do {
+		h->seq = __sync_add_and_fetch(&pipeline_seq, 1);
+	} while (!h->seq);
+
+	p = msg + sizeof(struct sm_header);
+	if (len1)
+		memcpy(p, buf1, len1);
+	if (len2)
+		memcpy(p + len1, buf2, len2);
+
+	while (pos < len) {
+		rv = send_data(sock, msg + pos, len - pos, MSG_NOSIGNAL);
+		if (rv < 0) {
+			rv = -errno;
+			free(msg);
+			return rv;
+		}
+		pos += rv;
+	}
+
+	rv = (int)h->seq;
+	free(msg);
+	return rv;
+}
+
+int sanlock_pipeline_request(int sock, uint32_t flags, uint32_t force_mode,
+			     struct sanlk_resource *res)
+{
+	if (!res)
+		return -EINVAL;
+
+	return pipeline_submit(sock, SM_CMD_REQUEST, flags, force_mode, 0,
+			       res, sizeof(struct sanlk_resource),
+			       res->disks, sizeof(struct sanlk_disk) * res->num_disks);
+}
+
+int sanlock_pipeline_inquire(int sock, int pid, uint32_t flags)
+{
+	return pipeline_submit(sock, SM_CMD_INQUIRE, flags, 0, pid,
+			       NULL, 0, NULL, 0);
+}
+
+int sanlock_pipeline_get_lvb(int sock, uint32_t flags, struct sanlk_resource *res)
+{
+	if (!res)
+		return -EINVAL;
+
+	/* data2 0: the lvb is the size of a sector */
+	return pipeline_submit(sock, SM_CMD_GET_LVB, flags, 0, 0,
+			       res, sizeof(struct sanlk_resource), NULL, 0);
+}
+
+int sanlock_pipeline_complete(int sock, int timeout_ms,
+			      struct sanlk_completion *comp)
+{
+	struct pollfd pollfd;
+	struct sm_header h;
+	char *reply_data = NULL;
+	int rv, len;
+
+	if (!comp)
+		return -EINVAL;
+
+	memset(comp, 0, sizeof(struct sanlk_completion));
+
+	pollfd.fd = sock;
+	pollfd.events = POLLIN;
+	pollfd.revents = 0;
+
+	rv = poll(&pollfd, 1, timeout_ms);
+	if (rv < 0)
+		return -errno;
+	if (!rv)
+		return -EAGAIN;
+
+	memset(&h, 0, sizeof(h));
+
+	rv = recv_data(sock, &h, sizeof(h), MSG_WAITALL);
+	if (rv < 0)
+		return -errno;
+	if (rv != sizeof(h))
+		return -ENOTCONN;
+
+	len = h.length - sizeof(h);
+	if (len > 0) {
+		reply_data = malloc(len);
+		if (!reply_data)
+			return -ENOMEM;
+
+		rv = recv_data(sock, reply_data, len, MSG_WAITALL);
+		if (rv != len) {
+			free(reply_data);
+			return -ENOTCONN;
+		}
+	}
+
+	comp->seq = h.seq;
+	comp->result = (int)h.data;
+	comp->data2 = h.data2;
+	comp->data_len = len > 0 ? len : 0;
+	comp->data = reply_data;
+	return 0;
+}
+
 /*
  * src may have colons/spaces escaped (with backslash) or unescaped.
  * if unescaped colons/spaces are found, insert backslash before them.
@@ -1804,12 +2391,12 @@ int sanlock_args_to_state(int res_count,
 			  char **res_state)
 {
 	char *str, *state;
-	int i, rv;
+	int i, rv, len, pos = 0;
 
-	state = malloc(res_count * (SANLK_MAX_RES_STR + 1));
+	state = malloc(res_count * (SANLK_MAX_RES_STR + 1) + 1);
 	if (!state)
 		return -ENOMEM;
-	memset(state, 0, res_count * (SANLK_MAX_RES_STR + 1));
+	state[0] = '\0';
 
 	for (i = 0; i < res_count; i++) {
 		str = NULL;
@@ -1820,15 +2407,18 @@ int sanlock_args_to_state(int res_count,
 			return rv;
 		}
 
-		if (strlen(str) > SANLK_MAX_RES_STR - 1) {
+		len = strlen(str);
+		if (len > SANLK_MAX_RES_STR - 1) {
 			free(str);
 			free(state);
 			return -EINVAL;
 		}
 
+		/* append at pos instead of strcat rescanning state */
 		if (i)
-			strcat(state, " ");
-		strcat(state, str);
+			state[pos++] = ' ';
+		memcpy(state + pos, str, len + 1);
+		pos += len;
 		free(str);
 	}
 
@@ -1855,7 +2445,9 @@ int sanlock_state_to_args(char *res_state,
 	int sep_colons = 0;
 	int i, j, len, rv;
 
-	for (i = 0; i < strlen(res_state); i++) {
+	len = strlen(res_state);
+
+	for (i = 0; i < len; i++) {
 		if (res_state[i] == '\\') {
 			i++;
 			continue;
@@ -1875,8 +2467,6 @@ int sanlock_state_to_args(char *res_state,
 	memset(str, 0, sizeof(str));
 	sep_colons = 0;
 
-	len = strlen(res_state);
-
 	for (i = 0; i < len + 1; i++) {
 
 		if (i < len && res_state[i] == '\\') {
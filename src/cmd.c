@@ -52,6 +52,7 @@ void client_resume(int ci);
 void client_free(int ci);
 void client_recv_all(int ci, struct sm_header *h_recv, int pos);
 void client_pid_dead(int ci);
+void client_watch_pid(int ci);
 void send_result(int fd, struct sm_header *h_recv, int result);
 
 static uint32_t token_id_counter = 1;
@@ -120,6 +121,185 @@ static int check_new_tokens_space(struct client *cl,
 	return 0;
 }
 
+/*
+ * The tokens in one acquire command are acquired concurrently.  The
+ * worker running cmd_acquire queues the extra tokens for a small pool
+ * of acquire helpers, each of which has its own task and aio context,
+ * and acquires the first token itself.  While it waits, the worker
+ * also takes back any of its jobs that no helper has started, so a
+ * command never depends on a free helper to make progress.
+ */
+
+struct acquire_job {
+	struct list_head list;
+	struct token *token;
+	uint32_t cmd_flags;
+	char *killpath;
+	char *killargs;
+	int rv;
+	int done;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_cond_t done_cond;
+	struct list_head jobs;
+	int num_helpers;
+	int free_helpers;
+} acquire_pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+	.jobs = LIST_HEAD_INIT(acquire_pool.jobs),
+};
+
+static void *acquire_helper(void *data)
+{
+	struct task task;
+	struct acquire_job *job;
+	int rv;
+
+	memset(&task, 0, sizeof(struct task));
+	setup_task_aio(&task, main_task.use_aio, WORKER_AIO_CB_SIZE);
+	snprintf(task.name, NAME_ID_SIZE, "acquire%ld", (long)data);
+
+	pthread_mutex_lock(&acquire_pool.mutex);
+
+	while (1) {
+		while (list_empty(&acquire_pool.jobs)) {
+			acquire_pool.free_helpers++;
+			pthread_cond_wait(&acquire_pool.cond, &acquire_pool.mutex);
+			acquire_pool.free_helpers--;
+		}
+
+		job = list_first_entry(&acquire_pool.jobs, struct acquire_job, list);
+		list_del_init(&job->list);
+		pthread_mutex_unlock(&acquire_pool.mutex);
+
+		rv = acquire_token(&task, job->token, job->cmd_flags,
+				   job->killpath, job->killargs);
+
+		pthread_mutex_lock(&acquire_pool.mutex);
+		job->rv = rv;
+		job->done = 1;
+		pthread_cond_broadcast(&acquire_pool.done_cond);
+	}
+
+	return NULL;
+}
+
+static void acquire_pool_add(struct acquire_job *jobs, int count)
+{
+	pthread_t th;
+	int i, rv, started = 0;
+
+	pthread_mutex_lock(&acquire_pool.mutex);
+	for (i = 0; i < count; i++)
+		list_add_tail(&jobs[i].list, &acquire_pool.jobs);
+
+	while (acquire_pool.free_helpers + started < count &&
+	       acquire_pool.num_helpers < com.max_worker_threads) {
+		rv = pthread_create(&th, NULL, acquire_helper,
+				    (void *)(long)acquire_pool.num_helpers);
+		if (rv)
+			break;
+		pthread_detach(th);
+		acquire_pool.num_helpers++;
+		started++;
+	}
+
+	pthread_cond_broadcast(&acquire_pool.cond);
+	pthread_mutex_unlock(&acquire_pool.mutex);
+}
+
+/*
+ * Acquire new_tokens[0..count), setting rvs[i] for each.  Acquiring
+ * two tokens for the same resource in one command depends on the order
+ * they are done in (e.g. a second shared token joins the first), so
+ * those commands are done serially as before.  SANLK_ACQUIRE_WAIT
+ * commands are also done serially, by the cmd worker, so that waiting
+ * acquires can't take up all the helpers.
+ */
+
+static void acquire_new_tokens(struct task *task, struct token *new_tokens[],
+			       int count, uint32_t cmd_flags,
+			       char *killpath, char *killargs, int *rvs)
+{
+	struct acquire_job *jobs = NULL;
+	struct acquire_job *job;
+	struct token *t1, *t2;
+	int i, j, serial = (count < 2) || (cmd_flags & SANLK_ACQUIRE_WAIT);
+
+	for (i = 0; i < count && !serial; i++) {
+		t1 = new_tokens[i];
+		for (j = i + 1; j < count; j++) {
+			t2 = new_tokens[j];
+			if (!strncmp(t1->r.lockspace_name, t2->r.lockspace_name, SANLK_NAME_LEN) &&
+			    !strncmp(t1->r.name, t2->r.name, SANLK_NAME_LEN)) {
+				serial = 1;
+				break;
+			}
+		}
+	}
+
+	if (!serial) {
+		jobs = malloc((count - 1) * sizeof(struct acquire_job));
+		if (!jobs)
+			serial = 1;
+	}
+
+	if (serial) {
+		for (i = 0; i < count; i++) {
+			rvs[i] = acquire_token(task, new_tokens[i], cmd_flags, killpath, killargs);
+			if (rvs[i] < 0)
+				break;
+		}
+		for (i = i + 1; i < count; i++)
+			rvs[i] = -ECANCELED;
+		return;
+	}
+
+	memset(jobs, 0, (count - 1) * sizeof(struct acquire_job));
+
+	for (i = 1; i < count; i++) {
+		job = &jobs[i - 1];
+		job->token = new_tokens[i];
+		job->cmd_flags = cmd_flags;
+		job->killpath = killpath;
+		job->killargs = killargs;
+	}
+
+	acquire_pool_add(jobs, count - 1);
+
+	rvs[0] = acquire_token(task, new_tokens[0], cmd_flags, killpath, killargs);
+
+	/* do our own jobs that no helper has picked up */
+
+	pthread_mutex_lock(&acquire_pool.mutex);
+	for (i = 0; i < count - 1; i++) {
+		job = &jobs[i];
+		if (job->done || list_empty(&job->list))
+			continue;
+		list_del_init(&job->list);
+		pthread_mutex_unlock(&acquire_pool.mutex);
+
+		job->rv = acquire_token(task, job->token, cmd_flags, killpath, killargs);
+
+		pthread_mutex_lock(&acquire_pool.mutex);
+		job->done = 1;
+	}
+
+	for (i = 0; i < count - 1; i++) {
+		while (!jobs[i].done)
+			pthread_cond_wait(&acquire_pool.done_cond, &acquire_pool.mutex);
+		rvs[i + 1] = jobs[i].rv;
+	}
+	pthread_mutex_unlock(&acquire_pool.mutex);
+
+	free(jobs);
+}
+
 static const char *acquire_error_str(int error)
 {
 	switch (error) {
@@ -153,12 +333,47 @@ static const char *acquire_error_str(int error)
 	};
 }
 
+/*
+ * rvs is in the order of the resources sent by the client.  A resource
+ * that was acquired but then released because of another failure gets
+ * -ECANCELED, as do the ones that were never tried.
+ */
+
+static void send_res_results(struct cmd_args *ca, int result, int *rvs, int count)
+{
+	struct sm_header h;
+	int i, rv;
+
+	if (count < 0 || count > SANLK_MAX_RESOURCES_BATCH)
+		count = 0;
+
+	memcpy(&h, &ca->header, sizeof(struct sm_header));
+	h.version = SM_PROTO;
+	h.length = sizeof(struct sm_header) + count * sizeof(int);
+	h.data = result;
+	h.data2 = count;
+	ca_send(ca, &h, sizeof(h));
+
+	for (i = 0; i < count; i++) {
+		if (!rvs)
+			rv = result;
+		else if (rvs[i] < 0)
+			rv = rvs[i];
+		else if (!result)
+			rv = 0;
+		else
+			rv = -ECANCELED;
+		ca_send(ca, &rv, sizeof(int));
+	}
+}
+
 static void cmd_acquire(struct task *task, struct cmd_args *ca)
 {
 	struct client *cl;
 	struct token *token = NULL;
-	struct token *new_tokens[SANLK_MAX_RESOURCES];
+	struct token **new_tokens = NULL;
 	struct token **grow_tokens;
+	int *rvs = NULL;
 	struct sanlk_resource res;
 	struct sanlk_options opt;
 	struct space_info spi;
@@ -170,9 +385,9 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 	int alloc_count = 0, acquire_count = 0;
 	int pos = 0, pid_dead = 0;
 	int new_tokens_count;
-	int recv_done = 0;
+	int recv_done = 0, rvs_done = 0;
 	int result = 0;
-	int grow_size;
+	int grow_slots, grow_size;
 	int cl_ci = ca->ci_target;
 	int cl_fd = ca->cl_fd;
 	int cl_pid = ca->cl_pid;
@@ -185,13 +400,22 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 	log_debug("cmd_acquire %d,%d,%d ci_in %d fd %d count %d flags %x",
 		  cl_ci, cl_fd, cl_pid, ca->ci_in, fd, new_tokens_count, ca->header.cmd_flags);
 
-	if (new_tokens_count > SANLK_MAX_RESOURCES) {
+	if (new_tokens_count < 0 || new_tokens_count > SANLK_MAX_RESOURCES_BATCH) {
 		log_error("cmd_acquire %d,%d,%d new %d max %d",
-			  cl_ci, cl_fd, cl_pid, new_tokens_count, SANLK_MAX_RESOURCES);
+			  cl_ci, cl_fd, cl_pid, new_tokens_count, SANLK_MAX_RESOURCES_BATCH);
 		result = -E2BIG;
 		goto done;
 	}
 
+	if (new_tokens_count) {
+		new_tokens = malloc(new_tokens_count * sizeof(struct token *));
+		rvs = malloc(new_tokens_count * sizeof(int));
+		if (!new_tokens || !rvs) {
+			result = -ENOMEM;
+			goto done;
+		}
+	}
+
 	pthread_mutex_lock(&cl->mutex);
 	if (cl->pid_dead) {
 		result = -ESTALE;
@@ -209,7 +433,15 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 		log_debug("cmd_acquire grow tokens slots %d empty %d new %d",
 			  cl->tokens_slots, empty_slots, new_tokens_count);
 
-		grow_size = (cl->tokens_slots + (SANLK_MAX_RESOURCES * 2)) * sizeof(struct token *);
+		/* double the table so a client adding leases in many
+		   commands does not copy it on every acquire */
+		grow_slots = cl->tokens_slots;
+		if (grow_slots < SANLK_MAX_RESOURCES * 2)
+			grow_slots = SANLK_MAX_RESOURCES * 2;
+		if (grow_slots < new_tokens_count - empty_slots)
+			grow_slots = new_tokens_count - empty_slots;
+
+		grow_size = (cl->tokens_slots + grow_slots) * sizeof(struct token *);
 		grow_tokens = malloc(grow_size);
 		if (!grow_tokens) {
 			log_error("cmd_acquire ENOMEM grow tokens slots %d empty %d new %d grow_size %d",
@@ -222,8 +454,8 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 			memcpy(grow_tokens, cl->tokens, cl->tokens_slots * sizeof(struct token *));
 			free(cl->tokens);
 			cl->tokens = grow_tokens;
-			cl->tokens_slots += (SANLK_MAX_RESOURCES * 2);
-			empty_slots += (SANLK_MAX_RESOURCES * 2);
+			cl->tokens_slots += grow_slots;
+			empty_slots += grow_slots;
 		}
 	}
 
@@ -248,7 +480,7 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 		 * receive sanlk_resource, create token for it
 		 */
 
-		rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+		rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 		if (rv > 0)
 			pos += rv;
 		if (rv != sizeof(struct sanlk_resource)) {
@@ -292,7 +524,7 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 		 * in sanlk_disk (TODO: let these differ?)
 		 */
 
-		rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+		rv = ca_recv(ca, token->disks, disks_len);
 		if (rv > 0)
 			pos += rv;
 		if (rv != disks_len) {
@@ -314,7 +546,7 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 		alloc_count++;
 	}
 
-	rv = recv(fd, &opt, sizeof(struct sanlk_options), MSG_WAITALL);
+	rv = ca_recv(ca, &opt, sizeof(struct sanlk_options));
 	if (rv > 0)
 		pos += rv;
 	if (rv != sizeof(struct sanlk_options)) {
@@ -333,7 +565,7 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 			goto done;
 		}
 
-		rv = recv(fd, opt_str, opt.len, MSG_WAITALL);
+		rv = ca_recv(ca, opt_str, opt.len);
 		if (rv > 0)
 			pos += rv;
 		if (rv != opt.len) {
@@ -383,10 +615,29 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 			  cl_ci, cl_fd, cl_pid);
 	}
 
+	acquire_new_tokens(task, new_tokens, new_tokens_count,
+			   ca->header.cmd_flags, killpath, killargs, rvs);
+	rvs_done = 1;
+
+	/*
+	 * Move the acquired tokens to the front of new_tokens so that
+	 * release_new_tokens releases exactly those if any one failed.
+	 */
+
 	for (i = 0; i < new_tokens_count; i++) {
 		token = new_tokens[i];
+		rv = rvs[i];
+
+		if (rv >= 0) {
+			new_tokens[i] = new_tokens[acquire_count];
+			new_tokens[acquire_count] = token;
+			acquire_count++;
+			continue;
+		}
+
+		if (rv == -ECANCELED)
+			continue;
 
-		rv = acquire_token(task, token, ca->header.cmd_flags, killpath, killargs);
 		if (rv < 0) {
 			switch (rv) {
 			case -EEXIST:
@@ -406,12 +657,14 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 			log_level(0, token->token_id, NULL, lvl,
 				  "cmd_acquire %d,%d,%d acquire_token %d %s",
 				  cl_ci, cl_fd, cl_pid, rv, acquire_error_str(rv));
-			result = rv;
-			goto done;
+			if (!result)
+				result = rv;
 		}
-		acquire_count++;
 	}
 
+	if (result < 0)
+		goto done;
+
 	/*
 	 * Success acquiring the leases:
 	 * lock mutex,
@@ -479,10 +732,11 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 	/* 1. Success acquiring leases, and pid is live */
 
 	if (!result && !pid_dead) {
+		j = 0;
 		for (i = 0; i < new_tokens_count; i++) {
-			for (j = 0; j < cl->tokens_slots; j++) {
+			for (; j < cl->tokens_slots; j++) {
 				if (!cl->tokens[j]) {
-					cl->tokens[j] = new_tokens[i];
+					cl->tokens[j++] = new_tokens[i];
 					break;
 				}
 			}
@@ -529,20 +783,27 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
  reply:
 	if (!recv_done)
 		client_recv_all(ca->ci_in, &ca->header, pos);
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	if (ca->header.cmd_flags & SM_FLAG_RES_RESULTS)
+		send_res_results(ca, result, rvs_done ? rvs : NULL, new_tokens_count);
+	else
+		ca_send_result(ca, result);
+	ca_done(ca);
+	free(new_tokens);
+	free(rvs);
 }
 
 static void cmd_release(struct task *task, struct cmd_args *ca)
 {
 	struct client *cl;
 	struct token *token;
-	struct token *rem_tokens[SANLK_MAX_RESOURCES];
+	struct token **rem_tokens = NULL;
+	struct sanlk_resource *rem_res = NULL;
 	struct sanlk_resource res;
 	struct sanlk_resource new;
 	struct sanlk_resource *resrename = NULL;
 	int fd, rv, i, j, found, pid_dead;
 	int rem_tokens_count = 0;
+	int rem_count;
 	int result = 0;
 	int cl_ci = ca->ci_target;
 	int cl_fd = ca->cl_fd;
@@ -559,6 +820,12 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 
 	if (ca->header.cmd_flags & SANLK_REL_ALL) {
 		pthread_mutex_lock(&cl->mutex);
+		rem_tokens = malloc(cl->tokens_slots * sizeof(struct token *));
+		if (!rem_tokens) {
+			pthread_mutex_unlock(&cl->mutex);
+			result = -ENOMEM;
+			goto out;
+		}
 		for (j = 0; j < cl->tokens_slots; j++) {
 			token = cl->tokens[j];
 			if (!token)
@@ -571,7 +838,7 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 	}
 
 	if (ca->header.cmd_flags & SANLK_REL_ORPHAN) {
-		rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+		rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 		if (rv != sizeof(struct sanlk_resource)) {
 			log_error("cmd_release %d,%d,%d recv res %d %d",
 				  cl_ci, cl_fd, cl_pid, rv, errno);
@@ -584,7 +851,7 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 	}
 
 	if (ca->header.cmd_flags & SANLK_REL_RENAME) {
-		rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+		rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 		if (rv != sizeof(struct sanlk_resource)) {
 			log_error("cmd_release %d,%d,%d recv res %d %d",
 				  cl_ci, cl_fd, cl_pid, rv, errno);
@@ -593,7 +860,7 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 		}
 
 		/* second res struct has new name for first res */
-		rv = recv(fd, &new, sizeof(struct sanlk_resource), MSG_WAITALL);
+		rv = ca_recv(ca, &new, sizeof(struct sanlk_resource));
 		if (rv != sizeof(struct sanlk_resource)) {
 			log_error("cmd_release %d,%d,%d recv new %d %d",
 				  cl_ci, cl_fd, cl_pid, rv, errno);
@@ -601,6 +868,12 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 			goto do_remove;
 		}
 
+		rem_tokens = malloc(sizeof(struct token *));
+		if (!rem_tokens) {
+			result = -ENOMEM;
+			goto out;
+		}
+
 		found = 0;
 
 		pthread_mutex_lock(&cl->mutex);
@@ -631,28 +904,56 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 		goto do_remove;
 	}
 
-	/* caller is specifying specific resources to release */
+	/*
+	 * caller is specifying specific resources to release;
+	 * receive them all, then take them from cl->tokens in one pass
+	 * under cl->mutex
+	 */
+
+	rem_count = ca->header.data;
+
+	if (rem_count < 0 || rem_count > SANLK_MAX_RESOURCES_BATCH) {
+		log_error("cmd_release %d,%d,%d count %d max %d",
+			  cl_ci, cl_fd, cl_pid, rem_count, SANLK_MAX_RESOURCES_BATCH);
+		client_recv_all(ca->ci_in, &ca->header, 0);
+		result = -E2BIG;
+		goto out;
+	}
 
-	for (i = 0; i < ca->header.data; i++) {
-		rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	if (!rem_count)
+		goto do_remove;
+
+	rem_tokens = malloc(rem_count * sizeof(struct token *));
+	rem_res = malloc(rem_count * sizeof(struct sanlk_resource));
+	if (!rem_tokens || !rem_res) {
+		client_recv_all(ca->ci_in, &ca->header, 0);
+		result = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < rem_count; i++) {
+		rv = ca_recv(ca, &rem_res[i], sizeof(struct sanlk_resource));
 		if (rv != sizeof(struct sanlk_resource)) {
 			log_error("cmd_release %d,%d,%d recv res %d %d",
 				  cl_ci, cl_fd, cl_pid, rv, errno);
 			result = -ENOTCONN;
 			break;
 		}
+	}
+	rem_count = i;
 
+	pthread_mutex_lock(&cl->mutex);
+	for (i = 0; i < rem_count; i++) {
 		found = 0;
 
-		pthread_mutex_lock(&cl->mutex);
 		for (j = 0; j < cl->tokens_slots; j++) {
 			token = cl->tokens[j];
 			if (!token)
 				continue;
 
-			if (memcmp(token->r.lockspace_name, res.lockspace_name, NAME_ID_SIZE))
+			if (memcmp(token->r.lockspace_name, rem_res[i].lockspace_name, NAME_ID_SIZE))
 				continue;
-			if (memcmp(token->r.name, res.name, NAME_ID_SIZE))
+			if (memcmp(token->r.name, rem_res[i].name, NAME_ID_SIZE))
 				continue;
 
 			rem_tokens[rem_tokens_count++] = token;
@@ -660,14 +961,14 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 			found = 1;
 			break;
 		}
-		pthread_mutex_unlock(&cl->mutex);
 
 		if (!found) {
 			log_error("cmd_release %d,%d,%d no resource %.48s",
-				  cl_ci, cl_fd, cl_pid, res.name);
+				  cl_ci, cl_fd, cl_pid, rem_res[i].name);
 			result = -1;
 		}
 	}
+	pthread_mutex_unlock(&cl->mutex);
 
  do_remove:
 
@@ -723,8 +1024,10 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 		client_free(cl_ci);
 	}
 
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
+	free(rem_tokens);
+	free(rem_res);
 }
 
 static void cmd_inquire(struct task *task, struct cmd_args *ca)
@@ -735,7 +1038,7 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 	char *state = NULL, *str;
 	int state_maxlen = 0, state_strlen = 0;
 	int res_count = 0, cat_count = 0;
-	int fd, i, rv, pid_dead;
+	int fd, i, rv, len, pid_dead;
 	int result = 0;
 	int cl_ci = ca->ci_target;
 	int cl_fd = ca->cl_fd;
@@ -771,7 +1074,7 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 		result = -ENOMEM;
 		goto done;
 	}
-	memset(state, 0, state_maxlen);
+	state[0] = '\0';
 
 	/* should match sanlock_args_to_state() */
 
@@ -799,9 +1102,10 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 			goto done;
 		}
 
-		if (strlen(str) > SANLK_MAX_RES_STR - 1) {
-			log_errot(token, "cmd_inquire %d,%d,%d strlen %zu",
-				  cl_ci, cl_fd, cl_pid, strlen(str));
+		len = strlen(str);
+		if (len > SANLK_MAX_RES_STR - 1) {
+			log_errot(token, "cmd_inquire %d,%d,%d strlen %d",
+				  cl_ci, cl_fd, cl_pid, len);
 			free(str);
 			result = -ELIBBAD;
 			goto done;
@@ -817,15 +1121,15 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 			goto done;
 		}
 
+		/* append at state_strlen rather than strcat from the start */
 		if (cat_count)
-			strcat(state, " ");
-		strcat(state, str);
+			state[state_strlen++] = ' ';
+		memcpy(state + state_strlen, str, len + 1);
+		state_strlen += len;
 		cat_count++;
 		free(str);
 	}
 
-	state[state_maxlen - 1] = '\0';
-	state_strlen = strlen(state);
 	result = 0;
  done:
 	pid_dead = cl->pid_dead;
@@ -847,15 +1151,15 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 
 	if (state) {
 		h.length = sizeof(h) + state_strlen + 1;
-		send(fd, &h, sizeof(h), MSG_NOSIGNAL);
-		send(fd, state, state_strlen + 1, MSG_NOSIGNAL);
+		ca_send(ca, &h, sizeof(h));
+		ca_send(ca, state, state_strlen + 1);
 		free(state);
 	} else {
 		h.length = sizeof(h);
-		send(fd, &h, sizeof(h), MSG_NOSIGNAL);
+		ca_send(ca, &h, sizeof(h));
 	}
 
-	client_resume(ca->ci_in);
+	ca_done(ca);
 }
 
 /*
@@ -895,7 +1199,7 @@ static void cmd_convert(struct task *task, struct cmd_args *ca)
 	log_debug("cmd_convert %d,%d,%d ci_in %d fd %d",
 		  cl_ci, cl_fd, cl_pid, ca->ci_in, fd);
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		result = -ENOTCONN;
 		goto reply;
@@ -939,8 +1243,8 @@ static void cmd_convert(struct task *task, struct cmd_args *ca)
 		client_free(cl_ci);
 	}
 
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 static void cmd_request(struct task *task, struct cmd_args *ca)
@@ -959,7 +1263,7 @@ static void cmd_request(struct task *task, struct cmd_args *ca)
 
 	/* receiving and setting up token copied from cmd_acquire */
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_request %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1000,7 +1304,7 @@ static void cmd_request(struct task *task, struct cmd_args *ca)
 	 * in sanlk_disk (TODO: let these differ?)
 	 */
 
-	rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+	rv = ca_recv(ca, token->disks, disks_len);
 	if (rv != disks_len) {
 		result = -ENOTCONN;
 		goto reply_free;
@@ -1046,8 +1350,8 @@ static void cmd_request(struct task *task, struct cmd_args *ca)
  reply:
 	log_debug("cmd_request %d,%d done %d", ca->ci_in, fd, result);
 
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 static void cmd_examine(struct task *task GNUC_UNUSED, struct cmd_args *ca)
@@ -1072,7 +1376,7 @@ static void cmd_examine(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 		ls = &buf.s;
 	}
 
-	rv = recv(fd, &buf, datalen, MSG_WAITALL);
+	rv = ca_recv(ca, &buf, datalen);
 	if (rv != datalen) {
 		log_error("cmd_examine %d,%d recv %d %d",
 			  ca->ci_in, fd, rv, errno);
@@ -1095,8 +1399,8 @@ static void cmd_examine(struct task *task GNUC_UNUSED, struct cmd_args *ca)
  reply:
 	log_debug("cmd_examine %d,%d done %d", ca->ci_in, fd, count);
 
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
@@ -1107,7 +1411,7 @@ static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_set_lvb %d,%d recv %d %d", ca->ci_in, fd, rv, errno);
 		result = -ENOTCONN;
@@ -1131,7 +1435,7 @@ static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 		goto reply;
 	}
 
-	rv = recv(fd, lvb, lvblen, MSG_WAITALL);
+	rv = ca_recv(ca, lvb, lvblen);
 	if (rv != lvblen) {
 		log_error("cmd_set_lvb %d,%d recv lvblen %d lvb %d %d",
 			  ca->ci_in, fd, lvblen, rv, errno);
@@ -1147,8 +1451,8 @@ static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 	if (lvb)
 		free(lvb);
 
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 static void cmd_get_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
@@ -1160,7 +1464,7 @@ static void cmd_get_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_get_lvb %d,%d recv %d %d", ca->ci_in, fd, rv, errno);
 		result = -ENOTCONN;
@@ -1179,16 +1483,16 @@ static void cmd_get_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 	h.version = SM_PROTO;
 	h.data = result;
 	h.data2 = 0;
-	h.length = sizeof(h) + lvblen;
+	h.length = sizeof(h) + (lvb ? lvblen : 0);
 
-	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
+	ca_send(ca, &h, sizeof(h));
 
 	if (lvb) {
-		send(fd, lvb, lvblen, MSG_NOSIGNAL);
+		ca_send(ca, lvb, lvblen);
 		free(lvb);
 	}
 
-	client_resume(ca->ci_in);
+	ca_done(ca);
 }
 
 static int shutdown_reply_ci = -1;
@@ -1269,7 +1573,7 @@ static void cmd_add_lockspace(struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		log_error("cmd_add_lockspace %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1297,8 +1601,8 @@ static void cmd_add_lockspace(struct cmd_args *ca)
 	if (async) {
 		result = rv;
 		log_debug("cmd_add_lockspace %d,%d async done %d", ca->ci_in, fd, result);
-		send_result(fd, &ca->header, result);
-		client_resume(ca->ci_in);
+		ca_send_result(ca, result);
+		ca_done(ca);
 		add_lockspace_wait(sp);
 		return;
 	}
@@ -1306,8 +1610,8 @@ static void cmd_add_lockspace(struct cmd_args *ca)
 	result = add_lockspace_wait(sp);
  reply:
 	log_debug("cmd_add_lockspace %d,%d done %d", ca->ci_in, fd, result);
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 static void cmd_inq_lockspace(struct cmd_args *ca)
@@ -1318,7 +1622,7 @@ static void cmd_inq_lockspace(struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		log_error("cmd_inq_lockspace %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1346,8 +1650,8 @@ static void cmd_inq_lockspace(struct cmd_args *ca)
  reply:
 	/* log_debug("cmd_inq_lockspace %d,%d done %d", ca->ci_in, fd, result); */
 
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 /*
@@ -1404,7 +1708,7 @@ static void cmd_rem_lockspace(struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		log_error("cmd_rem_lockspace %d,%d recv %d %d",
 			  ca->ci_in, fd, rv, errno);
@@ -1431,8 +1735,8 @@ static void cmd_rem_lockspace(struct cmd_args *ca)
 	if (async) {
 		result = rv;
 		log_debug("cmd_rem_lockspace %d,%d async done %d", ca->ci_in, fd, result);
-		send_result(fd, &ca->header, result);
-		client_resume(ca->ci_in);
+		ca_send_result(ca, result);
+		ca_done(ca);
 		rem_lockspace_wait(&lockspace, space_id);
 		return;
 	}
@@ -1440,8 +1744,8 @@ static void cmd_rem_lockspace(struct cmd_args *ca)
 	result = rem_lockspace_wait(&lockspace, space_id);
  reply:
 	log_debug("cmd_rem_lockspace %d,%d done %d", ca->ci_in, fd, result);
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 static void cmd_align(struct task *task GNUC_UNUSED, struct cmd_args *ca)
@@ -1452,7 +1756,7 @@ static void cmd_align(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &disk, sizeof(struct sanlk_disk), MSG_WAITALL);
+	rv = ca_recv(ca, &disk, sizeof(struct sanlk_disk));
 	if (rv != sizeof(struct sanlk_disk)) {
 		log_error("cmd_align %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1483,8 +1787,8 @@ static void cmd_align(struct task *task GNUC_UNUSED, struct cmd_args *ca)
  reply:
 	log_debug("cmd_align %d,%d done %d", ca->ci_in, fd, result);
 
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 static void cmd_read_lockspace(struct task *task, struct cmd_args *ca)
@@ -1498,7 +1802,7 @@ static void cmd_read_lockspace(struct task *task, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		log_error("cmd_read_lockspace %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1547,9 +1851,9 @@ static void cmd_read_lockspace(struct task *task, struct cmd_args *ca)
 	h.data = result;
 	h.data2 = io_timeout;
 	h.length = sizeof(h) + sizeof(lockspace);
-	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
-	send(fd, &lockspace, sizeof(lockspace), MSG_NOSIGNAL);
-	client_resume(ca->ci_in);
+	ca_send(ca, &h, sizeof(h));
+	ca_send(ca, &lockspace, sizeof(lockspace));
+	ca_done(ca);
 }
 
 static void cmd_read_resource(struct task *task, struct cmd_args *ca)
@@ -1564,7 +1868,7 @@ static void cmd_read_resource(struct task *task, struct cmd_args *ca)
 
 	/* receiving and setting up token copied from cmd_acquire */
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_read_resource %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1599,7 +1903,7 @@ static void cmd_read_resource(struct task *task, struct cmd_args *ca)
 	 * in sanlk_disk (TODO: let these differ?)
 	 */
 
-	rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+	rv = ca_recv(ca, token->disks, disks_len);
 	if (rv != disks_len) {
 		result = -ENOTCONN;
 		goto reply;
@@ -1640,9 +1944,9 @@ static void cmd_read_resource(struct task *task, struct cmd_args *ca)
 	h.data = result;
 	h.data2 = 0;
 	h.length = sizeof(h) + sizeof(res);
-	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
-	send(fd, &res, sizeof(res), MSG_NOSIGNAL);
-	client_resume(ca->ci_in);
+	ca_send(ca, &h, sizeof(h));
+	ca_send(ca, &res, sizeof(res));
+	ca_done(ca);
 }
 
 static void cmd_read_resource_owners(struct task *task, struct cmd_args *ca)
@@ -1658,7 +1962,7 @@ static void cmd_read_resource_owners(struct task *task, struct cmd_args *ca)
 
 	/* receiving and setting up token copied from cmd_acquire */
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_read_resource_owners %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1693,7 +1997,7 @@ static void cmd_read_resource_owners(struct task *task, struct cmd_args *ca)
 	 * in sanlk_disk (TODO: let these differ?)
 	 */
 
-	rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+	rv = ca_recv(ca, token->disks, disks_len);
 	if (rv != disks_len) {
 		result = -ENOTCONN;
 		goto reply;
@@ -1736,14 +2040,14 @@ static void cmd_read_resource_owners(struct task *task, struct cmd_args *ca)
 	h.data = result;
 	h.data2 = count;
 	h.length = sizeof(h) + sizeof(res) + send_len;
-	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
-	send(fd, &res, sizeof(res), MSG_NOSIGNAL);
+	ca_send(ca, &h, sizeof(h));
+	ca_send(ca, &res, sizeof(res));
 	if (send_len && send_buf) {
-		send(fd, send_buf, send_len, MSG_NOSIGNAL);
+		ca_send(ca, send_buf, send_len);
 		free(send_buf);
 	}
 
-	client_resume(ca->ci_in);
+	ca_done(ca);
 }
 
 static void cmd_write_lockspace(struct task *task, struct cmd_args *ca)
@@ -1755,7 +2059,7 @@ static void cmd_write_lockspace(struct task *task, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		log_error("cmd_write_lockspace %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1795,8 +2099,8 @@ static void cmd_write_lockspace(struct task *task, struct cmd_args *ca)
  reply:
 	log_debug("cmd_write_lockspace %d,%d done %d", ca->ci_in, fd, result);
 
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 static void cmd_write_resource(struct task *task, struct cmd_args *ca)
@@ -1811,7 +2115,7 @@ static void cmd_write_resource(struct task *task, struct cmd_args *ca)
 
 	/* receiving and setting up token copied from cmd_acquire */
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_write_resource %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1846,7 +2150,7 @@ static void cmd_write_resource(struct task *task, struct cmd_args *ca)
 	 * in sanlk_disk (TODO: let these differ?)
 	 */
 
-	rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+	rv = ca_recv(ca, token->disks, disks_len);
 	if (rv != disks_len) {
 		result = -ENOTCONN;
 		goto reply;
@@ -1883,8 +2187,8 @@ static void cmd_write_resource(struct task *task, struct cmd_args *ca)
 	if (token)
 		free(token);
 
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 /* N.B. the api doesn't support one client setting killpath for another
@@ -1952,17 +2256,15 @@ static void cmd_set_event(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 {
 	struct sanlk_lockspace lockspace;
 	struct sanlk_host_event he;
-	int rv, fd, result;
-
-	fd = client[ca->ci_in].fd;
+	int rv, result;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 	        result = -ENOTCONN;
 	        goto reply;
 	}
 
-	rv = recv(fd, &he, sizeof(struct sanlk_host_event), MSG_WAITALL);
+	rv = ca_recv(ca, &he, sizeof(struct sanlk_host_event));
 	if (rv != sizeof(struct sanlk_host_event)) {
 	        result = -ENOTCONN;
 	        goto reply;
@@ -1974,8 +2276,8 @@ static void cmd_set_event(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	log_debug("cmd_set_event result %d", result);
 reply:
-	send_result(fd, &ca->header, result);
-	client_resume(ca->ci_in);
+	ca_send_result(ca, result);
+	ca_done(ca);
 }
 
 void call_cmd_thread(struct task *task, struct cmd_args *ca)
@@ -2089,6 +2391,11 @@ static int print_state_daemon(char *str)
 		 "helper_kill_fd=%d "
 		 "helper_full_count=%u "
 		 "helper_last_status=%llu "
+		 "resource_threads=%d "
+		 "max_clients=%d "
+		 "release_async_count=%u "
+		 "release_async_last_ms=%llu "
+		 "release_async_max_ms=%llu "
 		 "monotime=%llu "
 		 "version_str=%s "
 		 "version_num=%u.%u.%u "
@@ -2110,6 +2417,11 @@ static int print_state_daemon(char *str)
 		 helper_kill_fd,
 		 helper_full_count,
 		 (unsigned long long)helper_last_status,
+		 com.resource_threads,
+		 com.max_clients,
+		 release_async_count,
+		 (unsigned long long)release_async_last_ms,
+		 (unsigned long long)release_async_max_ms,
 		 (unsigned long long)monotime(),
 		 VERSION,
 		 sanlock_version_major,
@@ -2463,7 +2775,8 @@ static void cmd_host_status(int fd, struct sm_header *h_recv)
 	struct sanlk_lockspace lockspace;
 	struct space *sp;
 	struct host_status *hs, *status = NULL;
-	int status_len;
+	int *host_ids = NULL;
+	int status_len, count = 0;
 	int i, rv;
 
 	memset(&h, 0, sizeof(h));
@@ -2472,24 +2785,30 @@ static void cmd_host_status(int fd, struct sm_header *h_recv)
 	h.length = sizeof(h);
 	h.data = 0;
 
-	status_len = sizeof(struct host_status) * DEFAULT_MAX_HOSTS;
-
-	status = malloc(status_len);
-	if (!status) {
-		h.data = -ENOMEM;
-		goto fail;
-	}
-
 	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		h.data = -ENOTCONN;
 		goto fail;
 	}
 
+	/* copy the listed hosts, see add_host_id */
+
 	pthread_mutex_lock(&spaces_mutex);
 	sp = find_lockspace(lockspace.name);
-	if (sp)
-		memcpy(status, &sp->host_status, status_len);
+	if (sp && sp->host_ids_count) {
+		count = sp->host_ids_count;
+		status_len = sizeof(struct host_status) * count;
+		status = malloc(status_len);
+		host_ids = malloc(sizeof(int) * count);
+
+		if (status && host_ids) {
+			for (i = 0; i < count; i++) {
+				host_ids[i] = sp->host_ids[i];
+				memcpy(&status[i], &sp->host_status[host_ids[i]-1],
+				       sizeof(struct host_status));
+			}
+		}
+	}
 	pthread_mutex_unlock(&spaces_mutex);
 
 	if (!sp) {
@@ -2497,23 +2816,32 @@ static void cmd_host_status(int fd, struct sm_header *h_recv)
 		goto fail;
 	}
 
+	if (count && (!status || !host_ids)) {
+		h.data = -ENOMEM;
+		goto fail;
+	}
+
 	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
 
-	for (i = 0; i < DEFAULT_MAX_HOSTS; i++) {
+	for (i = 0; i < count; i++) {
 		hs = &status[i];
 		if (!hs->last_live && !hs->owner_id)
 			continue;
-		send_state_host(fd, hs, i+1);
+		send_state_host(fd, hs, host_ids[i]);
 	}
 
 	if (status)
 		free(status);
+	if (host_ids)
+		free(host_ids);
 	return;
  fail:
 	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
 
 	if (status)
 		free(status);
+	if (host_ids)
+		free(host_ids);
 }
 
 static void cmd_renewal(int fd, struct sm_header *h_recv)
@@ -2679,16 +3007,70 @@ static void cmd_restrict(int ci, int fd, struct sm_header *h_recv)
 
 static void cmd_version(int ci GNUC_UNUSED, int fd, struct sm_header *h_recv)
 {
+	char reply[sizeof(struct sm_header) + sizeof(struct sm_version_info)];
+	struct sm_version_info info;
+
 	h_recv->magic = SM_MAGIC;
 	h_recv->version = SM_PROTO;
 	h_recv->cmd = SM_CMD_VERSION;
 	h_recv->cmd_flags = 0;
-	h_recv->length = sizeof(struct sm_header);
-	h_recv->seq = 0;
+	h_recv->length = sizeof(reply);
 	h_recv->data = 0;
 	h_recv->data2 = sanlock_version_combined;
 
-	send(fd, h_recv, sizeof(struct sm_header), MSG_NOSIGNAL);
+	memset(&info, 0, sizeof(info));
+	info.max_resources = SANLK_MAX_RESOURCES_BATCH;
+
+	memcpy(reply, h_recv, sizeof(struct sm_header));
+	memcpy(reply + sizeof(struct sm_header), &info, sizeof(info));
+
+	send(fd, reply, sizeof(reply), MSG_NOSIGNAL);
+}
+
+/* later cmds on this connection are run without waiting for replies */
+
+static void cmd_pipeline(int ci, int fd, struct sm_header *h_recv)
+{
+	struct sm_header h;
+	int result = 0;
+
+	pthread_mutex_lock(&client[ci].mutex);
+	if (client[ci].pid != -1) {
+		result = -EINVAL;
+	} else {
+		client[ci].flags |= CL_PIPELINE;
+		strcpy(client[ci].owner_name, "pipeline");
+	}
+	pthread_mutex_unlock(&client[ci].mutex);
+
+	log_debug("cmd_pipeline ci %d fd %d result %d", ci, fd, result);
+
+	memcpy(&h, h_recv, sizeof(struct sm_header));
+	h.version = SM_PROTO;
+	h.length = sizeof(h);
+	h.data = result;
+	h.data2 = result ? 0 : MAX_PIPELINE_CMDS;
+	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
+}
+
+/* the connection stays open after daemon cmds, see call_cmd_daemon */
+
+static void cmd_session(int ci, int fd, struct sm_header *h_recv)
+{
+	int result = 0;
+
+	pthread_mutex_lock(&client[ci].mutex);
+	if (client[ci].pid != -1) {
+		result = -EINVAL;
+	} else {
+		client[ci].flags |= CL_SESSION;
+		strcpy(client[ci].owner_name, "session");
+	}
+	pthread_mutex_unlock(&client[ci].mutex);
+
+	log_debug("cmd_session ci %d fd %d result %d", ci, fd, result);
+
+	send_result(fd, h_recv, result);
 }
 
 static void cmd_reg_event(int fd, struct sm_header *h_recv)
@@ -2813,6 +3195,7 @@ void call_cmd_daemon(int ci, struct sm_header *h_recv, int client_maxi)
 			break;
 		}
 		memset(client[ci].tokens, 0, sizeof(struct token *) * SANLK_MAX_RESOURCES);
+		client_watch_pid(ci);
 		auto_close = 0;
 		break;
 	case SM_CMD_RESTRICT:
@@ -2823,6 +3206,14 @@ void call_cmd_daemon(int ci, struct sm_header *h_recv, int client_maxi)
 		cmd_version(ci, fd, h_recv);
 		auto_close = 0;
 		break;
+	case SM_CMD_PIPELINE:
+		cmd_pipeline(ci, fd, h_recv);
+		auto_close = 0;
+		break;
+	case SM_CMD_SESSION:
+		cmd_session(ci, fd, h_recv);
+		auto_close = 0;
+		break;
 	case SM_CMD_SHUTDOWN:
 		strcpy(client[ci].owner_name, "shutdown");
 		if (h_recv->data) {
@@ -2877,7 +3268,13 @@ void call_cmd_daemon(int ci, struct sm_header *h_recv, int client_maxi)
 		break;
 	};
 
+	/* reg_event keeps a dup of the fd for sending events, so the
+	   connection can't be used for more cmds */
+	if (auto_close && (client[ci].flags & CL_SESSION) &&
+	    h_recv->cmd != SM_CMD_REG_EVENT && h_recv->cmd != SM_CMD_SHUTDOWN)
+		auto_close = 0;
+
 	if (auto_close)
-		close(fd);
+		client_free(ci);
 }
 
@@ -16,11 +16,28 @@ struct cmd_args {
 	int cl_fd;
 	int cl_pid;
 	struct sm_header header;
+
+	/* a pipelined cmd has its data read up front by the main loop,
+	   and its reply collected and sent when the cmd is done */
+	int pipelined;
+	int data_len;
+	int data_pos;
+	int reply_len;
+	int reply_size;
+	int reply_error;
+	char *data;
+	char *reply;
 };
 
 /* cmds processed by thread pool */
 void call_cmd_thread(struct task *task, struct cmd_args *ca);
 
+/* cmd data and replies for cmds processed by thread pool */
+int ca_recv(struct cmd_args *ca, void *buf, int len);
+void ca_send(struct cmd_args *ca, void *buf, int len);
+void ca_send_result(struct cmd_args *ca, int result);
+void ca_done(struct cmd_args *ca);
+
 /* cmds processed by main loop */
 void call_cmd_daemon(int ci, struct sm_header *h_recv, int client_maxi);
 
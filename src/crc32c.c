@@ -9,6 +9,18 @@
  */
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
 
 /*
  * This is the CRC-32C table
@@ -91,12 +103,175 @@ static const uint32_t crc32c_table[256] = {
  * crc using table.
  */
 
-uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length);
+uint32_t crc32c_byte(uint32_t crc, uint8_t *data, size_t length);
 
-uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length)
+uint32_t crc32c_byte(uint32_t crc, uint8_t *data, size_t length)
 {
 	while (length--)
 		crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
 
 	return crc;
 }
+
+/*
+ * Slicing-by-8: crc32c_sb8_table[k][n] is the crc of byte n followed
+ * by k zero bytes, so eight bytes are done with eight lookups.  Table 0
+ * is crc32c_table, the others are generated by crc32c_init.
+ */
+
+static uint32_t crc32c_sb8_table[8][256];
+
+uint32_t crc32c_sb8(uint32_t crc, uint8_t *data, size_t length);
+
+uint32_t crc32c_sb8(uint32_t crc, uint8_t *data, size_t length)
+{
+	uint32_t (*t)[256] = crc32c_sb8_table;
+	uint32_t lo;
+
+	while (length >= 8) {
+		lo = crc ^ ((uint32_t)data[0] |
+			    ((uint32_t)data[1] << 8) |
+			    ((uint32_t)data[2] << 16) |
+			    ((uint32_t)data[3] << 24));
+
+		crc = t[7][lo & 0xFF] ^
+		      t[6][(lo >> 8) & 0xFF] ^
+		      t[5][(lo >> 16) & 0xFF] ^
+		      t[4][lo >> 24] ^
+		      t[3][data[4]] ^
+		      t[2][data[5]] ^
+		      t[1][data[6]] ^
+		      t[0][data[7]];
+
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--)
+		crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+
+	return crc;
+}
+
+/*
+ * The SSE4.2 and ARMv8 crc32c instructions compute the same reflected
+ * crc as the table, eight bytes at a time.
+ */
+
+#if defined(__x86_64__)
+uint32_t crc32c_sse42(uint32_t crc, uint8_t *data, size_t length);
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, uint8_t *data, size_t length)
+{
+	uint64_t crc64 = crc;
+	uint64_t val;
+
+	while (length && ((uintptr_t)data & 7)) {
+		crc64 = _mm_crc32_u8((uint32_t)crc64, *data++);
+		length--;
+	}
+
+	while (length >= 8) {
+		memcpy(&val, data, 8);
+		crc64 = _mm_crc32_u64(crc64, val);
+		data += 8;
+		length -= 8;
+	}
+
+	crc = (uint32_t)crc64;
+
+	while (length--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return crc;
+}
+#endif
+
+#if defined(__aarch64__)
+uint32_t crc32c_armv8(uint32_t crc, uint8_t *data, size_t length);
+
+__attribute__((target("+crc")))
+uint32_t crc32c_armv8(uint32_t crc, uint8_t *data, size_t length)
+{
+	uint64_t val;
+
+	while (length && ((uintptr_t)data & 7)) {
+		crc = __crc32cb(crc, *data++);
+		length--;
+	}
+
+	while (length >= 8) {
+		memcpy(&val, data, 8);
+		crc = __crc32cd(crc, val);
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--)
+		crc = __crc32cb(crc, *data++);
+
+	return crc;
+}
+#endif
+
+/*
+ * The implementation is chosen once, the first time crc32c is called:
+ * the cpu's crc32c instruction if it has one, otherwise slicing-by-8.
+ */
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, uint8_t *data, size_t length);
+
+static crc32c_fn crc32c_impl;
+static const char *crc32c_impl_str;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void)
+{
+	uint32_t c;
+	int k, n;
+
+	for (n = 0; n < 256; n++)
+		crc32c_sb8_table[0][n] = crc32c_table[n];
+
+	for (k = 1; k < 8; k++) {
+		for (n = 0; n < 256; n++) {
+			c = crc32c_sb8_table[k - 1][n];
+			crc32c_sb8_table[k][n] = crc32c_table[c & 0xFF] ^ (c >> 8);
+		}
+	}
+
+	crc32c_impl = crc32c_sb8;
+	crc32c_impl_str = "sb8";
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc32c_impl = crc32c_sse42;
+		crc32c_impl_str = "sse4.2";
+	}
+#endif
+
+#if defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		crc32c_impl = crc32c_armv8;
+		crc32c_impl_str = "armv8";
+	}
+#endif
+}
+
+const char *crc32c_impl_name(void);
+
+const char *crc32c_impl_name(void)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+	return crc32c_impl_str;
+}
+
+uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length);
+
+uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+	return crc32c_impl(crc, data, length);
+}
@@ -30,6 +30,7 @@
 #include "paxos_lease.h"
 #include "delta_lease.h"
 #include "timeouts.h"
+#include "task.h"
 
 /* Based on "Light-Weight Leases for Storage-Centric Coordination"
    by Gregory Chockler and Dahlia Malkhi */
@@ -456,6 +457,114 @@ int delta_lease_acquire(struct task *task,
 	return SANLK_OK;
 }
 
+/*
+ * The checks on the leader read at the start of a renewal, and the
+ * update of the leader for the write that follows, are shared with the
+ * renewal engine, which does the read and write asynchronously.
+ */
+
+int delta_renew_check(struct space *sp, struct sync_disk *disk, char *space_name,
+		      char *iobuf, int prev_result,
+		      struct leader_record *leader_last,
+		      struct leader_record *leader_ret)
+{
+	struct leader_record leader;
+	struct leader_record leader_end;
+	uint32_t checksum;
+	uint64_t host_id, id_offset;
+	int rv;
+
+	host_id = leader_last->owner_id;
+	id_offset = (host_id - 1) * disk->sector_size;
+
+	memcpy(&leader_end, iobuf+id_offset, sizeof(struct leader_record));
+
+	/* N.B. compute checksum before byte swapping */
+	checksum = leader_checksum(&leader_end);
+
+	leader_record_in(&leader_end, &leader);
+
+	rv = verify_leader(disk, space_name, host_id, &leader, checksum, "delta_renew");
+	if (rv < 0) {
+		log_erros(sp, "delta_renew verify_leader error %d", rv);
+		return rv;
+	}
+
+	/* We can't always memcmp(&leader, leader_last) because previous writes
+	   may have timed out and we don't know if they were actually written
+	   or not.  We can definately verify that we're still the owner,
+	   though, which is the main thing we need to know. */
+
+	if (leader.owner_id != leader_last->owner_id ||
+	    leader.owner_generation != leader_last->owner_generation ||
+	    memcmp(leader.resource_name, leader_last->resource_name, NAME_ID_SIZE)) {
+		log_erros(sp, "delta_renew not owner");
+		log_leader_error(0, space_name, host_id, disk, leader_last, "delta_renew_last");
+		log_leader_error(0, space_name, host_id, disk, &leader, "delta_renew_read");
+		return SANLK_RENEW_OWNER;
+	}
+
+	if (prev_result == SANLK_OK &&
+	    memcmp(&leader, leader_last, sizeof(struct leader_record))) {
+		log_erros(sp, "delta_renew reread mismatch");
+		log_leader_error(0, space_name, host_id, disk, leader_last, "delta_renew_last");
+		log_leader_error(0, space_name, host_id, disk, &leader, "delta_renew_read");
+		return SANLK_RENEW_DIFF;
+	}
+
+	if (leader.io_timeout != sp->io_timeout) {
+		log_erros(sp, "delta_renew io_timeout changed disk %d sp %d",
+			  leader.io_timeout, sp->io_timeout);
+		leader.io_timeout = (sp->io_timeout & 0x00FF);
+	}
+
+	memcpy(leader_ret, &leader, sizeof(struct leader_record));
+	return SANLK_OK;
+}
+
+/* sets the new timestamp in leader and copies it into wbuf, returns the timestamp */
+
+uint64_t delta_renew_prep(struct space *sp, struct leader_record *leader,
+			  char *bitmap, struct delta_extra *extra,
+			  int log_renewal_level, char *wbuf)
+{
+	struct leader_record leader_end;
+	uint32_t checksum;
+	uint64_t new_ts;
+
+	new_ts = monotime();
+
+	if (log_renewal_level != -1)
+		log_level(sp->space_id, 0, NULL, log_renewal_level, "delta_renew begin write for new ts %llu", (unsigned long long)new_ts);
+
+	if (leader->timestamp >= new_ts)
+		log_erros(sp, "delta_renew timestamp too small");
+
+	leader->timestamp = new_ts;
+	leader->checksum = 0; /* set below */
+
+	/* TODO: rename the leader fields */
+	if (extra) {
+		leader->write_id = extra->field1;
+		leader->write_generation = extra->field2;
+		leader->write_timestamp = extra->field3;
+	}
+
+	leader_record_out(leader, &leader_end);
+
+	/*
+	 * N.B. must compute checksum after the data has been byte swapped.
+	 */
+	checksum = leader_checksum(&leader_end);
+	leader->checksum = checksum;
+	leader_end.checksum = cpu_to_le32(checksum);
+
+	memcpy(wbuf, &leader_end, sizeof(struct leader_record));
+	memcpy(wbuf+LEADER_RECORD_MAX, bitmap, HOSTID_BITMAP_SIZE);
+
+	return new_ts;
+}
+
 int delta_lease_renew(struct task *task,
 		      struct space *sp,
 		      struct sync_disk *disk,
@@ -470,12 +579,9 @@ int delta_lease_renew(struct task *task,
 		      int *rd_ms, int *wr_ms)
 {
 	struct leader_record leader;
-	struct leader_record leader_end;
 	char **p_iobuf;
-	char **p_wbuf;
 	char *wbuf;
 	struct timespec begin, end, diff;
-	uint32_t checksum;
 	uint32_t reap_timeout_msec;
 	uint64_t host_id, id_offset, new_ts, now;
 	int rv, iobuf_len, sector_size;
@@ -553,6 +659,7 @@ int delta_lease_renew(struct task *task,
 		   one from scratch.  the current task->iobuf mem will
 		   freed when timeout_aicb completes sometime */
 
+		task_uring_unregister_buf(task, task->iobuf);
 		task->read_iobuf_timeout_aicb = NULL;
 		task->iobuf = NULL;
 	}
@@ -568,14 +675,15 @@ int delta_lease_renew(struct task *task,
 
 		log_space(sp, "delta_renew timeout_aicb is unexpectedly %p iobuf %p",
 			  task->read_iobuf_timeout_aicb, task->iobuf);
+		task_uring_unregister_buf(task, task->iobuf);
 		task->read_iobuf_timeout_aicb = NULL;
 		task->iobuf = NULL;
 	}
 
 	/*
-	 * NB. this task->iobuf is also copied by the lockspace thread
-	 * into renewal_read_buf, which is then copied in the main loop
-	 * by check_our_lease and passed to check_other_leases.
+	 * NB. after a successful read, the lockspace thread swaps this
+	 * task->iobuf with renewal_read_buf, which the main loop takes
+	 * in check_our_lease and passes to check_other_leases.
 	 */
 
 	if (!task->iobuf) {
@@ -589,6 +697,9 @@ int delta_lease_renew(struct task *task,
 		if (rv) {
 			log_erros(sp, "dela_renew memalign rv %d", rv);
 			rv = -ENOMEM;
+		} else {
+			/* fixed buffer for io_uring, no-op otherwise */
+			task_uring_register_buf(task, task->iobuf, iobuf_len);
 		}
 	}
 
@@ -612,84 +723,19 @@ int delta_lease_renew(struct task *task,
 
  read_done:
 	*read_result = SANLK_OK;
-	memcpy(&leader_end, task->iobuf+id_offset, sizeof(struct leader_record));
-
-	/* N.B. compute checksum before byte swapping */
-	checksum = leader_checksum(&leader_end);
 
-	leader_record_in(&leader_end, &leader);
-
-	rv = verify_leader(disk, space_name, host_id, &leader, checksum, "delta_renew");
-	if (rv < 0) {
-		log_erros(sp, "delta_renew verify_leader error %d", rv);
+	rv = delta_renew_check(sp, disk, space_name, task->iobuf, prev_result,
+			       leader_last, &leader);
+	if (rv < 0)
 		return rv;
-	}
-
-	/* We can't always memcmp(&leader, leader_last) because previous writes
-	   may have timed out and we don't know if they were actually written
-	   or not.  We can definately verify that we're still the owner,
-	   though, which is the main thing we need to know. */
-
-	if (leader.owner_id != leader_last->owner_id ||
-	    leader.owner_generation != leader_last->owner_generation ||
-	    memcmp(leader.resource_name, leader_last->resource_name, NAME_ID_SIZE)) {
-		log_erros(sp, "delta_renew not owner");
-		log_leader_error(0, space_name, host_id, disk, leader_last, "delta_renew_last");
-		log_leader_error(0, space_name, host_id, disk, &leader, "delta_renew_read");
-		return SANLK_RENEW_OWNER;
-	}
-
-	if (prev_result == SANLK_OK &&
-	    memcmp(&leader, leader_last, sizeof(struct leader_record))) {
-		log_erros(sp, "delta_renew reread mismatch");
-		log_leader_error(0, space_name, host_id, disk, leader_last, "delta_renew_last");
-		log_leader_error(0, space_name, host_id, disk, &leader, "delta_renew_read");
-		return SANLK_RENEW_DIFF;
-	}
 
-	if (leader.io_timeout != sp->io_timeout) {
-		log_erros(sp, "delta_renew io_timeout changed disk %d sp %d",
-			  leader.io_timeout, sp->io_timeout);
-		leader.io_timeout = (sp->io_timeout & 0x00FF);
-	}
-
-	new_ts = monotime();
-
-	if (log_renewal_level != -1)
-		log_level(sp->space_id, 0, NULL, log_renewal_level, "delta_renew begin write for new ts %llu", (unsigned long long)new_ts);
-
-	if (leader.timestamp >= new_ts)
-		log_erros(sp, "delta_renew timestamp too small");
-
-	leader.timestamp = new_ts;
-	leader.checksum = 0; /* set below */
-
-	/* TODO: rename the leader fields */
-	if (extra) {
-		leader.write_id = extra->field1;
-		leader.write_generation = extra->field2;
-		leader.write_timestamp = extra->field3;
-	}
-
-	p_wbuf = &wbuf;
-	rv = posix_memalign((void *)p_wbuf, getpagesize(), sector_size);
-	if (rv) {
-		log_erros(sp, "dela_renew write memalign rv %d", rv);
+	wbuf = iobuf_get(task, sector_size);
+	if (!wbuf) {
+		log_erros(sp, "dela_renew write iobuf_get %d", sector_size);
 		return -ENOMEM;
 	}
-	memset(wbuf, 0, sector_size);
 
-	leader_record_out(&leader, &leader_end);
-
-	/*
-	 * N.B. must compute checksum after the data has been byte swapped.
-	 */
-	checksum = leader_checksum(&leader_end);
-	leader.checksum = checksum;
-	leader_end.checksum = cpu_to_le32(checksum);
-
-	memcpy(wbuf, &leader_end, sizeof(struct leader_record));
-	memcpy(wbuf+LEADER_RECORD_MAX, bitmap, HOSTID_BITMAP_SIZE);
+	new_ts = delta_renew_prep(sp, &leader, bitmap, extra, log_renewal_level, wbuf);
 
 	/* extend io timeout for this one write; we need to give this write
 	   every chance to succeed, and there's no point in letting it time
@@ -700,7 +746,7 @@ int delta_lease_renew(struct task *task,
 			 calc_host_dead_seconds(sp->io_timeout), wr_ms);
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(wbuf);
+		iobuf_put(task, wbuf, sector_size);
 
 	now = monotime();
 
@@ -771,6 +817,46 @@ int delta_lease_release(struct task *task,
 	return SANLK_OK;
 }
 
+/*
+ * The number of host_id leases initialized in the lockspace, i.e. the
+ * max_hosts given to delta_lease_init.  The rest of the lease area is
+ * zeroed by init, so this is the last sector with a valid leader.
+ */
+
+int delta_lease_max_hosts(struct task *task, struct space *sp,
+			  struct sync_disk *disk, char *space_name)
+{
+	struct leader_record leader;
+	char *iobuf;
+	int i, rv;
+
+	i = sp->align_size / disk->sector_size;
+	if (i > DEFAULT_MAX_HOSTS)
+		i = DEFAULT_MAX_HOSTS;
+
+	iobuf = iobuf_get(task, sp->align_size);
+	if (!iobuf)
+		return -ENOMEM;
+
+	rv = read_iobuf(disk->fd, disk->offset, iobuf, sp->align_size, task, sp->io_timeout, NULL);
+	if (rv < 0) {
+		if (rv != SANLK_AIO_TIMEOUT)
+			iobuf_put(task, iobuf, sp->align_size);
+		return rv;
+	}
+
+	for (; i > 0; i--) {
+		leader_record_in((struct leader_record *)(iobuf + ((i - 1) * disk->sector_size)), &leader);
+
+		if (leader.magic == DELTA_DISK_MAGIC &&
+		    !strncmp(leader.space_name, space_name, NAME_ID_SIZE))
+			break;
+	}
+
+	iobuf_put(task, iobuf, sp->align_size);
+	return i;
+}
+
 /* the host_id lease area begins disk->offset bytes from the start of
    block device disk->path */
 
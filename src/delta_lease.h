@@ -38,6 +38,15 @@ int delta_lease_renew(struct task *task,
                       struct leader_record *leader_ret,
 		      int *rd_ms, int *wr_ms);
 
+int delta_renew_check(struct space *sp, struct sync_disk *disk, char *space_name,
+		      char *iobuf, int prev_result,
+		      struct leader_record *leader_last,
+		      struct leader_record *leader_ret);
+
+uint64_t delta_renew_prep(struct space *sp, struct leader_record *leader,
+			  char *bitmap, struct delta_extra *extra,
+			  int log_renewal_level, char *wbuf);
+
 int delta_lease_release(struct task *task,
                         struct space *sp,
                         struct sync_disk *disk,
@@ -45,6 +54,9 @@ int delta_lease_release(struct task *task,
                         struct leader_record *leader_last,
                         struct leader_record *leader_ret);
 
+int delta_lease_max_hosts(struct task *task, struct space *sp,
+			  struct sync_disk *disk, char *space_name);
+
 int delta_lease_init(struct task *task,
 		     int io_timeout,
 		     struct sync_disk *disk,
@@ -46,6 +46,16 @@ int host_info(char *space_name GNUC_UNUSED, uint64_t host_id GNUC_UNUSED, struct
 	return -1;
 }
 
+int host_info_wait(char *space_name, uint64_t host_id, uint64_t last_check,
+		   int wait_sec, struct host_status *hs_out);
+
+int host_info_wait(char *space_name GNUC_UNUSED, uint64_t host_id GNUC_UNUSED,
+		   uint64_t last_check GNUC_UNUSED, int wait_sec GNUC_UNUSED,
+		   struct host_status *hs_out GNUC_UNUSED)
+{
+	return -1;
+}
+
 struct token;
 
 void check_mode_block(struct token *token GNUC_UNUSED, int q GNUC_UNUSED, char *dblock GNUC_UNUSED);
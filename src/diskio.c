@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <blkid/blkid.h>
 
 #include <libaio.h> /* linux aio */
@@ -30,6 +31,7 @@
 #include "diskio.h"
 #include "direct.h"
 #include "log.h"
+#include "task.h"
 
 static int set_disk_properties(struct sync_disk *disk)
 {
@@ -333,6 +335,14 @@ static struct aicb *find_callback_slot(struct task *task, int ioto)
 	if (cleared++)
 		return NULL;
 
+	if (task->use_aio == 3) {
+		/* orphaned aicbs are freed as their cqes are reaped */
+		rv = task_uring_reap(task, ioto * 1000);
+		if (rv <= 0)
+			return NULL;
+		goto find;
+	}
+
 	memset(&ts, 0, sizeof(struct timespec));
 	ts.tv_sec = ioto;
  retry:
@@ -359,7 +369,7 @@ static struct aicb *find_callback_slot(struct task *task, int ioto)
 		log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld old free",
 			  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
 		ev_aicb->used = 0;
-		free(ev_aicb->buf);
+		iobuf_put(task, ev_aicb->buf, ev_aicb->iocb.u.c.nbytes);
 		ev_aicb->buf = NULL;
 		goto find;
 	}
@@ -457,7 +467,7 @@ static int do_linux_aio(int fd, uint64_t offset, char *buf, int len,
 		if (ev_iocb != iocb) {
 			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld other free",
 				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
-			free(ev_aicb->buf);
+			iobuf_put(task, ev_aicb->buf, ev_aicb->iocb.u.c.nbytes);
 			ev_aicb->buf = NULL;
 			goto retry;
 		}
@@ -529,6 +539,227 @@ static int do_read_aio_linux(int fd, uint64_t offset, char *buf, int len,
 	return do_linux_aio(fd, offset, buf, len, task, ioto, IO_CMD_PREAD, rd_ms);
 }
 
+/*
+ * Same results as do_linux_aio, including SANLK_AIO_TIMEOUT, but the
+ * timeout is a LINK_TIMEOUT submitted along with the io.  When it fires,
+ * the kernel tries to cancel the io; if that works the aicb is released
+ * right away, otherwise the aicb and buf stay in use until the io's cqe
+ * is reaped (uring_orphan).
+ */
+
+/*
+ * task_uring_submit counts sqes, two per io.  An odd count means the
+ * last io was taken without its linked timeout; it's in flight but only
+ * its own cqe will come back.  Returns the number of ios submitted.
+ */
+
+static int uring_submitted_ios(struct aicb *last, int sqes)
+{
+	if (sqes & 1)
+		last->uring_pending = 1;
+	return (sqes + 1) / 2;
+}
+
+/* queue sqes for the io and its linked timeout, submitted by the caller */
+
+static int uring_prep_io(struct task *task, struct aicb *aicb, int fd, uint64_t offset,
+			 char *buf, int len, int ioto, int cmd)
+{
+	struct io_uring_sqe *sqes[2];
+	struct io_uring_sqe *sqe, *tsqe;
+	struct iocb *iocb;
+	int fixed_fd, fixed_buf;
+
+	/* describes the io for read_iobuf_reap and log messages */
+	iocb = &aicb->iocb;
+	memset(iocb, 0, sizeof(struct iocb));
+	iocb->aio_fildes = fd;
+	iocb->aio_lio_opcode = cmd;
+	iocb->u.c.buf = buf;
+	iocb->u.c.nbytes = len;
+	iocb->u.c.offset = offset;
+
+	if (task_uring_get_sqes(task, sqes, 2) < 0) {
+		/* shouldn't happen, the sq has two entries per aicb */
+		log_taske(task, "aio %d %p no sqe", cmd, aicb);
+		return -ENOENT;
+	}
+	sqe = sqes[0];
+	tsqe = sqes[1];
+
+	fixed_fd = task_uring_fixed_fd(task, fd);
+	fixed_buf = task_uring_fixed_buf(task, buf, len);
+
+	if (fixed_buf >= 0) {
+		sqe->opcode = (cmd == IO_CMD_PREAD) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+		sqe->buf_index = fixed_buf;
+	} else {
+		sqe->opcode = (cmd == IO_CMD_PREAD) ? IORING_OP_READ : IORING_OP_WRITE;
+	}
+
+	if (fixed_fd >= 0) {
+		sqe->fd = fixed_fd;
+		sqe->flags |= IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = fd;
+	}
+
+	sqe->flags |= IOSQE_IO_LINK;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = (uint64_t)(uintptr_t)aicb;
+
+	memset(&aicb->uring_ts, 0, sizeof(aicb->uring_ts));
+	aicb->uring_ts.tv_sec = ioto;
+
+	tsqe->opcode = IORING_OP_LINK_TIMEOUT;
+	tsqe->fd = -1;
+	tsqe->addr = (uint64_t)(uintptr_t)&aicb->uring_ts;
+	tsqe->len = 1;
+	tsqe->user_data = (uint64_t)(uintptr_t)aicb | 1;
+
+	aicb->uring_pending = 2;
+	aicb->uring_done = 0;
+	aicb->uring_res = 0;
+	aicb->uring_timedout = 0;
+	aicb->uring_orphan = 0;
+
+	/* don't reuse the aicb or free the buf until both cqes are reaped */
+	aicb->used = 1;
+	aicb->buf = buf;
+	return 0;
+}
+
+/* result of an io once its cqe or its timeout's cqe has been reaped */
+
+static int uring_finish_io(struct task *task, struct aicb *aicb, int ioto)
+{
+	struct iocb *iocb = &aicb->iocb;
+	const char *op_str;
+	int len = iocb->u.c.nbytes;
+	int cmd = iocb->aio_lio_opcode;
+
+	op_str = (cmd == IO_CMD_PREAD) ? "RD" : "WR";
+
+	if (!aicb->uring_done) {
+		/* the io cqe (-ECANCELED) follows the timeout if the kernel
+		   was able to cancel the io */
+		task_uring_reap(task, 0);
+	}
+
+	if (aicb->uring_done) {
+		/* the cqe for the linked timeout comes with the io cqe */
+		while (aicb->uring_pending) {
+			if (task_uring_reap(task, 1000) <= 0)
+				break;
+		}
+
+		if (aicb->uring_pending) {
+			/* shouldn't happen, the buf belongs to the caller again */
+			log_taskw(task, "aio collect %s %p:%p:%p timeout cqe pending",
+				  op_str, aicb, iocb, aicb->buf);
+			aicb->buf = NULL;
+			aicb->uring_orphan = 1;
+		} else {
+			aicb->used = 0;
+		}
+
+		if (aicb->uring_res == -ECANCELED && aicb->uring_timedout) {
+			task->to_count++;
+			log_taskw(task, "aio timeout %s %p:%p:%p ioto %d to_count %d canceled",
+				  op_str, aicb, iocb, iocb->u.c.buf, ioto, task->to_count);
+			return -ECANCELED;
+		}
+		if (aicb->uring_res < 0) {
+			log_taskw(task, "aio collect %s %p:%p:%p result %d match res",
+				  op_str, aicb, iocb, iocb->u.c.buf, aicb->uring_res);
+			return aicb->uring_res;
+		}
+		if (aicb->uring_res != len) {
+			log_taskw(task, "aio collect %s %p:%p:%p result %d match len %d",
+				  op_str, aicb, iocb, iocb->u.c.buf, aicb->uring_res, len);
+			return -EMSGSIZE;
+		}
+
+		/* standard success case */
+		return 0;
+	}
+
+	/* The kernel could not cancel the io.  aicb->used and aicb->buf
+	   both remain set until the io cqe is reaped, see uring_cqe(). */
+
+	task->to_count++;
+
+	log_taskw(task, "aio timeout %s %p:%p:%p ioto %d to_count %d",
+		  op_str, aicb, iocb, aicb->buf, ioto, task->to_count);
+
+	aicb->uring_orphan = 1;
+
+	if (cmd == IO_CMD_PREAD)
+		task->read_iobuf_timeout_aicb = aicb;
+
+	return SANLK_AIO_TIMEOUT;
+}
+
+static int do_uring_io(int fd, uint64_t offset, char *buf, int len,
+		       struct task *task, int ioto, int cmd, int *ms)
+{
+	struct aicb *aicb;
+	struct timespec begin, end, diff;
+	int rv;
+
+	if (!ioto) {
+		log_taske(task, "aio %d zero io timeout", cmd);
+		return -EINVAL;
+	}
+
+	aicb = find_callback_slot(task, ioto);
+	if (!aicb)
+		return -ENOENT;
+
+	rv = uring_prep_io(task, aicb, fd, offset, buf, len, ioto, cmd);
+	if (rv < 0)
+		return rv;
+
+	if (ms)
+		clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+
+	rv = task_uring_submit(task);
+	if (rv < 0) {
+		log_taske(task, "aio submit %d %p:%p:%p rv %d fd %d",
+			  cmd, aicb, &aicb->iocb, buf, rv, fd);
+		aicb->used = 0;
+		aicb->buf = NULL;
+		return rv;
+	}
+	uring_submitted_ios(aicb, rv);
+
+	task->io_count++;
+
+	/* the linked timeout guarantees a cqe within ioto, the extra
+	   second on the wait is only a backstop */
+
+	while (!aicb->uring_done && !aicb->uring_timedout) {
+		rv = task_uring_reap(task, (ioto + 1) * 1000);
+		if (rv < 0) {
+			log_taske(task, "aio getevent %p:%p:%p rv %d",
+				  aicb, &aicb->iocb, buf, rv);
+			break;
+		}
+		if (!rv)
+			break;
+	}
+
+	if (ms && aicb->uring_done) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+		ts_diff(&begin, &end, &diff);
+		*ms = (diff.tv_sec * 1000) + (diff.tv_nsec / 1000000);
+	}
+
+	return uring_finish_io(task, aicb, ioto);
+}
+
 static int do_write_aio_posix(int fd, uint64_t offset, char *buf, int len,
 			      struct task *task GNUC_UNUSED, int ioto)
 {
@@ -628,6 +859,798 @@ static int do_read_aio_posix(int fd, uint64_t offset, char *buf, int len,
 	return -1;
 }
 
+/*
+ * With libaio or io_uring, all the ios in a batch are submitted together
+ * and results are collected as they arrive.  The batch only uses aicbs
+ * that are free when it's submitted; an io that doesn't get one (and
+ * every io with sync or posix io) is done by itself in iobuf_batch_next.
+ */
+
+void iobuf_batch_init(struct iobuf_batch *batch, struct task *task, int cmd, int ioto)
+{
+	memset(batch, 0, sizeof(struct iobuf_batch));
+	batch->task = task;
+	batch->cmd = cmd;
+	batch->ioto = ioto;
+}
+
+int iobuf_batch_add(struct iobuf_batch *batch, int num, int fd, uint64_t offset,
+		    char *iobuf, int iobuf_len)
+{
+	struct iobuf_io *io;
+
+	if (batch->count >= SANLK_MAX_DISKS)
+		return -ENOSPC;
+
+	io = &batch->io[batch->count++];
+	io->num = num;
+	io->fd = fd;
+	io->offset = offset;
+	io->iobuf = iobuf;
+	io->iobuf_len = iobuf_len;
+	io->state = IOBUF_UNSUBMITTED;
+	io->rv = -1;
+	io->ms = -1;
+	return 0;
+}
+
+static int batch_elapsed_ms(struct iobuf_batch *batch)
+{
+	struct timespec now, diff;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	ts_diff(&batch->begin, &now, &diff);
+	return (diff.tv_sec * 1000) + (diff.tv_nsec / 1000000);
+}
+
+/* unlike find_callback_slot, this doesn't reap events to free a slot */
+
+static struct aicb *get_free_slot(struct task *task)
+{
+	int i;
+
+	for (i = 0; i < task->cb_size; i++) {
+		if (!task->callbacks[i].used)
+			return &task->callbacks[i];
+	}
+	return NULL;
+}
+
+void iobuf_batch_submit(struct iobuf_batch *batch)
+{
+	struct task *task = batch->task;
+	struct iocb *iocbs[SANLK_MAX_DISKS];
+	struct iobuf_io *io;
+	struct aicb *aicb;
+	struct iocb *iocb;
+	int i, n = 0, rv;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &batch->begin);
+
+	if (!task || !batch->ioto)
+		return;
+	if (task->use_aio != 1 && task->use_aio != 3)
+		return;
+
+	for (i = 0; i < batch->count; i++) {
+		io = &batch->io[i];
+
+		aicb = get_free_slot(task);
+		if (!aicb)
+			break;
+
+		if (task->use_aio == 3) {
+			rv = uring_prep_io(task, aicb, io->fd, io->offset, io->iobuf,
+					   io->iobuf_len, batch->ioto, batch->cmd);
+			if (rv < 0)
+				break;
+		} else {
+			iocb = &aicb->iocb;
+			memset(iocb, 0, sizeof(struct iocb));
+			iocb->aio_fildes = io->fd;
+			iocb->aio_lio_opcode = batch->cmd;
+			iocb->u.c.buf = io->iobuf;
+			iocb->u.c.nbytes = io->iobuf_len;
+			iocb->u.c.offset = io->offset;
+
+			/* don't reuse aicb->iocb or free the buf until we reap the event */
+			aicb->used = 1;
+			aicb->buf = io->iobuf;
+			iocbs[n] = iocb;
+		}
+
+		io->aicb = aicb;
+		io->state = IOBUF_SUBMITTED;
+		n++;
+	}
+
+	if (!n)
+		return;
+
+	if (task->use_aio == 3) {
+		/* sqes the kernel didn't consume were taken back, so the ios
+		   past the ones it took are not submitted */
+		rv = task_uring_submit(task);
+		if (rv > 0) {
+			int last = (rv + 1) / 2;
+
+			/* find the last io the kernel took */
+			for (i = 0; i < batch->count; i++) {
+				io = &batch->io[i];
+				if (io->state == IOBUF_SUBMITTED && !--last)
+					break;
+			}
+			rv = uring_submitted_ios(io->aicb, rv);
+		}
+	} else {
+		rv = io_submit(task->aio_ctx, n, iocbs);
+	}
+
+	if (rv < n)
+		log_taske(task, "aio submit batch %d rv %d", n, rv);
+	if (rv < 0)
+		rv = 0;
+
+	task->io_count += rv;
+
+	/* anything not submitted is done by itself in iobuf_batch_next */
+
+	for (i = 0; i < batch->count; i++) {
+		io = &batch->io[i];
+
+		if (io->state != IOBUF_SUBMITTED)
+			continue;
+		if (rv-- > 0)
+			continue;
+
+		io->aicb->used = 0;
+		io->aicb->buf = NULL;
+		io->aicb = NULL;
+		io->state = IOBUF_UNSUBMITTED;
+	}
+}
+
+/* same as the timeout case in do_linux_aio, for each io still submitted */
+
+static void batch_timeout_linux(struct iobuf_batch *batch)
+{
+	struct task *task = batch->task;
+	struct io_event event;
+	struct iobuf_io *io;
+	const char *op_str;
+	int i, rv;
+
+	op_str = (batch->cmd == IO_CMD_PREAD) ? "RD" : "WR";
+
+	for (i = 0; i < batch->count; i++) {
+		io = &batch->io[i];
+
+		if (io->state != IOBUF_SUBMITTED)
+			continue;
+
+		task->to_count++;
+
+		log_taskw(task, "aio timeout %s %p:%p:%p ioto %d to_count %d",
+			  op_str, io->aicb, &io->aicb->iocb, io->iobuf, batch->ioto, task->to_count);
+
+		rv = io_cancel(task->aio_ctx, &io->aicb->iocb, &event);
+		if (!rv) {
+			io->aicb->used = 0;
+			io->rv = -ECANCELED;
+		} else {
+			/* aicb->used and aicb->buf both remain set */
+			io->rv = SANLK_AIO_TIMEOUT;
+
+			if (batch->cmd == IO_CMD_PREAD)
+				task->read_iobuf_timeout_aicb = io->aicb;
+		}
+		io->state = IOBUF_DONE;
+	}
+}
+
+static void batch_wait_linux(struct iobuf_batch *batch)
+{
+	struct task *task = batch->task;
+	struct io_event events[SANLK_MAX_DISKS];
+	struct timespec ts;
+	struct iobuf_io *io;
+	struct iocb *ev_iocb;
+	struct aicb *ev_aicb;
+	const char *op_str;
+	int elapsed, remaining;
+	int i, j, op, rv;
+
+	elapsed = batch_elapsed_ms(batch);
+	remaining = (batch->ioto * 1000) - elapsed;
+
+	if (remaining <= 0) {
+		batch_timeout_linux(batch);
+		return;
+	}
+
+	memset(&ts, 0, sizeof(struct timespec));
+	ts.tv_sec = remaining / 1000;
+	ts.tv_nsec = (remaining % 1000) * 1000000;
+ retry:
+	memset(events, 0, sizeof(events));
+
+	rv = io_getevents(task->aio_ctx, 1, SANLK_MAX_DISKS, events, &ts);
+	if (rv == -EINTR)
+		goto retry;
+	if (rv < 0) {
+		log_taske(task, "aio getevent batch rv %d", rv);
+		batch_timeout_linux(batch);
+		return;
+	}
+
+	for (j = 0; j < rv; j++) {
+		ev_iocb = events[j].obj;
+		ev_aicb = container_of(ev_iocb, struct aicb, iocb);
+		op = ev_iocb ? ev_iocb->aio_lio_opcode : -1;
+
+		if (op == IO_CMD_PREAD)
+			op_str = "RD";
+		else if (op == IO_CMD_PWRITE)
+			op_str = "WR";
+		else
+			op_str = "UK";
+
+		ev_aicb->used = 0;
+
+		io = NULL;
+		for (i = 0; i < batch->count; i++) {
+			if (batch->io[i].state == IOBUF_SUBMITTED && batch->io[i].aicb == ev_aicb) {
+				io = &batch->io[i];
+				break;
+			}
+		}
+
+		if (!io) {
+			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld other free",
+				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, events[j].res, events[j].res2);
+			iobuf_put(task, ev_aicb->buf, ev_aicb->iocb.u.c.nbytes);
+			ev_aicb->buf = NULL;
+			continue;
+		}
+
+		io->ms = batch_elapsed_ms(batch);
+		io->state = IOBUF_DONE;
+
+		if ((int)events[j].res < 0) {
+			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld match res",
+				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, events[j].res, events[j].res2);
+			io->rv = events[j].res;
+		} else if (events[j].res != io->iobuf_len) {
+			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld match len %d",
+				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, events[j].res, events[j].res2,
+				  io->iobuf_len);
+			io->rv = -EMSGSIZE;
+		} else {
+			io->rv = 0;
+		}
+	}
+
+	/* rv 0 means the wait timed out, which is handled on the next call */
+}
+
+static void batch_wait_uring(struct iobuf_batch *batch)
+{
+	struct task *task = batch->task;
+	struct iobuf_io *io;
+	struct aicb *aicb;
+	int elapsed, remaining;
+	int i, rv = 0;
+
+	/* the linked timeouts should complete everything within ioto,
+	   the extra second is only a backstop */
+
+	elapsed = batch_elapsed_ms(batch);
+	remaining = ((batch->ioto + 1) * 1000) - elapsed;
+
+	if (remaining > 0) {
+		rv = task_uring_reap(task, remaining);
+		if (rv < 0)
+			log_taske(task, "aio getevent batch rv %d", rv);
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		io = &batch->io[i];
+		aicb = io->aicb;
+
+		if (io->state != IOBUF_SUBMITTED)
+			continue;
+
+		if (!aicb->uring_done && !aicb->uring_timedout && remaining > 0 && rv >= 0)
+			continue;
+
+		if (aicb->uring_done)
+			io->ms = batch_elapsed_ms(batch);
+
+		io->rv = uring_finish_io(task, aicb, batch->ioto);
+		io->state = IOBUF_DONE;
+	}
+}
+
+/* returns the index of the next completed io in batch->io[], or -1 when
+   all the ios have been returned */
+
+int iobuf_batch_next(struct iobuf_batch *batch)
+{
+	struct task *task = batch->task;
+	struct iobuf_io *io;
+	struct timespec begin, end, diff;
+	int i, submitted;
+
+	while (1) {
+		submitted = 0;
+
+		for (i = 0; i < batch->count; i++) {
+			io = &batch->io[i];
+
+			if (io->state == IOBUF_DONE) {
+				io->state = IOBUF_RETURNED;
+				return i;
+			}
+			if (io->state == IOBUF_SUBMITTED)
+				submitted++;
+		}
+
+		if (!submitted)
+			break;
+
+		if (task->use_aio == 3)
+			batch_wait_uring(batch);
+		else
+			batch_wait_linux(batch);
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		io = &batch->io[i];
+
+		if (io->state != IOBUF_UNSUBMITTED)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+
+		if (batch->cmd == IO_CMD_PREAD)
+			io->rv = read_iobuf(io->fd, io->offset, io->iobuf, io->iobuf_len,
+					    task, batch->ioto, NULL);
+		else
+			io->rv = write_iobuf(io->fd, io->offset, io->iobuf, io->iobuf_len,
+					     task, batch->ioto, NULL);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+		ts_diff(&begin, &end, &diff);
+		io->ms = (diff.tv_sec * 1000) + (diff.tv_nsec / 1000000);
+		io->state = IOBUF_RETURNED;
+		return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Stop waiting for the ios in the batch that haven't completed, e.g. when
+ * the caller already has results from a majority of disks.  A submitted
+ * io is left to complete in the background like one that timed out: its
+ * rv is SANLK_AIO_TIMEOUT, and the aicb frees the buf when the event is
+ * reaped.  An io that was never submitted gets -ECANCELED.  Ios that
+ * have completed are still returned by iobuf_batch_next.
+ */
+
+void iobuf_batch_abandon(struct iobuf_batch *batch)
+{
+	struct task *task = batch->task;
+	struct iobuf_io *io;
+	struct aicb *aicb;
+	const char *op_str;
+	int i;
+
+	op_str = (batch->cmd == IO_CMD_PREAD) ? "RD" : "WR";
+
+	for (i = 0; i < batch->count; i++) {
+		io = &batch->io[i];
+
+		if (io->state == IOBUF_UNSUBMITTED) {
+			io->rv = -ECANCELED;
+			io->state = IOBUF_RETURNED;
+			continue;
+		}
+
+		if (io->state != IOBUF_SUBMITTED)
+			continue;
+
+		aicb = io->aicb;
+
+		if (task->use_aio == 3) {
+			if (!aicb->uring_pending) {
+				io->rv = uring_finish_io(task, aicb, batch->ioto);
+				io->ms = batch_elapsed_ms(batch);
+				io->state = IOBUF_DONE;
+				continue;
+			}
+			aicb->uring_orphan = 1;
+		}
+
+		/* aicb->used and aicb->buf both remain set, and the io is
+		   counted like one that timed out */
+
+		task->to_count++;
+
+		log_taskd(task, "aio abandon %s %p:%p:%p ms %d to_count %d",
+			  op_str, aicb, &aicb->iocb, io->iobuf, batch_elapsed_ms(batch),
+			  task->to_count);
+
+		io->rv = SANLK_AIO_TIMEOUT;
+		io->state = IOBUF_RETURNED;
+	}
+}
+
+/*
+ * async_io: single ios on a task shared by several callers, which each
+ * check their own aicb after async_io_poll; used by the renewal engine.
+ * When aicb->async_done is set, async_io_result returns what read_iobuf
+ * or write_iobuf would have, and frees the aicb.  An io that's passed its
+ * timeout goes to async_io_timeout, after which the caller can keep
+ * waiting for it (like read_iobuf_reap), or give it up with
+ * async_io_abandon, and the buf is freed when the io completes.
+ */
+
+struct aicb *async_io_start(struct task *task, int fd, uint64_t offset,
+			    char *buf, int len, int ioto, int cmd)
+{
+	struct iocb *iocbs[1];
+	struct aicb *aicb;
+	struct iocb *iocb;
+	int rv;
+
+	if (task->use_aio != 1 && task->use_aio != 3)
+		return NULL;
+
+	aicb = get_free_slot(task);
+	if (!aicb)
+		return NULL;
+
+	if (task->use_aio == 3) {
+		if (uring_prep_io(task, aicb, fd, offset, buf, len, ioto, cmd) < 0)
+			return NULL;
+	} else {
+		iocb = &aicb->iocb;
+		memset(iocb, 0, sizeof(struct iocb));
+		iocb->aio_fildes = fd;
+		iocb->aio_lio_opcode = cmd;
+		iocb->u.c.buf = buf;
+		iocb->u.c.nbytes = len;
+		iocb->u.c.offset = offset;
+
+		aicb->used = 1;
+		aicb->buf = buf;
+	}
+
+	aicb->async_done = 0;
+	aicb->async_res = 0;
+	aicb->async_orphan = 0;
+	aicb->async_ioto = ioto;
+
+	if (task->use_aio == 3) {
+		rv = task_uring_submit(task);
+		if (rv > 0)
+			uring_submitted_ios(aicb, rv);
+	} else {
+		iocbs[0] = &aicb->iocb;
+		rv = io_submit(task->aio_ctx, 1, iocbs);
+		if (!rv)
+			rv = -EAGAIN;
+	}
+
+	if (rv < 0) {
+		log_taske(task, "aio submit %d %p:%p:%p rv %d fd %d",
+			  cmd, aicb, &aicb->iocb, buf, rv, fd);
+		aicb->used = 0;
+		aicb->buf = NULL;
+		return NULL;
+	}
+
+	task->io_count++;
+	return aicb;
+}
+
+#define ASYNC_IO_EVENTS 16
+
+/* returns the number of ios that completed, 0 if none did within wait_ms */
+
+int async_io_poll(struct task *task, int wait_ms)
+{
+	struct io_event events[ASYNC_IO_EVENTS];
+	struct timespec ts;
+	struct iocb *ev_iocb;
+	struct aicb *ev_aicb;
+	const char *op_str;
+	int i, op, rv, count = 0;
+
+	if (task->use_aio == 3) {
+		/* orphaned aicbs are freed as their cqes are reaped */
+		rv = task_uring_reap(task, wait_ms > 0 ? wait_ms : 0);
+		if (rv < 0)
+			return rv;
+
+		for (i = 0; i < task->cb_size; i++) {
+			ev_aicb = &task->callbacks[i];
+
+			if (!ev_aicb->used || ev_aicb->async_done || ev_aicb->uring_orphan)
+				continue;
+			if (!ev_aicb->uring_done || ev_aicb->uring_pending)
+				continue;
+
+			ev_aicb->async_done = 1;
+			count++;
+		}
+		return count;
+	}
+
+	memset(&ts, 0, sizeof(struct timespec));
+	if (wait_ms > 0) {
+		ts.tv_sec = wait_ms / 1000;
+		ts.tv_nsec = (wait_ms % 1000) * 1000000;
+	}
+ retry:
+	memset(events, 0, sizeof(events));
+
+	rv = io_getevents(task->aio_ctx, wait_ms > 0 ? 1 : 0, ASYNC_IO_EVENTS, events, &ts);
+	if (rv == -EINTR)
+		goto retry;
+	if (rv < 0)
+		return rv;
+
+	for (i = 0; i < rv; i++) {
+		ev_iocb = events[i].obj;
+		ev_aicb = container_of(ev_iocb, struct aicb, iocb);
+		op = ev_iocb ? ev_iocb->aio_lio_opcode : -1;
+
+		if (op == IO_CMD_PREAD)
+			op_str = "RD";
+		else if (op == IO_CMD_PWRITE)
+			op_str = "WR";
+		else
+			op_str = "UK";
+
+		if (ev_aicb->async_orphan) {
+			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld old free",
+				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, events[i].res, events[i].res2);
+			ev_aicb->used = 0;
+			ev_aicb->async_orphan = 0;
+			iobuf_put(task, ev_aicb->buf, ev_aicb->iocb.u.c.nbytes);
+			ev_aicb->buf = NULL;
+			continue;
+		}
+
+		if ((int)events[i].res < 0) {
+			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld match res",
+				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, events[i].res, events[i].res2);
+			ev_aicb->async_res = events[i].res;
+		} else if (events[i].res != ev_iocb->u.c.nbytes) {
+			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld match len %lu",
+				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, events[i].res, events[i].res2,
+				  ev_iocb->u.c.nbytes);
+			ev_aicb->async_res = -EMSGSIZE;
+		} else {
+			ev_aicb->async_res = 0;
+		}
+
+		/* the aicb stays in use until the caller takes the result */
+		ev_aicb->async_done = 1;
+		count++;
+	}
+
+	return count;
+}
+
+int async_io_result(struct task *task, struct aicb *aicb)
+{
+	if (task->use_aio == 3)
+		return uring_finish_io(task, aicb, aicb->async_ioto);
+
+	aicb->used = 0;
+	aicb->buf = NULL;
+	return aicb->async_res;
+}
+
+/*
+ * Same as the timeout in do_linux_aio.  Returns -ECANCELED if the io was
+ * canceled and the buf is the caller's again, or SANLK_AIO_TIMEOUT if the
+ * io is still in progress, or the result if it has just completed.
+ */
+
+int async_io_timeout(struct task *task, struct aicb *aicb)
+{
+	struct io_event event;
+	const char *op_str;
+	int rv;
+
+	op_str = (aicb->iocb.aio_lio_opcode == IO_CMD_PREAD) ? "RD" : "WR";
+
+	if (task->use_aio == 3) {
+		/* the io cqe (-ECANCELED) follows the linked timeout if
+		   the kernel was able to cancel the io */
+		if (!aicb->uring_done)
+			task_uring_reap(task, 0);
+		if (aicb->uring_done)
+			return uring_finish_io(task, aicb, aicb->async_ioto);
+	} else if (aicb->async_done) {
+		return async_io_result(task, aicb);
+	}
+
+	task->to_count++;
+
+	log_taskw(task, "aio timeout %s %p:%p:%p ioto %d to_count %d",
+		  op_str, aicb, &aicb->iocb, aicb->buf, aicb->async_ioto, task->to_count);
+
+	if (task->use_aio == 1) {
+		rv = io_cancel(task->aio_ctx, &aicb->iocb, &event);
+		if (!rv) {
+			aicb->used = 0;
+			aicb->buf = NULL;
+			return -ECANCELED;
+		}
+	}
+
+	/* aicb->used and aicb->buf both remain set */
+	return SANLK_AIO_TIMEOUT;
+}
+
+/* the caller can no longer use the buf */
+
+void async_io_abandon(struct task *task, struct aicb *aicb)
+{
+	char *buf = aicb->buf;
+	int len = aicb->iocb.u.c.nbytes;
+
+	if (aicb->async_done || (task->use_aio == 3 && !aicb->uring_pending)) {
+		async_io_result(task, aicb);
+		iobuf_put(task, buf, len);
+		return;
+	}
+
+	log_taskd(task, "aio abandon %p:%p:%p", aicb, &aicb->iocb, buf);
+
+	if (task->use_aio == 3)
+		aicb->uring_orphan = 1;
+	else
+		aicb->async_orphan = 1;
+}
+
+/*
+ * Page aligned, zeroed io buffers are taken from the task's pool, and
+ * new ones are allocated only when the pool has none of the length.
+ * A buffer that's held by a timed out aicb is put back when its event
+ * is reaped, as it would otherwise be freed then.  The pool is limited
+ * to IOBUF_POOL_MAX_BYTES per task.  With mlock_level 1, which doesn't
+ * lock memory allocated after startup, new buffers are mlocked here,
+ * and munlocked by iobuf_free.
+ */
+
+static struct iobuf_pool_class *iobuf_pool_class(struct task *task, int len, int add)
+{
+	struct iobuf_pool_class *pc;
+	int i;
+
+	for (i = 0; i < IOBUF_POOL_CLASSES; i++) {
+		pc = &task->iobuf_pool[i];
+		if (pc->len == len)
+			return pc;
+	}
+
+	if (!add)
+		return NULL;
+
+	for (i = 0; i < IOBUF_POOL_CLASSES; i++) {
+		pc = &task->iobuf_pool[i];
+		if (!pc->len) {
+			pc->len = len;
+			return pc;
+		}
+	}
+	return NULL;
+}
+
+static void iobuf_free(char *buf, int len)
+{
+	if (com.mlock_level == 1)
+		munlock(buf, len);
+	free(buf);
+}
+
+char *iobuf_get(struct task *task, int len)
+{
+	struct iobuf_pool_class *pc;
+	char *buf, **p_buf;
+	int rv;
+
+	if (task) {
+		pc = iobuf_pool_class(task, len, 0);
+		if (pc && pc->count) {
+			buf = pc->bufs[--pc->count];
+			pc->bufs[pc->count] = NULL;
+			task->iobuf_pool_bytes -= len;
+			memset(buf, 0, len);
+			return buf;
+		}
+	}
+
+	p_buf = &buf;
+
+	rv = posix_memalign((void *)p_buf, getpagesize(), len);
+	if (rv)
+		return NULL;
+
+	if (task && com.mlock_level == 1)
+		mlock(buf, len);
+
+	memset(buf, 0, len);
+	return buf;
+}
+
+void iobuf_put(struct task *task, char *buf, int len)
+{
+	struct iobuf_pool_class *pc;
+
+	if (!buf)
+		return;
+
+	/* the renewal read buffer is managed separately */
+	if (!task || buf == task->iobuf || len <= 0)
+		goto out;
+
+	if (task->iobuf_pool_bytes + len > IOBUF_POOL_MAX_BYTES)
+		goto out;
+
+	pc = iobuf_pool_class(task, len, 1);
+	if (!pc || pc->count == IOBUF_POOL_DEPTH)
+		goto out;
+
+	pc->bufs[pc->count++] = buf;
+	task->iobuf_pool_bytes += len;
+	return;
+ out:
+	/* only buffers from iobuf_get with a task were mlocked */
+	if (task && buf != task->iobuf && len > 0)
+		iobuf_free(buf, len);
+	else
+		free(buf);
+}
+
+/* allocate buffers up front so they are mlocked before they're needed */
+
+void iobuf_pool_reserve(struct task *task, int len, int count)
+{
+	char *bufs[IOBUF_POOL_DEPTH];
+	int i, n = 0;
+
+	for (i = 0; i < count && i < IOBUF_POOL_DEPTH; i++) {
+		bufs[i] = iobuf_get(task, len);
+		if (!bufs[i])
+			break;
+		n++;
+	}
+
+	for (i = 0; i < n; i++)
+		iobuf_put(task, bufs[i], len);
+}
+
+void iobuf_pool_free(struct task *task)
+{
+	struct iobuf_pool_class *pc;
+	int i, j;
+
+	for (i = 0; i < IOBUF_POOL_CLASSES; i++) {
+		pc = &task->iobuf_pool[i];
+		for (j = 0; j < pc->count; j++)
+			iobuf_free(pc->bufs[j], pc->len);
+		memset(pc, 0, sizeof(struct iobuf_pool_class));
+	}
+	task->iobuf_pool_bytes = 0;
+}
+
 /* write aligned io buffer */
 
 int write_iobuf(int fd, uint64_t offset, char *iobuf, int iobuf_len,
@@ -635,6 +1658,8 @@ int write_iobuf(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 {
 	if (task && task->use_aio == 1)
 		return do_write_aio_linux(fd, offset, iobuf, iobuf_len, task, ioto, wr_ms);
+	else if (task && task->use_aio == 3)
+		return do_uring_io(fd, offset, iobuf, iobuf_len, task, ioto, IO_CMD_PWRITE, wr_ms);
 	else if (task && task->use_aio == 2)
 		return do_write_aio_posix(fd, offset, iobuf, iobuf_len, task, ioto);
 	else
@@ -647,7 +1672,7 @@ static int _write_sectors(const struct sync_disk *disk, uint64_t sector_nr,
 			  struct task *task, int ioto,
 			  const char *blktype)
 {
-	char *iobuf, **p_iobuf;
+	char *iobuf;
 	uint64_t offset;
 	int rv;
 
@@ -656,17 +1681,14 @@ static int _write_sectors(const struct sync_disk *disk, uint64_t sector_nr,
 
 	offset = disk->offset + (sector_nr * disk->sector_size);
 
-	p_iobuf = &iobuf;
-
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv) {
-		log_error("write_sectors %s posix_memalign rv %d %s",
-			  blktype, rv, disk->path);
+	iobuf = iobuf_get(task, iobuf_len);
+	if (!iobuf) {
+		log_error("write_sectors %s iobuf_get %d %s",
+			  blktype, iobuf_len, disk->path);
 		rv = -ENOMEM;
 		goto out;
 	}
 
-	memset(iobuf, 0, iobuf_len);
 	memcpy(iobuf, data, data_len);
 
 	rv = write_iobuf(disk->fd, offset, iobuf, iobuf_len, task, ioto, NULL);
@@ -676,7 +1698,7 @@ static int _write_sectors(const struct sync_disk *disk, uint64_t sector_nr,
 	}
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		iobuf_put(task, iobuf, iobuf_len);
  out:
 	return rv;
 }
@@ -729,6 +1751,8 @@ int read_iobuf(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 {
 	if (task && task->use_aio == 1)
 		return do_read_aio_linux(fd, offset, iobuf, iobuf_len, task, ioto, rd_ms);
+	else if (task && task->use_aio == 3)
+		return do_uring_io(fd, offset, iobuf, iobuf_len, task, ioto, IO_CMD_PREAD, rd_ms);
 	else if (task && task->use_aio == 2)
 		return do_read_aio_posix(fd, offset, iobuf, iobuf_len, task, ioto);
 	else
@@ -746,7 +1770,7 @@ int read_sectors(const struct sync_disk *disk, uint64_t sector_nr,
 		 struct task *task, int ioto,
 		 const char *blktype)
 {
-	char *iobuf, **p_iobuf;
+	char *iobuf;
 	uint64_t offset;
 	int iobuf_len;
 	int rv;
@@ -759,18 +1783,14 @@ int read_sectors(const struct sync_disk *disk, uint64_t sector_nr,
 	iobuf_len = sector_count * disk->sector_size;
 	offset = disk->offset + (sector_nr * disk->sector_size);
 
-	p_iobuf = &iobuf;
-
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv) {
-		log_error("read_sectors %s posix_memalign rv %d %s",
-			  blktype, rv, disk->path);
+	iobuf = iobuf_get(task, iobuf_len);
+	if (!iobuf) {
+		log_error("read_sectors %s iobuf_get %d %s",
+			  blktype, iobuf_len, disk->path);
 		rv = -ENOMEM;
 		goto out;
 	}
 
-	memset(iobuf, 0, iobuf_len);
-
 	rv = read_iobuf(disk->fd, offset, iobuf, iobuf_len, task, ioto, NULL);
 	if (!rv) {
 		memcpy(data, iobuf, data_len);
@@ -780,11 +1800,62 @@ int read_sectors(const struct sync_disk *disk, uint64_t sector_nr,
 	}
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		iobuf_put(task, iobuf, iobuf_len);
  out:
 	return rv;
 }
 
+static int read_iobuf_reap_uring(struct task *task, struct aicb *aicb,
+				 int iobuf_len, uint32_t ioto_msec)
+{
+	struct timespec begin, now, diff;
+	uint32_t waited_msec;
+	int rv;
+
+	/* the caller wants the buf back if the read completes */
+	aicb->uring_orphan = 0;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+
+	while (!aicb->uring_done) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		ts_diff(&begin, &now, &diff);
+		waited_msec = (diff.tv_sec * 1000) + (diff.tv_nsec / 1000000);
+		if (waited_msec >= ioto_msec)
+			break;
+
+		rv = task_uring_reap(task, ioto_msec - waited_msec);
+		if (rv < 0) {
+			log_taske(task, "aio getevent %p:%p:%p rv %d r",
+				  aicb, &aicb->iocb, aicb->buf, rv);
+			break;
+		}
+	}
+
+	if (!aicb->uring_done || aicb->uring_pending) {
+		/* timed out again */
+		aicb->uring_orphan = 1;
+		return SANLK_AIO_TIMEOUT;
+	}
+
+	aicb->used = 0;
+
+	if (aicb->uring_res < 0) {
+		log_taskw(task, "aio collect RD %p:%p:%p result %d match res r",
+			  aicb, &aicb->iocb, aicb->buf, aicb->uring_res);
+		return aicb->uring_res;
+	}
+	if (aicb->uring_res != iobuf_len) {
+		log_taskw(task, "aio collect RD %p:%p:%p result %d match len %d r",
+			  aicb, &aicb->iocb, aicb->buf, aicb->uring_res, iobuf_len);
+		return -EMSGSIZE;
+	}
+
+	log_taskw(task, "aio collect RD %p:%p:%p result %d match reap",
+		  aicb, &aicb->iocb, aicb->buf, aicb->uring_res);
+	return 0;
+}
+
 /* Try to reap the event of a previously timed out read_iobuf.
    The aicb used in a task's last timed out read_iobuf is
    task->read_iobuf_timeout_aicb . */
@@ -814,6 +1885,9 @@ int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 	if (iocb->aio_lio_opcode != IO_CMD_PREAD)
 		return -EINVAL;
 
+	if (task->use_aio == 3)
+		return read_iobuf_reap_uring(task, aicb, iobuf_len, ioto_msec);
+
 	memset(&ts, 0, sizeof(struct timespec));
 	ts.tv_sec = ioto_msec / 1000;
 	ts.tv_nsec = (ioto_msec % 1000) * 1000000;
@@ -846,7 +1920,7 @@ int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 		if (ev_iocb != iocb) {
 			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld other free r",
 				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
-			free(ev_aicb->buf);
+			iobuf_put(task, ev_aicb->buf, ev_aicb->iocb.u.c.nbytes);
 			ev_aicb->buf = NULL;
 			goto retry;
 		}
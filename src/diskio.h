@@ -29,6 +29,50 @@ int read_iobuf(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 		    struct task *task, uint32_t ioto_msec);
 
+char *iobuf_get(struct task *task, int len);
+
+void iobuf_put(struct task *task, char *buf, int len);
+
+void iobuf_pool_reserve(struct task *task, int len, int count);
+
+void iobuf_pool_free(struct task *task);
+
+/*
+ * iobuf_batch functions: add an io for each disk, submit them all,
+ * then call iobuf_batch_next until it returns -1 to get the io that
+ * completed next.  Each io->rv has the same meaning as the result of
+ * read_iobuf/write_iobuf; the caller cannot free io->iobuf when io->rv
+ * is SANLK_AIO_TIMEOUT.
+ */
+
+void iobuf_batch_init(struct iobuf_batch *batch, struct task *task, int cmd, int ioto);
+
+int iobuf_batch_add(struct iobuf_batch *batch, int num, int fd, uint64_t offset,
+		    char *iobuf, int iobuf_len);
+
+void iobuf_batch_submit(struct iobuf_batch *batch);
+
+int iobuf_batch_next(struct iobuf_batch *batch);
+
+void iobuf_batch_abandon(struct iobuf_batch *batch);
+
+/*
+ * async_io functions start an io and return without waiting for it;
+ * async_io_poll collects completions for all the ios on the task, and
+ * sets aicb->async_done on each one that has a result.
+ */
+
+struct aicb *async_io_start(struct task *task, int fd, uint64_t offset,
+			    char *buf, int len, int ioto, int cmd);
+
+int async_io_poll(struct task *task, int wait_ms);
+
+int async_io_result(struct task *task, struct aicb *aicb);
+
+int async_io_timeout(struct task *task, struct aicb *aicb);
+
+void async_io_abandon(struct task *task, struct aicb *aicb);
+
 /*
  * sector functions allocate an iobuf themselves, copy into it for read, use it
  * for io, copy out of it for write, and free it
@@ -180,9 +180,52 @@ int test_id_bit(int host_id, char *bitmap)
 	return (*byte & mask);
 }
 
+/*
+ * Loops over the hosts in a lockspace use sp->host_ids, the host_ids that
+ * have been seen with a lease or have had their bit set, which is usually
+ * far fewer than max_hosts.  Called with both spaces_mutex and sp->mutex
+ * held, so either is enough for reading host_ids.
+ */
+
+static void add_host_id(struct space *sp, int host_id)
+{
+	int i;
+
+	if (sp->host_status[host_id-1].listed)
+		return;
+
+	for (i = sp->host_ids_count; i > 0 && sp->host_ids[i-1] > host_id; i--)
+		sp->host_ids[i] = sp->host_ids[i-1];
+
+	sp->host_ids[i] = host_id;
+	sp->host_ids_count++;
+	sp->host_status[host_id-1].listed = 1;
+}
+
+/*
+ * A new bit or event is written by a renewal done now, instead of at
+ * the next regular renewal, and a reply to it is read sooner by doing
+ * renewals every renewal_fast_sec for a while.  See timeouts.h.
+ * sp->mutex is held.
+ */
+
+static void renew_fast(struct space *sp, uint64_t now)
+{
+	if (com.renewal_fast_sec)
+		sp->renew_fast_until = now + sp->set_bitmap_seconds;
+}
+
+static void renew_expedite(struct space *sp, uint64_t now)
+{
+	sp->renew_expedite = 1;
+	renew_fast(sp, now);
+}
+
 int host_status_set_bit(char *space_name, uint64_t host_id)
 {
+	struct host_status *hs;
 	struct space *sp;
+	uint64_t now;
 	int found = 0;
 
 	if (!host_id || host_id > DEFAULT_MAX_HOSTS)
@@ -195,17 +238,41 @@ int host_status_set_bit(char *space_name, uint64_t host_id)
 		found = 1;
 		break;
 	}
-	pthread_mutex_unlock(&spaces_mutex);
 
-	if (!found)
+	if (!found) {
+		pthread_mutex_unlock(&spaces_mutex);
 		return -ENOSPC;
+	}
+
+	if (host_id > sp->max_hosts) {
+		pthread_mutex_unlock(&spaces_mutex);
+		return -EINVAL;
+	}
+
+	now = monotime();
 
 	pthread_mutex_lock(&sp->mutex);
-	sp->host_status[host_id-1].set_bit_time = monotime();
+	hs = &sp->host_status[host_id-1];
+	if (!hs->set_bit_time || now - hs->set_bit_time > sp->set_bitmap_seconds)
+		renew_expedite(sp, now);
+	hs->set_bit_time = now;
+	add_host_id(sp, host_id);
 	pthread_mutex_unlock(&sp->mutex);
+	pthread_mutex_unlock(&spaces_mutex);
 	return 0;
 }
 
+static void copy_host_status(struct space *sp, uint64_t host_id, struct host_status *hs_out)
+{
+	memcpy(hs_out, &sp->host_status[host_id-1], sizeof(struct host_status));
+
+	if (!hs_out->io_timeout) {
+		log_erros(sp, "host_info %llu use own io_timeout %d",
+			  (unsigned long long)host_id, sp->io_timeout);
+		hs_out->io_timeout = sp->io_timeout;
+	}
+}
+
 int host_info(char *space_name, uint64_t host_id, struct host_status *hs_out)
 {
 	struct space *sp;
@@ -218,14 +285,12 @@ int host_info(char *space_name, uint64_t host_id, struct host_status *hs_out)
 	list_for_each_entry(sp, &spaces, list) {
 		if (strncmp(sp->space_name, space_name, NAME_ID_SIZE))
 			continue;
-		memcpy(hs_out, &sp->host_status[host_id-1], sizeof(struct host_status));
-		found = 1;
-
-		if (!hs_out->io_timeout) {
-			log_erros(sp, "host_info %llu use own io_timeout %d",
-				  (unsigned long long)host_id, sp->io_timeout);
-			hs_out->io_timeout = sp->io_timeout;
+		if (host_id > sp->max_hosts) {
+			pthread_mutex_unlock(&spaces_mutex);
+			return -EINVAL;
 		}
+		copy_host_status(sp, host_id, hs_out);
+		found = 1;
 		break;
 	}
 	pthread_mutex_unlock(&spaces_mutex);
@@ -235,16 +300,101 @@ int host_info(char *space_name, uint64_t host_id, struct host_status *hs_out)
 	return 0;
 }
 
+/*
+ * Threads waiting on another host's lease (paxos_lease_acquire) are woken
+ * by check_other_leases, with spaces_mutex, after each renewal read.
+ */
+
+static pthread_cond_t host_status_cond;
+static pthread_once_t host_status_cond_once = PTHREAD_ONCE_INIT;
+static int host_status_waiters;
+
+static void host_status_cond_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&host_status_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/*
+ * Same as host_info, after waiting up to wait_sec for the host to be
+ * checked again, i.e. for its last_check to differ from the one given.
+ * Returns -ETIMEDOUT (with hs_out set) if it wasn't checked in time.
+ */
+
+int host_info_wait(char *space_name, uint64_t host_id, uint64_t last_check,
+		   int wait_sec, struct host_status *hs_out)
+{
+	struct timespec ts;
+	struct space *sp;
+	int timedout = 0;
+	int rv;
+
+	if (!host_id || host_id > DEFAULT_MAX_HOSTS)
+		return -EINVAL;
+
+	pthread_once(&host_status_cond_once, host_status_cond_init);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += wait_sec;
+
+	pthread_mutex_lock(&spaces_mutex);
+	host_status_waiters++;
+
+	while (1) {
+		/* sp may go away while we wait, so look it up each time */
+		sp = _search_space(space_name, NULL, 0, &spaces, NULL, NULL, NULL);
+		if (!sp) {
+			rv = -ENOSPC;
+			break;
+		}
+
+		if (host_id > sp->max_hosts) {
+			rv = -EINVAL;
+			break;
+		}
+
+		if (sp->host_status[host_id-1].last_check != last_check || timedout) {
+			copy_host_status(sp, host_id, hs_out);
+			rv = timedout ? -ETIMEDOUT : 0;
+			break;
+		}
+
+		if (pthread_cond_timedwait(&host_status_cond, &spaces_mutex, &ts))
+			timedout = 1;
+	}
+
+	host_status_waiters--;
+	pthread_mutex_unlock(&spaces_mutex);
+	return rv;
+}
+
 static void create_bitmap_and_extra(struct space *sp, char *bitmap, struct delta_extra *extra)
 {
 	uint64_t now;
-	int i;
+	int i, j, count;
 	char c;
 
 	now = monotime();
 
 	pthread_mutex_lock(&sp->mutex);
-	for (i = 0; i < DEFAULT_MAX_HOSTS; i++) {
+
+	/* every host may have a bit for a while after SANLK_SETEV_ALL_HOSTS */
+
+	if (now - sp->set_all_bit_time > sp->set_bitmap_seconds)
+		count = sp->host_ids_count;
+	else
+		count = sp->max_hosts;
+
+	for (j = 0; j < count; j++) {
+		if (count == sp->max_hosts)
+			i = j;
+		else
+			i = sp->host_ids[j] - 1;
+
 		if (i+1 == sp->host_id)
 			continue;
 
@@ -263,25 +413,65 @@ static void create_bitmap_and_extra(struct space *sp, char *bitmap, struct delta
 	extra->field1 = sp->host_event.generation;
 	extra->field2 = sp->host_event.event;
 	extra->field3 = sp->host_event.data;
+	sp->renew_expedite = 0;
 	pthread_mutex_unlock(&sp->mutex);
 }
 
+/* a renewal is due at the regular interval, or sooner, see renew_expedite */
+
+static int renewal_due(struct space *sp, uint64_t last_success, int id_renewal_seconds)
+{
+	uint64_t now = monotime();
+	int due;
+
+	if (now - last_success >= id_renewal_seconds)
+		return 1;
+
+	if (now - last_success < sp->renewal_min_seconds)
+		return 0;
+
+	pthread_mutex_lock(&sp->mutex);
+	due = sp->renew_expedite ||
+	      (now < sp->renew_fast_until && now - last_success >= com.renewal_fast_sec);
+	pthread_mutex_unlock(&sp->mutex);
+
+	return due;
+}
+
 /* 
  * Called from main thread to look through the lease data collected in
  * the last renewal.  Records liveness history about other hosts in the
  * lockspace, checks if another host is notifying us (through their bitmap)
  * to look at resource requests or an event they've written.
  *
- * NB. the way that this gets the copy of all leases to look at is
- * unfortunately very subtle and convoluted.
+ * The leases are looked at in place, in the buffer they were read into,
+ * which is passed between threads without copying.  Three buffers are
+ * rotated by swapping pointers under sp->mutex:
+ *
+ * - task iobuf: the lockspace thread reads all delta leases into it.
+ *   After a successful read it swaps it with renewal_read_buf and
+ *   increments renewal_read_count.
+ *
+ * - sp->lease_status.renewal_read_buf: the last buffer that was read,
+ *   or a spare.
  *
- * The lockspace thread makes a copy of task iobuf, which holds all
- * delta leases that were read in the last renewal, into
- * sp->lease_status.renewal_read_buf.  Then check_our_lease() called
- * by the main loop makes a copy of sp->lease_status.renewal_read_buf
- * to pass to this function.
+ * - sp->check_buf: owned by the main loop.  When renewal_read_count
+ *   has changed, check_our_lease() swaps it with renewal_read_buf, and
+ *   the main loop passes it to this function without holding the mutex.
  */
 
+/*
+ * Only the leader record and bitmap of each sector are used below.
+ * In steady state most hosts only change their timestamp, and many
+ * slots are unused or belong to hosts that are gone.  The sectors that
+ * are unchanged since the last check would make no change to host_status
+ * (other than last_check), so they are skipped after a memcmp with the
+ * copy saved in check_prev.  Sectors with a bad lease are always checked
+ * so lease_bad continues to be counted.
+ */
+
+#define CHECK_SECTOR_LEN (HOSTID_BITMAP_OFFSET + HOSTID_BITMAP_SIZE)
+
 void check_other_leases(struct space *sp, char *buf)
 {
 	struct leader_record leader_in;
@@ -291,15 +481,29 @@ void check_other_leases(struct space *sp, char *buf)
 	struct host_status *hs;
 	struct sanlk_host_event he;
 	char *bitmap;
+	char *prev = NULL;
 	uint64_t now;
-	int i, new;
+	int i, new, cmp_len;
 
 	disk = &sp->host_id_disk;
 
 	now = monotime();
 	new = 0;
 
-	for (i = 0; i < DEFAULT_MAX_HOSTS; i++) {
+	cmp_len = CHECK_SECTOR_LEN;
+	if (cmp_len > disk->sector_size)
+		cmp_len = disk->sector_size;
+
+	if (!sp->check_prev) {
+		/* the first check uses every sector */
+		sp->check_prev = malloc(sp->max_hosts * cmp_len);
+		if (!sp->check_prev)
+			log_erros(sp, "check_other_leases no mem for check_prev");
+	} else {
+		prev = sp->check_prev;
+	}
+
+	for (i = 0; i < sp->max_hosts; i++) {
 		hs = &sp->host_status[i];
 		hs->last_check = now;
 
@@ -308,6 +512,13 @@ void check_other_leases(struct space *sp, char *buf)
 
 		leader_end = (struct leader_record *)(buf + (i * disk->sector_size));
 
+		if (prev && !hs->lease_bad &&
+		    !memcmp(prev + (i * cmp_len), leader_end, cmp_len))
+			continue;
+
+		if (sp->check_prev)
+			memcpy(sp->check_prev + (i * cmp_len), leader_end, cmp_len);
+
 		leader_record_in(leader_end, &leader_in);
 		leader = &leader_in;
 
@@ -387,6 +598,12 @@ void check_other_leases(struct space *sp, char *buf)
 		hs->timestamp = leader->timestamp;
 		hs->last_live = now;
 
+		if (!hs->listed) {
+			pthread_mutex_lock(&sp->mutex);
+			add_host_id(sp, i+1);
+			pthread_mutex_unlock(&sp->mutex);
+		}
+
 		if (i+1 == sp->host_id)
 			continue;
 
@@ -406,6 +623,11 @@ void check_other_leases(struct space *sp, char *buf)
 		he.event = leader->write_generation;
 		he.data = leader->write_timestamp;
 
+		/* read the lease sooner for what follows, see renew_expedite */
+		pthread_mutex_lock(&sp->mutex);
+		renew_fast(sp, now);
+		pthread_mutex_unlock(&sp->mutex);
+
 		/*
 		 * Pass an event to the resource_thread which is a
 		 * convenient place to do callbacks (we don't want
@@ -414,7 +636,7 @@ void check_other_leases(struct space *sp, char *buf)
 		if (he.event) {
 			/*
 			 * lock order: spaces_mutex (main_loop), then
-			 * resource_mutex (add_host_event).
+			 * resource_thread_mutex (add_host_event).
 			 */
 			log_space(sp, "host event from host_id %d", i+1);
 			add_host_event(sp->space_id, &he,
@@ -438,14 +660,18 @@ void check_other_leases(struct space *sp, char *buf)
 	 */
 	if (new)
 		set_resource_examine(sp->space_name, NULL);
+
+	if (host_status_waiters)
+		pthread_cond_broadcast(&host_status_cond);
 }
 
 /*
  * check if our_host_id_thread has renewed within timeout
  */
 
-int check_our_lease(struct space *sp, int *check_all, char *check_buf)
+int check_our_lease(struct space *sp, int *check_all, char **check_buf)
 {
+	char *buf;
 	int id_renewal_fail_seconds, id_renewal_warn_seconds;
 	uint64_t last_success;
 	int corrupt_result;
@@ -457,14 +683,17 @@ int check_our_lease(struct space *sp, int *check_all, char *check_buf)
 
 	if (sp->lease_status.renewal_read_count > sp->lease_status.renewal_read_check) {
 		/*
-		 * NB. it's unfortunate how subtle this is.
-		 * main loop will pass this buf to check_other_leases next
+		 * Take the newly read buf, and give the old one back to be
+		 * read into.  The main loop passes this buf to
+		 * check_other_leases next.  See comment above it.
 		 */
 		sp->lease_status.renewal_read_check = sp->lease_status.renewal_read_count;
 		*check_all = 1;
-		if (check_buf)
-			memcpy(check_buf, sp->lease_status.renewal_read_buf, sp->align_size);
+		buf = sp->lease_status.renewal_read_buf;
+		sp->lease_status.renewal_read_buf = sp->check_buf;
+		sp->check_buf = buf;
 	}
+	*check_buf = sp->check_buf;
 	pthread_mutex_unlock(&sp->mutex);
 
 	if (corrupt_result) {
@@ -569,6 +798,795 @@ static void save_renewal_history(struct space *sp, int delta_result,
 	}
 }
 
+static int alloc_host_status(struct task *task, struct space *sp)
+{
+	int max_hosts;
+
+	max_hosts = delta_lease_max_hosts(task, sp, &sp->host_id_disk, sp->space_name);
+	if (max_hosts < 0) {
+		log_erros(sp, "delta_lease_max_hosts error %d", max_hosts);
+		return max_hosts;
+	}
+
+	/* delta_lease_acquire reports a host_id outside the lockspace */
+	if (max_hosts < sp->host_id && sp->host_id <= DEFAULT_MAX_HOSTS)
+		max_hosts = sp->host_id;
+	if (!max_hosts)
+		max_hosts = 1;
+
+	sp->host_status = calloc(max_hosts, sizeof(struct host_status));
+	sp->host_ids = calloc(max_hosts, sizeof(int));
+	if (!sp->host_status || !sp->host_ids)
+		return -ENOMEM;
+
+	sp->max_hosts = max_hosts;
+	log_space(sp, "max_hosts %d", max_hosts);
+	return 0;
+}
+
+/*
+ * Publish the result of a renewal for the main loop, and pet the watchdog.
+ * After a successful read, *iobuf is exchanged with renewal_read_buf: the
+ * next renewal reads into the spare, or the buf that was read last time if
+ * the main loop hasn't taken it yet; see check_other_leases.  Returns the
+ * buf that was published, or NULL.
+ */
+
+static char *publish_renewal(struct space *sp, char **iobuf,
+			     int delta_result, int read_result,
+			     uint64_t delta_begin, uint64_t last_success,
+			     int id_renewal_fail_seconds, int rd_ms, int wr_ms)
+{
+	char *publish_buf = NULL;
+
+	pthread_mutex_lock(&sp->mutex);
+	sp->lease_status.renewal_last_result = delta_result;
+	sp->lease_status.renewal_last_attempt = delta_begin;
+
+	if (delta_result == SANLK_OK)
+		sp->lease_status.renewal_last_success = last_success;
+
+	if (delta_result != SANLK_OK && !sp->lease_status.corrupt_result)
+		sp->lease_status.corrupt_result = corrupt_result(delta_result);
+
+	if (read_result == SANLK_OK && *iobuf) {
+		publish_buf = *iobuf;
+		*iobuf = sp->lease_status.renewal_read_buf;
+		sp->lease_status.renewal_read_buf = publish_buf;
+		sp->lease_status.renewal_read_count++;
+	}
+
+	/*
+	 * pet the watchdog
+	 * (don't update on thread_stop because it's probably unlinked)
+	 */
+
+	if (delta_result == SANLK_OK && !sp->thread_stop)
+		update_watchdog(sp, last_success, id_renewal_fail_seconds);
+
+	save_renewal_history(sp, delta_result, last_success, rd_ms, wr_ms);
+	pthread_mutex_unlock(&sp->mutex);
+
+	return publish_buf;
+}
+
+static void log_renewal(struct space *sp, int delta_result, int delta_length,
+			uint64_t last_success, int renewal_interval,
+			int id_renewal_seconds)
+{
+	if (delta_result != SANLK_OK) {
+		log_erros(sp, "renewal error %d delta_length %d last_success %llu",
+			  delta_result, delta_length, (unsigned long long)last_success);
+	} else if (delta_length > id_renewal_seconds) {
+		log_erros(sp, "renewed %llu delta_length %d too long",
+			  (unsigned long long)last_success, delta_length);
+	} else {
+		if (com.debug_renew) {
+			log_space(sp, "renewed %llu delta_length %d interval %d",
+				  (unsigned long long)last_success, delta_length, renewal_interval);
+		}
+	}
+}
+
+/* release the delta lease and clean up when renewals are stopped */
+
+static void lockspace_thread_end(struct task *task, struct space *sp, int delta_result,
+				 struct leader_record *leader, int opened)
+{
+	/* cached leases are released on disk while the host_id is still
+	   held; if renewals failed, they are only purged below */
+
+	if (delta_result == SANLK_OK) {
+		release_cached_resources(task, sp->space_name);
+		delta_lease_release(task, sp, &sp->host_id_disk,
+				    sp->space_name, leader, leader);
+	}
+
+	if (opened) {
+		task_uring_unregister_fd(task, sp->host_id_disk.fd);
+		close(sp->host_id_disk.fd);
+	}
+
+	/*
+	 * TODO: are there cases where struct resources for this lockspace
+	 * still exist on resource_held/resource_add/resource_rem?  Is that ok?
+	 * Should we purge all of them here?  When a lockspace is removed and
+	 * pids are killed, their resources go through release_token_async,
+	 * which will see token->space_dead, and those resources are freed
+	 * directly.  resources that may have already been on resources_rem and
+	 * the resource_thread may be in the middle of releasing one of them.
+	 * For any further async releases, resource_thread will see that the
+	 * lockspace is going away and will just free the resource.
+	 */
+
+	purge_resource_orphans(sp->space_name);
+
+	close_event_fds(sp);
+}
+
+/*
+ * Renewal engine: with renewal_threads set, the delta lease renewals of
+ * all lockspaces are done by that number of threads, rather than by one
+ * lockspace_thread per lockspace.  Each engine thread has one aio context
+ * for the lockspaces it's given, and keeps them on a timer wheel of one
+ * second slots, by the time of their next renewal.  The renewal read and
+ * write are started with async_io_start, and each step of the renewal is
+ * done as its io completes or times out, so a slow disk doesn't hold up
+ * renewals in other lockspaces.  lockspace_thread still acquires the
+ * delta lease, then gives the lockspace to an engine thread and exits.
+ * When the lockspace is stopped, the release is done in a short lived
+ * thread, as it would have been at the end of lockspace_thread.
+ */
+
+#define RENEWAL_WHEEL_SLOTS 64
+#define RENEWAL_MAX_SPACES 128 /* per engine thread */
+#define RENEWAL_AIO_CB_SIZE (RENEWAL_MAX_SPACES * 4)
+
+#define RENEW_WAIT  0 /* on the wheel until the next renewal */
+#define RENEW_REAP  1 /* waiting for the read that timed out last time */
+#define RENEW_READ  2
+#define RENEW_WRITE 3
+
+struct renewal_engine;
+
+struct renewal {
+	struct list_head list;  /* engine renewals or adds */
+	struct list_head wheel; /* engine wheel slot for next */
+	struct space *sp;
+	struct leader_record leader;
+	struct leader_record leader_new; /* being written */
+	struct delta_extra extra;
+	struct aicb *read_aicb; /* also a timed out read that may be reaped */
+	struct aicb *write_aicb;
+	char *iobuf;            /* same as task.iobuf in lockspace_thread */
+	char *wbuf;
+	char bitmap[HOSTID_BITMAP_SIZE];
+	uint64_t next;          /* monotime of the next renewal */
+	uint64_t last_success;
+	uint64_t delta_begin;
+	uint64_t new_ts;
+	uint64_t io_begin;      /* msec */
+	uint64_t io_deadline;   /* msec */
+	int state;
+	int stop;
+	int delta_result;
+	int read_result;
+	int rd_ms;
+	int wr_ms;
+	int renewal_interval;
+	int id_renewal_seconds;
+	int id_renewal_fail_seconds;
+};
+
+struct renewal_engine {
+	pthread_t thread;
+	pthread_mutex_t mutex; /* protects adds, count */
+	struct list_head adds;
+	int count;
+	struct task task;
+	struct list_head renewals;
+	struct list_head wheel[RENEWAL_WHEEL_SLOTS];
+	uint64_t tick;         /* next wheel slot to check */
+};
+
+static struct renewal_engine *renewal_engines;
+static int renewal_engines_count;
+static pthread_mutex_t renewal_engines_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * sp->renew_engine and sp->renew_done are set under renewal_done_mutex,
+ * not sp->mutex, so the stop thread doesn't touch sp after setting
+ * renew_done, when sp can be freed.
+ */
+static pthread_mutex_t renewal_done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t renewal_done_cond = PTHREAD_COND_INITIALIZER;
+
+static void renewal_io_done(struct renewal_engine *eng, struct renewal *r);
+
+static uint64_t monotime_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void renewal_schedule(struct renewal_engine *eng, struct renewal *r, uint64_t next)
+{
+	if (next < eng->tick)
+		next = eng->tick;
+
+	r->next = next;
+	r->state = RENEW_WAIT;
+	list_add_tail(&r->wheel, &eng->wheel[next % RENEWAL_WHEEL_SLOTS]);
+}
+
+static void *renewal_stop_thread(void *arg_in)
+{
+	struct renewal *r = arg_in;
+	struct space *sp = r->sp;
+	struct task task;
+
+	memset(&task, 0, sizeof(struct task));
+	setup_task_aio(&task, main_task.use_aio, HOSTID_AIO_CB_SIZE);
+	memcpy(task.name, sp->space_name, NAME_ID_SIZE);
+
+	close_watchdog(sp);
+
+	lockspace_thread_end(&task, sp, r->delta_result, &r->leader, 1);
+
+	close_task_aio(&task);
+
+	if (r->iobuf)
+		free(r->iobuf);
+	free(r);
+
+	/* stop_lockspace_thread can free sp after this */
+	pthread_mutex_lock(&renewal_done_mutex);
+	sp->renew_done = 1;
+	pthread_cond_broadcast(&renewal_done_cond);
+	pthread_mutex_unlock(&renewal_done_mutex);
+	return NULL;
+}
+
+static void renewal_stop(struct renewal_engine *eng, struct renewal *r)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int rv;
+
+	list_del(&r->list);
+	list_del_init(&r->wheel);
+
+	if (r->read_aicb) {
+		/* a timed out read, the buf is freed when it completes */
+		async_io_abandon(&eng->task, r->read_aicb);
+		r->read_aicb = NULL;
+		r->iobuf = NULL;
+	}
+
+	pthread_mutex_lock(&eng->mutex);
+	eng->count--;
+	pthread_mutex_unlock(&eng->mutex);
+
+	log_space(r->sp, "renewal engine stop");
+
+	/* the release may wait for io, which other renewals can't */
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rv = pthread_create(&thread, &attr, renewal_stop_thread, r);
+	pthread_attr_destroy(&attr);
+
+	if (rv) {
+		log_erros(r->sp, "renewal engine stop thread error %d", rv);
+		renewal_stop_thread(r);
+	}
+}
+
+/* the rest of lockspace_thread's loop after delta_lease_renew returns */
+
+static void renewal_end(struct renewal_engine *eng, struct renewal *r, int result)
+{
+	struct space *sp = r->sp;
+	int delta_length;
+
+	r->delta_result = result;
+
+	if (result == SANLK_OK) {
+		r->renewal_interval = r->leader.timestamp - r->last_success;
+		r->last_success = r->leader.timestamp;
+	}
+
+	delta_length = monotime() - r->delta_begin;
+
+	/* the engine doesn't use io_uring fixed buffers */
+
+	publish_renewal(sp, &r->iobuf, r->delta_result, r->read_result,
+			r->delta_begin, r->last_success,
+			r->id_renewal_fail_seconds, r->rd_ms, r->wr_ms);
+
+	log_renewal(sp, r->delta_result, delta_length, r->last_success,
+		    r->renewal_interval, r->id_renewal_seconds);
+
+	if (r->stop) {
+		r->state = RENEW_WAIT;
+		renewal_stop(eng, r);
+		return;
+	}
+
+	/* a failed renewal is retried at the next tick */
+
+	if (result == SANLK_OK)
+		renewal_schedule(eng, r, r->last_success + r->id_renewal_seconds);
+	else
+		renewal_schedule(eng, r, monotime() + 1);
+}
+
+static void renewal_read(struct renewal_engine *eng, struct renewal *r)
+{
+	struct space *sp = r->sp;
+	struct sync_disk *disk = &sp->host_id_disk;
+	int rv;
+
+	if (!r->iobuf) {
+		rv = posix_memalign((void *)&r->iobuf, getpagesize(), sp->align_size);
+		if (rv) {
+			log_erros(sp, "dela_renew memalign rv %d", rv);
+			r->iobuf = NULL;
+			renewal_end(eng, r, -ENOMEM);
+			return;
+		}
+	}
+
+	if (com.debug_renew)
+		log_space(sp, "delta_renew begin read");
+
+	r->io_begin = monotime_msec();
+	r->io_deadline = r->io_begin + (sp->io_timeout * 1000);
+
+	r->read_aicb = async_io_start(&eng->task, disk->fd, disk->offset,
+				      r->iobuf, sp->align_size, sp->io_timeout,
+				      IO_CMD_PREAD);
+	if (!r->read_aicb) {
+		log_erros(sp, "delta_renew read start offset %llu %s",
+			  (unsigned long long)disk->offset, disk->path);
+		renewal_end(eng, r, -ENOENT);
+		return;
+	}
+
+	r->state = RENEW_READ;
+}
+
+static void renewal_write(struct renewal_engine *eng, struct renewal *r)
+{
+	struct space *sp = r->sp;
+	struct sync_disk *disk = &sp->host_id_disk;
+	uint64_t id_offset;
+	int ioto, rv;
+
+	r->read_result = SANLK_OK;
+
+	rv = delta_renew_check(sp, disk, sp->space_name, r->iobuf, r->delta_result,
+			       &r->leader, &r->leader_new);
+	if (rv < 0) {
+		renewal_end(eng, r, rv);
+		return;
+	}
+
+	r->wbuf = iobuf_get(&eng->task, disk->sector_size);
+	if (!r->wbuf) {
+		log_erros(sp, "dela_renew write iobuf_get %d", disk->sector_size);
+		renewal_end(eng, r, -ENOMEM);
+		return;
+	}
+
+	r->new_ts = delta_renew_prep(sp, &r->leader_new, r->bitmap, &r->extra,
+				     com.debug_renew ? LOG_DEBUG : -1, r->wbuf);
+
+	/* same extended timeout as the write in delta_lease_renew */
+
+	ioto = calc_host_dead_seconds(sp->io_timeout);
+	id_offset = (sp->host_id - 1) * disk->sector_size;
+
+	r->io_begin = monotime_msec();
+	r->io_deadline = r->io_begin + (ioto * 1000);
+
+	r->write_aicb = async_io_start(&eng->task, disk->fd, disk->offset + id_offset,
+				       r->wbuf, disk->sector_size, ioto, IO_CMD_PWRITE);
+	if (!r->write_aicb) {
+		log_erros(sp, "delta_renew write start offset %llu %s",
+			  (unsigned long long)disk->offset, disk->path);
+		iobuf_put(&eng->task, r->wbuf, disk->sector_size);
+		r->wbuf = NULL;
+		renewal_end(eng, r, -ENOENT);
+		return;
+	}
+
+	r->state = RENEW_WRITE;
+}
+
+static void renewal_written(struct renewal_engine *eng, struct renewal *r, int rv)
+{
+	struct space *sp = r->sp;
+	uint64_t now = monotime();
+
+	if (rv < 0) {
+		log_erros(sp, "delta_renew write time %llu error %d",
+			  (unsigned long long)(now - r->new_ts), rv);
+		renewal_end(eng, r, rv);
+		return;
+	}
+
+	if (now - r->new_ts >= sp->io_timeout)
+		log_erros(sp, "delta_renew long write time %llu sec",
+			  (unsigned long long)(now - r->new_ts));
+
+	memcpy(&r->leader, &r->leader_new, sizeof(struct leader_record));
+	renewal_end(eng, r, SANLK_OK);
+}
+
+static void renewal_begin(struct renewal_engine *eng, struct renewal *r)
+{
+	struct space *sp = r->sp;
+	uint32_t reap_timeout_msec;
+
+	memset(r->bitmap, 0, sizeof(r->bitmap));
+	memset(&r->extra, 0, sizeof(r->extra));
+	create_bitmap_and_extra(sp, r->bitmap, &r->extra);
+
+	r->delta_begin = monotime();
+	r->rd_ms = -1;
+	r->wr_ms = -1;
+	r->read_result = SANLK_ERROR;
+
+	if (r->read_aicb && r->delta_result == SANLK_AIO_TIMEOUT) {
+		/* as in delta_lease_renew, use the result of the previous
+		   read that timed out if it completes soon enough */
+
+		log_space(sp, "delta_renew begin reap");
+
+		if (!sp->renewal_read_extend_sec)
+			reap_timeout_msec = 500;
+		else
+			reap_timeout_msec = sp->renewal_read_extend_sec * 1000;
+
+		r->io_begin = monotime_msec();
+		r->io_deadline = r->io_begin + reap_timeout_msec;
+		r->state = RENEW_REAP;
+
+		if (r->read_aicb->async_done)
+			renewal_io_done(eng, r);
+		return;
+	}
+
+	if (r->read_aicb) {
+		async_io_abandon(&eng->task, r->read_aicb);
+		r->read_aicb = NULL;
+		r->iobuf = NULL;
+	}
+
+	renewal_read(eng, r);
+}
+
+/* handle an io completion for the renewal, if it has one */
+
+static void renewal_io_done(struct renewal_engine *eng, struct renewal *r)
+{
+	struct space *sp = r->sp;
+	uint64_t now;
+	int rv;
+
+	switch (r->state) {
+	case RENEW_REAP:
+	case RENEW_READ:
+		if (!r->read_aicb->async_done)
+			return;
+
+		rv = async_io_result(&eng->task, r->read_aicb);
+		r->read_aicb = NULL;
+		now = monotime_msec();
+
+		if (r->state == RENEW_REAP) {
+			log_space(sp, "delta_renew reap %d", rv);
+
+			/* the buf is ours again, read into it from scratch */
+			if (rv) {
+				renewal_read(eng, r);
+				return;
+			}
+
+			/* read time is the io_timeout length for the previous
+			   read plus the time spent in reap */
+			r->rd_ms = (now - r->io_begin) + (sp->io_timeout * 1000);
+		} else {
+			r->rd_ms = now - r->io_begin;
+
+			if (rv) {
+				log_erros(sp, "delta_renew read rv %d offset %llu %s",
+					  rv, (unsigned long long)sp->host_id_disk.offset,
+					  sp->host_id_disk.path);
+				renewal_end(eng, r, rv);
+				return;
+			}
+		}
+
+		renewal_write(eng, r);
+		break;
+
+	case RENEW_WRITE:
+		if (!r->write_aicb->async_done)
+			return;
+
+		rv = async_io_result(&eng->task, r->write_aicb);
+		r->write_aicb = NULL;
+		r->wr_ms = monotime_msec() - r->io_begin;
+
+		iobuf_put(&eng->task, r->wbuf, sp->host_id_disk.sector_size);
+		r->wbuf = NULL;
+
+		renewal_written(eng, r, rv);
+		break;
+	}
+}
+
+/* handle an io that has passed its timeout */
+
+static void renewal_io_timeout(struct renewal_engine *eng, struct renewal *r)
+{
+	struct space *sp = r->sp;
+	int rv;
+
+	switch (r->state) {
+	case RENEW_REAP:
+		/* abandon the previous timed out read and try a new one
+		   from scratch, the buf is freed when the read completes */
+		log_space(sp, "delta_renew reap %d", SANLK_AIO_TIMEOUT);
+		async_io_abandon(&eng->task, r->read_aicb);
+		r->read_aicb = NULL;
+		r->iobuf = NULL;
+		renewal_read(eng, r);
+		break;
+
+	case RENEW_READ:
+		rv = async_io_timeout(&eng->task, r->read_aicb);
+		if (!rv) {
+			/* completed just now */
+			r->read_aicb = NULL;
+			r->rd_ms = monotime_msec() - r->io_begin;
+			renewal_write(eng, r);
+			break;
+		}
+
+		/* with SANLK_AIO_TIMEOUT, read_aicb is kept to be reaped
+		   by the next renewal */
+
+		if (rv == SANLK_AIO_TIMEOUT) {
+			log_erros(sp, "delta_renew read timeout %u sec offset %llu %s",
+				  sp->io_timeout, (unsigned long long)sp->host_id_disk.offset,
+				  sp->host_id_disk.path);
+		} else {
+			r->read_aicb = NULL;
+			log_erros(sp, "delta_renew read rv %d offset %llu %s",
+				  rv, (unsigned long long)sp->host_id_disk.offset,
+				  sp->host_id_disk.path);
+		}
+		renewal_end(eng, r, rv);
+		break;
+
+	case RENEW_WRITE:
+		rv = async_io_timeout(&eng->task, r->write_aicb);
+		if (rv == SANLK_AIO_TIMEOUT)
+			async_io_abandon(&eng->task, r->write_aicb);
+		else
+			iobuf_put(&eng->task, r->wbuf, sp->host_id_disk.sector_size);
+		r->write_aicb = NULL;
+		r->wbuf = NULL;
+
+		renewal_written(eng, r, rv);
+		break;
+	}
+}
+
+static void *renewal_engine_thread(void *arg_in)
+{
+	struct renewal_engine *eng = arg_in;
+	struct renewal *r, *safe;
+	struct list_head *slot;
+	uint64_t now, now_msec;
+	int wait_msec, stop, rv;
+
+	eng->tick = monotime();
+
+	while (1) {
+		pthread_mutex_lock(&eng->mutex);
+		list_for_each_entry_safe(r, safe, &eng->adds, list) {
+			list_move_tail(&r->list, &eng->renewals);
+			renewal_schedule(eng, r, r->next);
+		}
+		pthread_mutex_unlock(&eng->mutex);
+
+		/*
+		 * check for stopped lockspaces at least once a second, as
+		 * lockspace_thread did; a renewal in progress is finished
+		 * first
+		 */
+
+		list_for_each_entry_safe(r, safe, &eng->renewals, list) {
+			pthread_mutex_lock(&r->sp->mutex);
+			stop = r->sp->thread_stop;
+			pthread_mutex_unlock(&r->sp->mutex);
+
+			if (!stop) {
+				/* move an early renewal to this tick */
+				if (r->state == RENEW_WAIT && r->delta_result == SANLK_OK &&
+				    r->next > eng->tick &&
+				    renewal_due(r->sp, r->last_success, r->id_renewal_seconds)) {
+					list_del_init(&r->wheel);
+					renewal_schedule(eng, r, eng->tick);
+				}
+				continue;
+			}
+
+			r->stop = 1;
+
+			if (r->state == RENEW_WAIT)
+				renewal_stop(eng, r);
+		}
+
+		/*
+		 * start renewals that are due; an entry in the slot for a
+		 * later time around the wheel is left there
+		 */
+
+		now = monotime();
+
+		while (eng->tick <= now) {
+			slot = &eng->wheel[eng->tick % RENEWAL_WHEEL_SLOTS];
+
+			list_for_each_entry_safe(r, safe, slot, wheel) {
+				if (r->next > eng->tick)
+					continue;
+				list_del_init(&r->wheel);
+				renewal_begin(eng, r);
+			}
+			eng->tick++;
+		}
+
+		/*
+		 * wait for io until the next tick or the first io timeout
+		 */
+
+		now_msec = monotime_msec();
+		wait_msec = 1000 - (now_msec % 1000);
+
+		list_for_each_entry_safe(r, safe, &eng->renewals, list) {
+			if (r->state == RENEW_WAIT)
+				continue;
+
+			if (r->io_deadline <= now_msec) {
+				renewal_io_timeout(eng, r);
+				continue;
+			}
+
+			if (r->io_deadline - now_msec < wait_msec)
+				wait_msec = r->io_deadline - now_msec;
+		}
+
+		rv = async_io_poll(&eng->task, wait_msec);
+		if (rv < 0) {
+			log_error("renewal engine poll error %d", rv);
+			usleep(wait_msec * 1000);
+			continue;
+		}
+		if (!rv)
+			continue;
+
+		list_for_each_entry_safe(r, safe, &eng->renewals, list)
+			renewal_io_done(eng, r);
+	}
+
+	return NULL;
+}
+
+static int renewal_engines_start(void)
+{
+	struct renewal_engine *eng;
+	int i, j, rv;
+
+	renewal_engines = malloc(com.renewal_threads * sizeof(struct renewal_engine));
+	if (!renewal_engines)
+		return -ENOMEM;
+	memset(renewal_engines, 0, com.renewal_threads * sizeof(struct renewal_engine));
+
+	for (i = 0; i < com.renewal_threads; i++) {
+		eng = &renewal_engines[i];
+
+		pthread_mutex_init(&eng->mutex, NULL);
+		INIT_LIST_HEAD(&eng->adds);
+		INIT_LIST_HEAD(&eng->renewals);
+		for (j = 0; j < RENEWAL_WHEEL_SLOTS; j++)
+			INIT_LIST_HEAD(&eng->wheel[j]);
+
+		setup_task_aio(&eng->task, main_task.use_aio, RENEWAL_AIO_CB_SIZE);
+		snprintf(eng->task.name, NAME_ID_SIZE, "renewal_%d", i);
+
+		/* the engine can't work without async io */
+		if (eng->task.use_aio != 1 && eng->task.use_aio != 3) {
+			log_error("renewal engine requires use_aio 1 or 3");
+			close_task_aio(&eng->task);
+			break;
+		}
+
+		rv = pthread_create(&eng->thread, NULL, renewal_engine_thread, eng);
+		if (rv) {
+			log_error("renewal engine thread error %d", rv);
+			close_task_aio(&eng->task);
+			break;
+		}
+	}
+
+	renewal_engines_count = i;
+	return i ? 0 : -1;
+}
+
+/* give renewals of a newly acquired lockspace to the least busy engine */
+
+static int renewal_engine_add(struct space *sp, struct leader_record *leader,
+			      uint64_t last_success, int id_renewal_seconds,
+			      int id_renewal_fail_seconds)
+{
+	struct renewal_engine *eng = NULL;
+	struct renewal *r;
+	int i;
+
+	pthread_mutex_lock(&renewal_engines_mutex);
+	if (!renewal_engines)
+		renewal_engines_start();
+
+	/* count is changed under the engine mutex, it's only a hint here */
+
+	for (i = 0; i < renewal_engines_count; i++) {
+		if (renewal_engines[i].count >= RENEWAL_MAX_SPACES)
+			continue;
+		if (!eng || renewal_engines[i].count < eng->count)
+			eng = &renewal_engines[i];
+	}
+	pthread_mutex_unlock(&renewal_engines_mutex);
+
+	if (!eng) {
+		log_space(sp, "renewal engine not available");
+		return -ENOSPC;
+	}
+
+	r = malloc(sizeof(struct renewal));
+	if (!r)
+		return -ENOMEM;
+	memset(r, 0, sizeof(struct renewal));
+
+	INIT_LIST_HEAD(&r->wheel);
+	r->sp = sp;
+	memcpy(&r->leader, leader, sizeof(struct leader_record));
+	r->last_success = last_success;
+	r->next = last_success + id_renewal_seconds;
+	r->delta_result = SANLK_OK;
+	r->id_renewal_seconds = id_renewal_seconds;
+	r->id_renewal_fail_seconds = id_renewal_fail_seconds;
+
+	pthread_mutex_lock(&renewal_done_mutex);
+	sp->renew_engine = 1;
+	pthread_mutex_unlock(&renewal_done_mutex);
+
+	pthread_mutex_lock(&eng->mutex);
+	list_add_tail(&r->list, &eng->adds);
+	eng->count++;
+	pthread_mutex_unlock(&eng->mutex);
+
+	log_space(sp, "renewal engine %ld", (long)(eng - renewal_engines));
+	return 0;
+}
+
 /*
  * This thread must not be stopped unless all pids that may be using any
  * resources in it are dead/gone.  (The USED flag in the lockspace represents
@@ -580,6 +1598,7 @@ static void save_renewal_history(struct space *sp, int delta_result,
 static void *lockspace_thread(void *arg_in)
 {
 	char bitmap[HOSTID_BITMAP_SIZE];
+	char *publish_buf;
 	struct delta_extra extra;
 	struct task task;
 	struct space *sp;
@@ -617,6 +1636,8 @@ static void *lockspace_thread(void *arg_in)
 	}
 	opened = 1;
 
+	task_uring_register_fd(&task, sp->host_id_disk.fd);
+
 	sp->align_size = direct_align(&sp->host_id_disk);
 	if (sp->align_size < 0) {
 		log_erros(sp, "direct_align error");
@@ -625,13 +1646,27 @@ static void *lockspace_thread(void *arg_in)
 		goto set_status;
 	}
 
-	sp->lease_status.renewal_read_buf = malloc(sp->align_size);
-	if (!sp->lease_status.renewal_read_buf) {
+	/* a spare to swap with task.iobuf after the first renewal read */
+	rv = posix_memalign((void *)&sp->lease_status.renewal_read_buf,
+			    getpagesize(), sp->align_size);
+	if (rv) {
+		sp->lease_status.renewal_read_buf = NULL;
 		acquire_result = -ENOMEM;
 		delta_result = -1;
 		goto set_status;
 	}
 
+	/* host_status is sized to the host_id leases initialized on disk */
+	rv = alloc_host_status(&task, sp);
+	if (rv < 0) {
+		acquire_result = rv;
+		delta_result = -1;
+		goto set_status;
+	}
+
+	/* the renewal write buffer, allocated (and mlocked) before renewals */
+	iobuf_pool_reserve(&task, sp->host_id_disk.sector_size, 1);
+
 	/* Connect first so we can fail quickly if wdmd is not running. */
 	wd_con = connect_watchdog(sp);
 	if (wd_con < 0) {
@@ -690,6 +1725,15 @@ static void *lockspace_thread(void *arg_in)
 
 	sp->host_generation = leader.owner_generation;
 
+	if (com.renewal_threads &&
+	    !renewal_engine_add(sp, &leader, last_success, id_renewal_seconds,
+				id_renewal_fail_seconds)) {
+		/* renewals and the eventual release are done by the engine */
+		task_uring_unregister_fd(&task, sp->host_id_disk.fd);
+		close_task_aio(&task);
+		return NULL;
+	}
+
 	while (1) {
 		pthread_mutex_lock(&sp->mutex);
 		stop = sp->thread_stop;
@@ -701,7 +1745,7 @@ static void *lockspace_thread(void *arg_in)
 		 * wait between each renewal
 		 */
 
-		if (monotime() - last_success < id_renewal_seconds) {
+		if (!renewal_due(sp, last_success, id_renewal_seconds)) {
 			sleep(1);
 			continue;
 		} else {
@@ -740,50 +1784,19 @@ static void *lockspace_thread(void *arg_in)
 		 * publish the results
 		 */
 
-		pthread_mutex_lock(&sp->mutex);
-		sp->lease_status.renewal_last_result = delta_result;
-		sp->lease_status.renewal_last_attempt = delta_begin;
-
-		if (delta_result == SANLK_OK)
-			sp->lease_status.renewal_last_success = last_success;
+		publish_buf = publish_renewal(sp, &task.iobuf, delta_result, read_result,
+					      delta_begin, last_success,
+					      id_renewal_fail_seconds, rd_ms, wr_ms);
 
-		if (delta_result != SANLK_OK && !sp->lease_status.corrupt_result)
-			sp->lease_status.corrupt_result = corrupt_result(delta_result);
-
-		if (read_result == SANLK_OK && task.iobuf) {
-			/* NB. be careful with how this iobuf escapes */
-			memcpy(sp->lease_status.renewal_read_buf, task.iobuf, sp->align_size);
-			sp->lease_status.renewal_read_count++;
+		if (publish_buf) {
+			/* fixed buffer for io_uring, no-op otherwise */
+			task_uring_unregister_buf(&task, publish_buf);
+			if (task.iobuf)
+				task_uring_register_buf(&task, task.iobuf, sp->align_size);
 		}
 
-		/*
-		 * pet the watchdog
-		 * (don't update on thread_stop because it's probably unlinked)
-		 */
-
-		if (delta_result == SANLK_OK && !sp->thread_stop)
-			update_watchdog(sp, last_success, id_renewal_fail_seconds);
-
-		save_renewal_history(sp, delta_result, last_success, rd_ms, wr_ms);
-		pthread_mutex_unlock(&sp->mutex);
-
-
-		/*
-		 * log the results
-		 */
-
-		if (delta_result != SANLK_OK) {
-			log_erros(sp, "renewal error %d delta_length %d last_success %llu",
-				  delta_result, delta_length, (unsigned long long)last_success);
-		} else if (delta_length > id_renewal_seconds) {
-			log_erros(sp, "renewed %llu delta_length %d too long",
-				  (unsigned long long)last_success, delta_length);
-		} else {
-			if (com.debug_renew) {
-				log_space(sp, "renewed %llu delta_length %d interval %d",
-					  (unsigned long long)last_success, delta_length, renewal_interval);
-			}
-		}
+		log_renewal(sp, delta_result, delta_length, last_success,
+			    renewal_interval, id_renewal_seconds);
 	}
 
 	/* watchdog unlink was done in main_loop when thread_stop was set, to
@@ -791,37 +1804,54 @@ static void *lockspace_thread(void *arg_in)
 
 	close_watchdog(sp);
  out:
-	if (delta_result == SANLK_OK)
-		delta_lease_release(&task, sp, &sp->host_id_disk,
-				    sp->space_name, &leader, &leader);
-
-	if (opened)
-		close(sp->host_id_disk.fd);
+	lockspace_thread_end(&task, sp, delta_result, &leader, opened);
+	close_task_aio(&task);
+	return NULL;
+}
 
-	/*
-	 * TODO: are there cases where struct resources for this lockspace
-	 * still exist on resource_held/resource_add/resource_rem?  Is that ok?
-	 * Should we purge all of them here?  When a lockspace is removed and
-	 * pids are killed, their resources go through release_token_async,
-	 * which will see token->space_dead, and those resources are freed
-	 * directly.  resources that may have already been on resources_rem and
-	 * the resource_thread may be in the middle of releasing one of them.
-	 * For any further async releases, resource_thread will see that the
-	 * lockspace is going away and will just free the resource.
-	 */
+/*
+ * lockspace_thread exits after giving renewals to the renewal engine,
+ * and the engine is finished with the lockspace when renew_done is set.
+ */
 
-	purge_resource_orphans(sp->space_name);
+static int join_lockspace_thread(struct space *sp, int wait)
+{
+	int rv = 0;
 
-	close_event_fds(sp);
+	if (!sp->thread_joined) {
+		if (wait)
+			rv = pthread_join(sp->thread, NULL);
+		else
+			rv = pthread_tryjoin_np(sp->thread, NULL);
+		if (rv)
+			return rv;
+		sp->thread_joined = 1;
+	}
 
-	close_task_aio(&task);
-	return NULL;
+	pthread_mutex_lock(&renewal_done_mutex);
+	while (sp->renew_engine && !sp->renew_done) {
+		if (!wait) {
+			rv = EBUSY;
+			break;
+		}
+		pthread_cond_wait(&renewal_done_cond, &renewal_done_mutex);
+	}
+	pthread_mutex_unlock(&renewal_done_mutex);
+	return rv;
 }
 
 static void free_sp(struct space *sp)
 {
 	if (sp->lease_status.renewal_read_buf)
 		free(sp->lease_status.renewal_read_buf);
+	if (sp->check_buf)
+		free(sp->check_buf);
+	if (sp->check_prev)
+		free(sp->check_prev);
+	if (sp->host_status)
+		free(sp->host_status);
+	if (sp->host_ids)
+		free(sp->host_ids);
 	free(sp);
 }
 
@@ -851,6 +1881,7 @@ int add_lockspace_start(struct sanlk_lockspace *ls, uint32_t io_timeout, struct
 	sp->host_id = ls->host_id;
 	sp->io_timeout = io_timeout;
 	sp->set_bitmap_seconds = calc_set_bitmap_seconds(io_timeout);
+	sp->renewal_min_seconds = calc_renewal_min_seconds(io_timeout);
 	pthread_mutex_init(&sp->mutex, NULL);
 
 	if (com.renewal_read_extend_sec_set)
@@ -1012,7 +2043,7 @@ int add_lockspace_wait(struct space *sp)
 		sp->thread_stop = 1;
 		deactivate_watchdog(sp);
 		pthread_mutex_unlock(&sp->mutex);
-		pthread_join(sp->thread, NULL);
+		join_lockspace_thread(sp, 1);
 		rv = -1;
 		log_space(sp, "add_lockspace undo complete");
 		goto fail_del;
@@ -1305,7 +2336,7 @@ int get_hosts(struct sanlk_lockspace *ls, char *buf, int *len, int *count, int m
 	struct host_status *hs;
 	struct sanlk_host *host;
 	int host_count = 0;
-	int i, rv;
+	int i, j, rv;
 
 	rv = 0;
 	*len = 0;
@@ -1330,11 +2361,20 @@ int get_hosts(struct sanlk_lockspace *ls, char *buf, int *len, int *count, int m
 		goto out;
 	}
 
-	for (i = 0; i < DEFAULT_MAX_HOSTS; i++) {
-		hs = &sp->host_status[i];
+	if (ls->host_id > sp->max_hosts) {
+		rv = -EINVAL;
+		goto out;
+	}
 
-		if (ls->host_id && (ls->host_id != (i + 1)))
-			continue;
+	/* one host_id, or the listed host_ids that have a timestamp */
+
+	for (j = 0; j < (ls->host_id ? 1 : sp->host_ids_count); j++) {
+		if (ls->host_id)
+			i = ls->host_id - 1;
+		else
+			i = sp->host_ids[j] - 1;
+
+		hs = &sp->host_status[i];
 
 		if (!ls->host_id && !hs->timestamp)
 			continue;
@@ -1536,13 +2576,21 @@ int lockspace_set_event(struct sanlk_lockspace *ls, struct sanlk_host_event *he,
 		return -EINVAL;
 	}
 
+	/* spaces_mutex is held for add_host_id */
+
 	pthread_mutex_lock(&spaces_mutex);
 	sp = _search_space(ls->name, NULL, 0, &spaces, NULL, NULL, NULL);
 	if (!sp) {
 		pthread_mutex_unlock(&spaces_mutex);
 		return -ENOENT;
 	}
-	pthread_mutex_unlock(&spaces_mutex);
+
+	if (he->host_id > sp->max_hosts) {
+		pthread_mutex_unlock(&spaces_mutex);
+		log_error("set_event invalid host_id %llu max_hosts %d",
+			  (unsigned long long)he->host_id, sp->max_hosts);
+		return -EINVAL;
+	}
 
 	if (!he->generation && (flags & SANLK_SETEV_CUR_GENERATION)) {
 		hs = &(sp->host_status[he->host_id-1]);
@@ -1587,16 +2635,21 @@ int lockspace_set_event(struct sanlk_lockspace *ls, struct sanlk_host_event *he,
 		goto out;
 	}
 set:
+	renew_expedite(sp, now);
 	sp->set_event_time = now;
 	sp->host_status[he->host_id-1].set_bit_time = now;
+	add_host_id(sp, he->host_id);
 	memcpy(&sp->host_event, he, sizeof(struct sanlk_host_event));
 
 	if (flags & SANLK_SETEV_ALL_HOSTS) {
-		for (i = 0; i < DEFAULT_MAX_HOSTS; i++)
+		/* see create_bitmap_and_extra */
+		for (i = 0; i < sp->max_hosts; i++)
 			sp->host_status[i].set_bit_time = now;
+		sp->set_all_bit_time = now;
 	}
 out:
 	pthread_mutex_unlock(&sp->mutex);
+	pthread_mutex_unlock(&spaces_mutex);
 	return rv;
 }
 
@@ -1662,7 +2715,7 @@ ret:
 
 static int stop_lockspace_thread(struct space *sp, int wait)
 {
-	int stop, rv;
+	int stop;
 
 	pthread_mutex_lock(&sp->mutex);
 	stop = sp->thread_stop;
@@ -1675,12 +2728,7 @@ static int stop_lockspace_thread(struct space *sp, int wait)
 		return -EINVAL;
 	}
 
-	if (wait)
-		rv = pthread_join(sp->thread, NULL);
-	else
-		rv = pthread_tryjoin_np(sp->thread, NULL);
-
-	return rv;
+	return join_lockspace_thread(sp, wait);
 }
 
 void free_lockspaces(int wait)
@@ -9,7 +9,7 @@
 #ifndef __LOCKSPACE_H__
 #define __LOCKSPACE__H__
 
-/* See resource.h for lock ordering between spaces_mutex and resource_mutex. */
+/* See resource.h for lock ordering between spaces_mutex and resource locks. */
 
 /* no locks */
 struct space *find_lockspace(const char *name);
@@ -25,6 +25,8 @@ int lockspace_disk(char *space_name, struct sync_disk *disk);
 
 /* locks spaces_mutex */
 int host_info(char *space_name, uint64_t host_id, struct host_status *hs_out);
+int host_info_wait(char *space_name, uint64_t host_id, uint64_t last_check,
+		   int wait_sec, struct host_status *hs_out);
 
 /* locks spaces_mutex, locks sp */
 int host_status_set_bit(char *space_name, uint64_t host_id);
@@ -36,9 +38,9 @@ int test_id_bit(int host_id, char *bitmap);
 void set_id_bit(int host_id, char *bitmap, char *c);
 
 /* locks sp */
-int check_our_lease(struct space *sp, int *check_all, char *check_buf);
+int check_our_lease(struct space *sp, int *check_all, char **check_buf);
 
-/* locks resource_mutex (add_host_event), locks resource_mutex (set_resource_examine) */
+/* locks resource_thread_mutex (add_host_event), locks resource shards (set_resource_examine) */
 void check_other_leases(struct space *sp, char *buf);
 
 /* locks spaces_mutex */
@@ -29,7 +29,6 @@
 #include "log.h"
 
 #define LOG_STR_LEN 512
-static char log_str[LOG_STR_LEN];
 
 static pthread_t thread_handle;
 
@@ -54,6 +53,49 @@ static unsigned int log_dropped;
 static unsigned int log_pending_ents;
 static unsigned int log_thread_done;
 
+/*
+ * Each thread adds its messages to its own ring without locking, and
+ * the log thread (or copy_log_dump) moves them, in seq order, into
+ * log_dump and log_ents while holding log_mutex.  The message text is
+ * formatted by the caller (args may point to memory that is gone by
+ * the time the log thread runs), but the time prefix is formatted when
+ * the message is moved.
+ */
+
+#define LOG_RING_SIZE (128 * 1024)
+#define LOG_DRAIN_MS 100
+
+struct log_rec {
+	uint64_t seq;
+	uint64_t mono;
+	struct timeval tv;
+	int level;
+	int len; /* of str including \0, -1 means skip to start of ring */
+	char str[];
+};
+
+struct log_ring {
+	struct list_head list;
+	pid_t tid;
+	int exited;
+	uint64_t head; /* only written by the thread */
+	char str[LOG_STR_LEN];
+	uint64_t tail; /* only written with log_mutex held */
+	char buf[LOG_RING_SIZE];
+};
+
+static LIST_HEAD(log_rings);
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_once = PTHREAD_ONCE_INIT;
+static __thread struct log_ring *log_ring_self;
+static uint64_t log_seq;
+static uint64_t log_seq_drained;
+static uint64_t log_seq_gap_mono;
+static unsigned int log_ring_dropped;
+
+static time_t log_time_sec = -1;
+static char log_time_str[64];
+
 static char logfile_path[PATH_MAX];
 static FILE *logfile_fp;
 
@@ -61,12 +103,12 @@ extern int log_logfile_priority;
 extern int log_syslog_priority;
 extern int log_stderr_priority;
 
-static void _log_save_dump(int level GNUC_UNUSED, int len)
+static void _log_save_dump(int level GNUC_UNUSED, char *str, int len)
 {
 	int i;
 
 	if (len < LOG_DUMP_SIZE - log_point) {
-		memcpy(log_dump+log_point, log_str, len);
+		memcpy(log_dump+log_point, str, len);
 		log_point += len;
 
 		if (log_point == LOG_DUMP_SIZE) {
@@ -77,7 +119,7 @@ static void _log_save_dump(int level GNUC_UNUSED, int len)
 	}
 
 	for (i = 0; i < len; i++) {
-		log_dump[log_point++] = log_str[i];
+		log_dump[log_point++] = str[i];
 
 		if (log_point == LOG_DUMP_SIZE) {
 			log_point = 0;
@@ -86,7 +128,7 @@ static void _log_save_dump(int level GNUC_UNUSED, int len)
 	}
 }
 
-static void _log_save_ent(int level, int len)
+static void _log_save_ent(int level, char *str, int len)
 {
 	struct entry *e;
 
@@ -103,84 +145,288 @@ static void _log_save_ent(int level, int len)
 	log_pending_ents++;
 
 	e->level = level;
-	memcpy(e->str, log_str, len);
+	memcpy(e->str, str, len);
+}
+
+/* the full line: time prefix, then str which begins with the name */
+
+static int log_format(char *buf, char *time_str, uint64_t mono, pid_t tid, char *str)
+{
+	int ret, pos = 0;
+	int len = LOG_STR_LEN - 2; /* leave room for \n\0 */
+
+	ret = snprintf(buf + pos, len - pos, "%s%llu [%u]: ",
+		       time_str, (unsigned long long)mono, tid);
+	pos += ret;
+
+	ret = snprintf(buf + pos, len - pos, "%s", str);
+
+	if (ret >= len - pos)
+		pos = len - 1;
+	else
+		pos += ret;
+
+	buf[pos++] = '\n';
+	buf[pos++] = '\0';
+	return pos;
+}
+
+static void log_ring_exit(void *arg)
+{
+	struct log_ring *r = arg;
+
+	__atomic_store_n(&r->exited, 1, __ATOMIC_RELEASE);
+	log_ring_self = NULL;
+}
+
+static void log_ring_init(void)
+{
+	pthread_key_create(&log_ring_key, log_ring_exit);
+}
+
+static struct log_ring *log_ring_get(void)
+{
+	struct log_ring *r;
+
+	if (log_ring_self)
+		return log_ring_self;
+
+	pthread_once(&log_ring_once, log_ring_init);
+
+	r = malloc(sizeof(struct log_ring));
+	if (!r)
+		return NULL;
+	memset(r, 0, offsetof(struct log_ring, buf));
+	r->tid = syscall(SYS_gettid);
+
+	pthread_mutex_lock(&log_mutex);
+	list_add_tail(&r->list, &log_rings);
+	pthread_mutex_unlock(&log_mutex);
+
+	pthread_setspecific(log_ring_key, r);
+	log_ring_self = r;
+	return r;
+}
+
+/* returns 1 when the ring becomes half full */
+
+static int log_ring_put(struct log_ring *r, int level, struct timeval *tv,
+			uint64_t mono, int len)
+{
+	struct log_rec *rec;
+	uint64_t head = r->head;
+	uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	int pos = head % LOG_RING_SIZE;
+	int need = (sizeof(struct log_rec) + len + 7) & ~7;
+	int used = head - tail;
+	int skip = 0;
+
+	if (LOG_RING_SIZE - pos < need)
+		skip = LOG_RING_SIZE - pos;
+
+	if (head + skip + need - tail > LOG_RING_SIZE) {
+		__atomic_add_fetch(&log_ring_dropped, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	if (skip) {
+		if (skip >= sizeof(struct log_rec))
+			((struct log_rec *)(r->buf + pos))->len = -1;
+		head += skip;
+		pos = 0;
+	}
+
+	rec = (struct log_rec *)(r->buf + pos);
+	rec->seq = __atomic_add_fetch(&log_seq, 1, __ATOMIC_RELAXED);
+	rec->mono = mono;
+	rec->tv = *tv;
+	rec->level = level;
+	rec->len = len;
+	memcpy(rec->str, r->str, len);
+
+	__atomic_store_n(&r->head, head + need, __ATOMIC_RELEASE);
+
+	return (used < LOG_RING_SIZE / 2) &&
+	       (used + skip + need >= LOG_RING_SIZE / 2);
+}
+
+/* the next message in the ring, skipping the unused end of the ring */
+
+static struct log_rec *log_ring_next(struct log_ring *r, uint64_t head)
+{
+	struct log_rec *rec;
+	int pos;
+
+	while (r->tail != head) {
+		pos = r->tail % LOG_RING_SIZE;
+
+		if (LOG_RING_SIZE - pos >= sizeof(struct log_rec)) {
+			rec = (struct log_rec *)(r->buf + pos);
+			if (rec->len >= 0)
+				return rec;
+		}
+		__atomic_store_n(&r->tail, r->tail + (LOG_RING_SIZE - pos), __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/*
+ * Called with log_mutex held.  Moves all messages from the rings into
+ * log_dump and log_ents, and frees the rings of threads that exited.
+ *
+ * A thread takes its seq before its message is published by the store
+ * to r->head, so the lowest published seq may not be the next one: the
+ * thread with the next seq hasn't published it yet.  The drain stops at
+ * that gap and the rest is moved by a later drain, once the message is
+ * there.  A gap that stays for a second is skipped, so a thread stalled
+ * in log_ring_put can't hold up the log.
+ */
+
+static void log_drain(void)
+{
+	struct log_ring *r, *safe, *best;
+	struct log_rec *rec, *best_rec;
+	struct tm time_info;
+	char str[LOG_STR_LEN];
+	uint64_t head;
+	int len;
+
+	while (1) {
+		best = NULL;
+		best_rec = NULL;
+
+		list_for_each_entry(r, &log_rings, list) {
+			head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+			rec = log_ring_next(r, head);
+			if (rec && (!best_rec || rec->seq < best_rec->seq)) {
+				best = r;
+				best_rec = rec;
+			}
+		}
+
+		if (!best)
+			break;
+
+		rec = best_rec;
+
+		if (rec->seq > log_seq_drained + 1) {
+			if (!log_seq_gap_mono)
+				log_seq_gap_mono = monotime();
+			if (monotime() - log_seq_gap_mono < 1)
+				break;
+		}
+		log_seq_gap_mono = 0;
+		if (rec->seq > log_seq_drained)
+			log_seq_drained = rec->seq;
+
+		if (rec->tv.tv_sec != log_time_sec) {
+			localtime_r(&rec->tv.tv_sec, &time_info);
+			strftime(log_time_str, sizeof(log_time_str),
+				 "%Y-%m-%d %H:%M:%S%z ", &time_info);
+			log_time_sec = rec->tv.tv_sec;
+		}
+
+		len = log_format(str, log_time_str, rec->mono, best->tid, rec->str);
+
+		/*
+		 * save all messages in circular buffer "log_dump" that can be
+		 * sent over unix socket
+		 */
+
+		_log_save_dump(rec->level, str, len - 1);
+
+		/*
+		 * save some messages in circular array "log_ents" that a thread
+		 * writes to logfile/syslog
+		 */
+
+		if (rec->level <= log_logfile_priority || rec->level <= log_syslog_priority)
+			_log_save_ent(rec->level, str, len);
+
+		__atomic_store_n(&best->tail,
+				 best->tail + ((sizeof(struct log_rec) + rec->len + 7) & ~7),
+				 __ATOMIC_RELEASE);
+	}
+
+	log_dropped += __atomic_exchange_n(&log_ring_dropped, 0, __ATOMIC_RELAXED);
+
+	list_for_each_entry_safe(r, safe, &log_rings, list) {
+		if (!__atomic_load_n(&r->exited, __ATOMIC_ACQUIRE))
+			continue;
+		if (r->tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+			continue;
+		list_del(&r->list);
+		free(r);
+	}
 }
 
 /*
  * This log function:
- * 1. formats the log message in the log_str buffer
- * 2. copies log_str into the log_dump circular buffer
- * 3. copies log_str into the log_ents circular array to be written to
+ * 1. formats the log message in the thread's ring
+ * 2. wakes the log thread if the message is for logfile/syslog, or the
+ *    ring is filling up, to move messages into the log_dump circular
+ *    buffer, and into the log_ents circular array to be written to
  *    logfile and/or syslog (so callers don't block writing messages to files)
  */
 
 void log_level(uint32_t space_id, uint32_t token_id, char *name_in, int level, const char *fmt, ...)
 {
 	va_list ap;
-	char name[NAME_ID_SIZE + 1];
+	struct log_ring *r;
+	char line[LOG_STR_LEN];
+	char time_str[64];
 	int ret, pos = 0;
-	int len = LOG_STR_LEN - 2; /* leave room for \n\0 */
+	int len = LOG_STR_LEN - 1;
 	struct timeval cur_time;
 	struct tm time_info;
-	pid_t tid;
+	uint64_t mono;
+	int wake;
 
-	memset(name, 0, sizeof(name));
+	r = log_ring_get();
+	if (!r) {
+		__atomic_add_fetch(&log_ring_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
 
 	if (space_id && !token_id)
-		snprintf(name, NAME_ID_SIZE, "s%u ", space_id);
+		ret = snprintf(r->str, NAME_ID_SIZE, "s%u ", space_id);
 	else if (!space_id && token_id)
-		snprintf(name, NAME_ID_SIZE, "r%u ", token_id);
+		ret = snprintf(r->str, NAME_ID_SIZE, "r%u ", token_id);
 	else if (space_id && token_id)
-		snprintf(name, NAME_ID_SIZE, "s%u:r%u ", space_id, token_id);
+		ret = snprintf(r->str, NAME_ID_SIZE, "s%u:r%u ", space_id, token_id);
 	else if (name_in)
-		snprintf(name, NAME_ID_SIZE, "%.8s ", name_in);
-
-	pthread_mutex_lock(&log_mutex);
-
-	gettimeofday(&cur_time, NULL);
-	localtime_r(&cur_time.tv_sec, &time_info);
-	ret = strftime(log_str + pos, len - pos,
-		       "%Y-%m-%d %H:%M:%S%z ", &time_info);
-	pos += ret;
-
-	tid = syscall(SYS_gettid);
-
-	ret = snprintf(log_str + pos, len - pos, "%llu [%u]: %s",
-		       (unsigned long long) monotime(), tid, name);
-	pos += ret;
+		ret = snprintf(r->str, NAME_ID_SIZE, "%.8s ", name_in);
+	else
+		ret = 0;
+	pos = (ret < NAME_ID_SIZE) ? ret : NAME_ID_SIZE - 1;
 
 	va_start(ap, fmt);
-	ret = vsnprintf(log_str + pos, len - pos, fmt, ap);
+	ret = vsnprintf(r->str + pos, len - pos, fmt, ap);
 	va_end(ap);
 
 	if (ret >= len - pos)
 		pos = len - 1;
 	else
 		pos += ret;
+	r->str[pos++] = '\0';
 
-	log_str[pos++] = '\n';
-	log_str[pos++] = '\0';
-
-	/*
-	 * save all messages in circular buffer "log_dump" that can be
-	 * sent over unix socket
-	 */
-
-	_log_save_dump(level, pos - 1);
+	gettimeofday(&cur_time, NULL);
+	mono = monotime();
 
-	/*
-	 * save some messages in circular array "log_ents" that a thread
-	 * writes to logfile/syslog
-	 */
+	wake = log_ring_put(r, level, &cur_time, mono, pos);
 
 	if (level <= log_logfile_priority || level <= log_syslog_priority)
-		_log_save_ent(level, pos);
+		wake = 1;
 
-	if (level <= log_stderr_priority)
-		fprintf(stderr, "%s", log_str);
+	if (wake)
+		pthread_cond_signal(&log_cond);
 
-	pthread_cond_signal(&log_cond);
-	pthread_mutex_unlock(&log_mutex);
+	if (level <= log_stderr_priority) {
+		localtime_r(&cur_time.tv_sec, &time_info);
+		strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S%z ", &time_info);
+		log_format(line, time_str, mono, r->tid, r->str);
+		fprintf(stderr, "%s", line);
+	}
 }
 
 static void write_entry(int level, char *str)
@@ -206,6 +452,10 @@ void copy_log_dump(char *buf, int *len)
 
 	pthread_mutex_lock(&log_mutex);
 
+	log_drain();
+	if (log_head_ent != log_tail_ent)
+		pthread_cond_signal(&log_cond);
+
 	if (!log_wrap && !log_point) {
 		*len = 0;
 	} else if (log_wrap) {
@@ -224,17 +474,26 @@ void copy_log_dump(char *buf, int *len)
 static void *log_thread_fn(void *arg GNUC_UNUSED)
 {
 	char str[LOG_STR_LEN];
+	struct timespec ts;
 	struct entry *e;
 	int level, prev_dropped = 0;
 
 	while (1) {
 		pthread_mutex_lock(&log_mutex);
+		log_drain();
 		while (log_head_ent == log_tail_ent) {
 			if (log_thread_done) {
 				pthread_mutex_unlock(&log_mutex);
 				goto out;
 			}
-			pthread_cond_wait(&log_cond, &log_mutex);
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += LOG_DRAIN_MS * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&log_cond, &log_mutex, &ts);
+			log_drain();
 		}
 
 		e = &log_ents[log_tail_ent++];
@@ -19,7 +19,6 @@
 #include <time.h>
 #include <syslog.h>
 #include <pthread.h>
-#include <poll.h>
 #include <sched.h>
 #include <pwd.h>
 #include <grp.h>
@@ -34,8 +33,10 @@
 #include <sys/mman.h>
 #include <sys/utsname.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #include <uuid/uuid.h>
-#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 #define EXTERN
 #include "sanlock_internal.h"
@@ -60,14 +61,31 @@
 
 #define SIGRUNPATH 100 /* anything that's not SIGTERM/SIGKILL */
 
+/*
+ * Cmds that don't do disk io or wait are queued on fast_data, which
+ * workers check first, and which the fast worker handles exclusively,
+ * so they are not stuck behind slow cmds when all workers are busy.
+ * Workers above min_workers exit after WORKER_IDLE_SECONDS unused.
+ * Workers waiting for a busy lease (SANLK_ACQUIRE_WAIT) are not counted
+ * against max_workers, see thread_pool_wait_begin.
+ */
+
+#define WORKER_IDLE_SECONDS 60
+
 struct thread_pool {
 	int num_workers;
+	int min_workers;
 	int max_workers;
 	int free_workers;
+	int wait_workers;
+	int fast_worker;
+	int fast_free;
 	int quit;
 	struct list_head work_data;
+	struct list_head fast_data;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
+	pthread_cond_t fast_cond;
 	pthread_cond_t quit_wait;
 };
 
@@ -76,10 +94,14 @@ int log_logfile_priority = LOG_WARNING;
 int log_syslog_priority = LOG_ERR;
 int log_stderr_priority = -1; /* -D sets this to LOG_DEBUG */
 
-#define CLIENT_NALLOC 1024
+#define MAX_EVENTS 64
+#define PIPELINE_OUT_MAX (1024 * 1024)
 static int client_maxi;
 static int client_size = 0;
-static struct pollfd *pollfd;
+static int epoll_fd = -1;
+static int *client_free_slots; /* stack of unused ci */
+static int client_free_count;
+static pthread_mutex_t client_slots_mutex = PTHREAD_MUTEX_INITIALIZER;
 static char command[COMMAND_MAX];
 static int cmd_argc;
 static char **cmd_argv;
@@ -87,15 +109,37 @@ static struct thread_pool pool;
 static struct random_data rand_data;
 static char rand_state[32];
 static pthread_mutex_t rand_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int killed_pid_exited; /* main_loop checks lockspaces right away */
+
+static void client_ignore(int ci);
+static void pipeline_out_clear(struct client *cl);
+
+#ifndef __NR_pidfd_send_signal
+#define __NR_pidfd_send_signal 424
+#endif
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+static int sys_pidfd_open(int pid)
+{
+	int rv = syscall(__NR_pidfd_open, pid, 0);
+	return rv < 0 ? -errno : rv;
+}
+
+static int sys_pidfd_send_signal(int pidfd, int sig)
+{
+	int rv = syscall(__NR_pidfd_send_signal, pidfd, sig, NULL, 0);
+	return rv < 0 ? -errno : rv;
+}
 
 static void close_helper(void)
 {
+	client_ignore(helper_ci);
 	close(helper_kill_fd);
 	close(helper_status_fd);
 	helper_kill_fd = -1;
 	helper_status_fd = -1;
-	pollfd[helper_ci].fd = -1;
-	pollfd[helper_ci].events = 0;
 	helper_ci = -1;
 
 	/* don't set helper_pid = -1 until we've tried waitpid */
@@ -183,39 +227,172 @@ static void send_helper_kill(struct space *sp, struct client *cl, int sig)
 		cl->flags |= CL_RUNPATH_SENT;
 }
 
-/* FIXME: add a mutex for client array so we don't try to expand it
-   while a cmd thread is using it.  Or, with a thread pool we know
-   when cmd threads are running and can expand when none are. */
+/*
+ * Signal the pid through its pidfd, which can't refer to a different
+ * process if the pid exits and is reused.  The helper (which runs as
+ * root) is used for killpath, and when the daemon runs as a user that
+ * can't signal the pid.
+ */
+
+static void send_kill(struct space *sp, struct client *cl, int pidfd, int sig)
+{
+	int rv;
+
+	if (sig == SIGRUNPATH || pidfd < 0)
+		goto helper;
+
+	rv = sys_pidfd_send_signal(pidfd, sig);
+	if (!rv) {
+		log_erros(sp, "kill %d sig %d count %d", cl->pid, sig, cl->kill_count);
+		return;
+	}
+	if (rv == -ESRCH) {
+		log_space(sp, "kill %d sig %d exited", cl->pid, sig);
+		return;
+	}
+	log_space(sp, "kill %d sig %d pidfd error %d", cl->pid, sig, rv);
+ helper:
+	send_helper_kill(sp, cl, sig);
+}
+
+/*
+ * The client array is sized once from max_clients because cmd threads
+ * hold pointers into it.  Unused slots are kept on a stack so client_add
+ * does not scan the array.
+ */
 
 static int client_alloc(void)
 {
 	int i;
 
-	/* pollfd is one element longer as we use an additional element for the
-	 * eventfd notification mechanism */
-	client = malloc(CLIENT_NALLOC * sizeof(struct client));
-	pollfd = malloc((CLIENT_NALLOC+1) * sizeof(struct pollfd));
+	client = malloc(com.max_clients * sizeof(struct client));
+	client_free_slots = malloc(com.max_clients * sizeof(int));
 
-	if (!client || !pollfd) {
-		log_error("can't alloc for client or pollfd array");
+	if (!client || !client_free_slots) {
+		log_error("can't alloc for client array");
 		return -ENOMEM;
 	}
 
-	for (i = 0; i < CLIENT_NALLOC; i++) {
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		log_error("can't create epoll fd %d", errno);
+		return -errno;
+	}
+
+	for (i = 0; i < com.max_clients; i++) {
 		memset(&client[i], 0, sizeof(struct client));
-		memset(&pollfd[i], 0, sizeof(struct pollfd));
 
 		pthread_mutex_init(&client[i].mutex, NULL);
+		pthread_mutex_init(&client[i].send_mutex, NULL);
 		client[i].fd = -1;
 		client[i].pid = -1;
-
-		pollfd[i].fd = -1;
-		pollfd[i].events = 0;
+		client[i].pidfd = -1;
+		client[i].pipe_out_fd = -1;
 	}
-	client_size = CLIENT_NALLOC;
+
+	/* lowest ci on top of the stack */
+	for (i = 0; i < com.max_clients; i++)
+		client_free_slots[i] = com.max_clients - 1 - i;
+	client_free_count = com.max_clients;
+
+	client_size = com.max_clients;
 	return 0;
 }
 
+/*
+ * epoll data holds the slot's gen, the type of fd (connection, pidfd or
+ * pipe_out_fd), and ci.  An event queued for a client that has since been
+ * freed, whose slot and fd may both have been reused, has an old gen and
+ * is ignored; an event for the pidfd or pipe_out_fd never goes to workfn.
+ */
+
+#define EV_PIDFD 0x80000000
+#define EV_OUT   0x40000000
+#define EV_CI    0x3FFFFFFF
+
+static void client_watch(int ci, int fd)
+{
+	struct epoll_event ev;
+	uint32_t type = 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+
+	if (fd == client[ci].pidfd) {
+		type = EV_PIDFD;
+	} else if (fd == client[ci].pipe_out_fd) {
+		type = EV_OUT;
+		ev.events = EPOLLOUT;
+	}
+
+	ev.data.u64 = ((uint64_t)client[ci].gen << 32) | type | (uint32_t)ci;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST)
+		log_error("client_watch ci %d fd %d error %d", ci, fd, errno);
+}
+
+static void client_ignore(int ci)
+{
+	if (ci < 0 || client[ci].fd < 0)
+		return;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client[ci].fd, NULL);
+}
+
+static void client_close_pidfd(struct client *cl)
+{
+	if (cl->pidfd < 0)
+		return;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, cl->pidfd, NULL);
+	close(cl->pidfd);
+	cl->pidfd = -1;
+}
+
+/* the pidfd becomes readable when the registered pid exits */
+
+void client_watch_pid(int ci);
+void client_watch_pid(int ci)
+{
+	struct client *cl = &client[ci];
+	int pidfd;
+
+	pidfd = sys_pidfd_open(cl->pid);
+	if (pidfd < 0) {
+		/* connection close still shows the pid exit */
+		log_debug("client_watch_pid %d,%d,%d pidfd error %d",
+			  ci, cl->fd, cl->pid, pidfd);
+		return;
+	}
+	fcntl(pidfd, F_SETFD, FD_CLOEXEC);
+
+	pthread_mutex_lock(&cl->mutex);
+	client_close_pidfd(cl);
+	cl->pidfd = pidfd;
+	pthread_mutex_unlock(&cl->mutex);
+
+	client_watch(ci, pidfd);
+}
+
+static void client_put_slot(int ci)
+{
+	pthread_mutex_lock(&client_slots_mutex);
+	client_free_slots[client_free_count++] = ci;
+	pthread_mutex_unlock(&client_slots_mutex);
+}
+
+static int client_get_slot(void)
+{
+	int ci = -1;
+
+	pthread_mutex_lock(&client_slots_mutex);
+	if (client_free_count)
+		ci = client_free_slots[--client_free_count];
+	pthread_mutex_unlock(&client_slots_mutex);
+
+	return ci;
+}
+
 static void _client_free(int ci)
 {
 	struct client *cl = &client[ci];
@@ -245,8 +422,20 @@ static void _client_free(int ci)
 		goto out;
 	}
 
-	if (cl->fd != -1)
+	if (cl->cmd_inflight) {
+		/* the last pipelined cmd to finish frees the client */
+		log_debug("client_free ci %d cmds inflight %d", ci, cl->cmd_inflight);
+		client_ignore(ci);
+		cl->need_free = 1;
+		goto out;
+	}
+
+	if (cl->fd != -1) {
+		client_ignore(ci);
 		close(cl->fd);
+	}
+
+	client_close_pidfd(cl);
 
 	cl->used = 0;
 	cl->fd = -1;
@@ -270,9 +459,19 @@ static void _client_free(int ci)
 	cl->tokens = NULL;
 	cl->tokens_slots = 0;
 
-	/* make poll() ignore this connection */
-	pollfd[ci].fd = -1;
-	pollfd[ci].events = 0;
+	if (cl->pipe_h)
+		free(cl->pipe_h);
+	if (cl->pipe_data)
+		free(cl->pipe_data);
+	cl->pipe_h = NULL;
+	cl->pipe_data = NULL;
+	cl->pipe_pos = 0;
+
+	pthread_mutex_lock(&cl->send_mutex);
+	pipeline_out_clear(cl);
+	pthread_mutex_unlock(&cl->send_mutex);
+
+	client_put_slot(ci);
  out:
 	return;
 }
@@ -320,9 +519,8 @@ static int client_suspend(int ci)
 
 	cl->suspend = 1;
 
-	/* make poll() ignore this connection */
-	pollfd[ci].fd = -1;
-	pollfd[ci].events = 0;
+	/* make main_loop ignore this connection */
+	client_ignore(ci);
  out:
 	pthread_mutex_unlock(&cl->mutex);
 
@@ -360,12 +558,9 @@ void client_resume(int ci)
 		log_debug("client_resume ci %d need_free", ci);
 		_client_free(ci);
 	} else {
-		/* make poll() watch this connection */
-		pollfd[ci].fd = cl->fd;
-		pollfd[ci].events = POLLIN;
-
-		/* interrupt any poll() that might already be running */
-		eventfd_write(efd, 1);
+		/* make main_loop watch this connection again; a running
+		   epoll_wait sees the new registration */
+		client_watch(ci, cl->fd);
 	}
  out:
 	pthread_mutex_unlock(&cl->mutex);
@@ -376,28 +571,32 @@ static int client_add(int fd, void (*workfn)(int ci), void (*deadfn)(int ci))
 	struct client *cl;
 	int i;
 
-	for (i = 0; i < client_size; i++) {
-		cl = &client[i];
-		pthread_mutex_lock(&cl->mutex);
-		if (!cl->used) {
-			cl->used = 1;
-			cl->fd = fd;
-			cl->workfn = workfn;
-			cl->deadfn = deadfn ? deadfn : client_free;
-
-			/* make poll() watch this connection */
-			pollfd[i].fd = fd;
-			pollfd[i].events = POLLIN;
-
-			if (i > client_maxi)
-				client_maxi = i;
-			pthread_mutex_unlock(&cl->mutex);
-			return i;
-		}
+	i = client_get_slot();
+	if (i < 0) {
+		log_error("client_add fd %d no free slots %d", fd, client_size);
+		return -1;
+	}
+
+	cl = &client[i];
+	pthread_mutex_lock(&cl->mutex);
+	if (cl->used) {
+		/* should never happen */
+		log_error("client_add ci %d fd %d slot used", i, cl->fd);
 		pthread_mutex_unlock(&cl->mutex);
+		return -1;
 	}
+	cl->used = 1;
+	cl->gen++;
+	cl->fd = fd;
+	cl->workfn = workfn;
+	cl->deadfn = deadfn ? deadfn : client_free;
 
-	return -1;
+	client_watch(i, fd);
+
+	if (i > client_maxi)
+		client_maxi = i;
+	pthread_mutex_unlock(&cl->mutex);
+	return i;
 }
 
 /* clear the unreceived portion of an aborted command */
@@ -409,7 +608,8 @@ void client_recv_all(int ci, struct sm_header *h_recv, int pos)
 	int rem = h_recv->length - sizeof(struct sm_header) - pos;
 	int rv, error = 0, total = 0, retries = 0;
 
-	if (!rem)
+	/* pipelined cmd data was read before the cmd was queued */
+	if (!rem || (client[ci].flags & CL_PIPELINE))
 		return;
 
 	while (1) {
@@ -437,19 +637,264 @@ void client_recv_all(int ci, struct sm_header *h_recv, int pos)
 		  ci, client[ci].fd, client[ci].pid, pos, rv, error, retries, rem, total);
 }
 
+static void result_header(struct sm_header *h, struct sm_header *h_recv, int result)
+{
+	memcpy(h, h_recv, sizeof(struct sm_header));
+	h->version = SM_PROTO;
+	h->length = sizeof(struct sm_header);
+	h->data = result;
+	h->data2 = 0;
+}
+
 void send_result(int fd, struct sm_header *h_recv, int result);
 void send_result(int fd, struct sm_header *h_recv, int result)
 {
 	struct sm_header h;
 
-	memcpy(&h, h_recv, sizeof(struct sm_header));
-	h.version = SM_PROTO;
-	h.length = sizeof(h);
-	h.data = result;
-	h.data2 = 0;
+	result_header(&h, h_recv, result);
 	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
 }
 
+/*
+ * Cmds on a pipelined connection run concurrently.  The main loop reads
+ * all the data for a cmd before queueing it, and the reply is collected
+ * and sent as a whole under send_mutex so that replies don't interleave.
+ * While the cmds are in flight, the client is not freed.
+ */
+
+/*
+ * Replies never block a worker thread: what the socket won't take is
+ * queued in pipe_out, and main_loop sends the rest when pipe_out_fd (a
+ * dup of fd, so it can be watched for EPOLLOUT apart from the EPOLLIN
+ * watch on fd) is writable.  A client that submits cmds without reading
+ * the replies is disconnected once PIPELINE_OUT_MAX is queued.
+ */
+
+/* returns bytes sent, or -1 if the connection failed */
+
+static int pipeline_send_nb(int ci, char *p, int len)
+{
+	struct client *cl = &client[ci];
+	int rv, sent = 0;
+
+	while (sent < len) {
+		rv = send(cl->fd, p + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv < 0 && errno == EAGAIN)
+			break;
+		if (rv <= 0) {
+			log_debug("pipeline_send ci %d fd %d error %d", ci, cl->fd, errno);
+			return -1;
+		}
+		sent += rv;
+	}
+	return sent;
+}
+
+/* called with send_mutex held */
+
+static void pipeline_out_clear(struct client *cl)
+{
+	if (cl->pipe_out_fd >= 0) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, cl->pipe_out_fd, NULL);
+		close(cl->pipe_out_fd);
+		cl->pipe_out_fd = -1;
+	}
+	if (cl->pipe_out)
+		free(cl->pipe_out);
+	cl->pipe_out = NULL;
+	cl->pipe_out_len = 0;
+	cl->pipe_out_size = 0;
+}
+
+/* called with send_mutex held */
+
+static int pipeline_out_queue(int ci, char *p, int len)
+{
+	struct client *cl = &client[ci];
+	char *out;
+	int size;
+
+	if (cl->pipe_out_len + len > PIPELINE_OUT_MAX) {
+		log_error("pipeline_send ci %d fd %d replies not read", ci, cl->fd);
+		return -1;
+	}
+
+	if (cl->pipe_out_len + len > cl->pipe_out_size) {
+		size = cl->pipe_out_size ? cl->pipe_out_size : 4096;
+		while (size < cl->pipe_out_len + len)
+			size *= 2;
+
+		out = realloc(cl->pipe_out, size);
+		if (!out)
+			return -1;
+		cl->pipe_out = out;
+		cl->pipe_out_size = size;
+	}
+
+	memcpy(cl->pipe_out + cl->pipe_out_len, p, len);
+	cl->pipe_out_len += len;
+
+	if (cl->pipe_out_fd < 0) {
+		cl->pipe_out_fd = fcntl(cl->fd, F_DUPFD_CLOEXEC, 0);
+		if (cl->pipe_out_fd < 0) {
+			log_error("pipeline_send ci %d fd %d dup error %d", ci, cl->fd, errno);
+			return -1;
+		}
+		client_watch(ci, cl->pipe_out_fd);
+	}
+	return 0;
+}
+
+static void pipeline_send(int ci, void *buf, int len)
+{
+	struct client *cl = &client[ci];
+	int sent = 0;
+
+	pthread_mutex_lock(&cl->send_mutex);
+
+	/* earlier replies are still queued, this one goes after them */
+	if (!cl->pipe_out_len)
+		sent = pipeline_send_nb(ci, buf, len);
+
+	if (sent >= 0 && sent < len)
+		sent = pipeline_out_queue(ci, (char *)buf + sent, len - sent);
+
+	if (sent < 0) {
+		pipeline_out_clear(cl);
+		shutdown(cl->fd, SHUT_RDWR);
+	}
+	pthread_mutex_unlock(&cl->send_mutex);
+}
+
+/* main_loop: pipe_out_fd is writable */
+
+static void pipeline_flush(int ci)
+{
+	struct client *cl = &client[ci];
+	int sent;
+
+	pthread_mutex_lock(&cl->send_mutex);
+	if (cl->pipe_out_fd < 0)
+		goto out;
+
+	sent = pipeline_send_nb(ci, cl->pipe_out, cl->pipe_out_len);
+	if (sent < 0) {
+		pipeline_out_clear(cl);
+		shutdown(cl->fd, SHUT_RDWR);
+		goto out;
+	}
+
+	cl->pipe_out_len -= sent;
+	if (!cl->pipe_out_len) {
+		pipeline_out_clear(cl);
+		goto out;
+	}
+	memmove(cl->pipe_out, cl->pipe_out + sent, cl->pipe_out_len);
+ out:
+	pthread_mutex_unlock(&cl->send_mutex);
+}
+
+static void pipeline_put(int ci)
+{
+	struct client *cl = &client[ci];
+
+	pthread_mutex_lock(&cl->mutex);
+	cl->cmd_inflight--;
+
+	if (cl->need_free) {
+		if (!cl->cmd_inflight) {
+			cl->suspend = 0;
+			_client_free(ci);
+		}
+	} else if (cl->suspend && cl->cmd_inflight < MAX_PIPELINE_CMDS) {
+		cl->suspend = 0;
+		client_watch(ci, cl->fd);
+	}
+	pthread_mutex_unlock(&cl->mutex);
+}
+
+static void pipeline_reply(int ci, struct sm_header *h_recv, int result)
+{
+	struct sm_header h;
+
+	result_header(&h, h_recv, result);
+	pipeline_send(ci, &h, sizeof(h));
+	pipeline_put(ci);
+}
+
+int ca_recv(struct cmd_args *ca, void *buf, int len)
+{
+	if (!ca->pipelined)
+		return recv(client[ca->ci_in].fd, buf, len, MSG_WAITALL);
+
+	if (len > ca->data_len - ca->data_pos)
+		len = ca->data_len - ca->data_pos;
+	if (len <= 0)
+		return 0;
+
+	memcpy(buf, ca->data + ca->data_pos, len);
+	ca->data_pos += len;
+	return len;
+}
+
+void ca_send(struct cmd_args *ca, void *buf, int len)
+{
+	char *reply;
+	int size;
+
+	if (!ca->pipelined) {
+		send(client[ca->ci_in].fd, buf, len, MSG_NOSIGNAL);
+		return;
+	}
+
+	if (ca->reply_error)
+		return;
+
+	if (ca->reply_len + len > ca->reply_size) {
+		size = ca->reply_size ? ca->reply_size : 256;
+		while (size < ca->reply_len + len)
+			size *= 2;
+
+		reply = realloc(ca->reply, size);
+		if (!reply) {
+			ca->reply_error = -ENOMEM;
+			return;
+		}
+		ca->reply = reply;
+		ca->reply_size = size;
+	}
+
+	memcpy(ca->reply + ca->reply_len, buf, len);
+	ca->reply_len += len;
+}
+
+void ca_send_result(struct cmd_args *ca, int result)
+{
+	struct sm_header h;
+
+	result_header(&h, &ca->header, result);
+	ca_send(ca, &h, sizeof(h));
+}
+
+/* the reply is complete, the client can be resumed or freed */
+
+void ca_done(struct cmd_args *ca)
+{
+	if (!ca->pipelined) {
+		client_resume(ca->ci_in);
+		return;
+	}
+
+	if (ca->reply_error)
+		pipeline_reply(ca->ci_in, &ca->header, ca->reply_error);
+	else {
+		pipeline_send(ca->ci_in, ca->reply, ca->reply_len);
+		pipeline_put(ca->ci_in);
+	}
+}
+
 void client_pid_dead(int ci);
 void client_pid_dead(int ci)
 {
@@ -463,6 +908,12 @@ void client_pid_dead(int ci)
 	   are accessing cl->tokens */
 
 	pthread_mutex_lock(&cl->mutex);
+	if (cl->used && cl->pid_dead) {
+		/* the pidfd and the connection both reported the exit */
+		pthread_mutex_unlock(&cl->mutex);
+		return;
+	}
+
 	if (!cl->used || cl->fd == -1 || cl->pid == -1) {
 		/* should never happen */
 		pthread_mutex_unlock(&cl->mutex);
@@ -475,8 +926,10 @@ void client_pid_dead(int ci)
 	log_debug("client_pid_dead %d,%d,%d cmd_active %d suspend %d",
 		  ci, cl->fd, cl->pid, cl->cmd_active, cl->suspend);
 
-	if (cl->kill_count)
+	if (cl->kill_count) {
 		log_error("dead %d ci %d count %d", cl->pid, ci, cl->kill_count);
+		killed_pid_exited = 1;
+	}
 
 	cmd_active = cl->cmd_active;
 	pid = cl->pid;
@@ -487,9 +940,9 @@ void client_pid_dead(int ci)
 	   cl->mutex to set cl->cmd_active to 0, it will see cl->pid_dead is 1
 	   and know they need to release cl->tokens and call client_free */
 
-	/* make poll() ignore this connection */
-	pollfd[ci].fd = -1;
-	pollfd[ci].events = 0;
+	/* make main_loop ignore this connection */
+	client_ignore(ci);
+	client_close_pidfd(cl);
 
 	pthread_mutex_unlock(&cl->mutex);
 
@@ -502,6 +955,7 @@ void client_pid_dead(int ci)
 	if (cmd_active) {
 		log_debug("client_pid_dead %d,%d,%d defer to cmd %d",
 			  ci, cl->fd, pid, cmd_active);
+		abort_token_waiters(pid);
 		return;
 	}
 
@@ -520,6 +974,56 @@ void client_pid_dead(int ci)
 	pthread_mutex_unlock(&cl->mutex);
 }
 
+/*
+ * The pidfd becomes readable when the registered pid exits.  Leases are
+ * held until the registered connection is closed, so the exit is only
+ * handled as the client's death if no other process, e.g. a child,
+ * still holds the connection; otherwise the connection close is the
+ * signal, as without pidfds.  The pidfd is kept for send_kill.
+ */
+
+static int client_conn_closed(int fd)
+{
+	struct pollfd pollfd;
+
+	pollfd.fd = fd;
+	pollfd.events = POLLRDHUP;
+	pollfd.revents = 0;
+
+	if (poll(&pollfd, 1, 0) < 0)
+		return 0;
+
+	return (pollfd.revents & (POLLHUP | POLLRDHUP | POLLERR)) ? 1 : 0;
+}
+
+static void client_pidfd_exited(int ci)
+{
+	struct client *cl = &client[ci];
+	struct pollfd pollfd;
+
+	/* the event may be from a pidfd that has since been replaced */
+	pollfd.fd = cl->pidfd;
+	pollfd.events = POLLIN;
+	pollfd.revents = 0;
+
+	if (cl->pidfd < 0 || poll(&pollfd, 1, 0) <= 0)
+		return;
+
+	if (client_conn_closed(cl->fd)) {
+		log_debug("client pidfd %d,%d,%d exited",
+			  ci, cl->fd, cl->pid);
+		client_pid_dead(ci);
+		return;
+	}
+
+	log_debug("client pidfd %d,%d,%d exited, connection still open",
+		  ci, cl->fd, cl->pid);
+
+	pthread_mutex_lock(&cl->mutex);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, cl->pidfd, NULL);
+	pthread_mutex_unlock(&cl->mutex);
+}
+
 /* At some point we may want to keep a record of each pid using a lockspace
    in the sp struct to avoid walking through each client's cl->tokens to see if
    it's using the lockspace.  It should be the uncommon situation where a
@@ -565,7 +1069,7 @@ static void kill_pids(struct space *sp)
 	struct client *cl;
 	uint64_t now, last_success;
 	int id_renewal_fail_seconds;
-	int ci, sig;
+	int ci, sig, pidfd;
 	int do_kill, in_grace;
 
 	/*
@@ -648,6 +1152,11 @@ static void kill_pids(struct space *sp)
 		if ((sig == SIGTERM) && (cl->restricted & SANLK_RESTRICT_SIGTERM))
 			sig = SIGKILL;
 
+		/* _client_free can close cl->pidfd once the mutex is
+		   released, so signal through a copy */
+		pidfd = -1;
+		if (cl->pidfd >= 0)
+			pidfd = fcntl(cl->pidfd, F_DUPFD_CLOEXEC, 0);
 		do_kill = 1;
  unlock:
 		pthread_mutex_unlock(&cl->mutex);
@@ -655,7 +1164,10 @@ static void kill_pids(struct space *sp)
 		if (!do_kill)
 			continue;
 
-		send_helper_kill(sp, cl, sig);
+		send_kill(sp, cl, pidfd, sig);
+
+		if (pidfd >= 0)
+			close(pidfd);
 	}
 }
 
@@ -703,7 +1215,7 @@ static int all_pids_dead(struct space *sp)
 	if (sp->flags & SP_USED_BY_ORPHANS) {
 		/*
 		 * lock ordering: spaces_mutex (main_loop), then
-		 * resource_mutex (resource_orphan_count)
+		 * resource shards (resource_orphan_count)
 		 */
 		int orphans = resource_orphan_count(sp->space_name);
 		if (orphans) {
@@ -736,59 +1248,74 @@ static int main_loop(void)
 {
 	void (*workfn) (int ci);
 	void (*deadfn) (int ci);
+	struct epoll_event events[MAX_EVENTS];
 	struct space *sp, *safe;
 	struct timeval now, last_check;
 	int poll_timeout, check_interval;
 	unsigned int ms;
-	int i, rv, empty, check_all;
+	uint32_t gen;
+	int i, ci, rv, empty, check_all;
 	char *check_buf = NULL;
-	int check_buf_len = 0;
-	uint64_t ebuf;
 
 	gettimeofday(&last_check, NULL);
 	poll_timeout = STANDARD_CHECK_INTERVAL;
 	check_interval = STANDARD_CHECK_INTERVAL;
 
 	while (1) {
-		/* as well as the clients, check the eventfd */
-		pollfd[client_maxi+1].fd = efd;
-		pollfd[client_maxi+1].events = POLLIN;
-
-		rv = poll(pollfd, client_maxi + 2, poll_timeout);
+		rv = epoll_wait(epoll_fd, events, MAX_EVENTS, poll_timeout);
 		if (rv == -1 && errno == EINTR)
 			continue;
 		if (rv < 0) {
 			/* not sure */
+			rv = 0;
 		}
-		for (i = 0; i <= client_maxi + 1; i++) {
-			if (pollfd[i].fd == efd && pollfd[i].revents & POLLIN) {
-				/* a client_resume completed */
-				eventfd_read(efd, &ebuf);
+		for (i = 0; i < rv; i++) {
+			ci = (int)(events[i].data.u64 & EV_CI);
+			gen = (uint32_t)(events[i].data.u64 >> 32);
+
+			/* freed, or freed and reused, since the event */
+			if (client[ci].fd < 0 || client[ci].gen != gen)
+				continue;
+
+			/* the registered pid exited */
+			if (events[i].data.u64 & EV_PIDFD) {
+				client_pidfd_exited(ci);
 				continue;
 			}
-			if (client[i].fd < 0)
+
+			/* queued replies can be sent */
+			if (events[i].data.u64 & EV_OUT) {
+				pipeline_flush(ci);
 				continue;
-			if (pollfd[i].revents & POLLIN) {
-				workfn = client[i].workfn;
+			}
+
+			if (events[i].events & EPOLLIN) {
+				workfn = client[ci].workfn;
 				if (workfn)
-					workfn(i);
+					workfn(ci);
 			}
-			if (pollfd[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
-				deadfn = client[i].deadfn;
+
+			/* workfn may have freed it */
+			if (client[ci].fd < 0 || client[ci].gen != gen)
+				continue;
+
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				deadfn = client[ci].deadfn;
 				if (deadfn)
-					deadfn(i);
+					deadfn(ci);
 			}
 		}
 
 
 		gettimeofday(&now, NULL);
 		ms = time_diff(&last_check, &now);
-		if (ms < check_interval) {
+		if (ms < check_interval && !killed_pid_exited) {
 			poll_timeout = check_interval - ms;
 			continue;
 		}
 		last_check = now;
 		check_interval = STANDARD_CHECK_INTERVAL;
+		killed_pid_exited = 0;
 
 		/*
 		 * check the condition of each lockspace,
@@ -827,18 +1354,9 @@ static int main_loop(void)
 			 * check host_id lease renewal
 			 */
 
-			if (sp->align_size > check_buf_len) {
-				if (check_buf)
-					free(check_buf);
-				check_buf_len = sp->align_size;
-				check_buf = malloc(check_buf_len);
-			}
-			if (check_buf)
-				memset(check_buf, 0, check_buf_len);
-
 			check_all = 0;
 
-			rv = check_our_lease(sp, &check_all, check_buf);
+			rv = check_our_lease(sp, &check_all, &check_buf);
 			if (rv)
 				sp->renew_fail = 1;
 
@@ -850,7 +1368,7 @@ static int main_loop(void)
 				kill_pids(sp);
 				check_interval = RECOVERY_CHECK_INTERVAL;
 
-			} else if (check_all) {
+			} else if (check_all && check_buf) {
 				check_other_leases(sp, check_buf);
 			}
 		}
@@ -883,41 +1401,135 @@ static int main_loop(void)
 	return 0;
 }
 
+/* data is the pipelined cmd data read by the main loop */
+
+static struct cmd_args *alloc_cmd_args(int ci_in, struct sm_header *h_recv,
+				       char *data, int data_len)
+{
+	struct cmd_args *ca;
+
+	ca = malloc(sizeof(struct cmd_args));
+	if (!ca)
+		return NULL;
+
+	memset(ca, 0, sizeof(struct cmd_args));
+	ca->ci_in = ci_in;
+	memcpy(&ca->header, h_recv, sizeof(struct sm_header));
+
+	if (client[ci_in].flags & CL_PIPELINE) {
+		ca->pipelined = 1;
+		ca->data = data;
+		ca->data_len = data_len;
+	}
+	return ca;
+}
+
+static void free_cmd_args(struct cmd_args *ca)
+{
+	if (ca->data)
+		free(ca->data);
+	if (ca->reply)
+		free(ca->reply);
+	free(ca);
+}
+
+static int cmd_is_fast(struct sm_header *h)
+{
+	switch (h->cmd) {
+	case SM_CMD_INQUIRE:
+	case SM_CMD_EXAMINE_LOCKSPACE:
+	case SM_CMD_EXAMINE_RESOURCE:
+	case SM_CMD_KILLPATH:
+	case SM_CMD_SET_EVENT:
+		return 1;
+	case SM_CMD_INQ_LOCKSPACE:
+		return !(h->cmd_flags & SANLK_INQ_WAIT);
+	}
+	return 0;
+}
+
+/* called with pool.mutex held */
+
+static struct cmd_args *thread_pool_get_work(int fast)
+{
+	struct cmd_args *ca;
+
+	if (!list_empty(&pool.fast_data))
+		ca = list_first_entry(&pool.fast_data, struct cmd_args, list);
+	else if (!fast && !list_empty(&pool.work_data))
+		ca = list_first_entry(&pool.work_data, struct cmd_args, list);
+	else
+		return NULL;
+
+	list_del(&ca->list);
+	return ca;
+}
+
+static __thread int pool_worker_thread;
+
+/* data is the worker number, or -1 for the fast worker */
+
 static void *thread_pool_worker(void *data)
 {
 	struct task task;
 	struct cmd_args *ca;
+	struct timespec ts;
+	long num = (long)data;
+	int fast = (num < 0);
+	int rv;
 
 	memset(&task, 0, sizeof(struct task));
 	setup_task_aio(&task, main_task.use_aio, WORKER_AIO_CB_SIZE);
-	snprintf(task.name, NAME_ID_SIZE, "worker%ld", (long)data);
+	if (fast)
+		snprintf(task.name, NAME_ID_SIZE, "fastworker");
+	else
+		snprintf(task.name, NAME_ID_SIZE, "worker%ld", num);
+
+	pool_worker_thread = !fast;
 
 	pthread_mutex_lock(&pool.mutex);
 
 	while (1) {
-		while (!pool.quit && list_empty(&pool.work_data)) {
+		while (!(ca = thread_pool_get_work(fast))) {
+			if (pool.quit)
+				goto out;
+
+			if (fast) {
+				pool.fast_free++;
+				pthread_cond_wait(&pool.fast_cond, &pool.mutex);
+				pool.fast_free--;
+				continue;
+			}
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += WORKER_IDLE_SECONDS;
+
 			pool.free_workers++;
-			pthread_cond_wait(&pool.cond, &pool.mutex);
+			rv = pthread_cond_timedwait(&pool.cond, &pool.mutex, &ts);
 			pool.free_workers--;
+
+			if (rv == ETIMEDOUT && pool.num_workers > pool.min_workers &&
+			    list_empty(&pool.fast_data) && list_empty(&pool.work_data)) {
+				log_debug("%s exit idle workers %d", task.name, pool.num_workers);
+				goto out;
+			}
 		}
 
-		while (!list_empty(&pool.work_data)) {
-			ca = list_first_entry(&pool.work_data, struct cmd_args, list);
-			list_del(&ca->list);
+		do {
 			pthread_mutex_unlock(&pool.mutex);
 
 			call_cmd_thread(&task, ca);
-			free(ca);
+			free_cmd_args(ca);
 
 			pthread_mutex_lock(&pool.mutex);
-		}
-
-		if (pool.quit)
-			break;
+		} while ((ca = thread_pool_get_work(fast)));
 	}
-
-	pool.num_workers--;
-	if (!pool.num_workers)
+ out:
+	if (fast)
+		pool.fast_worker = 0;
+	else
+		pool.num_workers--;
+	if (!pool.num_workers && !pool.fast_worker)
 		pthread_cond_signal(&pool.quit_wait);
 	pthread_mutex_unlock(&pool.mutex);
 
@@ -925,22 +1537,40 @@ static void *thread_pool_worker(void *data)
 	return NULL;
 }
 
-static int thread_pool_add_work(struct cmd_args *ca)
+static int thread_pool_start(long num)
 {
 	pthread_t th;
 	int rv;
 
+	rv = pthread_create(&th, NULL, thread_pool_worker, (void *)num);
+	if (rv)
+		return -rv;
+
+	pthread_detach(th);
+	return 0;
+}
+
+static int thread_pool_add_work(struct cmd_args *ca)
+{
+	int fast = cmd_is_fast(&ca->header);
+	int rv;
+
 	pthread_mutex_lock(&pool.mutex);
 	if (pool.quit) {
 		pthread_mutex_unlock(&pool.mutex);
 		return -1;
 	}
 
-	list_add_tail(&ca->list, &pool.work_data);
+	list_add_tail(&ca->list, fast ? &pool.fast_data : &pool.work_data);
+
+	if (fast && !pool.free_workers && pool.fast_free) {
+		pthread_cond_signal(&pool.fast_cond);
+		pthread_mutex_unlock(&pool.mutex);
+		return 0;
+	}
 
-	if (!pool.free_workers && pool.num_workers < pool.max_workers) {
-		rv = pthread_create(&th, NULL, thread_pool_worker,
-				    (void *)(long)pool.num_workers);
+	if (!pool.free_workers && pool.num_workers - pool.wait_workers < pool.max_workers) {
+		rv = thread_pool_start(pool.num_workers);
 		if (rv < 0) {
 			list_del(&ca->list);
 			pthread_mutex_unlock(&pool.mutex);
@@ -954,35 +1584,87 @@ static int thread_pool_add_work(struct cmd_args *ca)
 	return 0;
 }
 
+/*
+ * A worker that waits for a busy lease in acquire_token can wait for a
+ * release that needs a worker itself, so while it waits it's not counted
+ * against max_workers, and a worker is started for any queued cmds.
+ * This keeps workers for cmds that don't wait, however many acquires are
+ * waiting.  At most max_workers can be waiting at once, so the number of
+ * threads is still bounded (2 * max_workers); beyond that the acquire
+ * fails with -EAGAIN instead of waiting.  Only pool workers wait, waiting
+ * acquires are not given to acquire helpers (see acquire_new_tokens).
+ */
+
+int thread_pool_wait_begin(void);
+int thread_pool_wait_begin(void)
+{
+	int rv;
+
+	if (!pool_worker_thread)
+		return 0;
+
+	pthread_mutex_lock(&pool.mutex);
+	if (pool.wait_workers >= pool.max_workers) {
+		pthread_mutex_unlock(&pool.mutex);
+		return -EAGAIN;
+	}
+	pool.wait_workers++;
+
+	if (!pool.quit && !pool.free_workers && !list_empty(&pool.work_data) &&
+	    pool.num_workers - pool.wait_workers < pool.max_workers) {
+		rv = thread_pool_start(pool.num_workers);
+		if (!rv)
+			pool.num_workers++;
+	}
+	pthread_mutex_unlock(&pool.mutex);
+	return 0;
+}
+
+void thread_pool_wait_end(void);
+void thread_pool_wait_end(void)
+{
+	if (!pool_worker_thread)
+		return;
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.wait_workers--;
+	pthread_mutex_unlock(&pool.mutex);
+}
+
 static void thread_pool_free(void)
 {
 	pthread_mutex_lock(&pool.mutex);
 	pool.quit = 1;
-	if (pool.num_workers > 0) {
-		pthread_cond_broadcast(&pool.cond);
+	pthread_cond_broadcast(&pool.cond);
+	pthread_cond_broadcast(&pool.fast_cond);
+	while (pool.num_workers > 0 || pool.fast_worker)
 		pthread_cond_wait(&pool.quit_wait, &pool.mutex);
-	}
 	pthread_mutex_unlock(&pool.mutex);
 }
 
 static int thread_pool_create(int min_workers, int max_workers)
 {
-	pthread_t th;
 	int i, rv;
 
 	memset(&pool, 0, sizeof(pool));
 	INIT_LIST_HEAD(&pool.work_data);
+	INIT_LIST_HEAD(&pool.fast_data);
 	pthread_mutex_init(&pool.mutex, NULL);
 	pthread_cond_init(&pool.cond, NULL);
+	pthread_cond_init(&pool.fast_cond, NULL);
 	pthread_cond_init(&pool.quit_wait, NULL);
+	pool.min_workers = min_workers;
 	pool.max_workers = max_workers;
 
-	for (i = 0; i < min_workers; i++) {
-		rv = pthread_create(&th, NULL, thread_pool_worker,
-				    (void *)(long)i);
-		if (rv < 0)
-			break;
-		pool.num_workers++;
+	pool.fast_worker = 1;
+	rv = thread_pool_start(-1);
+	if (rv < 0)
+		pool.fast_worker = 0;
+
+	for (i = 0; !rv && i < min_workers; i++) {
+		rv = thread_pool_start(i);
+		if (!rv)
+			pool.num_workers++;
 	}
 
 	if (rv < 0)
@@ -998,31 +1680,38 @@ static int thread_pool_create(int min_workers, int max_workers)
  * client or the tokens held by a specific client.
  */
 
-static void process_cmd_thread_unregistered(int ci_in, struct sm_header *h_recv)
+static void process_cmd_thread_unregistered(int ci_in, struct sm_header *h_recv,
+					    char *data, int data_len)
 {
 	struct cmd_args *ca;
 	int rv;
 
-	ca = malloc(sizeof(struct cmd_args));
+	ca = alloc_cmd_args(ci_in, h_recv, data, data_len);
 	if (!ca) {
 		rv = -ENOMEM;
 		goto fail;
 	}
-	ca->ci_in = ci_in;
-	memcpy(&ca->header, h_recv, sizeof(struct sm_header));
 
-	snprintf(client[ci_in].owner_name, SANLK_NAME_LEN, "cmd%d", h_recv->cmd);
+	if (!ca->pipelined)
+		snprintf(client[ci_in].owner_name, SANLK_NAME_LEN, "cmd%d", h_recv->cmd);
 
 	rv = thread_pool_add_work(ca);
 	if (rv < 0)
-		goto fail_free;
+		goto fail;
 	return;
 
- fail_free:
-	free(ca);
  fail:
+	if (ca)
+		free_cmd_args(ca);
+	else if (data)
+		free(data);
+
+	if (client[ci_in].flags & CL_PIPELINE) {
+		pipeline_reply(ci_in, h_recv, rv);
+		return;
+	}
 	send_result(client[ci_in].fd, h_recv, rv);
-	close(client[ci_in].fd);
+	client_resume(ci_in);
 }
 
 /*
@@ -1035,14 +1724,15 @@ static void process_cmd_thread_unregistered(int ci_in, struct sm_header *h_recv)
  * processing and handle the cleanup of the client if so.
  */
 
-static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv)
+static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv,
+					  char *data, int data_len)
 {
 	struct cmd_args *ca;
 	struct client *cl;
 	int result = 0;
 	int rv, i, ci_target;
 
-	ca = malloc(sizeof(struct cmd_args));
+	ca = alloc_cmd_args(ci_in, h_recv, data, data_len);
 	if (!ca) {
 		result = -ENOMEM;
 		goto fail;
@@ -1052,7 +1742,7 @@ static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv)
 		/* lease for another registered client with pid specified by data2 */
 		ci_target = -1;
 
-		for (i = 0; i < client_size; i++) {
+		for (i = 0; i <= client_maxi; i++) {
 			cl = &client[i];
 			pthread_mutex_lock(&cl->mutex);
 			if (cl->pid != h_recv->data2) {
@@ -1140,11 +1830,9 @@ static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv)
 	if (result < 0)
 		goto fail;
 
-	ca->ci_in = ci_in;
 	ca->ci_target = ci_target;
 	ca->cl_pid = cl->pid;
 	ca->cl_fd = cl->fd;
-	memcpy(&ca->header, h_recv, sizeof(struct sm_header));
 
 	rv = thread_pool_add_work(ca);
 	if (rv < 0) {
@@ -1163,12 +1851,192 @@ static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv)
 	return;
 
  fail:
+	if (ca)
+		free_cmd_args(ca);
+	else if (data)
+		free(data);
+
+	if (client[ci_in].flags & CL_PIPELINE) {
+		pipeline_reply(ci_in, h_recv, result);
+		return;
+	}
 	client_recv_all(ci_in, h_recv, 0);
 	send_result(client[ci_in].fd, h_recv, result);
 	client_resume(ci_in);
+}
 
-	if (ca)
-		free(ca);
+static int check_header(int ci, struct sm_header *h)
+{
+	if (h->magic != SM_MAGIC) {
+		log_error("ci %d recv %d magic %x vs %x",
+			  ci, (int)sizeof(*h), h->magic, SM_MAGIC);
+		return -1;
+	}
+	if (client[ci].restricted & SANLK_RESTRICT_ALL) {
+		log_error("ci %d fd %d pid %d cmd %d restrict all",
+			  ci, client[ci].fd, client[ci].pid, h->cmd);
+		return -1;
+	}
+	if (h->version && (h->cmd != SM_CMD_VERSION) &&
+	    (h->version & 0xFFFF0000) > (SM_PROTO & 0xFFFF0000)) {
+		log_error("ci %d recv %d proto %x vs %x",
+			  ci, (int)sizeof(*h), h->version , SM_PROTO);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Receive what's available of a pipelined cmd into cl->pipe_h and
+ * cl->pipe_data without blocking the main loop.  Returns 1 when the
+ * cmd is complete, 0 when more is needed, -1 if the client is dead.
+ */
+
+static int pipeline_recv(int ci)
+{
+	struct client *cl = &client[ci];
+	int hlen = sizeof(struct sm_header);
+	int data_len, rv;
+
+	if (!cl->pipe_h) {
+		cl->pipe_h = malloc(hlen);
+		if (!cl->pipe_h) {
+			log_error("ci %d fd %d pipelined no mem", ci, cl->fd);
+			return -1;
+		}
+	}
+
+	while (1) {
+		if (cl->pipe_pos < hlen) {
+			rv = recv(cl->fd, (char *)cl->pipe_h + cl->pipe_pos,
+				  hlen - cl->pipe_pos, MSG_DONTWAIT);
+		} else {
+			data_len = cl->pipe_h->length - hlen;
+			if (cl->pipe_pos - hlen == data_len)
+				return 1;
+
+			rv = recv(cl->fd, cl->pipe_data + (cl->pipe_pos - hlen),
+				  data_len - (cl->pipe_pos - hlen), MSG_DONTWAIT);
+		}
+
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		/* the hangup is handled by deadfn */
+		if (!rv)
+			return 0;
+		if (rv < 0) {
+			log_error("ci %d fd %d pipelined recv errno %d",
+				  ci, cl->fd, errno);
+			return -1;
+		}
+
+		cl->pipe_pos += rv;
+
+		if (cl->pipe_pos != hlen)
+			continue;
+
+		/* the header is complete */
+
+		if (check_header(ci, cl->pipe_h) < 0)
+			return -1;
+
+		if (cl->pipe_h->length < hlen ||
+		    cl->pipe_h->length - hlen > MAX_CLIENT_MSG) {
+			log_error("ci %d fd %d pipelined cmd %d length %u",
+				  ci, cl->fd, cl->pipe_h->cmd, cl->pipe_h->length);
+			return -1;
+		}
+
+		data_len = cl->pipe_h->length - hlen;
+		if (!data_len)
+			return 1;
+
+		cl->pipe_data = malloc(data_len);
+		if (!cl->pipe_data) {
+			log_error("ci %d fd %d pipelined cmd %d no mem %d",
+				  ci, cl->fd, cl->pipe_h->cmd, data_len);
+			return -1;
+		}
+	}
+}
+
+/*
+ * A cmd on a pipelined connection is passed to a worker thread without
+ * suspending the connection, so the next cmd can be read right away.
+ * The main loop collects the cmd as it arrives, and a client that stops
+ * sending partway through a cmd doesn't hold it up.  Reading stops while
+ * MAX_PIPELINE_CMDS are in flight.
+ */
+
+static void process_pipelined(int ci)
+{
+	struct client *cl = &client[ci];
+	struct sm_header h;
+	void (*deadfn)(int ci);
+	char *data;
+	int data_len, rv;
+
+	rv = pipeline_recv(ci);
+	if (rv < 0)
+		goto dead;
+	if (!rv)
+		return;
+
+	memcpy(&h, cl->pipe_h, sizeof(struct sm_header));
+	data = cl->pipe_data;
+	data_len = h.length - sizeof(struct sm_header);
+
+	cl->pipe_data = NULL;
+	cl->pipe_pos = 0;
+	cl->cmd_last = h.cmd;
+
+	pthread_mutex_lock(&cl->mutex);
+	cl->cmd_inflight++;
+	if (cl->cmd_inflight >= MAX_PIPELINE_CMDS) {
+		cl->suspend = 1;
+		client_ignore(ci);
+	}
+	pthread_mutex_unlock(&cl->mutex);
+
+	switch (h.cmd) {
+	case SM_CMD_ADD_LOCKSPACE:
+	case SM_CMD_INQ_LOCKSPACE:
+	case SM_CMD_REM_LOCKSPACE:
+	case SM_CMD_REQUEST:
+	case SM_CMD_EXAMINE_RESOURCE:
+	case SM_CMD_EXAMINE_LOCKSPACE:
+	case SM_CMD_ALIGN:
+	case SM_CMD_WRITE_LOCKSPACE:
+	case SM_CMD_WRITE_RESOURCE:
+	case SM_CMD_READ_LOCKSPACE:
+	case SM_CMD_READ_RESOURCE:
+	case SM_CMD_READ_RESOURCE_OWNERS:
+	case SM_CMD_SET_LVB:
+	case SM_CMD_GET_LVB:
+	case SM_CMD_SET_EVENT:
+		process_cmd_thread_unregistered(ci, &h, data, data_len);
+		break;
+	case SM_CMD_ACQUIRE:
+	case SM_CMD_RELEASE:
+	case SM_CMD_INQUIRE:
+	case SM_CMD_CONVERT:
+		/* on behalf of the registered pid in data2 */
+		process_cmd_thread_registered(ci, &h, data, data_len);
+		break;
+	default:
+		log_error("ci %d cmd %d not pipelined", ci, h.cmd);
+		if (data)
+			free(data);
+		pipeline_reply(ci, &h, -EINVAL);
+	};
+	return;
+
+ dead:
+	deadfn = cl->deadfn;
+	if (deadfn)
+		deadfn(ci);
 }
 
 static void process_connection(int ci)
@@ -1177,6 +2045,11 @@ static void process_connection(int ci)
 	void (*deadfn)(int ci);
 	int rv;
 
+	if (client[ci].flags & CL_PIPELINE) {
+		process_pipelined(ci);
+		return;
+	}
+
 	memset(&h, 0, sizeof(h));
 
 	rv = recv(client[ci].fd, &h, sizeof(h), MSG_WAITALL);
@@ -1192,22 +2065,8 @@ static void process_connection(int ci)
 			  ci, client[ci].fd, client[ci].pid, rv);
 		goto dead;
 	}
-	if (h.magic != SM_MAGIC) {
-		log_error("ci %d recv %d magic %x vs %x",
-			  ci, rv, h.magic, SM_MAGIC);
+	if (check_header(ci, &h) < 0)
 		goto dead;
-	}
-	if (client[ci].restricted & SANLK_RESTRICT_ALL) {
-		log_error("ci %d fd %d pid %d cmd %d restrict all",
-			  ci, client[ci].fd, client[ci].pid, h.cmd);
-		goto dead;
-	}
-	if (h.version && (h.cmd != SM_CMD_VERSION) &&
-	    (h.version & 0xFFFF0000) > (SM_PROTO & 0xFFFF0000)) {
-		log_error("ci %d recv %d proto %x vs %x",
-			  ci, rv, h.version , SM_PROTO);
-		goto dead;
-	}
 
 	client[ci].cmd_last = h.cmd;
 
@@ -1225,6 +2084,8 @@ static void process_connection(int ci)
 	case SM_CMD_REG_EVENT:
 	case SM_CMD_END_EVENT:
 	case SM_CMD_SET_CONFIG:
+	case SM_CMD_PIPELINE:
+	case SM_CMD_SESSION:
 		call_cmd_daemon(ci, &h, client_maxi);
 		break;
 	case SM_CMD_ADD_LOCKSPACE:
@@ -1246,7 +2107,7 @@ static void process_connection(int ci)
 		rv = client_suspend(ci);
 		if (rv < 0)
 			return;
-		process_cmd_thread_unregistered(ci, &h);
+		process_cmd_thread_unregistered(ci, &h, NULL, 0);
 		break;
 	case SM_CMD_ACQUIRE:
 	case SM_CMD_RELEASE:
@@ -1258,7 +2119,7 @@ static void process_connection(int ci)
 		rv = client_suspend(ci);
 		if (rv < 0)
 			return;
-		process_cmd_thread_registered(ci, &h);
+		process_cmd_thread_registered(ci, &h, NULL, 0);
 		break;
 	default:
 		log_error("ci %d cmd %d unknown", ci, h.cmd);
@@ -1283,7 +2144,8 @@ static void process_listener(int ci GNUC_UNUSED)
 
 	setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on));
 
-	client_add(fd, process_connection, NULL);
+	if (client_add(fd, process_connection, NULL) < 0)
+		close(fd);
 }
 
 static int setup_listener(void)
@@ -1315,7 +2177,7 @@ static int setup_listener(void)
 		goto exit_fail;
 	}
 
-	rv = listen(fd, 5);
+	rv = listen(fd, SOMAXCONN);
 	if (rv < 0)
 		goto exit_fail;
 
@@ -1444,6 +2306,13 @@ static void setup_limits(void)
 		log_error("cannot set the limits for core dumps %i", errno);
 		exit(EXIT_FAILURE);
 	}
+
+	/* each registered pid holds a connection */
+	if (!getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &rlim) < 0)
+			log_error("cannot set the limits for open files %i", errno);
+	}
 }
 
 static void setup_groups(void)
@@ -1693,12 +2562,6 @@ static int do_daemon(void)
 	if (rv < 0)
 		goto out_threads;
 
-	/* initialize global eventfd for client_resume notification */
-	if ((efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
-		log_error("couldn't create eventfd");
-		goto out_threads;
-	}
-
 	main_loop();
 
 	close_token_manager();
@@ -1820,6 +2683,7 @@ static void print_usage(void)
 	printf("  -w 0|1        use watchdog through wdmd (%d)\n", DEFAULT_USE_WATCHDOG);
 	printf("  -h 0|1        use high priority (RR) scheduling (%d)\n", DEFAULT_HIGH_PRIORITY);
 	printf("  -l <num>      use mlockall (0 none, 1 current, 2 current and future) (%d)\n", DEFAULT_MLOCK_LEVEL);
+	printf("  -a <num>      disk i/o (0 sync, 1 libaio, 3 io_uring) (%d)\n", DEFAULT_USE_AIO);
 	printf("  -b <sec>      seconds a host id bit will remain set in delta lease bitmap\n");
 	printf("                (default: 6 * io_timeout)\n");
 	printf("  -e <str>      local host name used in delta leases\n");
@@ -1848,7 +2712,7 @@ static void print_usage(void)
 	printf("sanlock client request -r RESOURCE -f <force_mode>\n");
 	printf("sanlock client examine -r RESOURCE | -s LOCKSPACE\n");
 	printf("\n");
-	printf("sanlock direct <action> [-a 0|1] [-o 0|1]\n");
+	printf("sanlock direct <action> [-a 0|1|3] [-o 0|1]\n");
 	printf("sanlock direct init -s LOCKSPACE | -r RESOURCE\n");
 	printf("sanlock direct read_leader -s LOCKSPACE | -r RESOURCE\n");
 	printf("sanlock direct dump <path>[:<offset>]\n");
@@ -2071,7 +2935,7 @@ static int read_command_line(int argc, char *argv[])
 		case 'a':
 			com.all = atoi(optionarg);
 			com.aio_arg = atoi(optionarg);
-			if (com.aio_arg && com.aio_arg != 1)
+			if (com.aio_arg && com.aio_arg != 1 && com.aio_arg != 3)
 				com.aio_arg = 1;
 			break;
 		case 't':
@@ -2313,10 +3177,20 @@ static void read_config_file(void)
 			get_val_int(line, &val);
 			com.mlock_level = val;
 
+		} else if (!strcmp(str, "use_aio")) {
+			get_val_int(line, &val);
+			if (val && val != 1 && val != 3)
+				val = 1;
+			com.aio_arg = val;
+
 		} else if (!strcmp(str, "sh_retries")) {
 			get_val_int(line, &val);
 			com.sh_retries = val;
 
+		} else if (!strcmp(str, "paxos_early_quorum")) {
+			get_val_int(line, &val);
+			com.paxos_early_quorum = val;
+
 		} else if (!strcmp(str, "uname")) {
 			memset(str, 0, sizeof(str));
 			get_val_str(line, str);
@@ -2340,9 +3214,37 @@ static void read_config_file(void)
 			com.renewal_read_extend_sec_set = 1;
 			com.renewal_read_extend_sec = val;
 
+		} else if (!strcmp(str, "renewal_fast_sec")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			com.renewal_fast_sec = val;
+
 		} else if (!strcmp(str, "renewal_history_size")) {
 			get_val_int(line, &val);
 			com.renewal_history_size = val;
+
+		} else if (!strcmp(str, "renewal_threads")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			com.renewal_threads = val;
+
+		} else if (!strcmp(str, "resource_threads")) {
+			get_val_int(line, &val);
+			if (val < 1)
+				val = 1;
+			if (val > MAX_RESOURCE_THREADS)
+				val = MAX_RESOURCE_THREADS;
+			com.resource_threads = val;
+
+		} else if (!strcmp(str, "max_clients")) {
+			get_val_int(line, &val);
+			if (val < DEFAULT_MAX_CLIENTS)
+				val = DEFAULT_MAX_CLIENTS;
+			if (val > MAX_CLIENTS)
+				val = MAX_CLIENTS;
+			com.max_clients = val;
 		}
 	}
 
@@ -3198,6 +4100,8 @@ int main(int argc, char *argv[])
 	com.high_priority = DEFAULT_HIGH_PRIORITY;
 	com.mlock_level = DEFAULT_MLOCK_LEVEL;
 	com.max_worker_threads = DEFAULT_MAX_WORKER_THREADS;
+	com.resource_threads = DEFAULT_RESOURCE_THREADS;
+	com.max_clients = DEFAULT_MAX_CLIENTS;
 	com.io_timeout_arg = DEFAULT_IO_TIMEOUT;
 	com.aio_arg = DEFAULT_USE_AIO;
 	com.pid = -1;
@@ -93,138 +93,150 @@ int paxos_lease_request_write(struct task *task, struct token *token,
 	return SANLK_OK;
 }
 
-static int write_dblock(struct task *task,
-		        struct token *token,
-			struct sync_disk *disk,
-			uint64_t host_id,
-			struct paxos_dblock *pd);
-
-int paxos_erase_dblock(struct task *task,
-		       struct token *token,
-		       uint64_t host_id)
-{
-	struct paxos_dblock dblock_end;
-	int num_disks = token->r.num_disks;
-	int num_writes = 0;
-	int d, rv, error = -1;
-
-	memset(&dblock_end, 0, sizeof(struct paxos_dblock));
-
-	for (d = 0; d < num_disks; d++) {
-		rv = write_dblock(task, token, &token->disks[d], host_id, &dblock_end);
-		if (rv < 0) {
-			error = rv;
-			continue;
-		}
-		num_writes++;
-	}
-
-	if (!majority_disks(num_disks, num_writes))
-		return error;
-	return SANLK_OK;
-}
-
 /*
- * Write a combined dblock and mblock.  This is an odd case that doesn't fit
- * well with the way the code has been written.  It's used when we want to
- * convert sh to ex, which requires acquiring the lease owner, but we don't
- * want to clobber our SHARED mblock by writing a plain dblock in the process
- * in case there's a problem with the acquiring, we don't want to loose our
- * shared mode lease.
+ * Copy a dblock into a sector iobuf in ondisk format.
+ *
+ * With T_WRITE_DBLOCK_MBLOCK_SH, the sector gets a combined dblock and
+ * mblock.  This is an odd case that doesn't fit well with the way the code
+ * has been written.  It's used when we want to convert sh to ex, which
+ * requires acquiring the lease owner, but we don't want to clobber our
+ * SHARED mblock by writing a plain dblock in the process in case there's a
+ * problem with the acquiring, we don't want to loose our shared mode lease.
  *
  * NB. this assumes the only mblock flag we want is MBLOCK_SHARED and that
  * the generation we want is token->host_generation.  This is currently
  * the case, but could change in the future.
  */
 
-static int write_dblock_mblock_sh(struct task *task,
-			          struct token *token,
-			          struct sync_disk *disk,
-			          uint64_t host_id,
-			          struct paxos_dblock *pd)
+static void dblock_to_iobuf(struct token *token, struct paxos_dblock *pd, char *iobuf)
 {
 	struct paxos_dblock pd_end;
 	struct mode_block mb;
 	struct mode_block mb_end;
-	char *iobuf, **p_iobuf;
-	uint64_t offset;
 	uint32_t checksum;
-	int iobuf_len, rv;
+
+	paxos_dblock_out(pd, &pd_end);
+
+	/*
+	 * N.B. must compute checksum after the data has been byte swapped.
+	 */
+	checksum = dblock_checksum(&pd_end);
+	pd->checksum = checksum;
+	pd_end.checksum = cpu_to_le32(checksum);
+
+	memcpy(iobuf, (char *)&pd_end, sizeof(struct paxos_dblock));
+
+	if (!(token->flags & T_WRITE_DBLOCK_MBLOCK_SH))
+		return;
 
 	memset(&mb, 0, sizeof(mb));
 	mb.flags = MBLOCK_SHARED;
 	mb.generation = token->host_generation;
 
-	iobuf_len = disk->sector_size;
+	mode_block_out(&mb, &mb_end);
+
+	memcpy(iobuf + MBLOCK_OFFSET, (char *)&mb_end, sizeof(struct mode_block));
+}
+
+/*
+ * Write the dblock for host_id to all disks at once.  Returns the last
+ * error, and the number of disks written in num_writes.  ms is the time
+ * until the last write completed.
+ */
+
+static int write_dblocks(struct task *task,
+			 struct token *token,
+			 uint64_t host_id,
+			 struct paxos_dblock *pd,
+			 int *num_writes,
+			 int *ms)
+{
+	struct iobuf_batch batch;
+	struct iobuf_io *io;
+	struct sync_disk *disk;
+	char *iobuf[SANLK_MAX_DISKS];
+	int num_disks = token->r.num_disks;
+	int iobuf_len = token->disks[0].sector_size;
+	int d, i, error = 0;
+
+	*num_writes = 0;
+	*ms = 0;
+
 	if (!iobuf_len)
 		return -EINVAL;
 
-	p_iobuf = &iobuf;
+	iobuf_batch_init(&batch, task, IO_CMD_PWRITE, token->io_timeout);
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv)
-		return -ENOMEM;
+	for (d = 0; d < num_disks; d++) {
+		disk = &token->disks[d];
 
-	offset = disk->offset + ((2 + host_id - 1) * disk->sector_size);
+		iobuf[d] = iobuf_get(task, iobuf_len);
+		if (!iobuf[d]) {
+			error = -ENOMEM;
+			continue;
+		}
 
-	paxos_dblock_out(pd, &pd_end);
+		dblock_to_iobuf(token, pd, iobuf[d]);
 
-	/*
-	 * N.B. must compute checksum after the data has been byte swapped.
-	 */
-	checksum = dblock_checksum(&pd_end);
-	pd->checksum = checksum;
-	pd_end.checksum = cpu_to_le32(checksum);
+		/* 1 leader block + 1 request block;
+		   host_id N is block offset N-1 */
 
-	mode_block_out(&mb, &mb_end);
+		iobuf_batch_add(&batch, d, disk->fd,
+				disk->offset + ((2 + host_id - 1) * disk->sector_size),
+				iobuf[d], iobuf_len);
+	}
 
-	memcpy(iobuf, (char *)&pd_end, sizeof(struct paxos_dblock));
-	memcpy(iobuf + MBLOCK_OFFSET, (char *)&mb_end, sizeof(struct mode_block));
+	iobuf_batch_submit(&batch);
+
+	while ((i = iobuf_batch_next(&batch)) >= 0) {
+		io = &batch.io[i];
+		disk = &token->disks[io->num];
+
+		if (io->ms > *ms)
+			*ms = io->ms;
+
+		if (io->rv < 0) {
+			log_errot(token, "write_dblock host_id %llu gen %llu offset %llu rv %d %s",
+				  (unsigned long long)host_id,
+				  (unsigned long long)token->host_generation,
+				  (unsigned long long)io->offset, io->rv, disk->path);
+			error = io->rv;
+		} else {
+			(*num_writes)++;
+		}
 
-	rv = write_iobuf(disk->fd, offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
+		if (com.paxos_early_quorum && majority_disks(num_disks, *num_writes))
+			iobuf_batch_abandon(&batch);
+	}
 
-	if (rv < 0) {
-		log_errot(token, "write_dblock_mblock_sh host_id %llu gen %llu rv %d",
-			  (unsigned long long)host_id,
-			  (unsigned long long)token->host_generation,
-			  rv);
+	for (i = 0; i < batch.count; i++) {
+		/* don't free iobufs that have timed out or were abandoned */
+		if (batch.io[i].rv == SANLK_AIO_TIMEOUT)
+			iobuf[batch.io[i].num] = NULL;
 	}
 
-	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
-	return rv;
+	for (d = 0; d < num_disks; d++)
+		iobuf_put(task, iobuf[d], iobuf_len);
+
+	return error;
 }
 
-static int write_dblock(struct task *task,
-		        struct token *token,
-			struct sync_disk *disk,
-			uint64_t host_id,
-			struct paxos_dblock *pd)
+int paxos_erase_dblock(struct task *task,
+		       struct token *token,
+		       uint64_t host_id)
 {
-	struct paxos_dblock pd_end;
-	uint32_t checksum;
+	struct paxos_dblock dblock_end;
+	int num_disks = token->r.num_disks;
+	int num_writes, ms;
 	int rv;
 
-	if (token->flags & T_WRITE_DBLOCK_MBLOCK_SH) {
-		/* special case to preserve our SH mode block within the dblock */
-		return write_dblock_mblock_sh(task, token, disk, host_id, pd);
-	}
-
-	/* 1 leader block + 1 request block;
-	   host_id N is block offset N-1 */
-
-	paxos_dblock_out(pd, &pd_end);
+	memset(&dblock_end, 0, sizeof(struct paxos_dblock));
 
-	/*
-	 * N.B. must compute checksum after the data has been byte swapped.
-	 */
-	checksum = dblock_checksum(&pd_end);
-	pd->checksum = checksum;
-	pd_end.checksum = cpu_to_le32(checksum);
+	rv = write_dblocks(task, token, host_id, &dblock_end, &num_writes, &ms);
 
-	rv = write_sector(disk, 2 + host_id - 1, (char *)&pd_end, sizeof(struct paxos_dblock),
-			  task, token->io_timeout, "dblock");
-	return rv;
+	if (!majority_disks(num_disks, num_writes))
+		return rv < 0 ? rv : -1;
+	return SANLK_OK;
 }
 
 static int write_leader(struct task *task,
@@ -437,8 +449,9 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 	struct paxos_dblock *bk_end;
 	struct paxos_dblock *bk;
 	struct sync_disk *disk;
+	struct iobuf_batch batch;
+	struct iobuf_io *io;
 	char *iobuf[SANLK_MAX_DISKS];
-	char **p_iobuf[SANLK_MAX_DISKS];
 	uint32_t checksum;
 	int num_disks = token->r.num_disks;
 	int num_writes, num_reads;
@@ -446,9 +459,10 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 	int sector_count;
 	int iobuf_len;
 	int phase2 = 0;
-	int d, q, rv = 0;
+	int d, i, q, rv = 0;
 	int q_max = -1;
-	int error;
+	int p1_wr_ms = 0, p1_rd_ms = 0, p2_wr_ms = 0, p2_rd_ms = 0;
+	int error = 0;
 
 	sector_count = roundup_power_of_two(num_hosts + 2);
 
@@ -458,11 +472,12 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 		return -EINVAL;
 
 	for (d = 0; d < num_disks; d++) {
-		p_iobuf[d] = &iobuf[d];
-
-		rv = posix_memalign((void *)p_iobuf[d], getpagesize(), iobuf_len);
-		if (rv)
-			return rv;
+		iobuf[d] = iobuf_get(task, iobuf_len);
+		if (!iobuf[d]) {
+			while (d--)
+				iobuf_put(task, iobuf[d], iobuf_len);
+			return -ENOMEM;
+		}
 	}
 
 
@@ -488,14 +503,7 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 
 	memset(&bk_max, 0, sizeof(struct paxos_dblock));
 
-	num_writes = 0;
-
-	for (d = 0; d < num_disks; d++) {
-		rv = write_dblock(task, token, &token->disks[d], token->host_id, &dblock);
-		if (rv < 0)
-			continue;
-		num_writes++;
-	}
+	rv = write_dblocks(task, token, token->host_id, &dblock, &num_writes, &p1_wr_ms);
 
 	if (!majority_disks(num_disks, num_writes)) {
 		log_errot(token, "ballot %llu dblock write error %d",
@@ -504,7 +512,16 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 		goto out;
 	}
 
-	num_reads = 0;
+	/*
+	 * Read all disks at once, and check each as its read completes.
+	 * If one disk causes an abort, the reads still outstanding on the
+	 * others are collected before returning, but not checked.  With
+	 * paxos_early_quorum, the phase is done once a majority of disks
+	 * have been read without an abort, and ios still outstanding on
+	 * slower disks are abandoned (see iobuf_batch_abandon).
+	 */
+
+	iobuf_batch_init(&batch, task, IO_CMD_PREAD, token->io_timeout);
 
 	for (d = 0; d < num_disks; d++) {
 		disk = &token->disks[d];
@@ -513,11 +530,27 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 			continue;
 		memset(iobuf[d], 0, iobuf_len);
 
-		rv = read_iobuf(disk->fd, disk->offset, iobuf[d], iobuf_len, task, token->io_timeout, NULL);
+		iobuf_batch_add(&batch, d, disk->fd, disk->offset, iobuf[d], iobuf_len);
+	}
+
+	iobuf_batch_submit(&batch);
+
+	num_reads = 0;
+
+	while ((i = iobuf_batch_next(&batch)) >= 0) {
+		io = &batch.io[i];
+		d = io->num;
+		rv = io->rv;
+
+		if (io->ms > p1_rd_ms)
+			p1_rd_ms = io->ms;
+
 		if (rv == SANLK_AIO_TIMEOUT)
 			iobuf[d] = NULL;
 		if (rv < 0)
 			continue;
+		if (error < 0)
+			continue;
 		num_reads++;
 
 		for (q = 0; q < num_hosts; q++) {
@@ -543,7 +576,7 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 					  (unsigned long long)next_lver, q,
 					  (unsigned long long)bk->lver);
 				error = SANLK_DBLOCK_LVER;
-				goto out;
+				break;
 			}
 
 			/* see "It aborts the ballot" in comment above */
@@ -554,7 +587,7 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 					  (unsigned long long)our_mbal, q,
 					  (unsigned long long)bk->mbal);
 				error = SANLK_DBLOCK_MBAL;
-				goto out;
+				break;
 			}
 
 			/* see choosing inp for phase 2 in comment below */
@@ -574,8 +607,20 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 				q_max = q;
 			}
 		}
+
+		if (com.paxos_early_quorum &&
+		    (error < 0 || majority_disks(num_disks, num_reads)))
+			iobuf_batch_abandon(&batch);
 	}
 
+	for (i = 0; i < batch.count; i++) {
+		if (batch.io[i].rv == SANLK_AIO_TIMEOUT)
+			iobuf[batch.io[i].num] = NULL;
+	}
+
+	if (error < 0)
+		goto out;
+
 	if (!majority_disks(num_disks, num_reads)) {
 		log_errot(token, "ballot %llu dblock read error %d",
 			  (unsigned long long)next_lver, rv);
@@ -634,22 +679,15 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 
 	phase2 = 1;
 
-	log_token(token, "ballot %llu phase2 bal %llu inp %llu %llu %llu q_max %d",
+	log_token(token, "ballot %llu phase2 bal %llu inp %llu %llu %llu q_max %d phase1 ms %d %d",
 		  (unsigned long long)dblock.lver,
 		  (unsigned long long)dblock.bal,
 		  (unsigned long long)dblock.inp,
 		  (unsigned long long)dblock.inp2,
 		  (unsigned long long)dblock.inp3,
-		  q_max);
+		  q_max, p1_wr_ms, p1_rd_ms);
 
-	num_writes = 0;
-
-	for (d = 0; d < num_disks; d++) {
-		rv = write_dblock(task, token, &token->disks[d], token->host_id, &dblock);
-		if (rv < 0)
-			continue;
-		num_writes++;
-	}
+	rv = write_dblocks(task, token, token->host_id, &dblock, &num_writes, &p2_wr_ms);
 
 	if (!majority_disks(num_disks, num_writes)) {
 		log_errot(token, "ballot %llu our dblock write2 error %d",
@@ -658,7 +696,7 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 		goto out;
 	}
 
-	num_reads = 0;
+	iobuf_batch_init(&batch, task, IO_CMD_PREAD, token->io_timeout);
 
 	for (d = 0; d < num_disks; d++) {
 		disk = &token->disks[d];
@@ -667,11 +705,27 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 			continue;
 		memset(iobuf[d], 0, iobuf_len);
 
-		rv = read_iobuf(disk->fd, disk->offset, iobuf[d], iobuf_len, task, token->io_timeout, NULL);
+		iobuf_batch_add(&batch, d, disk->fd, disk->offset, iobuf[d], iobuf_len);
+	}
+
+	iobuf_batch_submit(&batch);
+
+	num_reads = 0;
+
+	while ((i = iobuf_batch_next(&batch)) >= 0) {
+		io = &batch.io[i];
+		d = io->num;
+		rv = io->rv;
+
+		if (io->ms > p2_rd_ms)
+			p2_rd_ms = io->ms;
+
 		if (rv == SANLK_AIO_TIMEOUT)
 			iobuf[d] = NULL;
 		if (rv < 0)
 			continue;
+		if (error < 0)
+			continue;
 		num_reads++;
 
 		for (q = 0; q < num_hosts; q++) {
@@ -715,7 +769,7 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 					  (unsigned long long)dblock.inp2,
 					  (unsigned long long)dblock.inp3);
 				error = SANLK_DBLOCK_LVER;
-				goto out;
+				break;
 			}
 
 			/* see "It aborts the ballot" in comment above */
@@ -726,11 +780,23 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 					  (unsigned long long)our_mbal, q,
 					  (unsigned long long)bk->mbal);
 				error = SANLK_DBLOCK_MBAL;
-				goto out;
+				break;
 			}
 		}
+
+		if (com.paxos_early_quorum &&
+		    (error < 0 || majority_disks(num_disks, num_reads)))
+			iobuf_batch_abandon(&batch);
 	}
 
+	for (i = 0; i < batch.count; i++) {
+		if (batch.io[i].rv == SANLK_AIO_TIMEOUT)
+			iobuf[batch.io[i].num] = NULL;
+	}
+
+	if (error < 0)
+		goto out;
+
 	if (!majority_disks(num_disks, num_reads)) {
 		log_errot(token, "ballot %llu dblock read2 error %d",
 			  (unsigned long long)next_lver, rv);
@@ -740,15 +806,16 @@ static int run_ballot(struct task *task, struct token *token, int num_hosts,
 
 	/* "When it completes phase 2, p has committed dblock[p].inp." */
 
+	log_token(token, "ballot %llu phase1 ms %d %d phase2 ms %d %d",
+		  (unsigned long long)next_lver,
+		  p1_wr_ms, p1_rd_ms, p2_wr_ms, p2_rd_ms);
+
 	memcpy(dblock_out, &dblock, sizeof(struct paxos_dblock));
 	error = SANLK_OK;
  out:
-	for (d = 0; d < num_disks; d++) {
-		/* don't free iobufs that have timed out */
-		if (!iobuf[d])
-			continue;
-		free(iobuf[d]);
-	}
+	/* iobufs that have timed out are NULL */
+	for (d = 0; d < num_disks; d++)
+		iobuf_put(task, iobuf[d], iobuf_len);
 
 	if (phase2 && (error < 0) &&
 	    ((error == SANLK_DBLOCK_READ) || (error == SANLK_DBLOCK_WRITE))) {
@@ -1109,41 +1176,24 @@ int paxos_lease_leader_read(struct task *task,
 	return rv;
 }
 
-static int _lease_read_one(struct task *task,
-			   struct token *token,
-			   struct sync_disk *disk,
-			   struct leader_record *leader_ret,
-			   struct paxos_dblock *our_dblock,
-			   uint64_t *max_mbal,
-			   int *max_q,
-			   const char *caller)
+static int _lease_parse(struct token *token,
+			struct sync_disk *disk,
+			char *iobuf,
+			struct leader_record *leader_ret,
+			struct paxos_dblock *our_dblock,
+			uint64_t *max_mbal,
+			int *max_q,
+			const char *caller)
 {
 	struct leader_record leader_end;
 	struct paxos_dblock our_dblock_end;
 	struct paxos_dblock bk;
-	char *iobuf, **p_iobuf;
 	uint32_t host_id = token->host_id;
 	uint32_t sector_size = disk->sector_size;
 	uint32_t checksum;
 	struct paxos_dblock *bk_end;
 	uint64_t tmp_mbal = 0;
-	int q, tmp_q = -1, rv, iobuf_len;
-
-	iobuf_len = direct_align(disk);
-	if (iobuf_len < 0)
-		return iobuf_len;
-
-	p_iobuf = &iobuf;
-
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv)
-		return rv;
-
-	memset(iobuf, 0, iobuf_len);
-
-	rv = read_iobuf(disk->fd, disk->offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
-	if (rv < 0)
-		goto out;
+	int q, tmp_q = -1, rv;
 
 	memcpy(&leader_end, iobuf, sizeof(struct leader_record));
 
@@ -1156,7 +1206,7 @@ static int _lease_read_one(struct task *task,
 
 	rv = verify_leader(token, disk, leader_ret, checksum, caller);
 	if (rv < 0)
-		goto out;
+		return rv;
 
 	for (q = 0; q < leader_ret->num_hosts; q++) {
 		bk_end = (struct paxos_dblock *)(iobuf + ((2 + q) * sector_size));
@@ -1167,7 +1217,7 @@ static int _lease_read_one(struct task *task,
 
 		rv = verify_dblock(token, &bk, checksum);
 		if (rv < 0)
-			goto out;
+			return rv;
 
 		if (!tmp_mbal || bk.mbal > tmp_mbal) {
 			tmp_mbal = bk.mbal;
@@ -1177,13 +1227,46 @@ static int _lease_read_one(struct task *task,
 	*max_mbal = tmp_mbal;
 	*max_q = tmp_q;
 
+	return SANLK_OK;
+}
+
+static int _lease_read_one(struct task *task,
+			   struct token *token,
+			   struct sync_disk *disk,
+			   struct leader_record *leader_ret,
+			   struct paxos_dblock *our_dblock,
+			   uint64_t *max_mbal,
+			   int *max_q,
+			   const char *caller)
+{
+	char *iobuf;
+	int rv, iobuf_len;
+
+	iobuf_len = direct_align(disk);
+	if (iobuf_len < 0)
+		return iobuf_len;
+
+	iobuf = iobuf_get(task, iobuf_len);
+	if (!iobuf)
+		return -ENOMEM;
+
+	rv = read_iobuf(disk->fd, disk->offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
+	if (rv < 0)
+		goto out;
+
+	rv = _lease_parse(token, disk, iobuf, leader_ret, our_dblock,
+			  max_mbal, max_q, caller);
  out:
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		iobuf_put(task, iobuf, iobuf_len);
 	return rv;
 }
 
-/* TODO: completely untested */
+/*
+ * The lease areas on all disks are read concurrently, and each is
+ * parsed as its read completes.  With paxos_early_quorum, reads on
+ * the remaining disks are abandoned once a majority agree on the leader.
+ */
 
 static int _lease_read_num(struct task *task,
 			   struct token *token,
@@ -1193,15 +1276,20 @@ static int _lease_read_num(struct task *task,
 			   int *max_q,
 			   const char *caller)
 {
+	struct iobuf_batch batch;
+	struct iobuf_io *io;
 	struct paxos_dblock dblock_one;
 	struct leader_record leader_one;
 	struct leader_record *leaders;
+	struct sync_disk *disk;
+	char *iobuf[SANLK_MAX_DISKS];
 	uint64_t tmp_mbal = 0;
 	uint64_t mbal_one;
 	int *leader_reps;
+	int leader_ok[SANLK_MAX_DISKS];
 	int num_disks = token->r.num_disks;
-	int leaders_len, leader_reps_len;
-	int i, d, rv = 0, found, num_reads, q_one, tmp_q = -1;
+	int leaders_len, leader_reps_len, iobuf_len;
+	int i, j, d, rv = 0, found, num_reads, q_one, tmp_q = -1;
 
 	leaders_len = num_disks * sizeof(struct leader_record);
 	leader_reps_len = num_disks * sizeof(int);
@@ -1218,12 +1306,45 @@ static int _lease_read_num(struct task *task,
 
 	memset(leaders, 0, leaders_len);
 	memset(leader_reps, 0, leader_reps_len);
+	memset(leader_ok, 0, sizeof(leader_ok));
+	memset(iobuf, 0, sizeof(iobuf));
 
-	num_reads = 0;
+	iobuf_batch_init(&batch, task, IO_CMD_PREAD, token->io_timeout);
 
 	for (d = 0; d < num_disks; d++) {
-		rv = _lease_read_one(task, token, &token->disks[d], &leader_one,
-				     &dblock_one, &mbal_one, &q_one, caller);
+		disk = &token->disks[d];
+
+		iobuf_len = direct_align(disk);
+		if (iobuf_len < 0) {
+			rv = iobuf_len;
+			continue;
+		}
+
+		iobuf[d] = iobuf_get(task, iobuf_len);
+		if (!iobuf[d]) {
+			rv = -ENOMEM;
+			continue;
+		}
+
+		iobuf_batch_add(&batch, d, disk->fd, disk->offset, iobuf[d], iobuf_len);
+	}
+
+	iobuf_batch_submit(&batch);
+
+	num_reads = 0;
+
+	while ((i = iobuf_batch_next(&batch)) >= 0) {
+		io = &batch.io[i];
+		d = io->num;
+		rv = io->rv;
+
+		if (rv == SANLK_AIO_TIMEOUT)
+			iobuf[d] = NULL;
+		if (rv < 0)
+			continue;
+
+		rv = _lease_parse(token, &token->disks[d], iobuf[d], &leader_one,
+				  &dblock_one, &mbal_one, &q_one, caller);
 		if (rv < 0)
 			continue;
 
@@ -1236,20 +1357,47 @@ static int _lease_read_num(struct task *task,
 		}
 
 		memcpy(&leaders[d], &leader_one, sizeof(struct leader_record));
+		leader_ok[d] = 1;
 
-		leader_reps[d] = 1;
+		if (!com.paxos_early_quorum)
+			continue;
 
-		/* count how many times the same leader block repeats */
+		/* done when the same leader has been read from a majority */
+
+		found = 0;
+		for (j = 0; j < num_disks; j++) {
+			if (leader_ok[j] && leaders_match(&leaders[d], &leaders[j]))
+				found++;
+		}
+		if (majority_disks(num_disks, found))
+			iobuf_batch_abandon(&batch);
+	}
+
+	*max_mbal = tmp_mbal;
+	*max_q = tmp_q;
+
+	for (i = 0; i < batch.count; i++) {
+		/* don't free iobufs that have timed out or were abandoned */
+		if (batch.io[i].rv == SANLK_AIO_TIMEOUT)
+			continue;
+		iobuf_put(task, batch.io[i].iobuf, batch.io[i].iobuf_len);
+	}
+
+	/* count how many times the same leader block repeats */
+
+	for (d = 0; d < num_disks; d++) {
+		if (!leader_ok[d])
+			continue;
+
+		leader_reps[d] = 1;
 
 		for (i = 0; i < d; i++) {
-			if (leaders_match(&leaders[d], &leaders[i])) {
+			if (leader_ok[i] && leaders_match(&leaders[d], &leaders[i])) {
 				leader_reps[i]++;
 				break;
 			}
 		}
 	}
-	*max_mbal = tmp_mbal;
-	*max_q = tmp_q;
 
 	if (!num_reads) {
 		log_errot(token, "%s lease_read_num cannot read disks %d", caller, rv);
@@ -1274,6 +1422,8 @@ static int _lease_read_num(struct task *task,
 	if (!found) {
 		log_errot(token, "%s lease_read_num leader inconsistent", caller);
 		rv = SANLK_LEADER_DIFF;
+	} else {
+		rv = SANLK_OK;
 	}
  out:
 	free(leaders);
@@ -1380,10 +1530,13 @@ static int write_new_leader(struct task *task,
  * paxos_lease_acquire()
  * 	paxos_lease_read()	1 read   1 MB (entire lease area)
  * 	run_ballot()
- * 		write_dblock()	1 write  512 bytes (1 dblock sector)
+ * 		write_dblocks()	1 write  512 bytes (1 dblock sector)
  * 		read_iobuf()	1 read   1 MB (round up num_hosts + 2 sectors)
- * 		write_dblock()  1 write  512 bytes (1 dblock sector)
+ * 		write_dblocks() 1 write  512 bytes (1 dblock sector)
  * 		read_iobuf()	1 read   1 MB (round up num_hosts + 2 sectors)
+ *
+ * With multiple disks, each write_dblocks and read is done on all
+ * disks concurrently.
  * 	write_new_leader()	1 write  512 bytes (1 leader sector)
  *
  * 				6 i/os = 3 1MB reads, 3 512 byte writes
@@ -1404,8 +1557,9 @@ int paxos_lease_acquire(struct task *task,
 	struct paxos_dblock dblock;
 	struct paxos_dblock owner_dblock;
 	struct host_status hs;
-	uint64_t wait_start, now;
+	uint64_t wait_start, now, dead_at;
 	uint64_t last_timestamp;
+	uint64_t next_leader_read;
 	uint64_t next_lver;
 	uint64_t max_mbal;
 	uint64_t num_mbal;
@@ -1414,6 +1568,7 @@ int paxos_lease_acquire(struct task *task,
 	int disk_open = 0;
 	int error, rv, us;
 	int other_io_timeout, other_host_dead_seconds;
+	int leader_read_sec, wait_sec;
 
 	memset(&dblock, 0, sizeof(dblock)); /* shut up compiler */
 
@@ -1502,6 +1657,8 @@ int paxos_lease_acquire(struct task *task,
 		disk_open = 1;
 	}
 
+	memset(&hs, 0, sizeof(hs));
+
 	rv = host_info(cur_leader.space_name, cur_leader.owner_id, &hs);
 	if (!rv && hs.last_check && hs.last_live &&
 	    hs.owner_id == cur_leader.owner_id &&
@@ -1513,6 +1670,9 @@ int paxos_lease_acquire(struct task *task,
 		last_timestamp = 0;
 	}
 
+	next_leader_read = 0;
+	leader_read_sec = 1;
+
 	log_token(token, "paxos_acquire owner %llu %llu %llu "
 		  "host_status %llu %llu %llu wait_start %llu",
 		  (unsigned long long)cur_leader.owner_id,
@@ -1671,21 +1831,62 @@ int paxos_lease_acquire(struct task *task,
 		}
 
  skip_live_check:
-		/* TODO: test with sleep(2) here */
-		sleep(1);
+		/*
+		 * Rather than reading the owner's delta lease every second,
+		 * wait for our own lockspace to check it after each renewal
+		 * (check_other_leases updates host_status and wakes us), and
+		 * go back to read it directly when the owner looks alive or
+		 * could be dead.  The leader is reread on a backoff schedule
+		 * in the meantime, to see if the owner released it.
+		 */
 
-		if (external_shutdown) {
-			error = -1;
-			goto out;
-		}
+		while (1) {
+			if (hs.last_live && (hs.last_check == hs.last_live) &&
+			    hs.owner_id == cur_leader.owner_id &&
+			    hs.owner_generation == cur_leader.owner_generation)
+				break;
 
-		error = paxos_lease_leader_read(task, token, &tmp_leader, "paxos_acquire");
-		if (error < 0)
-			goto out;
+			other_host_dead_seconds = calc_host_dead_seconds(hs.io_timeout);
+			dead_at = wait_start + other_host_dead_seconds + 1;
+
+			now = monotime();
+			if (now >= dead_at)
+				break;
+
+			if (!next_leader_read)
+				next_leader_read = now + leader_read_sec;
+
+			wait_sec = (next_leader_read < dead_at ? next_leader_read : dead_at) - now;
+			if (wait_sec < 1)
+				wait_sec = 1;
+
+			rv = host_info_wait(cur_leader.space_name, cur_leader.owner_id,
+					    hs.last_check, wait_sec, &hs);
+			if (rv < 0 && rv != -ETIMEDOUT) {
+				/* the lockspace is gone, fall back to polling */
+				sleep(1);
+			}
+
+			if (external_shutdown) {
+				error = -1;
+				goto out;
+			}
+
+			if (monotime() < next_leader_read)
+				continue;
+
+			error = paxos_lease_leader_read(task, token, &tmp_leader, "paxos_acquire");
+			if (error < 0)
+				goto out;
+
+			if (memcmp(&cur_leader, &tmp_leader, sizeof(struct leader_record))) {
+				log_token(token, "paxos_acquire restart leader changed");
+				goto restart;
+			}
 
-		if (memcmp(&cur_leader, &tmp_leader, sizeof(struct leader_record))) {
-			log_token(token, "paxos_acquire restart leader changed");
-			goto restart;
+			if (leader_read_sec < PAXOS_OWNER_READ_MAX)
+				leader_read_sec *= 2;
+			next_leader_read = monotime() + leader_read_sec;
 		}
 	}
  run:
@@ -14,6 +14,9 @@
 #define PAXOS_ACQUIRE_SHARED		0x00000004
 #define PAXOS_ACQUIRE_OWNER_NOWAIT	0x00000008
 
+/* max seconds between leader reads while waiting on a live owner */
+#define PAXOS_OWNER_READ_MAX		8
+
 uint32_t leader_checksum(struct leader_record *lr);
 
 int paxos_lease_leader_read(struct task *task,
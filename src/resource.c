@@ -39,19 +39,93 @@ void send_state_resource(int fd, struct resource *r, const char *list_name, int
 
 /* from main.c */
 int get_rand(int a, int b);
+int thread_pool_wait_begin(void);
+void thread_pool_wait_end(void);
 
-static pthread_t resource_pt;
+/*
+ * A pool of resource_threads does the on-disk work passed off by
+ * release_token_async, release_orphan, set_resource_examine, etc.
+ * Each resource is handled by the thread chosen by its first disk, so
+ * operations on one disk are done in order by one thread.  Host event
+ * callbacks are done by a separate host_event_thread so they don't
+ * wait behind disk io.  The work flags, conditions and host_events are
+ * protected by resource_thread_mutex.
+ */
+
+struct resource_worker {
+	pthread_t pt;
+	pthread_cond_t cond;
+	int num;
+	int work;
+	int work_examine;
+};
+
+static struct resource_worker *resource_workers;
+static int resource_worker_count;
 static int resource_thread_stop;
-static int resource_thread_work;
-static int resource_thread_work_examine;
-static struct list_head resources_held;
-static struct list_head resources_add;
-static struct list_head resources_rem;
-static struct list_head resources_orphan;
-static pthread_mutex_t resource_mutex;
-static pthread_cond_t resource_cond;
+static pthread_mutex_t resource_thread_mutex;
+static pthread_t host_event_pt;
+static pthread_cond_t host_event_cond;
 static struct list_head host_events;
 
+/*
+ * Resources are split into shards by a hash of lockspace_name:name, and
+ * all of a resource's state is protected by its shard's mutex.  Within a
+ * shard, every resource is on one of the held/add/rem/orphan/cached lists
+ * (r->on_list records which), in a hash bucket, and linked into the
+ * resource_space for its lockspace, so that lookups don't scan the
+ * lists, and lockspace-wide operations only visit that lockspace.
+ *
+ * Lock order: spaces_mutex, then one shard mutex, then
+ * resource_thread_mutex.  Only one shard is locked at a time, and
+ * lock_shard aborts if a thread tries to take a second one.
+ */
+
+#define RESOURCE_SHARDS 64 /* power of 2 */
+#define RESOURCE_SHARD_HASH 256 /* buckets per shard, power of 2 */
+
+struct resource_space {
+	struct list_head list;      /* rsh->spaces */
+	struct list_head resources; /* r->space_list */
+	char name[NAME_ID_SIZE];
+};
+
+struct resource_shard {
+	pthread_mutex_t mutex;
+	struct list_head held;
+	struct list_head add;
+	struct list_head rem;
+	struct list_head orphan;
+	struct list_head cached;    /* R_CACHE, released but owned on disk */
+	struct list_head examine;   /* R_THREAD_EXAMINE resources */
+	struct list_head spaces;    /* resource_space */
+	struct list_head waiters;   /* token_waiter, in arrival order */
+	struct list_head hash[RESOURCE_SHARD_HASH];
+};
+
+/*
+ * An SANLK_ACQUIRE_WAIT acquire that finds the lease busy waits on its
+ * shard's waiters list.  Only the first waiter for a resource retries:
+ * when it is woken by the resource leaving the shard (the local holder
+ * released it), or every io_timeout seconds when another host owns it.
+ * A cmd worker that waits is not counted in the worker pool's limit, so
+ * the release it waits for can always be run, but the number waiting is
+ * limited (thread_pool_wait_begin).
+ */
+
+struct token_waiter {
+	struct list_head list;
+	char space_name[NAME_ID_SIZE];
+	char res_name[NAME_ID_SIZE];
+	pthread_cond_t cond;
+	int pid;
+	int wake;
+	int abort;
+};
+
+static struct resource_shard resource_shards[RESOURCE_SHARDS];
+static __thread struct resource_shard *shard_locked;
+
 
 static void free_resource(struct resource *r)
 {
@@ -60,32 +134,263 @@ static void free_resource(struct resource *r)
 	free(r);
 }
 
+static void lock_shard(struct resource_shard *rsh)
+{
+	if (shard_locked) {
+		log_error("lock_shard %ld with %ld locked",
+			  (long)(rsh - resource_shards),
+			  (long)(shard_locked - resource_shards));
+		abort();
+	}
+
+	pthread_mutex_lock(&rsh->mutex);
+	shard_locked = rsh;
+}
+
+static void unlock_shard(struct resource_shard *rsh)
+{
+	shard_locked = NULL;
+	pthread_mutex_unlock(&rsh->mutex);
+}
+
+/* mask has a bit set for each resource_worker num to wake */
+
+static void wake_resource_threads(uint64_t mask, int examine)
+{
+	struct resource_worker *w;
+	int i;
+
+	pthread_mutex_lock(&resource_thread_mutex);
+	for (i = 0; i < resource_worker_count; i++) {
+		if (!(mask & (1ULL << i)))
+			continue;
+		w = &resource_workers[i];
+		w->work = 1;
+		if (examine)
+			w->work_examine = 1;
+		pthread_cond_signal(&w->cond);
+	}
+	pthread_mutex_unlock(&resource_thread_mutex);
+}
+
+static int resource_worker_num(const char *disk_path)
+{
+	uint32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < SANLK_PATH_LEN && disk_path[i]; i++)
+		h = (h ^ (uint8_t)disk_path[i]) * 16777619U;
+
+	return h % resource_worker_count;
+}
+
+static uint64_t monotime_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000);
+}
+
+static void set_thread_release(struct resource *r)
+{
+	r->flags |= R_THREAD_RELEASE;
+	if (!r->thread_release_begin)
+		r->thread_release_begin = monotime_ms();
+}
+
+/* FNV-1a of the names as compared by strncmp(NAME_ID_SIZE) */
+
+static uint32_t resource_hash_key(const char *space_name, const char *res_name)
+{
+	uint32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < NAME_ID_SIZE && space_name[i]; i++)
+		h = (h ^ (uint8_t)space_name[i]) * 16777619U;
+
+	h = (h ^ ':') * 16777619U;
+
+	for (i = 0; i < NAME_ID_SIZE && res_name[i]; i++)
+		h = (h ^ (uint8_t)res_name[i]) * 16777619U;
+
+	return h;
+}
+
+static struct resource_shard *resource_shard(const char *space_name, const char *res_name)
+{
+	uint32_t h = resource_hash_key(space_name, res_name);
+
+	return &resource_shards[h % RESOURCE_SHARDS];
+}
+
+static struct list_head *resource_bucket(struct resource_shard *rsh,
+					 const char *space_name, const char *res_name)
+{
+	uint32_t h = resource_hash_key(space_name, res_name);
+
+	return &rsh->hash[(h / RESOURCE_SHARDS) % RESOURCE_SHARD_HASH];
+}
+
+static struct resource *lookup_resource(struct resource_shard *rsh,
+					const char *space_name, const char *res_name)
+{
+	struct list_head *head;
+	struct resource *r;
+
+	head = resource_bucket(rsh, space_name, res_name);
+
+	list_for_each_entry(r, head, hash_list) {
+		if (strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
+			continue;
+		if (strncmp(r->r.name, res_name, NAME_ID_SIZE))
+			continue;
+		return r;
+	}
+	return NULL;
+}
+
+static struct resource_space *find_resource_space(struct resource_shard *rsh,
+						  const char *space_name)
+{
+	struct resource_space *rs;
+
+	list_for_each_entry(rs, &rsh->spaces, list) {
+		if (!strncmp(rs->name, space_name, NAME_ID_SIZE))
+			return rs;
+	}
+	return NULL;
+}
+
+/* add a new r to the index and to one of the shard's resources lists */
+
+static int link_resource(struct resource_shard *rsh, struct resource *r,
+			 struct list_head *head)
+{
+	struct resource_space *rs;
+
+	rs = find_resource_space(rsh, r->r.lockspace_name);
+	if (!rs) {
+		rs = malloc(sizeof(struct resource_space));
+		if (!rs)
+			return -ENOMEM;
+		memset(rs, 0, sizeof(struct resource_space));
+		memcpy(rs->name, r->r.lockspace_name, NAME_ID_SIZE);
+		INIT_LIST_HEAD(&rs->resources);
+		list_add(&rs->list, &rsh->spaces);
+	}
+
+	r->shard = rsh;
+	r->rs = rs;
+	list_add(&r->space_list, &rs->resources);
+	list_add(&r->hash_list, resource_bucket(rsh, r->r.lockspace_name, r->r.name));
+	INIT_LIST_HEAD(&r->examine_list);
+	list_add(&r->list, head);
+	r->on_list = head;
+	return 0;
+}
+
+static void move_resource(struct resource *r, struct list_head *head)
+{
+	struct resource_shard *rsh = r->shard;
+
+	/* only held and cached resources are examined */
+	if ((r->on_list == &rsh->held || r->on_list == &rsh->cached) &&
+	    head != r->on_list) {
+		r->flags &= ~R_THREAD_EXAMINE;
+		list_del_init(&r->examine_list);
+	}
+
+	list_move(&r->list, head);
+	r->on_list = head;
+}
+
+static void put_resource_space(struct resource_space *rs)
+{
+	if (list_empty(&rs->resources)) {
+		list_del(&rs->list);
+		free(rs);
+	}
+}
+
+static struct token_waiter *first_waiter(struct resource_shard *rsh,
+					 const char *space_name, const char *res_name)
+{
+	struct token_waiter *w;
+
+	list_for_each_entry(w, &rsh->waiters, list) {
+		if (!strncmp(w->space_name, space_name, NAME_ID_SIZE) &&
+		    !strncmp(w->res_name, res_name, NAME_ID_SIZE))
+			return w;
+	}
+	return NULL;
+}
+
+static void wake_waiter(struct resource_shard *rsh,
+			const char *space_name, const char *res_name)
+{
+	struct token_waiter *w;
+
+	w = first_waiter(rsh, space_name, res_name);
+	if (w) {
+		w->wake = 1;
+		pthread_cond_signal(&w->cond);
+	}
+}
+
+static void _unlink_resource(struct resource *r)
+{
+	list_del(&r->list);
+	list_del(&r->hash_list);
+	list_del(&r->space_list);
+	list_del(&r->examine_list);
+	r->on_list = NULL;
+}
+
+/* remove r from the index and resources list, the caller frees r */
+
+static void unlink_resource(struct resource *r)
+{
+	_unlink_resource(r);
+	put_resource_space(r->rs);
+	wake_waiter(r->shard, r->r.lockspace_name, r->r.name);
+}
+
 /* N.B. the reporting function looks for the
    strings "add" and "rem", so if changed, they
    should be changed in both places. */
 
 void send_state_resources(int fd)
 {
+	struct resource_shard *rsh;
 	struct resource *r;
 	struct token *token;
+	int i;
 
-	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry(r, &resources_held, list) {
-		list_for_each_entry(token, &r->tokens, list)
-			send_state_resource(fd, r, "held", token->pid, token->token_id);
-	}
+	for (i = 0; i < RESOURCE_SHARDS; i++) {
+		rsh = &resource_shards[i];
 
-	list_for_each_entry(r, &resources_add, list) {
-		list_for_each_entry(token, &r->tokens, list)
-			send_state_resource(fd, r, "add", token->pid, token->token_id);
-	}
+		lock_shard(rsh);
+		list_for_each_entry(r, &rsh->held, list) {
+			list_for_each_entry(token, &r->tokens, list)
+				send_state_resource(fd, r, "held", token->pid, token->token_id);
+		}
+
+		list_for_each_entry(r, &rsh->add, list) {
+			list_for_each_entry(token, &r->tokens, list)
+				send_state_resource(fd, r, "add", token->pid, token->token_id);
+		}
 
-	list_for_each_entry(r, &resources_rem, list)
-		send_state_resource(fd, r, "rem", r->pid, r->release_token_id);
+		list_for_each_entry(r, &rsh->rem, list)
+			send_state_resource(fd, r, "rem", r->pid, r->release_token_id);
 
-	list_for_each_entry(r, &resources_orphan, list)
-		send_state_resource(fd, r, "orphan", r->pid, r->release_token_id);
-	pthread_mutex_unlock(&resource_mutex);
+		list_for_each_entry(r, &rsh->orphan, list)
+			send_state_resource(fd, r, "orphan", r->pid, r->release_token_id);
+
+		list_for_each_entry(r, &rsh->cached, list)
+			send_state_resource(fd, r, "cached", r->pid, r->release_token_id);
+		unlock_shard(rsh);
+	}
 }
 
 int read_resource_owners(struct task *task, struct token *token,
@@ -225,6 +530,11 @@ static int host_live(char *lockspace_name, uint64_t host_id, uint64_t gen)
 	int other_io_timeout, other_host_dead_seconds;
 	int rv;
 
+	/* host_info takes spaces_mutex, which is ordered before shards */
+	if (shard_locked)
+		log_error("host_live with shard %ld locked",
+			  (long)(shard_locked - resource_shards));
+
 	rv = host_info(lockspace_name, host_id, &hs);
 	if (rv) {
 		log_debug("host_live %llu %llu yes host_info %d",
@@ -302,10 +612,10 @@ static int write_host_block(struct task *task, struct token *token,
 	struct sync_disk *disk;
 	struct mode_block mb;
 	struct mode_block mb_end;
-	char *iobuf, **p_iobuf;
+	char *iobuf;
 	uint64_t offset;
 	int num_disks = token->r.num_disks;
-	int iobuf_len, rv, d;
+	int iobuf_len, rv = 0, d;
 
 	disk = &token->disks[0];
 
@@ -313,14 +623,10 @@ static int write_host_block(struct task *task, struct token *token,
 	if (!iobuf_len)
 		return -EINVAL;
 
-	p_iobuf = &iobuf;
-
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv)
+	iobuf = iobuf_get(task, iobuf_len);
+	if (!iobuf)
 		return -ENOMEM;
 
-	memset(iobuf, 0, iobuf_len);
-
 	if (mb_gen || mb_flags) {
 		memset(&mb, 0, sizeof(mb));
 		mb.flags = mb_flags;
@@ -348,7 +654,7 @@ static int write_host_block(struct task *task, struct token *token,
 	}
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		iobuf_put(task, iobuf, iobuf_len);
 	return rv;
 
 }
@@ -359,11 +665,11 @@ static int read_mode_block(struct task *task, struct token *token,
 	struct sync_disk *disk;
 	struct mode_block *mb_end;
 	struct mode_block mb;
-	char *iobuf, **p_iobuf;
+	char *iobuf;
 	uint64_t offset;
 	uint64_t max = 0;
 	int num_disks = token->r.num_disks;
-	int iobuf_len, rv, d;
+	int iobuf_len, rv = 0, d;
 
 	disk = &token->disks[0];
 
@@ -371,10 +677,8 @@ static int read_mode_block(struct task *task, struct token *token,
 	if (!iobuf_len)
 		return -EINVAL;
 
-	p_iobuf = &iobuf;
-
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv)
+	iobuf = iobuf_get(task, iobuf_len);
+	if (!iobuf)
 		return -ENOMEM;
 
 	for (d = 0; d < num_disks; d++) {
@@ -398,7 +702,7 @@ static int read_mode_block(struct task *task, struct token *token,
 	}
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		iobuf_put(task, iobuf, iobuf_len);
 
 	*max_gen = max;
 	return rv;
@@ -496,71 +800,71 @@ static int write_lvb_block(struct task *task, struct resource *r, struct token *
 
 int res_set_lvb(struct sanlk_resource *res, char *lvb, int lvblen)
 {
+	struct resource_shard *rsh;
 	struct resource *r;
 	int rv = -ENOENT;
 
-	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry(r, &resources_held, list) {
-		if (strncmp(r->r.lockspace_name, res->lockspace_name, NAME_ID_SIZE))
-			continue;
-		if (strncmp(r->r.name, res->name, NAME_ID_SIZE))
-			continue;
+	rsh = resource_shard(res->lockspace_name, res->name);
 
-		if (!r->lvb) {
-			rv = -EINVAL;
-			break;
-		}
+	lock_shard(rsh);
+	r = lookup_resource(rsh, res->lockspace_name, res->name);
+	if (!r || r->on_list != &rsh->held)
+		goto out;
 
-		if (lvblen > r->leader.sector_size) {
-			rv = -E2BIG;
-			break;
-		}
+	if (!r->lvb) {
+		rv = -EINVAL;
+		goto out;
+	}
 
-		memcpy(r->lvb, lvb, lvblen);
-		r->flags |= R_LVB_WRITE_RELEASE;
-		rv = 0;
-		break;
+	if (lvblen > r->leader.sector_size) {
+		rv = -E2BIG;
+		goto out;
 	}
-	pthread_mutex_unlock(&resource_mutex);
+
+	memcpy(r->lvb, lvb, lvblen);
+	r->flags |= R_LVB_WRITE_RELEASE;
+	rv = 0;
+ out:
+	unlock_shard(rsh);
 
 	return rv;
 }
 
 int res_get_lvb(struct sanlk_resource *res, char **lvb_out, int *lvblen)
 {
+	struct resource_shard *rsh;
 	struct resource *r;
 	char *lvb;
 	int rv = -ENOENT;
 	int len = *lvblen;
 
-	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry(r, &resources_held, list) {
-		if (strncmp(r->r.lockspace_name, res->lockspace_name, NAME_ID_SIZE))
-			continue;
-		if (strncmp(r->r.name, res->name, NAME_ID_SIZE))
-			continue;
+	rsh = resource_shard(res->lockspace_name, res->name);
 
-		if (!r->lvb) {
-			rv = -EINVAL;
-			break;
-		}
+	lock_shard(rsh);
+	r = lookup_resource(rsh, res->lockspace_name, res->name);
+	if (!r || r->on_list != &rsh->held)
+		goto out;
 
-		if (!len)
-			len = r->leader.sector_size;
+	if (!r->lvb) {
+		rv = -EINVAL;
+		goto out;
+	}
 
-		lvb = malloc(len);
-		if (!lvb) {
-			rv = -ENOMEM;
-			break;
-		}
+	if (!len)
+		len = r->leader.sector_size;
 
-		memcpy(lvb, r->lvb, len);
-		*lvb_out = lvb;
-		*lvblen = len;
-		rv = 0;
-		break;
+	lvb = malloc(len);
+	if (!lvb) {
+		rv = -ENOMEM;
+		goto out;
 	}
-	pthread_mutex_unlock(&resource_mutex);
+
+	memcpy(lvb, r->lvb, len);
+	*lvb_out = lvb;
+	*lvblen = len;
+	rv = 0;
+ out:
+	unlock_shard(rsh);
 
 	return rv;
 }
@@ -721,34 +1025,71 @@ static int release_disk(struct task *task, struct token *token,
  *   invalidate any on-disk lease state
  */
 
+/*
+ * An R_CACHE lease is kept owned on disk when released, and the
+ * resource is moved to the cached list, from which acquire_token
+ * takes it back without disk i/o.
+ */
+
+static int can_cache(struct resource *r, struct token *token)
+{
+	if (!(r->flags & R_CACHE))
+		return 0;
+	if (r->flags & (R_SHARED | R_UNDO_SHARED | R_ERASE_ALL | R_LVB_WRITE_RELEASE))
+		return 0;
+	if (token->space_dead || !r->leader.lver)
+		return 0;
+	return 1;
+}
+
+static void cache_resource(struct resource *r, struct token *token)
+{
+	r->pid = 0;
+	r->release_token_id = token->token_id;
+	move_resource(r, &r->shard->cached);
+	wake_waiter(r->shard, r->r.lockspace_name, r->r.name);
+}
+
 static int _release_token(struct task *task, struct token *token,
 			  struct sanlk_resource *resrename,
 			  int opened, int nodisk)
 {
 	struct leader_record leader;
 	struct resource *r = token->resource;
+	struct resource_shard *rsh = r->shard;
 	uint64_t lver;
 	uint32_t r_flags = 0;
 	int retry_async = 0;
 	int last_token = 0;
+	int cached = 0;
 	int ret = SANLK_OK;
 	int rv;
 
-	/* We keep r on the resources_rem list while doing the actual release 
+	/* We keep r on the rem list while doing the actual release 
 	   on disk so another acquire for the same resource will see it on
 	   the list and fail. we can't have one thread releasing and another
 	   acquiring the same resource.  While on the rem list, the resource
 	   can't be used by anyone. */
 
-	pthread_mutex_lock(&resource_mutex);
+	lock_shard(rsh);
 	list_del(&token->list);
-	if (list_empty(&r->tokens)) {
-		list_move(&r->list, &resources_rem);
+	if (list_empty(&r->tokens) && !resrename && !nodisk && can_cache(r, token)) {
+		cache_resource(r, token);
+		cached = 1;
+	} else if (list_empty(&r->tokens)) {
+		move_resource(r, &rsh->rem);
 		last_token = 1;
 	}
 	lver = r->leader.lver;
 	r_flags = r->flags;
-	pthread_mutex_unlock(&resource_mutex);
+	unlock_shard(rsh);
+
+	if (cached) {
+		log_token(token, "release_token cached lver %llu",
+			  (unsigned long long)lver);
+		close_disks(token->disks, token->r.num_disks);
+		return SANLK_OK;
+	}
 
 	if ((r_flags & R_SHARED) && !last_token) {
 		/* will release when final sh token is released */
@@ -900,9 +1241,9 @@ static int _release_token(struct task *task, struct token *token,
 			log_token(token, "release_token error %d r_flags %x", ret, r_flags);
 		else
 			log_token(token, "release_token done r_flags %x", r_flags);
-		pthread_mutex_lock(&resource_mutex);
-		list_del(&r->list);
-		pthread_mutex_unlock(&resource_mutex);
+		lock_shard(rsh);
+		unlink_resource(r);
+		unlock_shard(rsh);
 		free_resource(r);
 		return ret;
 	}
@@ -910,16 +1251,16 @@ static int _release_token(struct task *task, struct token *token,
 	/*
 	 * If a transient i/o error prevented the release on disk,
 	 * then handle this like an async release; set R_THREAD_RELEASE,
-	 * leave r on resources_rem, let resource_thread_release attempt
+	 * leave r on the rem list, let resource_thread_release attempt
 	 * to release it.  We don't want to leave the lease locked on
 	 * disk, preventing others from acquiring it.
 	 */
 
 	log_errot(token, "release_token timeout r_flags %x", r_flags);
-	pthread_mutex_lock(&resource_mutex);
-	r->flags |= R_THREAD_RELEASE;
+	lock_shard(rsh);
+	set_thread_release(r);
 	r->release_token_id = token->token_id;
-	pthread_mutex_unlock(&resource_mutex);
+	unlock_shard(rsh);
 	return SANLK_AIO_TIMEOUT;
 }
 
@@ -946,42 +1287,45 @@ int release_token(struct task *task, struct token *token,
 void release_token_async(struct token *token)
 {
 	struct resource *r = token->resource;
+	struct resource_shard *rsh = r->shard;
+	uint64_t wake = 0;
 
-	pthread_mutex_lock(&resource_mutex);
+	lock_shard(rsh);
 	list_del(&token->list);
 	if (list_empty(&r->tokens)) {
 		if (token->space_dead || !r->leader.lver) {
 			/* don't bother trying to release if the lockspace
 			   is dead (release will probably fail), or the
 			   lease was never acquired */
-			list_del(&r->list);
+			unlink_resource(r);
 			free_resource(r);
 		} else if (token->acquire_flags & SANLK_RES_PERSISTENT) {
 			r->release_token_id = token->token_id;
-			list_move(&r->list, &resources_orphan);
+			move_resource(r, &rsh->orphan);
+		} else if (can_cache(r, token)) {
+			cache_resource(r, token);
 		} else {
-			r->flags |= R_THREAD_RELEASE;
+			set_thread_release(r);
 			r->release_token_id = token->token_id;
-			resource_thread_work = 1;
-			list_move(&r->list, &resources_rem);
-			pthread_cond_signal(&resource_cond);
+			move_resource(r, &rsh->rem);
+			wake = 1ULL << r->worker;
 		}
 	}
-	pthread_mutex_unlock(&resource_mutex);
+	unlock_shard(rsh);
+
+	if (wake)
+		wake_resource_threads(wake, 0);
 }
 
-static struct resource *find_resource(struct token *token,
+static struct resource *find_resource(struct resource_shard *rsh,
+				      struct token *token,
 				      struct list_head *head)
 {
 	struct resource *r;
 
-	list_for_each_entry(r, head, list) {
-		if (strncmp(r->r.lockspace_name, token->r.lockspace_name, NAME_ID_SIZE))
-			continue;
-		if (strncmp(r->r.name, token->r.name, NAME_ID_SIZE))
-			continue;
+	r = lookup_resource(rsh, token->r.lockspace_name, token->r.name);
+	if (r && r->on_list == head)
 		return r;
-	}
 	return NULL;
 }
 
@@ -992,45 +1336,52 @@ static struct resource *find_resource(struct token *token,
 
 int lockspace_is_used(struct sanlk_lockspace *ls)
 {
+	struct resource_shard *rsh;
+	struct resource_space *rs;
 	struct resource *r;
-
-	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry(r, &resources_held, list) {
-		if (!strncmp(r->r.lockspace_name, ls->name, NAME_ID_SIZE))
-			goto yes;
-	}
-	list_for_each_entry(r, &resources_add, list) {
-		if (!strncmp(r->r.lockspace_name, ls->name, NAME_ID_SIZE))
-			goto yes;
-	}
-	list_for_each_entry(r, &resources_rem, list) {
-		if (!strncmp(r->r.lockspace_name, ls->name, NAME_ID_SIZE))
-			goto yes;
-	}
-	list_for_each_entry(r, &resources_orphan, list) {
-		if (!strncmp(r->r.lockspace_name, ls->name, NAME_ID_SIZE))
-			goto yes;
+	int i, used = 0;
+
+	/* a resource_space exists while it has any resources, cached
+	   resources are released when the lockspace is removed */
+
+	for (i = 0; i < RESOURCE_SHARDS && !used; i++) {
+		rsh = &resource_shards[i];
+		lock_shard(rsh);
+		rs = find_resource_space(rsh, ls->name);
+		if (rs) {
+			list_for_each_entry(r, &rs->resources, space_list) {
+				if (r->on_list != &rsh->cached) {
+					used = 1;
+					break;
+				}
+			}
+		}
+		unlock_shard(rsh);
 	}
-	pthread_mutex_unlock(&resource_mutex);
-	return 0;
- yes:
-	pthread_mutex_unlock(&resource_mutex);
-	return 1;
+	return used;
 }
 
 int resource_orphan_count(char *space_name)
 {
+	struct resource_shard *rsh;
+	struct resource_space *rs;
 	struct resource *r;
-	int count = 0;
-
-	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry(r, &resources_orphan, list) {
-		if (!strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
-			count++;
+	int i, count = 0;
+
+	for (i = 0; i < RESOURCE_SHARDS; i++) {
+		rsh = &resource_shards[i];
+		lock_shard(rsh);
+		rs = find_resource_space(rsh, space_name);
+		if (rs) {
+			list_for_each_entry(r, &rs->resources, space_list) {
+				if (r->on_list == &rsh->orphan)
+					count++;
+			}
+		}
+		unlock_shard(rsh);
 	}
-	pthread_mutex_unlock(&resource_mutex);
 	return count;
-}	
+}
 
 static void copy_disks(void *dst, void *src, int num_disks)
 {
@@ -1077,6 +1428,7 @@ static struct resource *new_resource(struct token *token)
 
 	r->host_id = token->host_id;
 	r->host_generation = token->host_generation;
+	r->worker = resource_worker_num(token->r.disks[0].path);
 
 	if (token->acquire_flags & SANLK_RES_SHARED) {
 		r->flags |= R_SHARED;
@@ -1297,6 +1649,7 @@ static int convert_ex2sh_token(struct task *task, struct resource *r, struct tok
 
 int convert_token(struct task *task, struct sanlk_resource *res, struct token *cl_token)
 {
+	struct resource_shard *rsh;
 	struct resource *r;
 	struct token *tk;
 	struct token *token = NULL;
@@ -1305,11 +1658,13 @@ int convert_token(struct task *task, struct sanlk_resource *res, struct token *c
 
 	/* we could probably grab cl_token->r, but it's good to verify */
 
-	pthread_mutex_lock(&resource_mutex);
+	rsh = resource_shard(cl_token->r.lockspace_name, cl_token->r.name);
 
-	r = find_resource(cl_token, &resources_held);
+	lock_shard(rsh);
+
+	r = find_resource(rsh, cl_token, &rsh->held);
 	if (!r) {
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
 		log_error("convert_token resource not found %.48s:%.48s",
 			  cl_token->r.lockspace_name, cl_token->r.name);
 		rv = -ENOENT;
@@ -1325,7 +1680,7 @@ int convert_token(struct task *task, struct sanlk_resource *res, struct token *c
 		if (tk->acquire_flags & SANLK_RES_SHARED)
 			sh_count++;
 	}
-	pthread_mutex_unlock(&resource_mutex);
+	unlock_shard(rsh);
 
 	if (!token) {
 		log_errot(cl_token, "convert_token token not found pid %d %.48s:%.48s",
@@ -1378,10 +1733,11 @@ int convert_token(struct task *task, struct sanlk_resource *res, struct token *c
 	return rv;
 }
 
-int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
-		  char *killpath, char *killargs)
+static int _acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
+			  char *killpath, char *killargs)
 {
 	struct leader_record leader;
+	struct resource_shard *rsh;
 	struct resource *r;
 	uint64_t acquire_lver = 0;
 	uint32_t new_num_hosts = 0;
@@ -1404,52 +1760,54 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 	if (cmd_flags & SANLK_ACQUIRE_OWNER_NOWAIT)
 		owner_nowait = 1;
 
-	pthread_mutex_lock(&resource_mutex);
+	rsh = resource_shard(token->r.lockspace_name, token->r.name);
+
+	lock_shard(rsh);
 
 	/*
 	 * Check if this resource already exists on any of the resource lists.
 	 */
 
-	r = find_resource(token, &resources_rem);
+	r = find_resource(rsh, token, &rsh->rem);
 	if (r) {
 		if (!com.quiet_fail)
 			log_errot(token, "acquire_token resource being removed");
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
 		return -EAGAIN;
 	}
 
-	r = find_resource(token, &resources_add);
+	r = find_resource(rsh, token, &rsh->add);
 	if (r) {
 		if (!com.quiet_fail)
 			log_errot(token, "acquire_token resource being added");
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
 		return -EBUSY;
 	}
 
-	r = find_resource(token, &resources_held);
+	r = find_resource(rsh, token, &rsh->held);
 	if (r && (token->acquire_flags & SANLK_RES_SHARED) && (r->flags & R_SHARED)) {
 		/* multiple shared holders allowed */
 		log_token(token, "acquire_token add shared");
 		copy_disks(&token->r.disks, &r->r.disks, token->r.num_disks);
 		token->resource = r;
 		list_add(&token->list, &r->tokens);
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
 		return SANLK_OK;
 	}
 
 	if (r) {
 		if (!com.quiet_fail)
 			log_errot(token, "acquire_token resource exists");
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
 		return -EEXIST;
 	}
 
 	/* caller did not ask for orphan, but an orphan exists */
 
-	r = find_resource(token, &resources_orphan);
+	r = find_resource(rsh, token, &rsh->orphan);
 	if (r && !allow_orphan) {
 		log_errot(token, "acquire_token found orphan");
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
 		return -EUCLEAN;
 	}
 
@@ -1458,7 +1816,7 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 	if (r && allow_orphan && 
 	    (r->flags & R_SHARED) && !(token->acquire_flags & SANLK_RES_SHARED)) {
 		log_errot(token, "acquire_token orphan is shared");
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
 		return -EUCLEAN;
 	}
 
@@ -1467,7 +1825,7 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 	if (r && allow_orphan &&
 	    !(r->flags & R_SHARED) && (token->acquire_flags & SANLK_RES_SHARED)) {
 		log_errot(token, "acquire_token orphan is exclusive");
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
 		return -EUCLEAN;
 	}
 
@@ -1478,8 +1836,8 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 		log_token(token, "acquire_token adopt shared orphan");
 		token->resource = r;
 		list_add(&token->list, &r->tokens);
-		list_move(&r->list, &resources_held);
-		pthread_mutex_unlock(&resource_mutex);
+		move_resource(r, &rsh->held);
+		unlock_shard(rsh);
 
 		/* do this to initialize some token fields */
 		rv = open_disks(token->disks, token->r.num_disks);
@@ -1502,8 +1860,8 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 		r->pid = token->pid;
 		token->resource = r;
 		list_add(&token->list, &r->tokens);
-		list_move(&r->list, &resources_held);
-		pthread_mutex_unlock(&resource_mutex);
+		move_resource(r, &rsh->held);
+		unlock_shard(rsh);
 
 		/* do this to initialize some token fields */
 		rv = open_disks(token->disks, token->r.num_disks);
@@ -1520,26 +1878,68 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 	/* caller only wants to acquire an orphan */
 
 	if (cmd_flags & only_orphan) {
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
 		return -ENOENT;
 	}
 
+	/* this host still owns the lease on disk from a cached release */
+
+	r = find_resource(rsh, token, &rsh->cached);
+	if (r && !(token->acquire_flags & SANLK_RES_SHARED) &&
+	    !(cmd_flags & SANLK_ACQUIRE_LVB) && !new_num_hosts &&
+	    r->host_generation == token->host_generation &&
+	    (!acquire_lver || acquire_lver == r->leader.lver)) {
+		log_token(token, "acquire_token adopt cached lver %llu",
+			  (unsigned long long)r->leader.lver);
+		token->r.lver = r->leader.lver;
+		r->pid = token->pid;
+		r->flags &= ~(R_CACHE | R_RESTRICT_SIGKILL | R_RESTRICT_SIGTERM);
+		if (cmd_flags & SANLK_ACQUIRE_CACHE)
+			r->flags |= R_CACHE;
+		if (token->flags & T_RESTRICT_SIGKILL)
+			r->flags |= R_RESTRICT_SIGKILL;
+		if (token->flags & T_RESTRICT_SIGTERM)
+			r->flags |= R_RESTRICT_SIGTERM;
+		memcpy(r->killpath, killpath, SANLK_HELPER_PATH_LEN);
+		memcpy(r->killargs, killargs, SANLK_HELPER_ARGS_LEN);
+		copy_disks(&token->r.disks, &r->r.disks, token->r.num_disks);
+		token->resource = r;
+		list_add(&token->list, &r->tokens);
+		move_resource(r, &rsh->held);
+		unlock_shard(rsh);
+		return SANLK_OK;
+	}
+
+	/* the ballot below takes over the lease that this host owns */
+
+	if (r) {
+		log_token(token, "acquire_token drop cached lver %llu",
+			  (unsigned long long)r->leader.lver);
+		unlink_resource(r);
+		free_resource(r);
+	}
+
 	/*
 	 * The resource does not exist, so create it.
 	 */
 
 	r = new_resource(token);
 	if (!r) {
-		pthread_mutex_unlock(&resource_mutex);
+		unlock_shard(rsh);
+		return -ENOMEM;
+	}
+
+	if (link_resource(rsh, r, &rsh->add) < 0) {
+		unlock_shard(rsh);
+		free_resource(r);
 		return -ENOMEM;
 	}
 
 	memcpy(r->killpath, killpath, SANLK_HELPER_PATH_LEN);
 	memcpy(r->killargs, killargs, SANLK_HELPER_ARGS_LEN);
 	list_add(&token->list, &r->tokens);
-	list_add(&r->list, &resources_add);
 	token->resource = r;
-	pthread_mutex_unlock(&resource_mutex);
+	unlock_shard(rsh);
 
 	rv = open_disks(token->disks, token->r.num_disks);
 	if (rv < 0) {
@@ -1551,15 +1951,11 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 	copy_disks(&r->r.disks, &token->r.disks, token->r.num_disks);
 
 	if (cmd_flags & SANLK_ACQUIRE_LVB) {
-		char *iobuf, **p_iobuf;
-		p_iobuf = &iobuf;
-
-		rv = posix_memalign((void *)p_iobuf, getpagesize(), token->disks[0].sector_size);
-		if (rv)
-			log_errot(token, "acquire_token lvb size %d memalign error %d",
-				  token->disks[0].sector_size, rv);
-		else
-			r->lvb = iobuf;
+		/* not from the task's pool or mlocked, free_resource frees it */
+		r->lvb = iobuf_get(NULL, token->disks[0].sector_size);
+		if (!r->lvb)
+			log_errot(token, "acquire_token lvb size %d alloc error",
+				  token->disks[0].sector_size);
 	}
 
  retry:
@@ -1708,13 +2104,192 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 
 	close_disks(token->disks, token->r.num_disks);
 
-	pthread_mutex_lock(&resource_mutex);
-	list_move(&r->list, &resources_held);
-	pthread_mutex_unlock(&resource_mutex);
+	lock_shard(rsh);
+	if ((cmd_flags & SANLK_ACQUIRE_CACHE) && !(cmd_flags & SANLK_ACQUIRE_LVB) &&
+	    !(token->acquire_flags & SANLK_RES_SHARED))
+		r->flags |= R_CACHE;
+	move_resource(r, &rsh->held);
+	unlock_shard(rsh);
 
 	return SANLK_OK;
 }
 
+/* acquire_token errors from the lease being used by another token */
+
+static int lease_busy(int rv)
+{
+	switch (rv) {
+	case -EEXIST:
+	case -EAGAIN:
+	case -EBUSY:
+	case SANLK_ACQUIRE_IDLIVE:
+	case SANLK_ACQUIRE_OWNED:
+	case SANLK_ACQUIRE_OTHER:
+	case SANLK_ACQUIRE_OWNED_RETRY:
+	case SANLK_ACQUIRE_SHRETRY:
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Ask the host that owns the lease for it, once per waiter: request the
+ * next lver and set the owner's bit so that it examines the request.
+ * An owner holding the lease cached (SANLK_ACQUIRE_CACHE) releases it.
+ */
+
+static void request_owner(struct task *task, struct token *token)
+{
+	uint64_t acquire_lver = token->acquire_lver;
+	uint64_t owner_id = 0;
+	int rv;
+
+	token->acquire_lver = 0;
+	rv = request_token(task, token, 0, &owner_id, 1);
+	token->acquire_lver = acquire_lver;
+
+	log_token(token, "acquire_token wait request rv %d owner %llu",
+		  rv, (unsigned long long)owner_id);
+
+	if (rv == SANLK_OK && owner_id && owner_id != token->host_id)
+		host_status_set_bit(token->r.lockspace_name, owner_id);
+}
+
+static int acquire_token_wait(struct task *task, struct token *token, uint32_t cmd_flags,
+			      char *killpath, char *killargs)
+{
+	struct resource_shard *rsh;
+	struct resource *r;
+	struct token_waiter w;
+	struct space_info spi;
+	struct timespec ts;
+	uint64_t retry_time = 0;
+	int requested = 0;
+	int waiting = 0;
+	int rv = 0;
+
+	memset(&w, 0, sizeof(w));
+	memcpy(w.space_name, token->r.lockspace_name, NAME_ID_SIZE);
+	memcpy(w.res_name, token->r.name, NAME_ID_SIZE);
+	pthread_cond_init(&w.cond, NULL);
+	w.pid = token->pid;
+	w.wake = 1;
+
+	rsh = resource_shard(token->r.lockspace_name, token->r.name);
+
+	lock_shard(rsh);
+	list_add_tail(&w.list, &rsh->waiters);
+
+	while (1) {
+		if (w.abort) {
+			rv = -ESTALE;
+			break;
+		}
+
+		if (first_waiter(rsh, w.space_name, w.res_name) == &w &&
+		    (w.wake || monotime() >= retry_time)) {
+			w.wake = 0;
+			unlock_shard(rsh);
+			rv = _acquire_token(task, token, cmd_flags, killpath, killargs);
+			lock_shard(rsh);
+
+			if (!lease_busy(rv))
+				break;
+
+			r = lookup_resource(rsh, w.space_name, w.res_name);
+			if (r && r->on_list == &rsh->held && r->pid == token->pid)
+				break;
+
+			retry_time = monotime() + token->io_timeout;
+
+			if (rv == -EEXIST || rv == -EAGAIN || rv == -EBUSY)
+				continue;
+
+			/* another host owns it, and our attempt woke us */
+			w.wake = 0;
+
+			if (!requested) {
+				log_token(token, "acquire_token wait owned %d", rv);
+				requested = 1;
+				unlock_shard(rsh);
+				request_owner(task, token);
+				lock_shard(rsh);
+			}
+			continue;
+		}
+
+		if (!waiting) {
+			unlock_shard(rsh);
+			rv = thread_pool_wait_begin();
+			lock_shard(rsh);
+			if (rv < 0) {
+				log_token(token, "acquire_token wait too many waiters");
+				break;
+			}
+			waiting = 1;
+			continue;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+
+		if (pthread_cond_timedwait(&w.cond, &rsh->mutex, &ts) != ETIMEDOUT)
+			continue;
+
+		unlock_shard(rsh);
+		rv = lockspace_info(token->r.lockspace_name, &spi);
+		lock_shard(rsh);
+
+		if (rv < 0 || spi.killing_pids || spi.host_generation != token->host_generation) {
+			log_token(token, "acquire_token wait lockspace gone");
+			rv = -ENOSPC;
+			break;
+		}
+	}
+
+	list_del(&w.list);
+
+	/* the next waiter for the resource is now first */
+	wake_waiter(rsh, w.space_name, w.res_name);
+	unlock_shard(rsh);
+
+	if (waiting)
+		thread_pool_wait_end();
+
+	pthread_cond_destroy(&w.cond);
+	return rv;
+}
+
+int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
+		  char *killpath, char *killargs)
+{
+	if (cmd_flags & SANLK_ACQUIRE_WAIT)
+		return acquire_token_wait(task, token, cmd_flags, killpath, killargs);
+
+	return _acquire_token(task, token, cmd_flags, killpath, killargs);
+}
+
+/* the pid waiting in acquire_token_wait has exited */
+
+void abort_token_waiters(int pid)
+{
+	struct resource_shard *rsh;
+	struct token_waiter *w;
+	int i;
+
+	for (i = 0; i < RESOURCE_SHARDS; i++) {
+		rsh = &resource_shards[i];
+		lock_shard(rsh);
+		list_for_each_entry(w, &rsh->waiters, list) {
+			if (w->pid != pid)
+				continue;
+			w->abort = 1;
+			pthread_cond_signal(&w->cond);
+		}
+		unlock_shard(rsh);
+	}
+}
+
 int request_token(struct task *task, struct token *token, uint32_t force_mode,
 		  uint64_t *owner_id, int next_lver)
 {
@@ -1830,19 +2405,22 @@ static void do_request(struct token *tt, int pid, uint32_t force_mode)
 	char killpath[SANLK_HELPER_PATH_LEN];
 	char killargs[SANLK_HELPER_ARGS_LEN];
 	struct helper_msg hm;
+	struct resource_shard *rsh;
 	struct resource *r;
 	uint32_t flags;
 	int rv, found = 0;
 
-	pthread_mutex_lock(&resource_mutex);
-	r = find_resource(tt, &resources_held);
+	rsh = resource_shard(tt->r.lockspace_name, tt->r.name);
+
+	lock_shard(rsh);
+	r = find_resource(rsh, tt, &rsh->held);
 	if (r && r->pid == pid) {
 		found = 1;
 		flags = r->flags;
 		memcpy(killpath, r->killpath, SANLK_HELPER_PATH_LEN);
 		memcpy(killargs, r->killargs, SANLK_HELPER_ARGS_LEN);
 	}
-	pthread_mutex_unlock(&resource_mutex);
+	unlock_shard(rsh);
 
 	if (!found) {
 		log_error("do_request pid %d %.48s:%.48s not found",
@@ -1890,25 +2468,62 @@ static void do_request(struct token *tt, int pid, uint32_t force_mode)
 			  pid, errno);
 }
 
-int set_resource_examine(char *space_name, char *res_name)
+static void examine_resource(struct resource *r)
 {
+	if (!(r->flags & R_THREAD_EXAMINE)) {
+		r->flags |= R_THREAD_EXAMINE;
+		list_add_tail(&r->examine_list, &r->shard->examine);
+	}
+}
+
+static int examine_space_shard(struct resource_shard *rsh, char *space_name,
+			       uint64_t *wake)
+{
+	struct resource_space *rs;
 	struct resource *r;
 	int count = 0;
 
-	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry(r, &resources_held, list) {
-		if (strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
-			continue;
-		if (res_name && strncmp(r->r.name, res_name, NAME_ID_SIZE))
-			continue;
-		r->flags |= R_THREAD_EXAMINE;
-		resource_thread_work = 1;
-		resource_thread_work_examine = 1;
-		count++;
+	lock_shard(rsh);
+	rs = find_resource_space(rsh, space_name);
+	if (rs) {
+		list_for_each_entry(r, &rs->resources, space_list) {
+			if (r->on_list != &rsh->held && r->on_list != &rsh->cached)
+				continue;
+			examine_resource(r);
+			*wake |= 1ULL << r->worker;
+			count++;
+		}
 	}
-	if (count)
-		pthread_cond_signal(&resource_cond);
-	pthread_mutex_unlock(&resource_mutex);
+	unlock_shard(rsh);
+
+	return count;
+}
+
+int set_resource_examine(char *space_name, char *res_name)
+{
+	struct resource_shard *rsh;
+	struct resource *r;
+	uint64_t wake = 0;
+	int i, count = 0;
+
+	if (res_name) {
+		rsh = resource_shard(space_name, res_name);
+
+		lock_shard(rsh);
+		r = lookup_resource(rsh, space_name, res_name);
+		if (r && (r->on_list == &rsh->held || r->on_list == &rsh->cached)) {
+			examine_resource(r);
+			wake |= 1ULL << r->worker;
+			count++;
+		}
+		unlock_shard(rsh);
+	} else {
+		for (i = 0; i < RESOURCE_SHARDS; i++)
+			count += examine_space_shard(&resource_shards[i], space_name, &wake);
+	}
+
+	if (wake)
+		wake_resource_threads(wake, 1);
 
 	return count;
 }
@@ -1920,17 +2535,30 @@ int set_resource_examine(char *space_name, char *res_name)
  * - examines request blocks of resources
  */
 
-static struct resource *find_resource_thread(struct list_head *head, uint32_t flag)
+static struct resource *find_resource_thread(struct resource_shard *rsh, uint32_t flag,
+					     int worker)
 {
 	struct resource *r;
 	uint64_t now = monotime();
 
-	list_for_each_entry(r, head, list) {
+	/* rsh->examine holds only R_THREAD_EXAMINE resources */
+
+	if (flag & R_THREAD_EXAMINE) {
+		list_for_each_entry(r, &rsh->examine, examine_list) {
+			if (r->worker != worker)
+				continue;
+			list_del_init(&r->examine_list);
+			return r;
+		}
+		return NULL;
+	}
+
+	list_for_each_entry(r, &rsh->rem, list) {
 		if (!(r->flags & flag))
 			continue;
 
-		if (flag & R_THREAD_EXAMINE)
-			return r;
+		if (r->worker != worker)
+			continue;
 
 		if (now >= r->thread_release_retry)
 			return r;
@@ -1958,8 +2586,10 @@ static struct resource *find_resource_thread(struct list_head *head, uint32_t fl
 
 static void resource_thread_release(struct task *task, struct resource *r, struct token *token)
 {
+	struct resource_shard *rsh = r->shard;
 	struct leader_record leader;
 	struct space_info spi;
+	uint64_t ms;
 	uint32_t r_flags;
 	int retry_async = 0;
 	int rv;
@@ -2067,22 +2697,57 @@ static void resource_thread_release(struct task *task, struct resource *r, struc
 	close_disks(token->disks, token->r.num_disks);
  out:
 	if (!retry_async) {
-		log_token(token, "release async done r_flags %x", r_flags);
-		pthread_mutex_lock(&resource_mutex);
-		list_del(&r->list);
-		pthread_mutex_unlock(&resource_mutex);
+		ms = monotime_ms() - r->thread_release_begin;
+		log_token(token, "release async done r_flags %x ms %llu",
+			  r_flags, (unsigned long long)ms);
+		lock_shard(rsh);
+		unlink_resource(r);
+		unlock_shard(rsh);
 		free_resource(r);
+
+		pthread_mutex_lock(&resource_thread_mutex);
+		release_async_count++;
+		release_async_last_ms = ms;
+		if (ms > release_async_max_ms)
+			release_async_max_ms = ms;
+		pthread_mutex_unlock(&resource_thread_mutex);
 		return;
 	}
 
 	/* Keep the resource on the list to keep trying. */
 	log_token(token, "release async timeout r_flags %x", r_flags);
-	pthread_mutex_lock(&resource_mutex);
+	lock_shard(rsh);
 	r->flags |= R_THREAD_RELEASE;
-	pthread_mutex_unlock(&resource_mutex);
+	unlock_shard(rsh);
+}
+
+/* another host requested a lease that we only hold cached */
+
+static void release_cached(struct token *tt, uint64_t lver)
+{
+	struct resource_shard *rsh;
+	struct resource *r;
+	uint64_t wake = 0;
+
+	rsh = resource_shard(tt->r.lockspace_name, tt->r.name);
+
+	lock_shard(rsh);
+	r = find_resource(rsh, tt, &rsh->cached);
+	if (r && r->leader.lver == lver) {
+		log_debug("release cached %.48s:%.48s lver %llu requested",
+			  tt->r.lockspace_name, tt->r.name, (unsigned long long)lver);
+		set_thread_release(r);
+		move_resource(r, &rsh->rem);
+		wake = 1ULL << r->worker;
+	}
+	unlock_shard(rsh);
+
+	if (wake)
+		wake_resource_threads(wake, 0);
 }
 
-static void resource_thread_examine(struct task *task, struct token *tt, int pid, uint64_t lver)
+static void resource_thread_examine(struct task *task, struct token *tt, int pid,
+				    uint64_t lver, int cached)
 {
 	struct request_record req;
 	int rv;
@@ -2100,7 +2765,7 @@ static void resource_thread_examine(struct task *task, struct token *tt, int pid
 	if (rv != SANLK_OK)
 		return;
 
-	if (!req.force_mode || !req.lver)
+	if (!req.lver || (!req.force_mode && !cached))
 		return;
 
 	if (req.lver <= lver) {
@@ -2109,7 +2774,9 @@ static void resource_thread_examine(struct task *task, struct token *tt, int pid
 		return;
 	}
 
-	if (req.force_mode) {
+	if (cached) {
+		release_cached(tt, lver);
+	} else if (req.force_mode) {
 		do_request(tt, pid, req.force_mode);
 	} else {
 		log_error("req force_mode %u unknown", req.force_mode);
@@ -2141,11 +2808,10 @@ void add_host_event(uint32_t space_id, struct sanlk_host_event *he,
 	rhe->from_host_id = from_host_id;
 	rhe->from_generation = from_generation;
 
-	pthread_mutex_lock(&resource_mutex);
+	pthread_mutex_lock(&resource_thread_mutex);
 	list_add_tail(&rhe->list, &host_events);
-	resource_thread_work = 1;
-	pthread_cond_signal(&resource_cond);
-	pthread_mutex_unlock(&resource_mutex);
+	pthread_cond_signal(&host_event_cond);
+	pthread_mutex_unlock(&resource_thread_mutex);
 }
 
 static struct recv_he *find_host_event(void)
@@ -2155,18 +2821,41 @@ static struct recv_he *find_host_event(void)
 	return list_first_entry(&host_events, struct recv_he, list);
 }
 
-static void *resource_thread(void *arg GNUC_UNUSED)
+static void *host_event_thread(void *arg GNUC_UNUSED)
 {
+	struct recv_he *rhe;
+
+	while (1) {
+		pthread_mutex_lock(&resource_thread_mutex);
+		while (!(rhe = find_host_event())) {
+			if (resource_thread_stop) {
+				pthread_mutex_unlock(&resource_thread_mutex);
+				return NULL;
+			}
+			pthread_cond_wait(&host_event_cond, &resource_thread_mutex);
+		}
+		list_del(&rhe->list);
+		pthread_mutex_unlock(&resource_thread_mutex);
+
+		send_event_callbacks(rhe->space_id, rhe->from_host_id, rhe->from_generation, &rhe->he);
+		free(rhe);
+	}
+}
+
+static void *resource_thread(void *arg)
+{
+	struct resource_worker *w = arg;
 	struct task task;
+	struct resource_shard *rsh;
 	struct resource *r;
 	struct token *tt = NULL;
-	struct recv_he *rhe;
 	uint64_t lver;
 	int pid, tt_len;
+	int i, examine, cached;
 
 	memset(&task, 0, sizeof(struct task));
 	setup_task_aio(&task, main_task.use_aio, RESOURCE_AIO_CB_SIZE);
-	sprintf(task.name, "%s", "resource");
+	snprintf(task.name, NAME_ID_SIZE, "resource%d", w->num);
 
 	/* a fake/tmp token struct we copy necessary res info into,
 	   because other functions take a token struct arg */
@@ -2179,23 +2868,25 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 	}
 
 	while (1) {
-		pthread_mutex_lock(&resource_mutex);
-		while (!resource_thread_work) {
+		pthread_mutex_lock(&resource_thread_mutex);
+		while (!w->work) {
 			if (resource_thread_stop) {
-				pthread_mutex_unlock(&resource_mutex);
+				pthread_mutex_unlock(&resource_thread_mutex);
 				goto out;
 			}
-			pthread_cond_wait(&resource_cond, &resource_mutex);
+			pthread_cond_wait(&w->cond, &resource_thread_mutex);
 		}
 
-		rhe = find_host_event();
-		if (rhe) {
-			list_del(&rhe->list);
-			pthread_mutex_unlock(&resource_mutex);
-			send_event_callbacks(rhe->space_id, rhe->from_host_id, rhe->from_generation, &rhe->he);
-			free(rhe);
-			continue;
-		}
+		/*
+		 * Clear the work flags before looking through the shards, so
+		 * that work added meanwhile gets another pass.  Each pass
+		 * handles one resource, then sets the flags again with more.
+		 */
+
+		examine = w->work_examine;
+		w->work = 0;
+		w->work_examine = 0;
+		pthread_mutex_unlock(&resource_thread_mutex);
 
 		/* FIXME: it's not nice how we copy a bunch of stuff
 		 * from token to r so that we can later copy it back from
@@ -2205,8 +2896,16 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 		memset(tt, 0, tt_len);
 		tt->disks = (struct sync_disk *)&tt->r.disks[0];
 
-		r = find_resource_thread(&resources_rem, R_THREAD_RELEASE);
-		if (r) {
+		for (i = 0; i < RESOURCE_SHARDS; i++) {
+			rsh = &resource_shards[i];
+
+			lock_shard(rsh);
+			r = find_resource_thread(rsh, R_THREAD_RELEASE, w->num);
+			if (!r) {
+				unlock_shard(rsh);
+				continue;
+			}
+
 			memcpy(&tt->r, &r->r, sizeof(struct sanlk_resource));
 			copy_disks(&tt->r.disks, &r->r.disks, r->r.num_disks);
 			tt->host_id = r->host_id;
@@ -2224,21 +2923,26 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 				r->thread_release_retry = monotime() + (r->io_timeout * 2);
 
 			r->flags &= ~R_THREAD_RELEASE;
-			pthread_mutex_unlock(&resource_mutex);
+			unlock_shard(rsh);
 
 			resource_thread_release(&task, r, tt);
-			continue;
+			goto more;
 		}
 
-		/*
-		 * We don't want to search all of resource_held each time
-		 * we are woken unless we know there is something to examine.
-		 */
-		if (!resource_thread_work_examine)
-			goto find_done;
+		/* set_resource_examine queues r on rsh->examine */
+		if (!examine)
+			continue;
+
+		for (i = 0; i < RESOURCE_SHARDS; i++) {
+			rsh = &resource_shards[i];
+
+			lock_shard(rsh);
+			r = find_resource_thread(rsh, R_THREAD_EXAMINE, w->num);
+			if (!r) {
+				unlock_shard(rsh);
+				continue;
+			}
 
-		r = find_resource_thread(&resources_held, R_THREAD_EXAMINE);
-		if (r) {
 			/* make copies of things we need because we can't use r
 			   once we unlock the mutex since it could be released */
 
@@ -2249,18 +2953,21 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 			tt->io_timeout = r->io_timeout;
 			pid = r->pid;
 			lver = r->leader.lver;
+			cached = (r->on_list == &rsh->cached);
 
 			r->flags &= ~R_THREAD_EXAMINE;
-			pthread_mutex_unlock(&resource_mutex);
+			unlock_shard(rsh);
 
-			resource_thread_examine(&task, tt, pid, lver);
-			continue;
+			resource_thread_examine(&task, tt, pid, lver, cached);
+			goto more;
 		}
-
- find_done:
-		resource_thread_work = 0;
-		resource_thread_work_examine = 0;
-		pthread_mutex_unlock(&resource_mutex);
+		continue;
+ more:
+		pthread_mutex_lock(&resource_thread_mutex);
+		w->work = 1;
+		if (examine)
+			w->work_examine = 1;
+		pthread_mutex_unlock(&resource_thread_mutex);
 	}
  out:
 	if (tt)
@@ -2269,89 +2976,259 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 	return NULL;
 }
 
-int release_orphan(struct sanlk_resource *res)
+static int release_orphan_shard(struct resource_shard *rsh, struct sanlk_resource *res,
+				uint64_t *wake)
 {
-	struct resource *r, *safe;
+	struct resource_space *rs;
+	struct resource *r;
 	int count = 0;
 
-	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry_safe(r, safe, &resources_orphan, list) {
-		if (strncmp(r->r.lockspace_name, res->lockspace_name, NAME_ID_SIZE))
+	lock_shard(rsh);
+	rs = find_resource_space(rsh, res->lockspace_name);
+	if (!rs)
+		goto out;
+
+	list_for_each_entry(r, &rs->resources, space_list) {
+		if (r->on_list != &rsh->orphan)
 			continue;
 
 		if (!res->name[0] || !strncmp(r->r.name, res->name, NAME_ID_SIZE)) {
 			log_debug("release orphan %.48s:%.48s", r->r.lockspace_name, r->r.name);
-			r->flags |= R_THREAD_RELEASE;
-			list_move(&r->list, &resources_rem);
+			set_thread_release(r);
+			move_resource(r, &rsh->rem);
+			*wake |= 1ULL << r->worker;
 			count++;
 		}
 	}
+ out:
+	unlock_shard(rsh);
+
+	return count;
+}
+
+int release_orphan(struct sanlk_resource *res)
+{
+	uint64_t wake = 0;
+	int i, count = 0;
 
-	if (count) {
-		resource_thread_work = 1;
-		pthread_cond_signal(&resource_cond);
+	if (res->name[0]) {
+		count = release_orphan_shard(resource_shard(res->lockspace_name, res->name),
+					     res, &wake);
+	} else {
+		for (i = 0; i < RESOURCE_SHARDS; i++)
+			count += release_orphan_shard(&resource_shards[i], res, &wake);
 	}
-	pthread_mutex_unlock(&resource_mutex);
+
+	if (wake)
+		wake_resource_threads(wake, 0);
 
 	return count;
 }
 
+/*
+ * Called when a lockspace is removed, before its delta lease is released,
+ * to release on disk the leases that this host holds cached.  Each one is
+ * moved to the rem list while it's released, so it can't be acquired.
+ */
+
+void release_cached_resources(struct task *task, char *space_name)
+{
+	struct resource_shard *rsh;
+	struct resource_space *rs;
+	struct resource *r, *found;
+	struct token *tt;
+	int tt_len, i, rv;
+
+	tt_len = sizeof(struct token) + (SANLK_MAX_DISKS * sizeof(struct sync_disk));
+	tt = malloc(tt_len);
+	if (!tt) {
+		log_error("release_cached_resources tt malloc error");
+		return;
+	}
+
+	for (i = 0; i < RESOURCE_SHARDS; i++) {
+		rsh = &resource_shards[i];
+ next:
+		found = NULL;
+
+		lock_shard(rsh);
+		rs = find_resource_space(rsh, space_name);
+		if (rs) {
+			list_for_each_entry(r, &rs->resources, space_list) {
+				if (r->on_list == &rsh->cached) {
+					found = r;
+					break;
+				}
+			}
+		}
+		if (!found) {
+			unlock_shard(rsh);
+			continue;
+		}
+		r = found;
+		move_resource(r, &rsh->rem);
+
+		memset(tt, 0, tt_len);
+		tt->disks = (struct sync_disk *)&tt->r.disks[0];
+		memcpy(&tt->r, &r->r, sizeof(struct sanlk_resource));
+		copy_disks(&tt->r.disks, &r->r.disks, r->r.num_disks);
+		tt->host_id = r->host_id;
+		tt->host_generation = r->host_generation;
+		tt->token_id = r->release_token_id;
+		tt->io_timeout = r->io_timeout;
+		unlock_shard(rsh);
+
+		log_token(tt, "release cached lver %llu lockspace removed",
+			  (unsigned long long)r->leader.lver);
+
+		rv = open_disks_fd(tt->disks, tt->r.num_disks);
+		if (rv < 0) {
+			log_errot(tt, "release cached open error %d", rv);
+		} else {
+			/* Failure here is not a big deal and can be ignored. */
+			rv = write_host_block(task, tt, tt->host_id, 0, 0);
+			if (rv < 0)
+				log_errot(tt, "release cached write_host_block %d", rv);
+
+			rv = release_disk(task, tt, NULL, &r->leader);
+			if (rv < 0)
+				log_errot(tt, "release cached release leader %d", rv);
+
+			close_disks(tt->disks, tt->r.num_disks);
+		}
+
+		lock_shard(rsh);
+		unlink_resource(r);
+		unlock_shard(rsh);
+		free_resource(r);
+		goto next;
+	}
+
+	free(tt);
+}
+
 void purge_resource_orphans(char *space_name)
 {
+	struct resource_shard *rsh;
+	struct resource_space *rs;
 	struct resource *r, *safe;
+	int i;
 
-	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry_safe(r, safe, &resources_orphan, list) {
-		if (strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
+	for (i = 0; i < RESOURCE_SHARDS; i++) {
+		rsh = &resource_shards[i];
+
+		lock_shard(rsh);
+		rs = find_resource_space(rsh, space_name);
+		if (!rs) {
+			unlock_shard(rsh);
 			continue;
-		log_debug("purge orphan %.48s:%.48s", r->r.lockspace_name, r->r.name);
-		list_del(&r->list);
-		free_resource(r);
+		}
+
+		list_for_each_entry_safe(r, safe, &rs->resources, space_list) {
+			if (r->on_list != &rsh->orphan && r->on_list != &rsh->cached)
+				continue;
+			log_debug("purge %s %.48s:%.48s",
+				  (r->on_list == &rsh->orphan) ? "orphan" : "cached",
+				  r->r.lockspace_name, r->r.name);
+			_unlink_resource(r);
+			free_resource(r);
+		}
+		put_resource_space(rs);
+		unlock_shard(rsh);
 	}
-	pthread_mutex_unlock(&resource_mutex);
 }
 
 /*
  * This is called by the main_loop once a second during normal operation.
- * The resources_rem list should normally be empty, so this does nothing.
+ * The rem lists should normally be empty, so this does nothing.
  * This is needed to wake up the resource_thread to retry release operations
  * that had timed out previously and need to be retried.
  */
 
 void free_resources(void)
 {
-	pthread_mutex_lock(&resource_mutex);
-	if (!list_empty(&resources_rem) && !resource_thread_work) {
-		resource_thread_work = 1;
-		pthread_cond_signal(&resource_cond);
+	struct resource_shard *rsh;
+	struct resource *r;
+	uint64_t wake = 0;
+	int i;
+
+	for (i = 0; i < RESOURCE_SHARDS; i++) {
+		rsh = &resource_shards[i];
+		lock_shard(rsh);
+		list_for_each_entry(r, &rsh->rem, list)
+			wake |= 1ULL << r->worker;
+		unlock_shard(rsh);
 	}
-	pthread_mutex_unlock(&resource_mutex);
+
+	if (wake)
+		wake_resource_threads(wake, 0);
 }
 
 int setup_token_manager(void)
 {
-	int rv;
-
-	pthread_mutex_init(&resource_mutex, NULL);
-	pthread_cond_init(&resource_cond, NULL);
-	INIT_LIST_HEAD(&resources_add);
-	INIT_LIST_HEAD(&resources_rem);
-	INIT_LIST_HEAD(&resources_held);
-	INIT_LIST_HEAD(&resources_orphan);
+	struct resource_shard *rsh;
+	int i, j, rv;
+
+	for (i = 0; i < RESOURCE_SHARDS; i++) {
+		rsh = &resource_shards[i];
+		pthread_mutex_init(&rsh->mutex, NULL);
+		INIT_LIST_HEAD(&rsh->held);
+		INIT_LIST_HEAD(&rsh->add);
+		INIT_LIST_HEAD(&rsh->rem);
+		INIT_LIST_HEAD(&rsh->orphan);
+		INIT_LIST_HEAD(&rsh->cached);
+		INIT_LIST_HEAD(&rsh->examine);
+		INIT_LIST_HEAD(&rsh->spaces);
+		INIT_LIST_HEAD(&rsh->waiters);
+		for (j = 0; j < RESOURCE_SHARD_HASH; j++)
+			INIT_LIST_HEAD(&rsh->hash[j]);
+	}
+
+	pthread_mutex_init(&resource_thread_mutex, NULL);
+	pthread_cond_init(&host_event_cond, NULL);
 	INIT_LIST_HEAD(&host_events);
 
-	rv = pthread_create(&resource_pt, NULL, resource_thread, NULL);
+	resource_workers = malloc(com.resource_threads * sizeof(struct resource_worker));
+	if (!resource_workers)
+		return -ENOMEM;
+	memset(resource_workers, 0, com.resource_threads * sizeof(struct resource_worker));
+
+	for (i = 0; i < com.resource_threads; i++) {
+		resource_workers[i].num = i;
+		pthread_cond_init(&resource_workers[i].cond, NULL);
+	}
+	resource_worker_count = com.resource_threads;
+
+	rv = pthread_create(&host_event_pt, NULL, host_event_thread, NULL);
 	if (rv)
 		return -1;
+
+	for (i = 0; i < resource_worker_count; i++) {
+		rv = pthread_create(&resource_workers[i].pt, NULL, resource_thread,
+				    &resource_workers[i]);
+		if (rv) {
+			log_error("setup_token_manager resource_thread %d error %d", i, rv);
+			resource_worker_count = i;
+			close_token_manager();
+			return -1;
+		}
+	}
 	return 0;
 }
 
 void close_token_manager(void)
 {
-	pthread_mutex_lock(&resource_mutex);
+	int i;
+
+	pthread_mutex_lock(&resource_thread_mutex);
 	resource_thread_stop = 1;
-	pthread_cond_signal(&resource_cond);
-	pthread_mutex_unlock(&resource_mutex);
-	pthread_join(resource_pt, NULL);
+	for (i = 0; i < resource_worker_count; i++)
+		pthread_cond_signal(&resource_workers[i].cond);
+	pthread_cond_signal(&host_event_cond);
+	pthread_mutex_unlock(&resource_thread_mutex);
+
+	for (i = 0; i < resource_worker_count; i++)
+		pthread_join(resource_workers[i].pt, NULL);
+	pthread_join(host_event_pt, NULL);
 }
 
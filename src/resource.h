@@ -10,48 +10,52 @@
 #define __RESOURCE_H__
 
 /*
- * We mostly avoid holding resource_mutex and spaces_mutex at once.  When they
- * are held at once, the order is spaces_mutex, then resource_mutex.
+ * Resource state is protected by a set of shard mutexes (see resource.c).
+ * We mostly avoid holding a shard mutex and spaces_mutex at once.  When they
+ * are held at once, the order is spaces_mutex, then a shard mutex, then
+ * resource_thread_mutex.  A thread never holds two shard mutexes.
  */
 
-/* locks resource_mutex */
+/* locks resource shards */
 void send_state_resources(int fd);
 
-/* locks resource_mutex */
+/* locks resource shards */
 int lockspace_is_used(struct sanlk_lockspace *ls);
 
-/* locks resource_mutex */
+/* locks resource shards */
 int resource_orphan_count(char *space_name);
 
 /* no locks */
 void check_mode_block(struct token *token, uint64_t next_lver, int q, char *dblock);
 
-/* locks resource_mutex */
+/* locks resource shards */
 int convert_token(struct task *task, struct sanlk_resource *res, struct token *cl_token);
 
-/* locks resource_mutex */
+/* locks resource shards */
 int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 		  char *killpath, char *killargs);
 
+/* locks resource shards */
+void abort_token_waiters(int pid);
 
-/* locks resource_mutex */
+/* locks resource shards */
 int release_token(struct task *task, struct token *token,
 		  struct sanlk_resource *resrename);
 
-/* locks resource_mutex */
+/* locks resource shards */
 void release_token_async(struct token *token);
 
 /* no locks */
 int request_token(struct task *task, struct token *token, uint32_t force_mode,
 		  uint64_t *owner_id, int next_lver);
 
-/* locks resource_mutex */
+/* locks resource shards */
 int set_resource_examine(char *space_name, char *res_name);
 
-/* locks resource_mutex */
+/* locks resource shards */
 int res_set_lvb(struct sanlk_resource *res, char *lvb, int lvblen);
 
-/* locks resource_mutex */
+/* locks resource shards */
 int res_get_lvb(struct sanlk_resource *res, char **lvb_out, int *lvblen);
 
 /* no locks */
@@ -59,16 +63,19 @@ int read_resource_owners(struct task *task, struct token *token,
                          struct sanlk_resource *res,
                          char **send_buf, int *send_len, int *count);
 
-/* locks resource_mutex */
+/* locks resource shards */
 void free_resources(void);
 
-/* locks resource_mutex */
+/* locks resource shards */
 int release_orphan(struct sanlk_resource *res);
 
-/* locks resource_mutex */
+/* locks resource shards */
+void release_cached_resources(struct task *task, char *space_name);
+
+/* locks resource shards */
 void purge_resource_orphans(char *space_name);
 
-/* locks resource_mutex */
+/* locks resource_thread_mutex */
 void add_host_event(uint32_t space_id, struct sanlk_host_event *he,
 		    uint64_t from_host_id, uint64_t from_generation);
 
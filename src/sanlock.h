@@ -15,6 +15,11 @@
 
 #define SANLK_MAX_RESOURCES	8
 
+/* a daemon that supports larger acquire or release calls accepts up to
+   this many resources; sanlock_max_resources() reports the daemon's limit. */
+
+#define SANLK_MAX_RESOURCES_BATCH	1024
+
 /* max resource name length */
 
 #define SANLK_NAME_LEN		48   
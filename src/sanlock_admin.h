@@ -303,6 +303,32 @@ int sanlock_test_resource_owners(struct sanlk_resource *res, uint32_t flags,
 
 int sanlock_version(uint32_t flags, uint32_t *version, uint32_t *proto);
 
+/*
+ * An admin session is one daemon connection used for many calls,
+ * saving a connect for each.  The sanlock_session_ functions are
+ * the same as those without the prefix, using the session sock.
+ * Calls on one session must not run concurrently.  After an error
+ * that is not a result from the daemon, e.g. -1 from a short reply,
+ * the session should be closed.
+ */
+
+int sanlock_session_open(uint32_t flags);
+int sanlock_session_close(int sock);
+
+int sanlock_session_inq_lockspace(int sock, struct sanlk_lockspace *ls,
+				  uint32_t flags);
+
+int sanlock_session_get_lockspaces(int sock, struct sanlk_lockspace **lss,
+				   int *lss_count, uint32_t flags);
+
+int sanlock_session_get_hosts(int sock, const char *ls_name, uint64_t host_id,
+			      struct sanlk_host **hss, int *hss_count,
+			      uint32_t flags);
+
+int sanlock_session_read_resource_owners(int sock, struct sanlk_resource *res,
+					 uint32_t flags, struct sanlk_host **hss,
+					 int *hss_count);
+
 /*
  * Lockspace host events
  *
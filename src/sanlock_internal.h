@@ -32,6 +32,7 @@
 #include "monotime.h"
 
 #include <libaio.h>
+#include <linux/io_uring.h>
 
 /* default max number of hosts supported */
 
@@ -115,9 +116,21 @@ struct token {
 #define R_LVB_WRITE_RELEASE	0x00000020
 #define R_UNDO_SHARED		0x00000040
 #define R_ERASE_ALL		0x00000080
+#define R_CACHE			0x00000100 /* SANLK_ACQUIRE_CACHE */
+
+struct resource_shard;
+struct resource_space;
 
 struct resource {
-	struct list_head list;
+	struct list_head list;       /* shard held/add/rem/orphan/cached */
+	struct list_head *on_list;   /* which of those lists r is on */
+	struct list_head hash_list;  /* shard hash bucket */
+	struct list_head space_list; /* resource_space->resources */
+	struct list_head examine_list; /* shard examine */
+	struct resource_shard *shard; /* its mutex protects r */
+	struct resource_space *rs;
+	int worker;                  /* resource_thread, chosen by disk */
+	uint64_t thread_release_begin; /* ms, when passed to resource_thread */
 	struct list_head tokens;     /* only one token when ex, multiple sh */
 	uint64_t host_id;
 	uint64_t host_generation;
@@ -144,7 +157,7 @@ struct lease_status {
 
 	uint32_t renewal_read_count;
 	uint32_t renewal_read_check;
-	char *renewal_read_buf;
+	char *renewal_read_buf; /* swapped, not copied, see check_other_leases */
 };
 
 struct host_status {
@@ -158,6 +171,7 @@ struct host_status {
 	uint64_t set_bit_time;
 	uint16_t io_timeout;
 	uint16_t lease_bad;
+	uint16_t listed; /* in sp->host_ids */
 	char owner_name[NAME_ID_SIZE];
 };
 
@@ -187,6 +201,7 @@ struct space {
 	uint32_t flags; /* SP_ */
 	uint32_t used_retries;
 	uint32_t renewal_read_extend_sec; /* defaults to io_timeout */
+	uint32_t renewal_min_seconds;
 	int align_size;
 	int renew_fail;
 	int space_dead;
@@ -198,9 +213,20 @@ struct space {
 	struct sanlk_host_event host_event;
 	uint64_t set_event_time;
 	pthread_t thread;
+	int thread_joined;
+	int renew_engine; /* renewals were given to the renewal engine */
+	int renew_done;   /* renewal engine is finished, see lockspace.c */
 	pthread_mutex_t mutex; /* protects lease_status, thread_stop  */
 	struct lease_status lease_status;
-	struct host_status host_status[DEFAULT_MAX_HOSTS];
+	int max_hosts;    /* host_id leases initialized in the lockspace */
+	struct host_status *host_status; /* max_hosts entries, by host_id-1 */
+	int *host_ids;    /* sorted host_ids that have been seen or signaled */
+	int host_ids_count;
+	uint64_t set_all_bit_time; /* SANLK_SETEV_ALL_HOSTS */
+	int renew_expedite;        /* renew now to write a new bit or event */
+	uint64_t renew_fast_until; /* renew every renewal_fast_sec until */
+	char *check_buf;  /* main loop, renewal read buf being checked */
+	char *check_prev; /* main loop, sectors from the last check_other_leases */
 	struct renewal_history *renewal_history;
 	int renewal_history_size;
 	int renewal_history_next;
@@ -219,15 +245,79 @@ struct space_info {
 };
 
 #define HOSTID_AIO_CB_SIZE 4
-#define WORKER_AIO_CB_SIZE 2
+#define WORKER_AIO_CB_SIZE (SANLK_MAX_DISKS + 2)
 #define DIRECT_AIO_CB_SIZE 1
-#define RESOURCE_AIO_CB_SIZE 2
+#define RESOURCE_AIO_CB_SIZE (SANLK_MAX_DISKS + 2)
 #define LIB_AIO_CB_SIZE 1
 
+/*
+ * use_aio values: 0 sync pread/pwrite, 1 libaio, 2 posix aio, 3 io_uring.
+ * With io_uring the iocb is still filled in to describe the io
+ * (fd/op/buf/len/offset) so the same checks apply, but it is never
+ * submitted with io_submit.
+ */
+
+#define URING_REG_FILES 4
+#define URING_REG_BUFS 4
+
 struct aicb {
 	int used;
 	char *buf;
 	struct iocb iocb;
+
+	/* io_uring only */
+	int uring_pending;	/* cqes not yet reaped, io + linked timeout */
+	int uring_done;		/* cqe for the io was reaped */
+	int uring_res;		/* cqe res for the io */
+	int uring_timedout;	/* linked timeout fired */
+	int uring_orphan;	/* caller gave up, free buf when reaped */
+	struct __kernel_timespec uring_ts;
+
+	/* async_io only */
+	int async_done;		/* async_res is set, until async_io_result */
+	int async_res;
+	int async_orphan;	/* caller gave up, free buf when reaped */
+	int async_ioto;
+};
+
+struct task_uring {
+	int ring_fd;
+	unsigned int sq_entries;
+	unsigned int sqe_tail;	/* local tail, published on submit */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	int reg_files;		/* sparse fixed file table registered */
+	int reg_bufs;		/* sparse fixed buffer table registered */
+	int file_fd[URING_REG_FILES];
+	char *buf_addr[URING_REG_BUFS];
+	int buf_len[URING_REG_BUFS];
+};
+
+/*
+ * Per-task pool of page aligned io buffers, kept by exact length,
+ * e.g. sector size, dblock area, and align_size.  See iobuf_get().
+ */
+
+#define IOBUF_POOL_CLASSES	4
+#define IOBUF_POOL_DEPTH	SANLK_MAX_DISKS
+#define IOBUF_POOL_MAX_BYTES	(16 * 1024 * 1024)
+
+struct iobuf_pool_class {
+	int len;
+	int count;
+	char *bufs[IOBUF_POOL_DEPTH];
 };
 
 struct task {
@@ -240,21 +330,60 @@ struct task {
 	int cb_size;
 	char *iobuf;
 	io_context_t aio_ctx;
+	struct task_uring *uring;
 	struct aicb *read_iobuf_timeout_aicb;
 	struct aicb *callbacks;
+	int iobuf_pool_bytes;
+	struct iobuf_pool_class iobuf_pool[IOBUF_POOL_CLASSES];
 };
 
 EXTERN struct task main_task;
 
+/*
+ * An iobuf_batch submits the same kind of io (read or write) to several
+ * disks at once, and returns the result of each as it completes, so the
+ * caller waits for the slowest disk rather than the sum of all of them.
+ */
+
+#define IOBUF_UNSUBMITTED	0
+#define IOBUF_SUBMITTED		1
+#define IOBUF_DONE		2 /* rv is set */
+#define IOBUF_RETURNED		3 /* returned by iobuf_batch_next */
+
+struct iobuf_io {
+	int num;		/* caller's id for the io, e.g. disk number */
+	int fd;
+	uint64_t offset;
+	char *iobuf;
+	int iobuf_len;
+	int state;		/* IOBUF_ */
+	int rv;			/* same as read_iobuf/write_iobuf */
+	int ms;
+	struct aicb *aicb;
+};
+
+struct iobuf_batch {
+	struct task *task;
+	int cmd;		/* IO_CMD_PREAD or IO_CMD_PWRITE */
+	int ioto;
+	int count;
+	struct timespec begin;
+	struct iobuf_io io[SANLK_MAX_DISKS];
+};
+
 /* TODO: change used, suspend, need_free, pid_dead to flags */
 
 #define CL_KILLPATH_PID 0x00000001 /* include pid as killpath arg */
 #define CL_RUNPATH_SENT 0x00000002 /* a RUNPATH msg has been sent to helper */
+#define CL_PIPELINE     0x00000004 /* cmds run concurrently, replies matched by seq */
+#define CL_SESSION      0x00000008 /* connection kept open for further admin cmds */
 
 struct client {
 	int used;
 	int fd;  /* unset is -1 */
 	int pid; /* unset is -1 */
+	int pidfd; /* unset is -1, watched by main_loop for pid exit, see client_pidfd_exited */
+	uint32_t gen; /* incremented each time the slot is used, see client_watch */
 	int cmd_active;
 	int cmd_last;
 	int pid_dead;
@@ -262,6 +391,14 @@ struct client {
 	int need_free;
 	int kill_count;
 	int tokens_slots;
+	int cmd_inflight; /* pipelined cmds not yet replied to */
+	int pipe_pos;     /* bytes of pipe_h and pipe_data received */
+	struct sm_header *pipe_h; /* pipelined cmd being received */
+	char *pipe_data;
+	char *pipe_out;   /* pipelined replies not yet sent, under send_mutex */
+	int pipe_out_len;
+	int pipe_out_size;
+	int pipe_out_fd;  /* dup of fd watched for EPOLLOUT while pipe_out_len */
 	uint32_t flags;
 	uint32_t restricted;
 	uint64_t kill_last;
@@ -269,6 +406,7 @@ struct client {
 	char killpath[SANLK_HELPER_PATH_LEN];
 	char killargs[SANLK_HELPER_ARGS_LEN];
 	pthread_mutex_t mutex;
+	pthread_mutex_t send_mutex; /* serializes pipelined replies */
 	void *workfn;
 	void *deadfn;
 	struct token **tokens;
@@ -296,6 +434,11 @@ EXTERN struct client *client;
 #define DEFAULT_SH_RETRIES 8
 #define DEFAULT_QUIET_FAIL 1
 #define DEFAULT_RENEWAL_HISTORY_SIZE 180 /* about 1 hour with 20 sec renewal interval */
+#define DEFAULT_RESOURCE_THREADS 4
+#define MAX_RESOURCE_THREADS 64
+#define DEFAULT_MAX_CLIENTS 1024
+#define MAX_CLIENTS (1024 * 1024)
+#define MAX_PIPELINE_CMDS 64 /* cmds in flight on one pipelined connection */
 
 struct command_line {
 	int type;				/* COM_ */
@@ -332,10 +475,15 @@ struct command_line {
 	int max_hosts;				/* -m */
 	int res_count;
 	int sh_retries;
+	int paxos_early_quorum;
+	int renewal_threads;
+	int resource_threads;
+	int max_clients;
 	uint32_t force_mode;
 	int renewal_history_size;
 	int renewal_read_extend_sec_set; /* 1 if renewal_read_extend_sec is configured */
 	uint32_t renewal_read_extend_sec;
+	int renewal_fast_sec;
 	char our_host_name[SANLK_NAME_LEN+1];
 	char *file_path;
 	char *dump_path;
@@ -395,7 +543,9 @@ EXTERN int helper_kill_fd;
 EXTERN int helper_status_fd;
 EXTERN uint64_t helper_last_status;
 EXTERN uint32_t helper_full_count;
-EXTERN int efd;
+EXTERN uint32_t release_async_count;
+EXTERN uint64_t release_async_last_ms;
+EXTERN uint64_t release_async_max_ms;
 
 EXTERN struct list_head spaces;
 EXTERN struct list_head spaces_rem;
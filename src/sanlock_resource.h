@@ -48,12 +48,41 @@
  * If the lock cannot be granted immediately
  * because the owner's lease needs to time out, do
  * not wait, but return -SANLK_ACQUIRE_OWNED_RETRY.
+ *
+ * SANLK_ACQUIRE_CACHE
+ * When an exclusive lock is released, keep it
+ * owned on disk by this host, so that the next
+ * acquire of it from this host needs no disk i/o.
+ * The lock is released on disk when another host
+ * requests it with sanlock_request (an lver above
+ * the current one, any force_mode), when it is
+ * acquired and released again without this flag,
+ * or when the lockspace is removed, before its
+ * host_id lease is released.  Not used with
+ * SANLK_ACQUIRE_LVB.
+ *
+ * SANLK_ACQUIRE_WAIT
+ * If the lock is held, wait for it instead of
+ * returning an error.  Waiters on this host are
+ * granted the lock in the order they asked for
+ * it.  If another host holds the lock, it is
+ * sent one request for it (see sanlock_request),
+ * and the lease is checked every io_timeout
+ * seconds.  The wait ends with an error if the
+ * pid exits or the lockspace is removed.  Each
+ * waiting acquire uses one daemon thread, which
+ * is not counted in the max worker threads, see
+ * sanlock_acquire_start.  When as many acquires
+ * as max worker threads are already waiting, it
+ * fails with -EAGAIN instead of waiting.
  */
 
 #define SANLK_ACQUIRE_LVB		0x00000001
 #define SANLK_ACQUIRE_ORPHAN		0x00000002
 #define SANLK_ACQUIRE_ORPHAN_ONLY	0x00000004
 #define SANLK_ACQUIRE_OWNER_NOWAIT	0x00000008
+#define SANLK_ACQUIRE_CACHE		0x00000010
+#define SANLK_ACQUIRE_WAIT		0x00000020
 
 /*
  * release flags
@@ -134,9 +163,43 @@ int sanlock_release(int sock, int pid, uint32_t flags, int res_count,
 int sanlock_inquire(int sock, int pid, uint32_t flags, int *res_count,
 		    char **res_state);
 
+/*
+ * max_resources is the number of resources the daemon accepts in one
+ * acquire or release call: SANLK_MAX_RESOURCES from older daemons, up
+ * to SANLK_MAX_RESOURCES_BATCH otherwise.
+ */
+
+int sanlock_max_resources(uint32_t flags, int *max_resources);
+
 int sanlock_convert(int sock, int pid, uint32_t flags,
 		    struct sanlk_resource *res);
 
+/*
+ * The _start variants send the cmd without waiting for the result, and
+ * return an fd that becomes readable when the result is ready: sock
+ * itself, or a new connection when sock is -1 (it is closed by the
+ * matching _result call, which must be called exactly once).
+ * sanlock_acquire_result sets res_results[i] to the result for
+ * res_args[i]: 0 if acquired, -ECANCELED if the resource was not
+ * acquired because another one failed, or the error for that resource.
+ */
+
+int sanlock_acquire_start(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[],
+			  struct sanlk_options *opt_in);
+
+int sanlock_acquire_result(int sock, int fd, int res_count, int *res_results);
+
+int sanlock_release_start(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[]);
+
+int sanlock_release_result(int sock, int fd);
+
+int sanlock_convert_start(int sock, int pid, uint32_t flags,
+			  struct sanlk_resource *res);
+
+int sanlock_convert_result(int sock, int fd);
+
 int sanlock_request(uint32_t flags, uint32_t force_mode,
 		    struct sanlk_resource *res);
 
@@ -149,6 +212,52 @@ int sanlock_set_lvb(uint32_t flags, struct sanlk_resource *res,
 int sanlock_get_lvb(uint32_t flags, struct sanlk_resource *res,
 		    char *lvb, int lvblen);
 
+/* admin session versions, see sanlock_session_open() in sanlock_admin.h */
+
+int sanlock_session_request(int sock, uint32_t flags, uint32_t force_mode,
+			    struct sanlk_resource *res);
+
+int sanlock_session_examine(int sock, uint32_t flags, struct sanlk_lockspace *ls,
+			    struct sanlk_resource *res);
+
+int sanlock_session_set_lvb(int sock, uint32_t flags, struct sanlk_resource *res,
+			    char *lvb, int lvblen);
+
+int sanlock_session_get_lvb(int sock, uint32_t flags, struct sanlk_resource *res,
+			    char *lvb, int lvblen);
+
+/*
+ * A pipelined connection carries many commands at once.  The submit
+ * functions return the seq (> 0) of the command without waiting for
+ * its result.  sanlock_pipeline_complete() waits up to timeout_ms
+ * (-1 waits forever) for the next result, in any order, and returns
+ * -EAGAIN on timeout.  comp->data (inquire state, get_lvb lvb) is
+ * allocated and the caller must free it.  Calls using one sock must
+ * not run concurrently, and no more than max_inflight commands should
+ * be outstanding.  An inquire for a pid returns -EBUSY while another
+ * command for that pid is running.  Close with close(sock).
+ */
+
+struct sanlk_completion {
+	uint32_t seq;
+	int result;
+	uint32_t data2;
+	int data_len;
+	char *data;
+};
+
+int sanlock_pipeline_open(uint32_t flags, int *max_inflight);
+
+int sanlock_pipeline_request(int sock, uint32_t flags, uint32_t force_mode,
+			     struct sanlk_resource *res);
+
+int sanlock_pipeline_inquire(int sock, int pid, uint32_t flags);
+
+int sanlock_pipeline_get_lvb(int sock, uint32_t flags, struct sanlk_resource *res);
+
+int sanlock_pipeline_complete(int sock, int timeout_ms,
+			      struct sanlk_completion *comp);
+
 /*
  * Functions to convert between string and struct resource formats.
  * All allocate space for returned data that the caller must free.
@@ -55,10 +55,32 @@ enum {
 	SM_CMD_SET_EVENT         = 32,
 	SM_CMD_SET_CONFIG        = 33,
 	SM_CMD_RENEWAL           = 34,
+	SM_CMD_PIPELINE          = 35,
+	SM_CMD_SESSION           = 36,
 };
 
 #define SM_CB_GET_EVENT 1
 
+/* acquire cmd_flags: reply with a result per resource after the header */
+#define SM_FLAG_RES_RESULTS 0x80000000
+
+/*
+ * The SM_CMD_VERSION reply has the daemon version in data2, and is
+ * followed by struct sm_version_info when length includes it.  Older
+ * daemons send only the header, meaning max_resources is
+ * SANLK_MAX_RESOURCES.
+ */
+
+/*
+ * After SM_CMD_PIPELINE (reply data2 is the max cmds in flight), a
+ * connection can send further cmds without waiting for replies.  Each
+ * cmd must set length to include all of its data, and its reply, which
+ * can arrive in any order, carries the same seq.
+ *
+ * After SM_CMD_SESSION, a connection is not closed after daemon cmds,
+ * so one connection can be used for a series of admin cmds.
+ */
+
 struct sm_header {
 	uint32_t magic;
 	uint32_t version;
@@ -70,6 +92,11 @@ struct sm_header {
 	uint32_t data2;
 };
 
+struct sm_version_info {
+	uint32_t max_resources; /* per acquire/release */
+	uint32_t unused[3];
+};
+
 #define SANLK_STATE_MAXSTR	4096
 
 #define SANLK_STATE_DAEMON      1
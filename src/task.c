@@ -21,10 +21,489 @@
 #include <syslog.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
 
 #include "sanlock_internal.h"
 #include "log.h"
 #include "task.h"
+#include "diskio.h"
+
+/*
+ * io_uring (use_aio 3)
+ *
+ * The ring is driven directly with the io_uring syscalls.  Each io uses
+ * two sqes: the read or write, linked to a LINK_TIMEOUT which takes the
+ * place of the io_getevents timeout used with libaio.  Both sqes produce
+ * a cqe, and an aicb is not reused until both have been reaped.  The
+ * cqe user_data is the aicb pointer, with the low bit set for the
+ * timeout.
+ */
+
+#define URING_TIMEOUT_TAG 1ULL
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	int rv = syscall(__NR_io_uring_setup, entries, p);
+	return rv < 0 ? -errno : rv;
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+			      unsigned int flags, void *arg, size_t argsz)
+{
+	int rv = syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+	return rv < 0 ? -errno : rv;
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+	int rv = syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+	return rv < 0 ? -errno : rv;
+}
+
+static void free_task_uring(struct task_uring *ur)
+{
+	if (ur->sqes && ur->sqes != MAP_FAILED)
+		munmap(ur->sqes, ur->sqes_size);
+	if (ur->cq_ring && ur->cq_ring != MAP_FAILED && ur->cq_ring != ur->sq_ring)
+		munmap(ur->cq_ring, ur->cq_ring_size);
+	if (ur->sq_ring && ur->sq_ring != MAP_FAILED)
+		munmap(ur->sq_ring, ur->sq_ring_size);
+	if (ur->ring_fd >= 0)
+		close(ur->ring_fd);
+	free(ur);
+}
+
+static int setup_task_uring(struct task *task, int cb_size)
+{
+	struct task_uring *ur;
+	struct io_uring_params p;
+	struct io_uring_rsrc_register rr;
+	int fds[URING_REG_FILES];
+	int rv, i;
+
+	ur = malloc(sizeof(struct task_uring));
+	if (!ur)
+		return -ENOMEM;
+	memset(ur, 0, sizeof(struct task_uring));
+
+	/* an sqe for each io and one for its linked timeout */
+
+	memset(&p, 0, sizeof(p));
+
+	ur->ring_fd = sys_io_uring_setup(cb_size * 2, &p);
+	if (ur->ring_fd < 0) {
+		rv = ur->ring_fd;
+		free(ur);
+		return rv;
+	}
+
+	/* waiting with a timeout requires IORING_ENTER_EXT_ARG */
+
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		rv = -EOPNOTSUPP;
+		goto fail;
+	}
+
+	ur->sq_entries = p.sq_entries;
+	ur->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_ring_size > ur->sq_ring_size)
+			ur->sq_ring_size = ur->cq_ring_size;
+		ur->cq_ring_size = ur->sq_ring_size;
+	}
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQ_RING);
+	if (ur->sq_ring == MAP_FAILED) {
+		rv = -errno;
+		goto fail;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	} else {
+		ur->cq_ring = mmap(NULL, ur->cq_ring_size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_CQ_RING);
+		if (ur->cq_ring == MAP_FAILED) {
+			rv = -errno;
+			goto fail;
+		}
+	}
+
+	ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED) {
+		rv = -errno;
+		goto fail;
+	}
+
+	ur->sq_head = (unsigned int *)((char *)ur->sq_ring + p.sq_off.head);
+	ur->sq_tail = (unsigned int *)((char *)ur->sq_ring + p.sq_off.tail);
+	ur->sq_mask = (unsigned int *)((char *)ur->sq_ring + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned int *)((char *)ur->sq_ring + p.sq_off.array);
+	ur->cq_head = (unsigned int *)((char *)ur->cq_ring + p.cq_off.head);
+	ur->cq_tail = (unsigned int *)((char *)ur->cq_ring + p.cq_off.tail);
+	ur->cq_mask = (unsigned int *)((char *)ur->cq_ring + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)((char *)ur->cq_ring + p.cq_off.cqes);
+	ur->sqe_tail = *ur->sq_tail;
+
+	/* Empty (sparse) fixed file and buffer tables, filled in by
+	   task_uring_register_fd/buf for long lived fds and buffers.
+	   Older kernels without sparse tables just don't get fixed
+	   files or buffers. */
+
+	for (i = 0; i < URING_REG_FILES; i++) {
+		fds[i] = -1;
+		ur->file_fd[i] = -1;
+	}
+
+	memset(&rr, 0, sizeof(rr));
+	rr.nr = URING_REG_FILES;
+	rr.flags = IORING_RSRC_REGISTER_SPARSE;
+
+	if (!sys_io_uring_register(ur->ring_fd, IORING_REGISTER_FILES2, &rr, sizeof(rr)))
+		ur->reg_files = 1;
+	else if (!sys_io_uring_register(ur->ring_fd, IORING_REGISTER_FILES, fds, URING_REG_FILES))
+		ur->reg_files = 1;
+
+	memset(&rr, 0, sizeof(rr));
+	rr.nr = URING_REG_BUFS;
+	rr.flags = IORING_RSRC_REGISTER_SPARSE;
+
+	if (!sys_io_uring_register(ur->ring_fd, IORING_REGISTER_BUFFERS2, &rr, sizeof(rr)))
+		ur->reg_bufs = 1;
+
+	task->uring = ur;
+	return 0;
+
+ fail:
+	free_task_uring(ur);
+	return rv;
+}
+
+/* get count sqes, or none if the sq doesn't have room for all */
+
+int task_uring_get_sqes(struct task *task, struct io_uring_sqe **sqes, int count)
+{
+	struct task_uring *ur = task->uring;
+	unsigned int head, idx;
+	int i;
+
+	head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+
+	if (ur->sqe_tail - head + count > ur->sq_entries)
+		return -EAGAIN;
+
+	for (i = 0; i < count; i++) {
+		idx = ur->sqe_tail & *ur->sq_mask;
+		ur->sq_array[idx] = idx;
+		ur->sqe_tail++;
+
+		sqes[i] = &ur->sqes[idx];
+		memset(sqes[i], 0, sizeof(struct io_uring_sqe));
+	}
+	return 0;
+}
+
+/*
+ * Submit all sqes from task_uring_get_sqes.  Returns the number the
+ * kernel consumed, or -errno if it consumed none.  The sqes it didn't
+ * consume are taken back, so they are never submitted later by another
+ * caller; the caller fails the ios they were for.
+ */
+
+int task_uring_submit(struct task *task)
+{
+	struct task_uring *ur = task->uring;
+	unsigned int head, count;
+	int submitted = 0;
+	int rv = 0;
+
+	head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+	count = ur->sqe_tail - head;
+
+	__atomic_store_n(ur->sq_tail, ur->sqe_tail, __ATOMIC_RELEASE);
+
+	while (submitted < count) {
+		rv = sys_io_uring_enter(ur->ring_fd, count - submitted, 0, 0, NULL, 0);
+		if (rv == -EINTR)
+			continue;
+		if (rv <= 0)
+			break;
+		submitted += rv;
+	}
+
+	if (submitted < count) {
+		/* no SQPOLL, so the kernel only reads sqes in io_uring_enter */
+		head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+		ur->sqe_tail = head;
+		__atomic_store_n(ur->sq_tail, head, __ATOMIC_RELEASE);
+
+		if (!submitted)
+			return (rv < 0) ? rv : -EAGAIN;
+	}
+
+	return submitted;
+}
+
+static const char *uring_op_str(struct aicb *aicb)
+{
+	if (aicb->iocb.aio_lio_opcode == IO_CMD_PREAD)
+		return "RD";
+	if (aicb->iocb.aio_lio_opcode == IO_CMD_PWRITE)
+		return "WR";
+	return "UK";
+}
+
+static void uring_cqe(struct task *task, struct io_uring_cqe *cqe)
+{
+	struct aicb *aicb = (struct aicb *)(uintptr_t)(cqe->user_data & ~URING_TIMEOUT_TAG);
+
+	if (cqe->user_data & URING_TIMEOUT_TAG) {
+		/* -ECANCELED means the io completed before the timeout */
+		if (cqe->res != -ECANCELED)
+			aicb->uring_timedout = 1;
+	} else {
+		aicb->uring_done = 1;
+		aicb->uring_res = cqe->res;
+	}
+
+	if (--aicb->uring_pending)
+		return;
+
+	if (!aicb->uring_orphan)
+		return;
+
+	/* The submitter gave up waiting for this io, it's been holding
+	   the aicb and buf since then; same as the "old free" case
+	   with libaio. */
+
+	log_taskw(task, "aio collect %s %p:%p:%p result %d old free",
+		  uring_op_str(aicb), aicb, &aicb->iocb, aicb->buf, aicb->uring_res);
+
+	if (task->read_iobuf_timeout_aicb == aicb)
+		task->read_iobuf_timeout_aicb = NULL;
+
+	if (aicb->buf && aicb->buf == task->iobuf) {
+		task_uring_unregister_buf(task, task->iobuf);
+		task->iobuf = NULL;
+	}
+
+	iobuf_put(task, aicb->buf, aicb->iocb.u.c.nbytes);
+	aicb->buf = NULL;
+	aicb->uring_orphan = 0;
+	aicb->used = 0;
+}
+
+/*
+ * Process available cqes.  If there are none, wait up to wait_msec
+ * for one.  Returns the number of cqes processed, 0 if the wait
+ * timed out, or -errno.
+ */
+
+int task_uring_reap(struct task *task, uint32_t wait_msec)
+{
+	struct task_uring *ur = task->uring;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int head, tail;
+	int count = 0;
+	int waited = 0;
+	int rv;
+
+ next:
+	head = *ur->cq_head;
+	tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		uring_cqe(task, &ur->cqes[head & *ur->cq_mask]);
+		head++;
+		count++;
+	}
+	__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+
+	if (count || waited || !wait_msec)
+		return count;
+
+	memset(&ts, 0, sizeof(ts));
+	ts.tv_sec = wait_msec / 1000;
+	ts.tv_nsec = (wait_msec % 1000) * 1000000;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+ retry:
+	rv = sys_io_uring_enter(ur->ring_fd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				&arg, sizeof(arg));
+	if (rv == -EINTR)
+		goto retry;
+	if (rv < 0 && rv != -ETIME)
+		return rv;
+
+	waited = 1;
+	goto next;
+}
+
+/*
+ * Fixed files and buffers save the kernel from looking up the fd and
+ * pinning the pages on each io.  They are used for the long lived fd
+ * and iobuf of a lockspace thread.  Slots are updated in place, which
+ * (unlike unregistering the whole table) doesn't wait for io that's
+ * still using the old entry.
+ */
+
+int task_uring_register_fd(struct task *task, int fd)
+{
+	struct task_uring *ur = task->uring;
+	struct io_uring_rsrc_update2 up;
+	int i, rv;
+
+	if (task->use_aio != 3 || !ur || !ur->reg_files)
+		return 0;
+
+	for (i = 0; i < URING_REG_FILES; i++) {
+		if (ur->file_fd[i] == -1)
+			break;
+	}
+	if (i == URING_REG_FILES)
+		return -ENOSPC;
+
+	memset(&up, 0, sizeof(up));
+	up.offset = i;
+	up.data = (uint64_t)(uintptr_t)&fd;
+	up.nr = 1;
+
+	rv = sys_io_uring_register(ur->ring_fd, IORING_REGISTER_FILES_UPDATE2, &up, sizeof(up));
+	if (rv < 0) {
+		log_taskd(task, "uring register fd %d error %d", fd, rv);
+		return rv;
+	}
+
+	ur->file_fd[i] = fd;
+	return 0;
+}
+
+void task_uring_unregister_fd(struct task *task, int fd)
+{
+	struct task_uring *ur = task->uring;
+	struct io_uring_rsrc_update2 up;
+	int unset = -1;
+	int i;
+
+	if (task->use_aio != 3 || !ur || !ur->reg_files)
+		return;
+
+	for (i = 0; i < URING_REG_FILES; i++) {
+		if (ur->file_fd[i] != fd)
+			continue;
+
+		memset(&up, 0, sizeof(up));
+		up.offset = i;
+		up.data = (uint64_t)(uintptr_t)&unset;
+		up.nr = 1;
+
+		sys_io_uring_register(ur->ring_fd, IORING_REGISTER_FILES_UPDATE2, &up, sizeof(up));
+		ur->file_fd[i] = -1;
+	}
+}
+
+int task_uring_register_buf(struct task *task, char *buf, int len)
+{
+	struct task_uring *ur = task->uring;
+	struct io_uring_rsrc_update2 up;
+	struct iovec iov;
+	int i, rv;
+
+	if (task->use_aio != 3 || !ur || !ur->reg_bufs)
+		return 0;
+
+	for (i = 0; i < URING_REG_BUFS; i++) {
+		if (!ur->buf_addr[i])
+			break;
+	}
+	if (i == URING_REG_BUFS)
+		return -ENOSPC;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	memset(&up, 0, sizeof(up));
+	up.offset = i;
+	up.data = (uint64_t)(uintptr_t)&iov;
+	up.nr = 1;
+
+	rv = sys_io_uring_register(ur->ring_fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up));
+	if (rv < 0) {
+		log_taskd(task, "uring register buf %p len %d error %d", buf, len, rv);
+		return rv;
+	}
+
+	ur->buf_addr[i] = buf;
+	ur->buf_len[i] = len;
+	return 0;
+}
+
+void task_uring_unregister_buf(struct task *task, char *buf)
+{
+	struct task_uring *ur = task->uring;
+	struct io_uring_rsrc_update2 up;
+	struct iovec iov;
+	int i;
+
+	if (task->use_aio != 3 || !ur || !ur->reg_bufs || !buf)
+		return;
+
+	for (i = 0; i < URING_REG_BUFS; i++) {
+		if (ur->buf_addr[i] != buf)
+			continue;
+
+		iov.iov_base = NULL;
+		iov.iov_len = 0;
+
+		memset(&up, 0, sizeof(up));
+		up.offset = i;
+		up.data = (uint64_t)(uintptr_t)&iov;
+		up.nr = 1;
+
+		sys_io_uring_register(ur->ring_fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up));
+		ur->buf_addr[i] = NULL;
+		ur->buf_len[i] = 0;
+	}
+}
+
+/* returns the fixed file index for fd, or -1 */
+
+int task_uring_fixed_fd(struct task *task, int fd)
+{
+	struct task_uring *ur = task->uring;
+	int i;
+
+	for (i = 0; i < URING_REG_FILES; i++) {
+		if (ur->file_fd[i] == fd)
+			return i;
+	}
+	return -1;
+}
+
+/* returns the fixed buffer index containing buf..buf+len, or -1 */
+
+int task_uring_fixed_buf(struct task *task, char *buf, int len)
+{
+	struct task_uring *ur = task->uring;
+	int i;
+
+	for (i = 0; i < URING_REG_BUFS; i++) {
+		if (!ur->buf_addr[i])
+			continue;
+		if (buf >= ur->buf_addr[i] && buf + len <= ur->buf_addr[i] + ur->buf_len[i])
+			return i;
+	}
+	return -1;
+}
 
 void setup_task_aio(struct task *task, int use_aio, int cb_size)
 {
@@ -44,10 +523,21 @@ void setup_task_aio(struct task *task, int use_aio, int cb_size)
 	if (!cb_size)
 		return;
 
+	if (use_aio == 3) {
+		rv = setup_task_uring(task, cb_size);
+		if (!rv)
+			goto alloc_callbacks;
+
+		/* io_uring may be missing, or disabled by sysctl or seccomp */
+		log_error("io_uring setup error %d, using libaio", rv);
+		task->use_aio = 1;
+	}
+
 	rv = io_setup(cb_size, &task->aio_ctx);
 	if (rv < 0)
 		goto fail;
 
+ alloc_callbacks:
 	task->cb_size = cb_size;
 	task->callbacks = malloc(cb_size * sizeof(struct aicb));
 	if (!task->callbacks) {
@@ -58,11 +548,86 @@ void setup_task_aio(struct task *task, int use_aio, int cb_size)
 	return;
 
  fail_setup:
-	io_destroy(task->aio_ctx);
+	if (task->uring) {
+		free_task_uring(task->uring);
+		task->uring = NULL;
+	} else {
+		io_destroy(task->aio_ctx);
+	}
  fail:
 	task->use_aio = 0;
 }
 
+static void close_task_uring(struct task *task)
+{
+	uint64_t last_warn;
+	uint64_t begin;
+	uint64_t now;
+	int i, used, lvl;
+
+	last_warn = time(NULL);
+	begin = last_warn;
+
+	/* wait for all outstanding io to complete before closing the
+	   ring and freeing aicbs and buffers; timed out io is orphaned
+	   and its buf is freed as it's reaped */
+
+	while (1) {
+		now = time(NULL);
+
+		if (now - last_warn >= (DEFAULT_IO_TIMEOUT * 6)) {
+			last_warn = now;
+			lvl = LOG_ERR;
+		} else {
+			lvl = LOG_DEBUG;
+		}
+
+		used = 0;
+
+		for (i = 0; i < task->cb_size; i++) {
+			if (!task->callbacks[i].used)
+				continue;
+			used++;
+
+			if (!task->callbacks[i].uring_orphan) {
+				/* shouldn't happen, nothing is waiting on it now;
+				   the buf is freed when the io is reaped */
+				task->callbacks[i].uring_orphan = 1;
+			}
+
+			log_level(0, 0, task->name, lvl, "close_task_aio %d %p busy",
+				  i, &task->callbacks[i]);
+		}
+
+		if (!used)
+			break;
+
+		if (now - begin >= 120)
+			break;
+
+		if (task_uring_reap(task, DEFAULT_IO_TIMEOUT * 1000) < 0)
+			break;
+	}
+
+	if (used) {
+		/* The kernel may still write into the bufs of incomplete
+		   io after the ring is closed, so they are not freed. */
+		log_taske(task, "close_task_aio destroy %d incomplete ops", used);
+
+		for (i = 0; i < task->cb_size; i++) {
+			if (task->callbacks[i].used && task->callbacks[i].buf == task->iobuf)
+				task->iobuf = NULL;
+		}
+	}
+
+	free_task_uring(task->uring);
+	task->uring = NULL;
+
+	if (task->iobuf)
+		free(task->iobuf);
+	task->iobuf = NULL;
+}
+
 void close_task_aio(struct task *task)
 {
 	struct timespec ts;
@@ -75,6 +640,11 @@ void close_task_aio(struct task *task)
 	if (!task->use_aio)
 		goto skip_aio;
 
+	if (task->uring) {
+		close_task_uring(task);
+		goto skip_aio;
+	}
+
 	memset(&ts, 0, sizeof(struct timespec));
 	ts.tv_sec = DEFAULT_IO_TIMEOUT;
 
@@ -129,7 +699,7 @@ void close_task_aio(struct task *task)
 				  ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
 
 			ev_aicb->used = 0;
-			free(ev_aicb->buf);
+			iobuf_put(task, ev_aicb->buf, ev_aicb->iocb.u.c.nbytes);
 			ev_aicb->buf = NULL;
 		}
 	}
@@ -146,6 +716,8 @@ void close_task_aio(struct task *task)
 		free(task->iobuf);
 
  skip_aio:
+	iobuf_pool_free(task);
+
 	if (task->callbacks)
 		free(task->callbacks);
 	task->callbacks = NULL;
@@ -12,4 +12,14 @@
 void setup_task_aio(struct task *task, int use_aio, int cb_size);
 void close_task_aio(struct task *task);
 
+int task_uring_get_sqes(struct task *task, struct io_uring_sqe **sqes, int count);
+int task_uring_submit(struct task *task);
+int task_uring_reap(struct task *task, uint32_t wait_msec);
+int task_uring_register_fd(struct task *task, int fd);
+void task_uring_unregister_fd(struct task *task, int fd);
+int task_uring_register_buf(struct task *task, char *buf, int len);
+void task_uring_unregister_buf(struct task *task, char *buf);
+int task_uring_fixed_fd(struct task *task, int fd);
+int task_uring_fixed_buf(struct task *task, char *buf, int len);
+
 #endif
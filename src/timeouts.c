@@ -56,6 +56,14 @@ int calc_set_bitmap_seconds(int io_timeout)
 	return 6 * io_timeout;
 }
 
+int calc_renewal_min_seconds(int io_timeout)
+{
+	/* expedited and fast renewals, see timeouts.h */
+	if (io_timeout < 5)
+		return 1;
+	return io_timeout / 5;
+}
+
 void log_timeouts(int io_timeout_arg)
 {
 	int io_timeout_seconds = io_timeout_arg;
@@ -84,6 +92,7 @@ void log_timeouts(int io_timeout_arg)
 	int paxos_acquire_free_max = 6 * io_timeout_seconds;
 	int paxos_acquire_free_min = 0;
 	int request_finish_seconds = 3 * id_renewal_seconds; /* random */
+	int renewal_min_seconds    = calc_renewal_min_seconds(io_timeout_seconds);
 
 	log_debug("io_timeout_seconds %d", io_timeout_seconds);
 	log_debug("id_renewal_seconds %d", id_renewal_seconds);
@@ -104,4 +113,5 @@ void log_timeouts(int io_timeout_arg)
 	log_debug("paxos_acquire_free_max %d", paxos_acquire_free_max);
 	log_debug("paxos_acquire_free_min %d", paxos_acquire_free_min);
 	log_debug("request_finish_seconds %d", request_finish_seconds);
+	log_debug("renewal_min_seconds %d", renewal_min_seconds);
 }
@@ -445,6 +445,22 @@
  * until the watchdog has reset it.
  */
 
+/*
+ * Renewing early: a new bitmap bit or event (host_status_set_bit,
+ * lockspace_set_event) is written by an immediate renewal instead of
+ * waiting up to id_renewal_seconds, and for set_bitmap_seconds after
+ * sending or receiving one, renewals (and the reads of the other hosts'
+ * leases done with them) can be done every renewal_fast_sec (sanlock.conf).
+ * Neither is done within renewal_min_seconds (N/5, at least 1) of the
+ * last renewal, so timestamps always advance and a stream of events
+ * can't turn into a stream of writes.
+ *
+ * Renewing early only shortens the time between renewals, it never
+ * lengthens it: id_renewal_seconds remains the longest interval, and
+ * id_renewal_fail_seconds, host_dead_seconds and the delta/paxos delays
+ * above are unchanged (delta_renew_min is already 0).
+ */
+
 #ifndef __TIMEOUTS_H__
 #define __TIMEOUTS_H__
 
@@ -453,6 +469,7 @@ int calc_id_renewal_seconds(int io_timeout);
 int calc_id_renewal_fail_seconds(int io_timeout);
 int calc_id_renewal_warn_seconds(int io_timeout);
 int calc_set_bitmap_seconds(int io_timeout);
+int calc_renewal_min_seconds(int io_timeout);
 void log_timeouts(int io_timeout_arg);
 
 #endif
@@ -0,0 +1,69 @@
+#!/bin/bash
+
+#
+# SANLK_ACQUIRE_WAIT tests with the lease owned by another host,
+# based on 10 sec io timeout.
+#
+# The daemon must have joined lockspace LS as host_id 1, with the
+# lockspace at offset 0 of dev (host_id 2 is used for the other host),
+# and a resource initialized at offset 1M, e.g.
+#   sanlock direct init -s LS:0:dev:0
+#   sanlock direct init -r LS:waitres:dev:1048576
+#   sanlock client add_lockspace -s LS:1:dev:0
+#
+
+ls=$1
+dev=$2
+res=$ls:waitres:$dev:1048576
+
+# host_id 2 owns the lease, from the lockspace's view it's alive until
+# its delta lease isn't renewed for host_dead_seconds
+
+own_as_host2() {
+	sanlock direct acquire_id -s $ls:2:$dev:0
+	gen=$(sanlock direct read_leader -s $ls:2:$dev:0 | awk '/owner_generation/ {print $2}')
+	sanlock direct acquire -r $res -i 2 -g $gen
+}
+
+
+echo test wait for a lease owned by a live remote host, which releases it
+echo messages: acquire_token wait owned, request, acquire_token done
+echo expect: acquire rv 0 waited 15-30 sec
+date
+set -x
+own_as_host2
+./sanlk_wait $res &
+pid=$!
+sleep 5
+sanlock direct dump $dev:1048576
+sleep 10
+sanlock direct release -r $res
+wait $pid
+sanlock direct release_id -s $ls:2:$dev:0
+set +x
+
+
+echo test wait for a lease owned by a remote host that fails
+echo messages: acquire_token wait owned, request, host 2 dead, acquire_token done
+echo expect: acquire rv 0 waited about host_dead_seconds
+date
+set -x
+own_as_host2
+./sanlk_wait $res
+sanlock direct release_id -s $ls:2:$dev:0
+set +x
+
+
+echo test waiter exits while the lease is owned by a remote host
+echo messages: acquire_token wait owned, the waiting acquire ends with -116 ESTALE
+date
+set -x
+own_as_host2
+./sanlk_wait $res &
+pid=$!
+sleep 15
+kill -9 $pid
+wait $pid
+sanlock direct release -r $res
+sanlock direct release_id -s $ls:2:$dev:0
+set +x
@@ -0,0 +1,99 @@
+/*
+ * Compare crc32c implementations from src/crc32c.c on leader and
+ * dblock sized inputs, and on a whole lease area.
+ *
+ * crc32c_bench [seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "leader.h"
+#include "paxos_dblock.h"
+
+uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length);
+uint32_t crc32c_byte(uint32_t crc, uint8_t *data, size_t length);
+uint32_t crc32c_sb8(uint32_t crc, uint8_t *data, size_t length);
+const char *crc32c_impl_name(void);
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, uint8_t *data, size_t length);
+
+static double seconds = 1.0;
+static uint8_t buf[1024 * 1024];
+static volatile uint32_t sink;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void bench(const char *name, crc32c_fn fn, size_t len, uint32_t expect)
+{
+	double begin, elapsed;
+	unsigned long long count = 0;
+	uint32_t crc = 0;
+	int i;
+
+	begin = now_sec();
+
+	do {
+		for (i = 0; i < 1000; i++)
+			crc ^= fn((uint32_t)~1, buf + (i & 7), len);
+		count += 1000;
+		elapsed = now_sec() - begin;
+	} while (elapsed < seconds);
+
+	sink = crc;
+
+	if (fn((uint32_t)~1, buf, len) != expect) {
+		printf("%-8s len %-7zu checksum mismatch\n", name, len);
+		exit(1);
+	}
+
+	printf("%-8s len %-7zu %10.1f ns/call %8.1f MB/s\n",
+	       name, len, (elapsed * 1e9) / count,
+	       (count * len) / elapsed / (1024 * 1024));
+}
+
+int main(int argc, char *argv[])
+{
+	size_t lens[] = { LEADER_CHECKSUM_LEN, DBLOCK_CHECKSUM_LEN, 512, sizeof(buf) - 8 };
+	uint32_t expect;
+	unsigned int i;
+
+	if (argc > 1)
+		seconds = atof(argv[1]);
+
+	srandom(1);
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = random();
+
+	printf("crc32c selected %s\n", crc32c_impl_name());
+
+	/* short and unaligned inputs */
+	for (i = 0; i < 8 * 100; i++) {
+		expect = crc32c_byte((uint32_t)~1, buf + (i % 8), i / 8);
+
+		if (crc32c_sb8((uint32_t)~1, buf + (i % 8), i / 8) != expect ||
+		    crc32c((uint32_t)~1, buf + (i % 8), i / 8) != expect) {
+			printf("checksum mismatch offset %u len %u\n", i % 8, i / 8);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		expect = crc32c_byte((uint32_t)~1, buf, lens[i]);
+
+		bench("byte", crc32c_byte, lens[i], expect);
+		bench("sb8", crc32c_sb8, lens[i], expect);
+		bench(crc32c_impl_name(), crc32c, lens[i], expect);
+	}
+
+	return 0;
+}
@@ -3,6 +3,7 @@
 #include <sys/un.h>
 #include <sys/mount.h>
 #include <sys/signalfd.h>
+#include <sys/resource.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -48,6 +49,7 @@ int ls_count = DEFAULT_LS_COUNT;
 int res_count = DEFAULT_RES_COUNT;
 int pid_count = DEFAULT_PID_COUNT;
 int one_mode = 0;
+int bench_seconds = 10;
 int our_hostid;
 int acquire_rv[MAX_RV];
 int release_rv[MAX_RV];
@@ -709,6 +711,9 @@ void get_options(int argc, char *argv[])
 		case 'm':
 			one_mode = atoi(optionarg);
 			break;
+		case 't':
+			bench_seconds = atoi(optionarg);
+			break;
 		default:
 			log_error("unknown option: %c", optchar);
 			exit(EXIT_FAILURE);
@@ -925,6 +930,278 @@ int do_all(int argc, char *argv[])
 	return 0;
 }
 
+/*
+ * Each bench child repeatedly acquires and releases its own ex lease,
+ * so the children only contend on the daemon, not on the leases.
+ * The number of acquire+release pairs done is written to wfd.
+ */
+
+static void do_bench_child(int num, int wfd)
+{
+	struct timespec ts;
+	unsigned long long count = 0;
+	time_t end;
+	int s1, r1, full;
+	int fd, rv;
+	int pid = getpid();
+
+	s1 = num % ls_count;
+	r1 = (num / ls_count) % res_count;
+
+	fd = sanlock_register();
+	if (fd < 0) {
+		log_error("%d sanlock_register error %d", pid, fd);
+		exit(-1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	end = ts.tv_sec + bench_seconds;
+
+	while (!prog_stop) {
+		rv = acquire_one(pid, fd, s1, r1, EX, &full);
+		if (rv < 0) {
+			log_error("%d bench acquire %d,%d error %d", pid, s1, r1, rv);
+			break;
+		}
+
+		rv = release_one(pid, fd, s1, r1);
+		if (rv < 0) {
+			log_error("%d bench release %d,%d error %d", pid, s1, r1, rv);
+			break;
+		}
+		count++;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (ts.tv_sec >= end)
+			break;
+	}
+
+	if (write(wfd, &count, sizeof(count)) != sizeof(count))
+		log_error("%d bench write error %d", pid, errno);
+}
+
+/*
+ * sanlk_load bench <lock_disk_base> -i <host_id> [-s <ls_count> -r <res_count> -p <pid_count> -t <seconds>]
+ *
+ * Run acquire/release with 1, 2, 4, ... pid_count processes for the given
+ * seconds each, and print the total rate for each step.  Compare runs with
+ * different max_worker_threads in sanlock.conf to see how the daemon scales.
+ */
+
+int do_bench(int argc, char *argv[])
+{
+	struct sigaction act;
+	unsigned long long count, total;
+	int pfd[2];
+	int i, n, rv, pid, status, run_count;
+
+	if (argc < 5)
+		return -1;
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = sigterm_handler;
+	sigaction(SIGTERM, &act, NULL);
+
+	strcpy(lock_disk_base, argv[2]);
+
+	get_options(argc, argv);
+
+	if (ls_count * res_count < pid_count) {
+		log_error("bench needs ls_count * res_count >= pid_count");
+		return -1;
+	}
+
+	rv = add_lockspaces();
+	if (rv < 0)
+		return rv;
+
+	n = 1;
+
+	while (!prog_stop) {
+		if (pipe(pfd) < 0) {
+			log_error("pipe error %d", errno);
+			return -1;
+		}
+
+		run_count = 0;
+
+		for (i = 0; i < n; i++) {
+			pid = fork();
+
+			if (pid < 0) {
+				log_error("fork %d failed %d", i, errno);
+				break;
+			}
+			if (!pid) {
+				close(pfd[0]);
+				do_bench_child(i, pfd[1]);
+				exit(0);
+			}
+			run_count++;
+		}
+		close(pfd[1]);
+
+		total = 0;
+		while (read(pfd[0], &count, sizeof(count)) == sizeof(count))
+			total += count;
+		close(pfd[0]);
+
+		while (run_count) {
+			pid = wait(&status);
+			if (pid > 0)
+				run_count--;
+		}
+
+		printf("bench pids %d acquire+release %llu in %d sec, %.1f per sec\n",
+		       n, total, bench_seconds, (double)total / bench_seconds);
+
+		if (n >= pid_count)
+			break;
+		n = (n * 2 < pid_count) ? n * 2 : pid_count;
+	}
+
+	return 0;
+}
+
+#define MAX_LAT_SAMPLES (1024 * 1024)
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Time one command for bench_seconds, and print the average and 99th
+ * percentile latency.  A sock of -1 times sanlock_version, which makes a
+ * new connection for each call; otherwise inquire on the registered sock.
+ */
+
+static void clients_latency(int conns, int sock, uint32_t *lat)
+{
+	uint64_t begin, end, sum = 0;
+	uint32_t version;
+	char *state;
+	int count, rv, n = 0;
+
+	end = now_usec() + (uint64_t)bench_seconds * 1000000;
+
+	while (!prog_stop && n < MAX_LAT_SAMPLES) {
+		begin = now_usec();
+		if (sock < 0) {
+			rv = sanlock_version(0, &version, NULL);
+		} else {
+			state = NULL;
+			rv = sanlock_inquire(sock, -1, 0, &count, &state);
+			free(state);
+		}
+		lat[n] = now_usec() - begin;
+		if (rv < 0) {
+			log_error("clients %s error %d", sock < 0 ? "version" : "inquire", rv);
+			break;
+		}
+		sum += lat[n++];
+
+		if (now_usec() >= end)
+			break;
+	}
+
+	if (!n)
+		return;
+
+	qsort(lat, n, sizeof(uint32_t), cmp_u32);
+
+	printf("clients %d %-7s %d calls avg %llu us p99 %u us\n",
+	       conns, sock < 0 ? "version" : "inquire", n,
+	       (unsigned long long)(sum / n), lat[(n * 99) / 100]);
+}
+
+/*
+ * sanlk_load clients <count> [-t <seconds>]
+ *
+ * Open registered connections to the daemon in steps up to count, and
+ * at each step time commands from one more registered connection, to
+ * see how idle connections affect command latency.  The daemon needs
+ * max_clients in sanlock.conf above count.
+ */
+
+int do_clients(int argc, char *argv[])
+{
+	struct sigaction act;
+	struct rlimit rlim;
+	uint32_t *lat;
+	int *fds;
+	int count, step, n = 0, sock, i;
+
+	if (argc < 3)
+		return -1;
+
+	count = atoi(argv[2]);
+	if (count < 0)
+		return -1;
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = sigterm_handler;
+	sigaction(SIGTERM, &act, NULL);
+
+	get_options(argc, argv);
+
+	if (!getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	fds = malloc((count + 1) * sizeof(int));
+	lat = malloc(MAX_LAT_SAMPLES * sizeof(uint32_t));
+	if (!fds || !lat)
+		return -1;
+
+	sock = sanlock_register();
+	if (sock < 0) {
+		log_error("sanlock_register error %d", sock);
+		return -1;
+	}
+
+	step = 0;
+
+	while (!prog_stop) {
+		for (; n < step; n++) {
+			fds[n] = sanlock_register();
+			if (fds[n] < 0) {
+				log_error("sanlock_register %d error %d", n, fds[n]);
+				count = n;
+				break;
+			}
+		}
+
+		clients_latency(n, sock, lat);
+		clients_latency(n, -1, lat);
+
+		if (step >= count)
+			break;
+		step = step ? step * 2 : 1000;
+		if (step > count)
+			step = count;
+	}
+
+	for (i = 0; i < n; i++)
+		close(fds[i]);
+	close(sock);
+	free(fds);
+	free(lat);
+	return 0;
+}
+
 /*
  * sanlk_load init <lock_disk_base> [<ls_count> <res_count>]
  * lock_disk_base = /dev/vg/foo
@@ -1009,6 +1286,12 @@ int main(int argc, char *argv[])
 	else if (!strcmp(argv[1], "all"))
 		rv = do_all(argc, argv);
 
+	else if (!strcmp(argv[1], "bench"))
+		rv = do_bench(argc, argv);
+
+	else if (!strcmp(argv[1], "clients"))
+		rv = do_clients(argc, argv);
+
 	if (!rv)
 		return 0;
 
@@ -1026,6 +1309,17 @@ int main(int argc, char *argv[])
 	printf("  -D        debug output\n");
 	printf("  -V        verbose debug output\n");
 	printf("\n");
+	printf("sanlk_load bench <disk_base> -i <host_id> [options]\n");
+	printf("  acquire/release throughput with 1, 2, 4, ... processes\n");
+	printf("  -s <num>  number of lockspaces\n");
+	printf("  -r <num>  number of resources per lockspace\n");
+	printf("  -p <num>  max number of processes\n");
+	printf("  -t <num>  seconds to run each step\n");
+	printf("\n");
+	printf("sanlk_load clients <count> [options]\n");
+	printf("  command latency with 0, 1000, 2000, ... count idle registered connections\n");
+	printf("  -t <num>  seconds to run each step\n");
+	printf("\n");
 	return -1;
 }
 
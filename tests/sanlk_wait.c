@@ -0,0 +1,69 @@
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "sanlock.h"
+#include "sanlock_resource.h"
+
+/*
+ * acquire RESOURCE with SANLK_ACQUIRE_WAIT, hold it for hold_sec,
+ * release it; prints how long the acquire waited (see acquire-wait.sh)
+ */
+
+int main(int argc, char *argv[])
+{
+	struct sanlk_resource *res = NULL;
+	time_t begin, end;
+	int hold_sec = 0;
+	int fd, rv;
+
+	if (argc < 2) {
+		printf("sanlk_wait RESOURCE [hold_sec]\n");
+		return -1;
+	}
+
+	if (argc > 2)
+		hold_sec = atoi(argv[2]);
+
+	rv = sanlock_str_to_res(argv[1], &res);
+	if (rv < 0) {
+		fprintf(stderr, "str_to_res error %d\n", rv);
+		return -1;
+	}
+
+	fd = sanlock_register();
+	if (fd < 0) {
+		fprintf(stderr, "register error %d\n", fd);
+		return -1;
+	}
+
+	begin = time(NULL);
+
+	rv = sanlock_acquire(fd, -1, SANLK_ACQUIRE_WAIT, 1, &res, NULL);
+
+	end = time(NULL);
+
+	printf("acquire %s:%s rv %d waited %ld sec\n",
+	       res->lockspace_name, res->name, rv, (long)(end - begin));
+
+	if (rv < 0)
+		return -1;
+
+	if (hold_sec)
+		sleep(hold_sec);
+
+	rv = sanlock_release(fd, -1, 0, 1, &res);
+	if (rv < 0) {
+		fprintf(stderr, "release error %d\n", rv);
+		return -1;
+	}
+
+	free(res);
+	return 0;
+}
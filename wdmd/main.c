@@ -19,7 +19,6 @@
 #include <errno.h>
 #include <limits.h>
 #include <time.h>
-#include <poll.h>
 #include <syslog.h>
 #include <dirent.h>
 #include <signal.h>
@@ -28,6 +27,7 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -105,10 +105,10 @@ struct client {
 };
 
 #define CLIENT_NALLOC 16
-static int client_maxi;
+#define MAX_EVENTS 16
 static int client_size = 0;
 static struct client *client = NULL;
-static struct pollfd *pollfd = NULL;
+static int epoll_fd = -1;
 
 
 #define log_debug(fmt, args...) \
@@ -151,27 +151,47 @@ static void client_alloc(void)
 
 	if (!client) {
 		client = malloc(CLIENT_NALLOC * sizeof(struct client));
-		pollfd = malloc(CLIENT_NALLOC * sizeof(struct pollfd));
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0)
+			log_error("can't create epoll fd %d", errno);
 	} else {
 		client = realloc(client, (client_size + CLIENT_NALLOC) *
 				 sizeof(struct client));
-		pollfd = realloc(pollfd, (client_size + CLIENT_NALLOC) *
-				 sizeof(struct pollfd));
-		if (!pollfd)
-			log_error("can't alloc for pollfd");
 	}
-	if (!client || !pollfd)
+	if (!client)
 		log_error("can't alloc for client array");
 
 	for (i = client_size; i < client_size + CLIENT_NALLOC; i++) {
 		memset(&client[i], 0, sizeof(struct client));
 		client[i].fd = -1;
-		pollfd[i].fd = -1;
-		pollfd[i].revents = 0;
 	}
 	client_size += CLIENT_NALLOC;
 }
 
+/*
+ * epoll data holds both ci and fd, so an event queued for a client that
+ * has since been freed and whose slot was reused can be recognized.
+ */
+
+static void client_watch(int ci, int fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = ((uint64_t)(uint32_t)fd << 32) | (uint32_t)ci;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		log_error("client_watch ci %d fd %d error %d", ci, fd, errno);
+}
+
+static void client_ignore(int ci)
+{
+	if (client[ci].fd < 0)
+		return;
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client[ci].fd, NULL);
+}
+
 static int client_add(int fd, void (*workfn)(int ci), void (*deadfn)(int ci))
 {
 	int i;
@@ -185,10 +205,7 @@ static int client_add(int fd, void (*workfn)(int ci), void (*deadfn)(int ci))
 			client[i].workfn = workfn;
 			client[i].deadfn = deadfn;
 			client[i].fd = fd;
-			pollfd[i].fd = fd;
-			pollfd[i].events = POLLIN;
-			if (i > client_maxi)
-				client_maxi = i;
+			client_watch(i, fd);
 			return i;
 		}
 	}
@@ -202,6 +219,7 @@ static void client_pid_dead(int ci)
 	if (!client[ci].expire) {
 		log_debug("client_pid_dead ci %d", ci);
 
+		client_ignore(ci);
 		close(client[ci].fd);
 
 		/* refcount automatically dropped if a client with
@@ -211,8 +229,6 @@ static void client_pid_dead(int ci)
 		memset(&client[ci], 0, sizeof(struct client));
 
 		client[ci].fd = -1;
-		pollfd[ci].fd = -1;
-		pollfd[ci].events = 0;
 	} else {
 		/*
 		 * Leave used and expire set so that test_clients will continue
@@ -237,13 +253,12 @@ static void client_pid_dead(int ci)
 			  (unsigned long long)client[ci].expire,
 			  client[ci].name);
 
+		client_ignore(ci);
 		close(client[ci].fd);
 
 		client[ci].pid_dead = 1;
 
 		client[ci].fd = -1;
-		pollfd[ci].fd = -1;
-		pollfd[ci].events = 0;
 	}
 }
 
@@ -1299,11 +1314,12 @@ static int test_loop(void)
 {
 	void (*workfn) (int ci);
 	void (*deadfn) (int ci);
+	struct epoll_event events[MAX_EVENTS];
 	uint64_t test_time;
 	int poll_timeout;
 	int sleep_seconds;
 	int fail_count;
-	int rv, i;
+	int rv, i, ci, fd;
 
 	pet_watchdog();
 
@@ -1311,24 +1327,31 @@ static int test_loop(void)
 	poll_timeout = test_interval * 1000;
 
 	while (1) {
-		rv = poll(pollfd, client_maxi + 1, poll_timeout);
+		rv = epoll_wait(epoll_fd, events, MAX_EVENTS, poll_timeout);
 		if (rv == -1 && errno == EINTR)
 			continue;
 		if (rv < 0) {
 			/* not sure */
+			rv = 0;
 		}
-		for (i = 0; i <= client_maxi; i++) {
-			if (client[i].fd < 0)
+		for (i = 0; i < rv; i++) {
+			ci = (int)(events[i].data.u64 & 0xFFFFFFFF);
+			fd = (int)(events[i].data.u64 >> 32);
+
+			/* freed, or freed and reused, since the event */
+			if (client[ci].fd < 0 || client[ci].fd != fd)
 				continue;
-			if (pollfd[i].revents & POLLIN) {
-				workfn = client[i].workfn;
+			if (events[i].events & EPOLLIN) {
+				workfn = client[ci].workfn;
 				if (workfn)
-					workfn(i);
+					workfn(ci);
 			}
-			if (pollfd[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
-				deadfn = client[i].deadfn;
+			if (client[ci].fd != fd)
+				continue;
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				deadfn = client[ci].deadfn;
 				if (deadfn)
-					deadfn(i);
+					deadfn(ci);
 			}
 		}
 